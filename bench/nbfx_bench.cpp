@@ -0,0 +1,380 @@
+/**
+ * Micro and macro benchmarks of parsing and serialization
+ *
+ * Micro benchmarks parse documents made of one record family, macro benchmarks parse and serialize
+ * realistic messages. Hooks benchmarks compare the default parse and serialize with explicit no-op hooks,
+ * which should perform the same, and with hooks that take timestamps.
+ * Reports MB/s, messages/s and heap allocations per message.
+ * Usage: nbfx_bench [--filter <substring>] [--time <seconds>] [--json <file>]
+ */
+#include "nbfx.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> allocated_bytes{0};
+}
+
+// the replacements pair malloc with free, GCC can't see that through the inlined operators
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (auto p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+    template<typename T>
+    void keep(const T &value) {
+#if defined(__GNUC__)
+        asm volatile("" : : "r"(&value) : "memory");
+#else
+        static volatile const void *sink;
+        sink = &value;
+#endif
+    }
+
+    struct Result {
+        std::string name;
+        size_t bytes;
+        uint64_t iterations;
+        double seconds;
+        uint64_t allocations;
+        uint64_t allocated_bytes;
+
+        double ns_per_op() const {
+            return seconds * 1e9 / static_cast<double>(iterations);
+        }
+
+        double mb_per_s() const {
+            return static_cast<double>(bytes) * static_cast<double>(iterations) / seconds / 1e6;
+        }
+
+        double msgs_per_s() const {
+            return static_cast<double>(iterations) / seconds;
+        }
+
+        double allocs_per_op() const {
+            return static_cast<double>(allocations) / static_cast<double>(iterations);
+        }
+
+        double alloc_bytes_per_op() const {
+            return static_cast<double>(allocated_bytes) / static_cast<double>(iterations);
+        }
+    };
+
+    struct Options {
+        std::string filter;
+        double min_time = 0.3;
+        std::string json;
+    };
+
+    /**
+     * Runs the operation in doubling batches until a batch takes min_time
+     */
+    class Runner {
+    public:
+        explicit Runner(Options options) : m_options(std::move(options)) {
+            std::printf("%-40s %12s %12s %14s %12s %14s\n", "benchmark", "ns/op", "MB/s", "msgs/s", "allocs/op",
+                        "alloc B/op");
+        }
+
+        void run(const std::string &name, size_t bytes, const std::function<void()> &operation) {
+            if (!m_options.filter.empty() && name.find(m_options.filter) == std::string::npos) {
+                return;
+            }
+
+            operation();
+            for (uint64_t batch = 1;; batch *= 2) {
+                const auto before = allocations.load(std::memory_order_relaxed);
+                const auto bytes_before = allocated_bytes.load(std::memory_order_relaxed);
+                const auto start = std::chrono::steady_clock::now();
+                for (uint64_t i = 0; i < batch; ++i) {
+                    operation();
+                }
+                const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (seconds >= m_options.min_time) {
+                    const auto allocated = allocations.load(std::memory_order_relaxed) - before;
+                    const auto allocated_size = allocated_bytes.load(std::memory_order_relaxed) - bytes_before;
+                    m_results.push_back(Result{name, bytes, batch, seconds, allocated, allocated_size});
+                    break;
+                }
+            }
+
+            const auto &result = m_results.back();
+            std::printf("%-40s %12.1f %12.1f %14.0f %12.1f %14.0f\n", name.c_str(), result.ns_per_op(),
+                        result.mb_per_s(), result.msgs_per_s(), result.allocs_per_op(), result.alloc_bytes_per_op());
+        }
+
+        bool write_json() const {
+            if (m_options.json.empty()) {
+                return true;
+            }
+            auto file = std::fopen(m_options.json.c_str(), "w");
+            if (!file) {
+                std::perror(m_options.json.c_str());
+                return false;
+            }
+            std::fprintf(file, "{\"benchmarks\":[");
+            for (size_t i = 0; i < m_results.size(); ++i) {
+                const auto &r = m_results[i];
+                std::fprintf(file, "%s\n{\"name\":\"%s\",\"bytes\":%zu,\"iterations\":%llu,\"ns_per_op\":%.2f,"
+                                   "\"mb_per_s\":%.2f,\"msgs_per_s\":%.1f,\"allocs_per_op\":%.2f,\"alloc_bytes_per_op\":%.0f}",
+                             i ? "," : "", r.name.c_str(), r.bytes, static_cast<unsigned long long>(r.iterations),
+                             r.ns_per_op(), r.mb_per_s(), r.msgs_per_s(), r.allocs_per_op(), r.alloc_bytes_per_op());
+            }
+            std::fprintf(file, "\n]}\n");
+            return std::fclose(file) == 0;
+        }
+
+    private:
+        Options m_options;
+        std::vector<Result> m_results;
+    };
+
+    std::vector<uint8_t> to_bytes(const NbfxElement &element) {
+        std::vector<uint8_t> data;
+        serialize(element, std::back_inserter(data), false);
+        return data;
+    }
+
+    NbfxElement repeated(size_t count, const std::function<NbfxValue(size_t)> &value) {
+        NbfxElement root(L"root", {}, {});
+        root.children().reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            root.children().push_back(NbfxElement(L"v", {}, value(i)));
+        }
+        return root;
+    }
+
+    NbfxElement soap_envelope(size_t lines) {
+        NbfxElement order(L"Order", {NbfxAttribute(L"id", NbfxValue(int64_t{20240117}))}, {});
+        for (size_t i = 0; i < lines; ++i) {
+            order.children().push_back(NbfxElement(L"Line", {}, {
+                    NbfxElement(L"Sku", {}, NbfxValue(L"SKU-" + std::to_wstring(1000 + i))),
+                    NbfxElement(L"Quantity", {}, NbfxValue(static_cast<int64_t>(i % 7 + 1))),
+                    NbfxElement(L"Price", {}, NbfxValue(static_cast<int64_t>(1999 + i))),
+                    NbfxElement(L"Gift", {}, NbfxValue(i % 2 == 0))
+            }));
+        }
+
+        NbfxElement envelope(QName(L"s", L"Envelope"), {
+                NbfxAttribute(QName(L"s", L"xmlns"), NbfxValue(L"http://www.w3.org/2003/05/soap-envelope")),
+                NbfxAttribute(QName(L"a", L"xmlns"), NbfxValue(L"http://www.w3.org/2005/08/addressing"))
+        }, {
+                NbfxElement(QName(L"s", L"Header"), {}, {
+                        NbfxElement(QName(L"a", L"Action"), {}, NbfxValue(L"http://tempuri.org/IOrders/Create")),
+                        NbfxElement(QName(L"a", L"MessageID"), {}, NbfxValue(L"urn:uuid:6f1c2b8e-2f4a-4c1e-9d5b-3a7e1f0c9b2d")),
+                        NbfxElement(QName(L"a", L"To"), {}, NbfxValue(L"net.tcp://orders.example.com/Orders.svc"))
+                })
+        });
+        envelope.children().push_back(NbfxElement(QName(L"s", L"Body"), {}, {}));
+        envelope.children().back().children().push_back(std::move(order));
+        return envelope;
+    }
+
+    NbfxElement deep_tree(size_t depth) {
+        if (!depth) {
+            return NbfxElement(L"leaf", {}, NbfxValue(L"bottom"));
+        }
+        NbfxElement node(L"node", {NbfxAttribute(L"level", NbfxValue(static_cast<int64_t>(depth)))}, {});
+        node.children().push_back(deep_tree(depth - 1));
+        return node;
+    }
+
+    void micro(Runner &runner) {
+        // MultiByteInt31 values of one to five bytes
+        std::vector<uint8_t> varints;
+        for (uint32_t i = 0; i < 10000; ++i) {
+            auto v = (i * 2654435761u) >> (i % 5 * 7);
+            do {
+                varints.push_back(static_cast<uint8_t>(v > 0x7Fu ? v | 0x80u : v));
+                v >>= 7u;
+            } while (v);
+        }
+        runner.run("micro/multibyteint31", varints.size(), [&] {
+            auto p = varints.data();
+            uint64_t sum = 0;
+            while (p != varints.data() + varints.size()) {
+                sum += detail::parseMultiByteInt21(p);
+            }
+            keep(sum);
+        });
+
+        const auto bench_parse = [&](const std::string &name, const NbfxElement &element) {
+            const auto data = to_bytes(element);
+            runner.run(name, data.size(), [&] { keep(parse(data.data())); });
+        };
+
+        bench_parse("micro/chars8", repeated(1000, [](size_t i) { return NbfxValue(L"value " + std::to_wstring(i)); }));
+        bench_parse("micro/chars16", repeated(20, [](size_t) { return NbfxValue(std::wstring(2000, L'x')); }));
+        bench_parse("micro/bytes8", repeated(1000, [](size_t) { return NbfxValue(std::vector<uint8_t>(64, 0xAB)); }));
+        bench_parse("micro/bytes32", repeated(4, [](size_t) { return NbfxValue(std::vector<uint8_t>(100000, 0xAB)); }));
+        bench_parse("micro/int8", repeated(1000, [](size_t i) { return NbfxValue(static_cast<int64_t>(i % 100 + 2)); }));
+        bench_parse("micro/int16", repeated(1000, [](size_t i) { return NbfxValue(static_cast<int64_t>(i + 1000)); }));
+        bench_parse("micro/int32", repeated(1000, [](size_t i) { return NbfxValue(static_cast<int64_t>(i + 100000)); }));
+        bench_parse("micro/int64", repeated(1000, [](size_t i) { return NbfxValue(static_cast<int64_t>(i + (1ll << 40))); }));
+        bench_parse("micro/datetime", repeated(1000, [](size_t i) {
+            return NbfxValue(std::chrono::system_clock::time_point(std::chrono::seconds(1700000000 + i)));
+        }));
+
+        NbfxElement names(L"root", {}, {});
+        for (size_t i = 0; i < 1000; ++i) {
+            names.children().push_back(NbfxElement(QName(L"ns", L"Element" + std::to_wstring(i % 50)), {}, {}));
+        }
+        bench_parse("micro/names", names);
+
+        // <root> with ShortDictionaryElement children
+        std::vector<uint8_t> dictionary = {0x40, 0x04, 'r', 'o', 'o', 't'};
+        for (uint32_t i = 0; i < 1000; ++i) {
+            dictionary.insert(dictionary.end(), {0x42, static_cast<uint8_t>(0x80u | (i & 0x7Fu)), static_cast<uint8_t>(i >> 7u), 0x01});
+        }
+        dictionary.push_back(0x01);
+        runner.run("micro/dictionary-names", dictionary.size(), [&] { keep(parse(dictionary.data())); });
+    }
+
+    void macro(Runner &runner) {
+        const auto bench = [&](const std::string &name, const NbfxElement &element) {
+            const auto data = to_bytes(element);
+            runner.run("parse/" + name, data.size(), [&] { keep(parse(data.data())); });
+            runner.run("parse_view/" + name, data.size(), [&] { keep(parse_view(data.data())); });
+            runner.run("reader/" + name, data.size(), [&] {
+                NbfxReader<const uint8_t *> reader(data.data());
+                size_t nodes = 0;
+                while (reader.read()) {
+                    ++nodes;
+                }
+                keep(nodes);
+            });
+
+            std::vector<uint8_t> buffer(data.size());
+            runner.run("serialize-pointer/" + name, data.size(), [&] {
+                keep(serialize(element, buffer.data(), false));
+            });
+            std::vector<uint8_t> reserved;
+            reserved.reserve(data.size());
+            runner.run("serialize-back_inserter/" + name, data.size(), [&] {
+                reserved.clear();
+                serialize(element, std::back_inserter(reserved), false);
+                keep(reserved);
+            });
+            runner.run("serialize-sorted/" + name, data.size(), [&] {
+                reserved.clear();
+                serialize(element, std::back_inserter(reserved));
+                keep(reserved);
+            });
+        };
+
+        bench("soap-small", soap_envelope(2));
+        bench("soap-large", soap_envelope(200));
+        bench("wide", repeated(10000, [](size_t i) { return NbfxValue(static_cast<int64_t>(i)); }));
+        bench("deep", deep_tree(200));
+        bench("blobs", repeated(4, [](size_t) { return NbfxValue(std::vector<uint8_t>(256 * 1024, 0x5A)); }));
+    }
+
+    /**
+     * Sums time spent in elements, the cost of tracing every element
+     */
+    struct TimingHooks : NbfxNoHooks {
+        static constexpr bool timestamps = true;
+        static constexpr size_t large_payload = 64 * 1024;
+
+        std::vector<time_point> open;
+        std::chrono::nanoseconds elements{0};
+        size_t payloads = 0;
+
+        void on_element_begin(const NbfxElement &, time_point t) {
+            open.push_back(t);
+        }
+
+        void on_element_end(const NbfxElement &, time_point t) {
+            elements += t - open.back();
+            open.pop_back();
+        }
+
+        void on_payload_begin(size_t, time_point) {
+            ++payloads;
+        }
+    };
+
+    void hooks(Runner &runner) {
+        const auto bench = [&](const std::string &name, const NbfxElement &element) {
+            const auto data = to_bytes(element);
+            NbfxNoHooks none;
+            TimingHooks timing;
+            timing.open.reserve(256);
+
+            runner.run("hooks-default-parse/" + name, data.size(), [&] { keep(parse(data.data())); });
+            runner.run("hooks-none-parse/" + name, data.size(), [&] { keep(parse(data.data(), none)); });
+            runner.run("hooks-timing-parse/" + name, data.size(), [&] { keep(parse(data.data(), timing)); });
+
+            std::vector<uint8_t> buffer(data.size());
+            runner.run("hooks-default-serialize/" + name, data.size(), [&] {
+                keep(serialize(element, buffer.data(), false));
+            });
+            runner.run("hooks-none-serialize/" + name, data.size(), [&] {
+                keep(serialize(element, buffer.data(), false, none));
+            });
+            runner.run("hooks-timing-serialize/" + name, data.size(), [&] {
+                keep(serialize(element, buffer.data(), false, timing));
+            });
+            keep(timing.elements.count());
+        };
+
+        bench("soap-large", soap_envelope(200));
+        bench("blobs", repeated(4, [](size_t) { return NbfxValue(std::vector<uint8_t>(256 * 1024, 0x5A)); }));
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--time" && i + 1 < argc) {
+            options.min_time = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.json = argv[++i];
+        } else {
+            std::fprintf(stderr, "usage: nbfx_bench [--filter <substring>] [--time <seconds>] [--json <file>]\n");
+            return 2;
+        }
+    }
+
+    Runner runner(options);
+    micro(runner);
+    macro(runner);
+    hooks(runner);
+    return runner.write_json() ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+/**
+ * Round trip latency of NbfxSharedRing between two processes
+ *
+ * The parent sends a message through one ring, the child parses it in place and echoes
+ * the id back through another ring. Usage: nbfx_ring_bench [messages] [payload bytes]
+ */
+#include "nbfx.hpp"
+#include "nbfx/ring.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace nbfx;
+
+int main(int argc, char **argv) {
+    const size_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    const size_t payload = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256;
+
+    auto requests = NbfxSharedRing::anonymous(1 << 20);
+    auto responses = NbfxSharedRing::anonymous(1 << 16);
+
+    const auto child = ::fork();
+    if (child < 0) {
+        std::perror("fork");
+        return 1;
+    }
+
+    if (child == 0) {
+        NbfxRingConsumer consumer(requests);
+        NbfxRingProducer producer(responses);
+        NbfxBytesView message{nullptr, 0};
+        while (consumer.receive(message)) {
+            const auto id = parse_view(message.data).first_child("Id")->value().text().integer();
+            consumer.release();
+            producer.send(reinterpret_cast<const uint8_t *>(&id), sizeof(id));
+        }
+        producer.close();
+        ::_exit(0);
+    }
+
+    NbfxRingProducer producer(requests);
+    NbfxRingConsumer consumer(responses);
+    NbfxElement request(L"Request", {}, {
+            NbfxElement(L"Id", {}, NbfxValue(int64_t{0})),
+            NbfxElement(L"Body", {}, NbfxValue(std::vector<uint8_t>(payload, 0x5A)))
+    });
+
+    std::vector<double> latencies;
+    latencies.reserve(messages);
+    NbfxBytesView message{nullptr, 0};
+
+    for (size_t i = 0; i < messages; ++i) {
+        request.children()[0].value() = NbfxValue(static_cast<int64_t>(i));
+
+        const auto start = std::chrono::steady_clock::now();
+        producer.send(request);
+        if (!consumer.receive(message)) {
+            std::fprintf(stderr, "echo process stopped\n");
+            return 1;
+        }
+        consumer.release();
+        const auto stop = std::chrono::steady_clock::now();
+
+        latencies.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+    }
+
+    producer.close();
+    ::waitpid(child, nullptr, 0);
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto at = [&](double q) { return latencies[static_cast<size_t>(q * (latencies.size() - 1))]; };
+    std::printf("messages %zu, payload %zu bytes, round trip ns: min %.0f p50 %.0f p99 %.0f p99.9 %.0f max %.0f\n",
+                messages, payload, latencies.front(), at(0.5), at(0.99), at(0.999), latencies.back());
+    return 0;
+}
@@ -1,4 +1,9 @@
 #pragma once
 
 #include "nbfx/deserializer.hpp"
-#include "nbfx/serializer.hpp"
\ No newline at end of file
+#include "nbfx/serializer.hpp"
+#include "nbfx/reader.hpp"
+#include "nbfx/view.hpp"
+#include "nbfx/contract.hpp"
+#include "nbfx/documents.hpp"
+#include "nbfx/quotas.hpp"
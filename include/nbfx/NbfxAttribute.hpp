@@ -42,7 +42,7 @@ namespace nbfx {
                 NbfxAttribute(inferAttributeType(name), name, value) {}
 
 
-        NbfxValue value() const {
+        const NbfxValue &value() const noexcept {
             return m_value;
         }
 
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <cerrno>
+#include <functional>
+#include <istream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace nbfx {
+
+	/**
+	 * Pull source of a Bytes value of unknown length
+	 *
+	 * The value is serialized as a sequence of Bytes*Text records of at most chunk_size bytes each,
+	 * so only one chunk is held in memory. The source is consumed by serialization.
+	 */
+	class NbfxBytesSource {
+	public:
+		// reads up to size bytes into buffer, returns 0 at the end of data
+		using read_function = std::function<size_t(uint8_t *buffer, size_t size)>;
+
+		static constexpr size_t default_chunk_size = 0xFFFF;
+
+		explicit NbfxBytesSource(read_function read, size_t chunk_size = default_chunk_size) :
+				m_read(std::move(read)), m_chunk_size(chunk_size) {
+			if (!m_chunk_size) {
+				throw std::invalid_argument("chunk size must be positive");
+			}
+		}
+
+		size_t chunk_size() const noexcept {
+			return m_chunk_size;
+		}
+
+		size_t read(uint8_t *buffer, size_t size) const {
+			return m_read(buffer, size);
+		}
+
+		/**
+		 * Reads from iterator range, the range is traversed once
+		 */
+		template<typename TIter>
+		static NbfxBytesSource from_range(TIter first, TIter last, size_t chunk_size = default_chunk_size) {
+			return NbfxBytesSource([first, last](uint8_t *buffer, size_t size) mutable {
+				size_t n = 0;
+				for (; n < size && first != last; ++n, ++first) {
+					buffer[n] = static_cast<uint8_t>(*first);
+				}
+				return n;
+			}, chunk_size);
+		}
+
+		/**
+		 * Reads from the stream until EOF, the stream has to outlive the source
+		 */
+		static NbfxBytesSource from_istream(std::istream &stream, size_t chunk_size = default_chunk_size) {
+			return NbfxBytesSource([&stream](uint8_t *buffer, size_t size) {
+				stream.read(reinterpret_cast<char *>(buffer), static_cast<std::streamsize>(size));
+				if (stream.bad()) {
+					throw std::runtime_error("failed to read bytes source stream");
+				}
+				return static_cast<size_t>(stream.gcount());
+			}, chunk_size);
+		}
+
+#if defined(__unix__) || defined(__APPLE__)
+		/**
+		 * Reads from file descriptor until EOF, the descriptor is not closed
+		 */
+		static NbfxBytesSource from_fd(int fd, size_t chunk_size = default_chunk_size) {
+			return NbfxBytesSource([fd](uint8_t *buffer, size_t size) {
+				for (;;) {
+					const auto n = ::read(fd, buffer, size);
+					if (n >= 0) {
+						return static_cast<size_t>(n);
+					}
+					if (errno != EINTR) {
+						throw std::system_error(errno, std::generic_category(), "failed to read bytes source");
+					}
+				}
+			}, chunk_size);
+		}
+#endif
+
+	private:
+		read_function m_read;
+		size_t m_chunk_size;
+	};
+}
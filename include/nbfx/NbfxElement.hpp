@@ -5,11 +5,14 @@
 #include "NbfxRecord.hpp"
 #include "NbfxAttribute.hpp"
 #include "NbfxValue.hpp"
+#include "NbfxMemoryUsage.hpp"
 
 #include <memory>
 #include <algorithm>
+#include <numeric>
 #include <stack>
 #include <queue>
+#include <unordered_map>
 
 namespace nbfx {
 
@@ -31,6 +34,28 @@ namespace nbfx {
         }
     }
 
+    /**
+     * Explicit member order of a data contract (the equivalent of DataMember's Order)
+     *
+     * Children are ordered the way DataContractSerializer does it: members without
+     * an explicit order go first, then members by ascending order, ties are broken by name.
+     */
+    class NbfxMemberOrder {
+    public:
+        NbfxMemberOrder(std::initializer_list<std::pair<const std::wstring, int>> order) : m_order(order) {}
+
+        /**
+         * Returns order of the member or -1 if member has no explicit order
+         */
+        int ordinal(const std::wstring &name) const noexcept {
+            const auto it = m_order.find(name);
+            return it == m_order.end() ? -1 : it->second;
+        }
+
+    private:
+        std::unordered_map<std::wstring, int> m_order;
+    };
+
     class NbfxElement : public NamedNbfxRecord {
     public:
         NbfxElement(NbfxElement&&) noexcept = default;
@@ -78,6 +103,69 @@ namespace nbfx {
             return m_value;
         }
 
+        const std::shared_ptr<const NbfxMemberOrder> &member_order() const noexcept {
+            return m_member_order;
+        }
+
+        /**
+         * Sets explicit member order of the children, the order can be shared by all elements of the same contract
+         */
+        void set_member_order(std::shared_ptr<const NbfxMemberOrder> order) noexcept {
+            m_member_order = std::move(order);
+        }
+
+        /**
+         * Calls f for each child in serialization order (member order, then name, stable)
+         *
+         * Doesn't modify the element. Orders of more than a few unsorted children are kept at the end
+         * of scratch while f runs, so one scratch vector can serve the whole tree when f recurses.
+         */
+        template<typename F>
+        void for_each_sorted_child(std::vector<uint32_t> &scratch, F &&f) const {
+            const auto size = m_children.size();
+            const auto less = [this](uint32_t l, uint32_t r) { return child_less(m_children[l], m_children[r]); };
+
+            bool sorted = true;
+            for (size_t i = 1; i < size && sorted; ++i) {
+                sorted = !child_less(m_children[i], m_children[i - 1]);
+            }
+
+            if (sorted) {
+                for (const auto &child : m_children) {
+                    f(child);
+                }
+            } else if (size <= small_sort_size) {
+                // insertion sort is stable and does not need a buffer
+                uint32_t order[small_sort_size];
+                for (uint32_t i = 0; i < size; ++i) {
+                    auto j = i;
+                    for (; j > 0 && less(i, order[j - 1]); --j) {
+                        order[j] = order[j - 1];
+                    }
+                    order[j] = i;
+                }
+                for (size_t i = 0; i < size; ++i) {
+                    f(m_children[order[i]]);
+                }
+            } else {
+                const auto base = scratch.size();
+                scratch.resize(base + size);
+                std::iota(scratch.begin() + base, scratch.end(), 0u);
+                std::stable_sort(scratch.begin() + base, scratch.end(), less);
+                // f may grow scratch, so entries are read by index
+                for (size_t i = 0; i < size; ++i) {
+                    f(m_children[scratch[base + i]]);
+                }
+                scratch.resize(base);
+            }
+        }
+
+        template<typename F>
+        void for_each_sorted_child(F &&f) const {
+            std::vector<uint32_t> scratch;
+            for_each_sorted_child(scratch, std::forward<F>(f));
+        }
+
         /**
          * Returns first descendant with matching name or nullptr if none found
          *
@@ -113,9 +201,56 @@ namespace nbfx {
             return it == end(m_children) ? nullptr : &(*it);
         }
 
+        /**
+         * Bytes used by the tree by category, the root object itself is counted as an element
+         */
+        NbfxMemoryUsage memory_usage() const {
+            NbfxMemoryUsage usage;
+            std::vector<const NbfxElement *> pending{this};
+            usage.elements += sizeof(NbfxElement);
+
+            while (!pending.empty()) {
+                const auto &element = *pending.back();
+                pending.pop_back();
+
+                ++usage.element_count;
+                detail::addStringUsage(element.prefix(), usage.names, usage.slack);
+                detail::addStringUsage(element.name(), usage.names, usage.slack);
+                element.m_value.add_memory_usage(usage);
+
+                detail::addVectorUsage(element.m_attributes, usage.attributes, usage.slack);
+                for (const auto &attribute : element.m_attributes) {
+                    ++usage.attribute_count;
+                    detail::addStringUsage(attribute.prefix(), usage.names, usage.slack);
+                    detail::addStringUsage(attribute.name(), usage.names, usage.slack);
+                    attribute.value().add_memory_usage(usage);
+                }
+
+                detail::addVectorUsage(element.m_children, usage.elements, usage.slack);
+                for (const auto &child : element.m_children) {
+                    pending.push_back(&child);
+                }
+            }
+            return usage;
+        }
+
     private:
+        static constexpr size_t small_sort_size = 16;
+
+        bool child_less(const NbfxElement &left, const NbfxElement &right) const {
+            if (m_member_order) {
+                const auto l = m_member_order->ordinal(left.name());
+                const auto r = m_member_order->ordinal(right.name());
+                if (l != r) {
+                    return l < r;
+                }
+            }
+            return left.name() < right.name();
+        }
+
         std::vector<NbfxAttribute> m_attributes;
         std::vector<NbfxElement> m_children;
         NbfxValue m_value;
+        std::shared_ptr<const NbfxMemberOrder> m_member_order;
     };
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace nbfx {
+
+	/**
+	 * Bytes used by a parsed tree by category, allocator overhead is not included
+	 *
+	 * Heap buffers are split into their used part, reported by category, and unused capacity, reported as slack.
+	 */
+	struct NbfxMemoryUsage {
+		// element objects, in their parent's children vector or wherever the root is
+		size_t elements = 0;
+		// attribute objects in attribute vectors
+		size_t attributes = 0;
+		// names and prefixes too long for the small string buffer
+		size_t names = 0;
+		// String values too long for the small string buffer
+		size_t strings = 0;
+		// Bytes payloads and their chunk lists
+		size_t bytes = 0;
+		// unused capacity of vectors and strings
+		size_t slack = 0;
+		// value objects that hold no value, already counted in elements and attributes
+		size_t empty_values = 0;
+
+		size_t element_count = 0;
+		size_t attribute_count = 0;
+
+		size_t total() const noexcept {
+			return elements + attributes + names + strings + bytes + slack;
+		}
+	};
+
+	namespace detail {
+		/**
+		 * True if the string keeps its characters in a heap buffer rather than in the object
+		 */
+		template<typename TChar>
+		bool isHeapString(const std::basic_string<TChar> &str) noexcept {
+			const auto data = reinterpret_cast<const char *>(str.data());
+			const auto object = reinterpret_cast<const char *>(&str);
+			return data < object || data >= object + sizeof(str);
+		}
+
+		/**
+		 * Adds heap buffer of the string, the terminator is counted as used
+		 */
+		template<typename TChar>
+		void addStringUsage(const std::basic_string<TChar> &str, size_t &used, size_t &slack) noexcept {
+			if (isHeapString(str)) {
+				used += (str.size() + 1) * sizeof(TChar);
+				slack += (str.capacity() - str.size()) * sizeof(TChar);
+			}
+		}
+
+		template<typename T>
+		void addVectorUsage(const std::vector<T> &v, size_t &used, size_t &slack) noexcept {
+			used += v.size() * sizeof(T);
+			slack += (v.capacity() - v.size()) * sizeof(T);
+		}
+	}
+}
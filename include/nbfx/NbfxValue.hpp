@@ -3,6 +3,8 @@
 #pragma once
 
 #include "NbfxRecord.hpp"
+#include "NbfxBytesSource.hpp"
+#include "NbfxMemoryUsage.hpp"
 
 #include <vector>
 #include <cassert>
@@ -10,6 +12,8 @@
 #include <iterator>
 #include <iostream>
 #include <array>
+#include <memory>
+#include <stdexcept>
 
 namespace nbfx {
 	enum struct NbfxValueType {
@@ -22,7 +26,8 @@ namespace nbfx {
 		Decimal,
 		DateTime,
 		String,
-		Bytes
+		Bytes,
+		BytesSource
 	};
 
 	class NbfxValue
@@ -30,13 +35,19 @@ namespace nbfx {
 	public:
 
 		NbfxValue(NbfxValue&&) noexcept = default;
-		NbfxValue(const NbfxValue&) = default;
+		NbfxValue(const NbfxValue& rho) :
+			m_type(rho.m_type),
+			m_value(rho.m_value),
+			m_bytes(rho.m_bytes),
+			m_string(rho.m_string),
+			m_extra(rho.m_extra ? std::make_unique<extra_t>(*rho.m_extra) : nullptr) {}
 
 		NbfxValue&	operator = (const NbfxValue& rho) {
 			m_type = rho.m_type;
 			m_value = rho.m_value;
 			m_bytes = rho.m_bytes;
 			m_string = rho.m_string;
+			m_extra = rho.m_extra ? std::make_unique<extra_t>(*rho.m_extra) : nullptr;
 			return *this;
 		}
 
@@ -45,6 +56,7 @@ namespace nbfx {
 			m_value = rho.m_value;
 			std::swap(m_bytes, rho.m_bytes);
 			std::swap(m_string, rho.m_string);
+			std::swap(m_extra, rho.m_extra);
 			return *this;
 		}
 
@@ -119,6 +131,11 @@ namespace nbfx {
 		/* implicit */ NbfxValue(std::vector<uint8_t> val) :m_type(NbfxValueType::Bytes), m_bytes(std::move(val)) {}
 		/* implicit */ NbfxValue(const std::vector<char>& val) :m_type(NbfxValueType::Bytes), m_bytes(val.data(), val.data()+val.size()) {}
 
+		/* implicit */ NbfxValue(NbfxBytesSource source) :m_type(NbfxValueType::BytesSource), m_extra(std::make_unique<extra_t>())
+		{
+			m_extra->source = std::make_shared<NbfxBytesSource>(std::move(source));
+		}
+
 		template<size_t S>
 		explicit NbfxValue(const std::array<uint8_t, S>& a) :m_type(NbfxValueType::Bytes), m_bytes()
 		{
@@ -168,24 +185,115 @@ namespace nbfx {
 			return m_value.float_double;
 		}
 
+		/**
+		 * Returns contiguous bytes, never modifies the value
+		 *
+		 * Values parse returns are contiguous. Values with chunks added by append_bytes have to be joined
+		 * by non-const bytes() first or read with for_each_chunk.
+		 */
 		const std::vector<uint8_t>& bytes() const
 		{
 			if (m_type != NbfxValueType::Bytes)
 			{
 				throw std::runtime_error("Invalid value type, expected Bytes");
 			}
+			if (chunked())
+			{
+				throw std::logic_error("Bytes value is chunked, join it with non-const bytes()");
+			}
 			return m_bytes;
 		}
 
+		/**
+		 * Returns contiguous bytes, joining chunks added by append_bytes
+		 */
 		std::vector<uint8_t>& bytes()
 		{
 			if (m_type != NbfxValueType::Bytes)
 			{
 				throw std::runtime_error("Invalid value type, expected Bytes");
 			}
+			join_chunks();
 			return m_bytes;
 		}
 
+		/**
+		 * Appends a chunk to Bytes value, data already held is neither moved nor copied
+		 */
+		void append_bytes(std::vector<uint8_t> chunk)
+		{
+			if (m_type != NbfxValueType::Bytes)
+			{
+				throw std::runtime_error("Invalid value type, expected Bytes");
+			}
+			if (m_bytes.empty() && !chunked())
+			{
+				m_bytes = std::move(chunk);
+			}
+			else
+			{
+				if (!m_extra)
+				{
+					m_extra = std::make_unique<extra_t>();
+				}
+				m_extra->chunks.emplace_back(std::move(chunk));
+			}
+		}
+
+		/**
+		 * Total size of Bytes value
+		 */
+		size_t bytes_size() const
+		{
+			if (m_type != NbfxValueType::Bytes)
+			{
+				throw std::runtime_error("Invalid value type, expected Bytes");
+			}
+			auto size = m_bytes.size();
+			if (m_extra)
+			{
+				for (const auto& chunk : m_extra->chunks)
+				{
+					size += chunk.size();
+				}
+			}
+			return size;
+		}
+
+		size_t chunk_count() const noexcept
+		{
+			return m_type == NbfxValueType::Bytes ? 1 + (m_extra ? m_extra->chunks.size() : 0) : 0;
+		}
+
+		/**
+		 * Calls f for each chunk of Bytes value without joining them
+		 */
+		template<typename F>
+		void for_each_chunk(F&& f) const
+		{
+			if (m_type != NbfxValueType::Bytes)
+			{
+				throw std::runtime_error("Invalid value type, expected Bytes");
+			}
+			f(m_bytes);
+			if (m_extra)
+			{
+				for (const auto& chunk : m_extra->chunks)
+				{
+					f(chunk);
+				}
+			}
+		}
+
+		const NbfxBytesSource& bytes_source() const
+		{
+			if (m_type != NbfxValueType::BytesSource)
+			{
+				throw std::runtime_error("Invalid value type, expected BytesSource");
+			}
+			return *m_extra->source;
+		}
+
 		const std::wstring& string() const
 		{
 			if (m_type != NbfxValueType::String)
@@ -208,6 +316,28 @@ namespace nbfx {
 
 		std::wstring to_string() const;
 
+		/**
+		 * Adds heap memory held by the value, the value object itself is counted by its owner
+		 */
+		void add_memory_usage(NbfxMemoryUsage& usage) const noexcept
+		{
+			if (m_type == NbfxValueType::Null)
+			{
+				usage.empty_values += sizeof(NbfxValue);
+			}
+			detail::addStringUsage(m_string, usage.strings, usage.slack);
+			detail::addVectorUsage(m_bytes, usage.bytes, usage.slack);
+			if (m_extra)
+			{
+				usage.bytes += sizeof(extra_t);
+				detail::addVectorUsage(m_extra->chunks, usage.bytes, usage.slack);
+				for (const auto& chunk : m_extra->chunks)
+				{
+					detail::addVectorUsage(chunk, usage.bytes, usage.slack);
+				}
+			}
+		}
+
 	private:
 		union value_t
 		{
@@ -219,9 +349,38 @@ namespace nbfx {
 			double float_double;
 		};
 
+		// rarely used parts of the value, allocated only by values that need them
+		struct extra_t
+		{
+			// chunks appended after the first one of Bytes value
+			std::vector<std::vector<uint8_t>> chunks;
+			std::shared_ptr<const NbfxBytesSource> source;
+		};
+
+		bool chunked() const noexcept
+		{
+			return m_extra && !m_extra->chunks.empty();
+		}
+
+		void join_chunks()
+		{
+			if (!chunked())
+			{
+				return;
+			}
+			m_bytes.reserve(bytes_size());
+			for (const auto& chunk : m_extra->chunks)
+			{
+				m_bytes.insert(m_bytes.end(), chunk.cbegin(), chunk.cend());
+			}
+			m_extra.reset();
+		}
+
 		NbfxValueType m_type;
 		value_t m_value;
+		// first chunk of Bytes value
 		std::vector<uint8_t>	m_bytes;
 		std::wstring m_string;
+		std::unique_ptr<extra_t> m_extra;
 	};
 }
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "stream.hpp"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace nbfx {
+
+	/**
+	 * Lazily started coroutine producing a value, resumes the awaiting coroutine when done
+	 */
+	template<typename T>
+	class NbfxTask {
+	public:
+		struct promise_type {
+			std::optional<T> value;
+			std::exception_ptr error;
+			std::coroutine_handle<> continuation;
+
+			NbfxTask get_return_object() noexcept {
+				return NbfxTask(std::coroutine_handle<promise_type>::from_promise(*this));
+			}
+
+			std::suspend_always initial_suspend() noexcept {
+				return {};
+			}
+
+			auto final_suspend() noexcept {
+				struct final_awaiter {
+					bool await_ready() noexcept {
+						return false;
+					}
+
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+						const auto continuation = h.promise().continuation;
+						return continuation ? continuation : std::noop_coroutine();
+					}
+
+					void await_resume() noexcept {}
+				};
+				return final_awaiter{};
+			}
+
+			void return_value(T result) {
+				value.emplace(std::move(result));
+			}
+
+			void unhandled_exception() noexcept {
+				error = std::current_exception();
+			}
+		};
+
+		NbfxTask(NbfxTask &&other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+
+		NbfxTask &operator=(NbfxTask &&other) noexcept {
+			if (this != &other) {
+				destroy();
+				m_handle = std::exchange(other.m_handle, {});
+			}
+			return *this;
+		}
+
+		NbfxTask(const NbfxTask &) = delete;
+
+		NbfxTask &operator=(const NbfxTask &) = delete;
+
+		~NbfxTask() {
+			destroy();
+		}
+
+		bool await_ready() const noexcept {
+			return !m_handle || m_handle.done();
+		}
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+			m_handle.promise().continuation = awaiting;
+			return m_handle;
+		}
+
+		T await_resume() {
+			auto &promise = m_handle.promise();
+			if (promise.error) {
+				std::rethrow_exception(promise.error);
+			}
+			return std::move(*promise.value);
+		}
+
+	private:
+		explicit NbfxTask(std::coroutine_handle<promise_type> handle) noexcept : m_handle(handle) {}
+
+		void destroy() noexcept {
+			if (m_handle) {
+				m_handle.destroy();
+				m_handle = {};
+			}
+		}
+
+		std::coroutine_handle<promise_type> m_handle;
+	};
+
+	/**
+	 * Parses documents from an awaitable source
+	 *
+	 * Source is anything with `async_read(uint8_t *buffer, size_t size)` returning an awaitable
+	 * that produces the number of bytes read, 0 at the end of data. Parsing suspends while the source
+	 * waits for input, so no thread is blocked on a slow peer. The source has to outlive the parser.
+	 */
+	template<typename TSource>
+	class NbfxAsyncParser {
+	public:
+		explicit NbfxAsyncParser(TSource &source, size_t buffer_size = NbfxIncrementalParser::default_buffer_size) :
+				m_source(source),
+				m_parser(buffer_size) {}
+
+		NbfxAsyncParser(TSource &source, size_t buffer_size, const NbfxReaderQuotas &quotas,
+		                size_t max_record_length = NbfxIncrementalParser::default_max_record_length) :
+				m_source(source),
+				m_parser(buffer_size, quotas, max_record_length) {}
+
+		/**
+		 * Checks if the source has no more data
+		 */
+		NbfxTask<bool> at_end() {
+			co_return m_parser.idle() && !co_await read();
+		}
+
+		/**
+		 * Parses the next document
+		 */
+		NbfxTask<NbfxElement> parse() {
+			NbfxNullSink sink;
+			co_return co_await parse(sink);
+		}
+
+		/**
+		 * Parses the next document passing payload of bytes records to the sink, see NbfxIncrementalParser::next
+		 */
+		template<typename TSink>
+		NbfxTask<NbfxElement> parse(TSink &sink) {
+			for (;;) {
+				if (auto element = m_parser.next(sink)) {
+					co_return std::move(*element);
+				}
+				if (!co_await read()) {
+					throw std::runtime_error("unexpected end of stream");
+				}
+			}
+		}
+
+	private:
+		NbfxTask<size_t> read() {
+			const auto span = m_parser.prepare();
+			const size_t n = co_await m_source.async_read(span.data, span.size);
+			m_parser.commit(n);
+			co_return n;
+		}
+
+		TSource &m_source;
+		NbfxIncrementalParser m_parser;
+	};
+
+	/**
+	 * Parses single document from the source, data read past its end is dropped
+	 */
+	template<typename TSource>
+	NbfxTask<NbfxElement> async_parse(TSource &source, size_t buffer_size = NbfxIncrementalParser::default_buffer_size) {
+		NbfxAsyncParser<TSource> parser(source, buffer_size);
+		co_return co_await parser.parse();
+	}
+}
+
+#endif
@@ -0,0 +1,498 @@
+#pragma once
+
+#include "serializer.hpp"
+#include "reader.hpp"
+
+#include <array>
+#include <tuple>
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace nbfx {
+
+	/**
+	 * Data contract of T, specialize it to serialize T without building NbfxElement tree:
+	 *
+	 *     template<> struct contract<Response> {
+	 *         static constexpr auto name = contract_name("s", "Response");
+	 *         static constexpr auto members = std::make_tuple(
+	 *                 contract_member("Code", &Response::Code),
+	 *                 contract_member("s", "Message", &Response::Message));
+	 *     };
+	 *
+	 * Members are written in the order they are listed. Names are UTF-8 and are encoded at compile time.
+	 */
+	template<typename T>
+	struct contract;
+
+	template<typename T, typename = void>
+	struct has_contract : std::false_type {};
+
+	template<typename T>
+	struct has_contract<T, std::void_t<decltype(contract<T>::members)>> : std::true_type {};
+
+	/**
+	 * Element record (type, prefix and name) encoded at compile time
+	 */
+	template<size_t N>
+	struct NbfxEncodedName {
+		std::array<uint8_t, N> record{};
+		size_t size = 0;
+
+		// position of UTF-8 name bytes within the record, unused for dictionary names
+		size_t name_offset = 0;
+		size_t name_size = 0;
+
+		bool dictionary = false;
+		uint32_t id = 0;
+
+		constexpr const uint8_t *data() const noexcept {
+			return record.data();
+		}
+	};
+
+	/**
+	 * Contract member: element name and pointer to the field
+	 */
+	template<typename T, typename M, size_t N>
+	struct NbfxContractMember {
+		using object_type = T;
+		using member_type = M;
+
+		NbfxEncodedName<N> name;
+		M T::*field;
+	};
+
+	namespace detail {
+		template<size_t N>
+		constexpr void encode_uint31(NbfxEncodedName<N> &n, uint32_t val) {
+			do {
+				n.record[n.size++] = static_cast<uint8_t>(val > 0x7Fu ? (val & 0x7Fu) | 0x80u : val);
+				val = val >> 7u;
+			} while (val != 0);
+		}
+
+		template<size_t N>
+		constexpr void encode_chars(NbfxEncodedName<N> &n, const char *str, size_t len) {
+			encode_uint31(n, static_cast<uint32_t>(len));
+			for (size_t i = 0; i < len; ++i) {
+				n.record[n.size++] = static_cast<uint8_t>(str[i]);
+			}
+		}
+
+		/**
+		 * Picks record type the same way inferElementType does, `letter`, `prefixed` and `local`
+		 * are the codes of a-z prefixed, arbitrary prefixed and local record variants.
+		 */
+		template<size_t N>
+		constexpr void encode_element_type(NbfxEncodedName<N> &n, const char *prefix, size_t len,
+										   uint8_t letter, uint8_t prefixed, uint8_t local) {
+			if (len == 0) {
+				n.record[n.size++] = local;
+			} else if (len == 1 && prefix[0] >= 'a' && prefix[0] <= 'z') {
+				n.record[n.size++] = static_cast<uint8_t>(letter + prefix[0] - 'a');
+			} else {
+				n.record[n.size++] = prefixed;
+				encode_chars(n, prefix, len);
+			}
+		}
+
+		template<typename T>
+		struct is_optional : std::false_type {};
+
+		template<typename T>
+		struct is_optional<std::optional<T>> : std::true_type {};
+
+		template<typename T>
+		struct is_repeated : std::false_type {};
+
+		template<typename T>
+		struct is_repeated<std::vector<T>> : std::true_type {};
+
+		template<>
+		struct is_repeated<std::vector<uint8_t>> : std::false_type {};
+
+		template<typename T>
+		struct dependent_false : std::false_type {};
+	}
+
+	template<size_t P, size_t N>
+	constexpr auto contract_name(const char (&prefix)[P], const char (&name)[N]) {
+		NbfxEncodedName<P + N + 10> n;
+		detail::encode_element_type(n, prefix, P - 1,
+									static_cast<uint8_t>(NbfxRecordType::PrefixElementA),
+									static_cast<uint8_t>(NbfxRecordType::Element),
+									static_cast<uint8_t>(NbfxRecordType::ShortElement));
+		detail::encode_uint31(n, N - 1);
+		n.name_offset = n.size;
+		n.name_size = N - 1;
+		for (size_t i = 0; i < N - 1; ++i) {
+			n.record[n.size++] = static_cast<uint8_t>(name[i]);
+		}
+		return n;
+	}
+
+	template<size_t N>
+	constexpr auto contract_name(const char (&name)[N]) {
+		return contract_name("", name);
+	}
+
+	template<size_t P>
+	constexpr auto contract_name(const char (&prefix)[P], uint32_t id) {
+		NbfxEncodedName<P + 10> n;
+		detail::encode_element_type(n, prefix, P - 1,
+									static_cast<uint8_t>(NbfxRecordType::PrefixDictionaryElementA),
+									static_cast<uint8_t>(NbfxRecordType::DictionaryElement),
+									static_cast<uint8_t>(NbfxRecordType::ShortDictionaryElement));
+		detail::encode_uint31(n, id);
+		n.dictionary = true;
+		n.id = id;
+		return n;
+	}
+
+	constexpr auto contract_name(uint32_t id) {
+		return contract_name("", id);
+	}
+
+	template<size_t N, typename T, typename M>
+	constexpr auto contract_member(const char (&name)[N], M T::*field) {
+		return NbfxContractMember<T, M, N + 11>{contract_name(name), field};
+	}
+
+	template<size_t P, size_t N, typename T, typename M>
+	constexpr auto contract_member(const char (&prefix)[P], const char (&name)[N], M T::*field) {
+		return NbfxContractMember<T, M, P + N + 10>{contract_name(prefix, name), field};
+	}
+
+	template<typename T, typename M>
+	constexpr auto contract_member(uint32_t id, M T::*field) {
+		return NbfxContractMember<T, M, 11>{contract_name(id), field};
+	}
+
+	template<size_t P, typename T, typename M>
+	constexpr auto contract_member(const char (&prefix)[P], uint32_t id, M T::*field) {
+		return NbfxContractMember<T, M, P + 10>{contract_name(prefix, id), field};
+	}
+
+	namespace detail {
+		template<typename TIt, typename T>
+		void write_members(NbfxWriter<TIt> &writer, const T &object);
+
+		template<typename TIt, typename M>
+		void write_content(NbfxWriter<TIt> &writer, const M &value) {
+			if constexpr (std::is_same_v<M, bool>) {
+				writer.write_bool(value, true);
+			} else if constexpr (std::is_same_v<M, uint64_t>) {
+				writer.write_uint64(value, true);
+			} else if constexpr (std::is_integral_v<M>) {
+				writer.write_int(static_cast<int64_t>(value), true);
+			} else if constexpr (std::is_same_v<M, float>) {
+				writer.write_float(value, true);
+			} else if constexpr (std::is_same_v<M, double>) {
+				writer.write_double(value, true);
+			} else if constexpr (std::is_same_v<M, std::string>) {
+				writer.write_string(value, true);
+			} else if constexpr (std::is_same_v<M, std::wstring>) {
+				writer.write_string(value, true);
+			} else if constexpr (std::is_same_v<M, std::vector<uint8_t>>) {
+				writer.write_vector(value, true);
+			} else if constexpr (std::is_same_v<M, datetime_t>) {
+				writer.write_datetime(value, true);
+			} else if constexpr (has_contract<M>::value) {
+				write_members(writer, value);
+				writer.write_element_end();
+			} else {
+				static_assert(dependent_false<M>::value, "member type is not supported by data contracts");
+			}
+		}
+
+		template<typename TIt, size_t N, typename M>
+		void write_member(NbfxWriter<TIt> &writer, const NbfxEncodedName<N> &name, const M &value) {
+			if constexpr (is_optional<M>::value) {
+				if (value) {
+					write_member(writer, name, *value);
+				}
+			} else if constexpr (is_repeated<M>::value) {
+				for (const auto &item : value) {
+					write_member(writer, name, item);
+				}
+			} else {
+				writer.write_records(name.data(), name.size);
+				write_content(writer, value);
+			}
+		}
+
+		template<typename TIt, typename T>
+		void write_members(NbfxWriter<TIt> &writer, const T &object) {
+			std::apply([&](const auto &... member) {
+				(write_member(writer, member.name, object.*(member.field)), ...);
+			}, contract<T>::members);
+		}
+	}
+
+	/**
+	 * Serializes object described by contract<T>, returns output iterator past the last written byte
+	 *
+	 * std::optional members are omitted when empty, std::vector members (except bytes) are written
+	 * as repeated elements, members with a contract are written as nested elements.
+	 */
+	template<typename T, typename TIt>
+	TIt serialize_object(const T &object, TIt out_iterator) {
+		static_assert(has_contract<T>::value, "contract<T> is not defined");
+
+		detail::NbfxStatsTimer timer(false);
+		NbfxWriter<TIt> writer(out_iterator);
+		writer.write_records(contract<T>::name.data(), contract<T>::name.size);
+		detail::write_members(writer, object);
+		writer.write_element_end();
+		return writer.position();
+	}
+
+	namespace detail {
+		constexpr uint32_t hash_seed_limit = 100000;
+
+		template<typename TBytes>
+		constexpr uint32_t hash_name(uint32_t seed, const TBytes &bytes, size_t offset, size_t size) {
+			// FNV-1a with seeded basis
+			uint32_t h = 2166136261u ^ seed;
+			for (size_t i = 0; i < size; ++i) {
+				h = (h ^ static_cast<uint8_t>(bytes[offset + i])) * 16777619u;
+			}
+			return h ^ (h >> 15u);
+		}
+
+		constexpr uint32_t hash_id(uint32_t seed, uint32_t id) {
+			uint32_t h = (id ^ seed) * 0x9E3779B1u;
+			return h ^ (h >> 16u);
+		}
+
+		template<size_t N>
+		constexpr uint32_t hash_member(uint32_t seed, const NbfxEncodedName<N> &name) {
+			return name.dictionary ? hash_id(seed, name.id) : hash_name(seed, name.record, name.name_offset, name.name_size);
+		}
+
+		/**
+		 * Name of a contract member as it is matched against input
+		 */
+		struct NbfxMemberKey {
+			const uint8_t *name;
+			size_t name_size;
+			bool dictionary;
+			uint32_t id;
+		};
+
+		/**
+		 * Perfect hash of member names of contract<T>, found at compile time
+		 *
+		 * Names are hashed to a table twice as large as the number of members,
+		 * the seed is searched until no two members share a slot.
+		 */
+		template<typename T>
+		struct member_table {
+			static constexpr size_t count = std::tuple_size<std::decay_t<decltype(contract<T>::members)>>::value;
+
+			static constexpr size_t size = [] {
+				size_t s = 1;
+				while (s < 2 * count) {
+					s *= 2;
+				}
+				return s;
+			}();
+
+			template<size_t... I>
+			static constexpr bool collides(uint32_t seed, std::index_sequence<I...>) {
+				const uint32_t slots[] = {
+						static_cast<uint32_t>(hash_member(seed, std::get<I>(contract<T>::members).name) & (size - 1))..., 0u};
+				for (size_t i = 0; i < count; ++i) {
+					for (size_t j = i + 1; j < count; ++j) {
+						if (slots[i] == slots[j]) {
+							return true;
+						}
+					}
+				}
+				return false;
+			}
+
+			static constexpr uint32_t seed = [] {
+				for (uint32_t s = 1; s < hash_seed_limit; ++s) {
+					if (!collides(s, std::make_index_sequence<count>())) {
+						return s;
+					}
+				}
+				return 0u;
+			}();
+
+			static_assert(seed != 0, "contract member names must be unique");
+
+			template<size_t... I>
+			static constexpr std::array<int, size> make_slots(std::index_sequence<I...>) {
+				std::array<int, size> result{};
+				for (auto &slot : result) {
+					slot = -1;
+				}
+				((result[hash_member(seed, std::get<I>(contract<T>::members).name) & (size - 1)] = static_cast<int>(I)), ...);
+				return result;
+			}
+
+			static constexpr std::array<int, size> slots = make_slots(std::make_index_sequence<count>());
+
+			template<size_t... I>
+			static constexpr std::array<NbfxMemberKey, count + 1> make_keys(std::index_sequence<I...>) {
+				return {{NbfxMemberKey{
+						std::get<I>(contract<T>::members).name.data() + std::get<I>(contract<T>::members).name.name_offset,
+						std::get<I>(contract<T>::members).name.name_size,
+						std::get<I>(contract<T>::members).name.dictionary,
+						std::get<I>(contract<T>::members).name.id}..., NbfxMemberKey{nullptr, 0, false, 0}}};
+			}
+
+			static constexpr std::array<NbfxMemberKey, count + 1> keys = make_keys(std::make_index_sequence<count>());
+		};
+
+		template<size_t N, typename TIter>
+		bool name_matches(const NbfxEncodedName<N> &name, const NbfxReader<TIter> &reader) {
+			if (name.dictionary || reader.is_dictionary_name()) {
+				return name.dictionary == reader.is_dictionary_name() && name.id == reader.name_id();
+			}
+			return reader.name() == std::string_view(reinterpret_cast<const char *>(name.data()) + name.name_offset, name.name_size);
+		}
+
+		/**
+		 * Returns index of the member matching current element or -1
+		 */
+		template<typename T, typename TIter>
+		int find_member(const NbfxReader<TIter> &reader) {
+			using table = member_table<T>;
+
+			const auto name = reader.name();
+			const auto h = reader.is_dictionary_name()
+						   ? hash_id(table::seed, reader.name_id())
+						   : hash_name(table::seed, name.data(), 0, name.size());
+			const auto index = table::slots[h & (table::size - 1)];
+			if (index < 0) {
+				return -1;
+			}
+
+			const auto &key = table::keys[index];
+			if (key.dictionary || reader.is_dictionary_name()) {
+				return key.dictionary == reader.is_dictionary_name() && key.id == reader.name_id() ? index : -1;
+			}
+			return name.size() == key.name_size && std::memcmp(name.data(), key.name, key.name_size) == 0 ? index : -1;
+		}
+
+		template<typename T, typename TIter>
+		void read_members(NbfxReader<TIter> &reader, T &object);
+
+		template<typename M>
+		void read_text(const NbfxTextView &text, M &value) {
+			if constexpr (std::is_same_v<M, bool>) {
+				value = text.boolean();
+			} else if constexpr (std::is_same_v<M, uint64_t>) {
+				value = text.uint64();
+			} else if constexpr (std::is_integral_v<M>) {
+				value = static_cast<M>(text.integer());
+			} else if constexpr (std::is_same_v<M, float>) {
+				value = text.float_single();
+			} else if constexpr (std::is_same_v<M, double>) {
+				value = text.float_double();
+			} else if constexpr (std::is_same_v<M, std::string>) {
+				const auto chars = text.chars();
+				value.append(chars.data(), chars.size());
+			} else if constexpr (std::is_same_v<M, std::wstring>) {
+				const auto chars = text.chars();
+				value += utf_to_wstring.from_bytes(chars.data(), chars.data() + chars.size());
+			} else if constexpr (std::is_same_v<M, std::vector<uint8_t>>) {
+				const auto bytes = text.bytes();
+				value.insert(value.end(), bytes.data, bytes.data + bytes.size);
+			} else if constexpr (std::is_same_v<M, datetime_t>) {
+				value = text.datetime();
+			} else {
+				static_assert(dependent_false<M>::value, "member type is not supported by data contracts");
+			}
+		}
+
+		/**
+		 * Reads content of the current element into value, consumes its end
+		 */
+		template<typename TIter, typename M>
+		void read_content(NbfxReader<TIter> &reader, M &value) {
+			if constexpr (has_contract<M>::value) {
+				read_members(reader, value);
+			} else {
+				while (reader.read() && reader.node_type() != NbfxNodeType::EndElement) {
+					if (reader.node_type() == NbfxNodeType::Text) {
+						read_text(reader.text(), value);
+					} else {
+						reader.skip();
+					}
+				}
+			}
+		}
+
+		template<typename TIter, typename M>
+		void read_member(NbfxReader<TIter> &reader, M &value) {
+			if constexpr (is_optional<M>::value) {
+				read_content(reader, value.emplace());
+			} else if constexpr (is_repeated<M>::value) {
+				read_content(reader, value.emplace_back());
+			} else {
+				read_content(reader, value);
+			}
+		}
+
+		template<typename T, typename TIter, size_t I>
+		void read_member_at(NbfxReader<TIter> &reader, T &object) {
+			read_member(reader, object.*(std::get<I>(contract<T>::members).field));
+		}
+
+		template<typename T, typename TIter, size_t... I>
+		constexpr auto make_member_readers(std::index_sequence<I...>) {
+			using reader_t = void (*)(NbfxReader<TIter> &, T &);
+			return std::array<reader_t, sizeof...(I)>{{&read_member_at<T, TIter, I>...}};
+		}
+
+		template<typename T, typename TIter>
+		void read_members(NbfxReader<TIter> &reader, T &object) {
+			static constexpr auto readers =
+					make_member_readers<T, TIter>(std::make_index_sequence<member_table<T>::count>());
+
+			while (reader.read() && reader.node_type() != NbfxNodeType::EndElement) {
+				if (reader.node_type() != NbfxNodeType::Element) {
+					continue;
+				}
+
+				const auto index = find_member<T>(reader);
+				if (index < 0) {
+					reader.skip();
+				} else {
+					readers[index](reader, object);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Deserializes object described by contract<T> from the input
+	 *
+	 * Child elements are dispatched to members by a perfect hash of their names, unknown elements,
+	 * attributes and text of the object element are skipped.
+	 */
+	template<typename T, typename TIter>
+	T parse_object(TIter p) {
+		static_assert(has_contract<T>::value, "contract<T> is not defined");
+
+		NbfxReader<TIter> reader(p);
+		reader.read();
+
+		if (!detail::name_matches(contract<T>::name, reader)) {
+			throw std::invalid_argument("unexpected topmost element");
+		}
+
+		T object{};
+		detail::read_members(reader, object);
+		return object;
+	}
+}
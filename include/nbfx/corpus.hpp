@@ -0,0 +1,345 @@
+#pragma once
+
+#include "NbfxElement.hpp"
+#include "serializer.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace nbfx {
+
+	/**
+	 * Shape of generated messages
+	 *
+	 * Sizes are drawn from ranges, weights select the type of leaf values.
+	 */
+	struct NbfxCorpusOptions {
+		uint64_t seed = 1;
+		// levels of payload below its root
+		size_t depth = 3;
+		// mean number of children of an inner element
+		size_t fan_out = 4;
+		// probability of an inner element on the way down being a leaf instead
+		double leaf_rate = 0.25;
+		// probability of a name taken from the vocabulary instead of a new one
+		double name_reuse = 0.9;
+		size_t vocabulary = 48;
+		// text lengths are log-uniform, short strings are more common than long ones
+		size_t text_min = 1;
+		size_t text_max = 64;
+		unsigned text_weight = 6;
+		unsigned integer_weight = 3;
+		unsigned boolean_weight = 1;
+		unsigned datetime_weight = 1;
+		unsigned blob_weight = 0;
+		size_t blob_min = 256;
+		size_t blob_max = 64 << 10;
+		// probability of an inner element holding a run of integer elements of the same name
+		double array_rate = 0;
+		size_t array_min = 8;
+		size_t array_max = 256;
+		// wraps the payload in a SOAP 1.2 envelope
+		bool soap = false;
+		// adds WS-Addressing headers to the envelope
+		bool addressing = false;
+	};
+
+	/**
+	 * Options of a named preset: soap12, soap12-blobs, soap12-arrays, wide or deep
+	 */
+	inline NbfxCorpusOptions corpus_preset(const std::string &name, uint64_t seed = 1) {
+		NbfxCorpusOptions options;
+		options.seed = seed;
+		if (name == "soap12") {
+			options.soap = true;
+			options.addressing = true;
+		} else if (name == "soap12-blobs") {
+			options.soap = true;
+			options.addressing = true;
+			options.depth = 2;
+			options.blob_weight = 2;
+		} else if (name == "soap12-arrays") {
+			options.soap = true;
+			options.addressing = true;
+			options.array_rate = 0.3;
+		} else if (name == "wide") {
+			options.depth = 1;
+			options.fan_out = 2000;
+			options.leaf_rate = 0;
+		} else if (name == "deep") {
+			options.depth = 200;
+			options.fan_out = 1;
+			options.leaf_rate = 0;
+		} else {
+			throw std::invalid_argument("unknown corpus preset " + name);
+		}
+		return options;
+	}
+
+	namespace detail {
+		/**
+		 * splitmix64, the same sequence on every platform unlike the std distributions
+		 */
+		class NbfxCorpusRandom {
+		public:
+			explicit NbfxCorpusRandom(uint64_t seed) : m_state(seed) {}
+
+			uint64_t next() noexcept {
+				auto z = (m_state += 0x9E3779B97F4A7C15ull);
+				z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+				return z ^ (z >> 31u);
+			}
+
+			/**
+			 * Uniform in [lo, hi]
+			 */
+			uint64_t between(uint64_t lo, uint64_t hi) noexcept {
+				return hi <= lo ? lo : lo + next() % (hi - lo + 1);
+			}
+
+			bool chance(double p) noexcept {
+				return static_cast<double>(next() >> 11u) * 0x1.0p-53 < p;
+			}
+
+			/**
+			 * Bit width is uniform, so every order of magnitude in [lo, hi] is equally likely
+			 */
+			uint64_t log_uniform(uint64_t lo, uint64_t hi) noexcept {
+				if (hi <= lo) {
+					return lo;
+				}
+				const auto bits = between(width(lo), width(hi));
+				const auto first = bits ? 1ull << (bits - 1) : 0;
+				const auto last = bits < 64 ? (1ull << bits) - 1 : ~0ull;
+				return between(first < lo ? lo : first, last > hi ? hi : last);
+			}
+
+		private:
+			static uint64_t width(uint64_t v) noexcept {
+				uint64_t bits = 0;
+				for (; v; v >>= 1u) {
+					++bits;
+				}
+				return bits;
+			}
+
+			uint64_t m_state;
+		};
+
+		constexpr const wchar_t *corpus_words[] = {
+				L"Order", L"Customer", L"Account", L"Address", L"Item", L"Line", L"Quantity", L"Price",
+				L"Amount", L"Currency", L"Status", L"Id", L"Name", L"Description", L"Created", L"Modified",
+				L"Reference", L"Code", L"Type", L"Value", L"Total", L"Tax", L"Discount", L"Product",
+				L"Category", L"Invoice", L"Payment", L"Shipment", L"Carrier", L"Tracking", L"Street", L"City",
+				L"Country", L"PostalCode", L"Phone", L"Email", L"Contact", L"Note", L"Tag", L"Version",
+				L"Owner", L"Region", L"Warehouse", L"Stock", L"Batch", L"Result", L"Error", L"Message",
+		};
+
+		constexpr const wchar_t *corpus_operations[] = {
+				L"GetOrder", L"SubmitOrder", L"CancelOrder", L"FindCustomers", L"UpdateAccount", L"GetInvoice",
+				L"ListShipments", L"Ping",
+		};
+
+		constexpr char corpus_text[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 -.,";
+	}
+
+	/**
+	 * Deterministic generator of synthetic messages
+	 *
+	 * The same options produce the same sequence of messages.
+	 */
+	class NbfxCorpusGenerator {
+	public:
+		explicit NbfxCorpusGenerator(NbfxCorpusOptions options) :
+				m_options(options), m_random(options.seed) {
+			if (!m_options.fan_out || !m_options.vocabulary || m_options.text_min > m_options.text_max ||
+			    m_options.blob_min > m_options.blob_max || m_options.array_min > m_options.array_max) {
+				throw std::invalid_argument("invalid corpus options");
+			}
+		}
+
+		/**
+		 * Generates the next message
+		 */
+		NbfxElement next() {
+			if (!m_options.soap) {
+				return payload(random_name(), m_options.depth);
+			}
+			return envelope();
+		}
+
+		/**
+		 * Serializes the next message, returns output iterator past the last written byte
+		 */
+		template<typename TIt>
+		TIt write(TIt out_iterator) {
+			return serialize(next(), out_iterator, false);
+		}
+
+		/**
+		 * Generates count messages stored back to back
+		 */
+		std::vector<uint8_t> generate(size_t count) {
+			std::vector<uint8_t> data;
+			for (size_t i = 0; i < count; ++i) {
+				write(std::back_inserter(data));
+			}
+			return data;
+		}
+
+		const NbfxCorpusOptions &options() const noexcept {
+			return m_options;
+		}
+
+	private:
+		NbfxElement envelope() {
+			const auto operation = pick(detail::corpus_operations);
+			NbfxElement envelope(QName(L"s", L"Envelope"), {
+					NbfxAttribute(QName(L"s", L"xmlns"), NbfxValue(L"http://www.w3.org/2003/05/soap-envelope"))
+			}, {});
+
+			if (m_options.addressing) {
+				envelope.attributes().emplace_back(QName(L"a", L"xmlns"), NbfxValue(L"http://www.w3.org/2005/08/addressing"));
+				const NbfxAttribute must_understand(QName(L"s", L"mustUnderstand"), NbfxValue(L"1"));
+				envelope.children().push_back(NbfxElement(QName(L"s", L"Header"), {}, {
+						NbfxElement(QName(L"a", L"Action"), {must_understand},
+						            NbfxValue(std::wstring(L"http://tempuri.org/IService/") + operation)),
+						NbfxElement(QName(L"a", L"MessageID"), {}, NbfxValue(uuid())),
+						NbfxElement(QName(L"a", L"ReplyTo"), {}, {
+								NbfxElement(QName(L"a", L"Address"), {},
+								            NbfxValue(L"http://www.w3.org/2005/08/addressing/anonymous"))
+						}),
+						NbfxElement(QName(L"a", L"To"), {must_understand},
+						            NbfxValue(L"net.tcp://services.example.com/Service.svc"))
+				}));
+			}
+
+			auto body = payload(operation, m_options.depth);
+			body.attributes().emplace_back(L"xmlns", NbfxValue(L"http://tempuri.org/"));
+			envelope.children().push_back(NbfxElement(QName(L"s", L"Body"), {}, {}));
+			envelope.children().back().children().push_back(std::move(body));
+			return envelope;
+		}
+
+		NbfxElement payload(std::wstring name, size_t depth) {
+			if (!depth) {
+				return NbfxElement(name, {}, leaf_value());
+			}
+
+			NbfxElement element(std::move(name));
+			if (m_random.chance(m_options.array_rate)) {
+				const auto item = random_name();
+				const auto count = m_random.between(m_options.array_min, m_options.array_max);
+				element.children().reserve(count);
+				for (uint64_t i = 0; i < count; ++i) {
+					element.children().push_back(NbfxElement(item, {}, integer()));
+				}
+				return element;
+			}
+
+			const auto count = m_random.between(1, 2 * m_options.fan_out - 1);
+			element.children().reserve(count);
+			for (uint64_t i = 0; i < count; ++i) {
+				const auto leaf = depth == 1 || m_random.chance(m_options.leaf_rate);
+				element.children().push_back(payload(random_name(), leaf ? 0 : depth - 1));
+			}
+			return element;
+		}
+
+		NbfxValue leaf_value() {
+			const auto &o = m_options;
+			auto n = m_random.between(1, o.text_weight + o.integer_weight + o.boolean_weight + o.datetime_weight +
+			                             o.blob_weight);
+			if (n <= o.text_weight) {
+				return NbfxValue(text(m_random.log_uniform(o.text_min, o.text_max)));
+			}
+			n -= o.text_weight;
+			if (n <= o.integer_weight) {
+				return integer();
+			}
+			n -= o.integer_weight;
+			if (n <= o.boolean_weight) {
+				return NbfxValue(m_random.chance(0.5));
+			}
+			n -= o.boolean_weight;
+			if (n <= o.datetime_weight) {
+				// within 2024
+				const auto seconds = 1704067200 + static_cast<int64_t>(m_random.between(0, 366 * 86400 - 1));
+				return NbfxValue(std::chrono::system_clock::time_point(std::chrono::seconds(seconds)));
+			}
+			if (n - o.datetime_weight <= o.blob_weight) {
+				std::vector<uint8_t> blob(m_random.log_uniform(o.blob_min, o.blob_max));
+				for (auto &b : blob) {
+					b = static_cast<uint8_t>(m_random.next());
+				}
+				return NbfxValue(std::move(blob));
+			}
+			// all weights are zero
+			return NbfxValue();
+		}
+
+		NbfxValue integer() {
+			// every integer record width is equally likely
+			const auto value = static_cast<int64_t>(m_random.next() >> (m_random.between(0, 3) * 16 + 1));
+			return NbfxValue(m_random.chance(0.2) ? -value : value);
+		}
+
+		std::wstring text(size_t length) {
+			std::wstring text(length, L' ');
+			for (auto &c : text) {
+				c = static_cast<wchar_t>(detail::corpus_text[m_random.between(0, sizeof(detail::corpus_text) - 2)]);
+			}
+			return text;
+		}
+
+		std::wstring random_name() {
+			if (m_random.chance(m_options.name_reuse)) {
+				// lower indices are picked more often, like names in real contracts
+				return vocabulary_name(m_random.between(0, m_random.between(0, m_options.vocabulary - 1)));
+			}
+			return pick(detail::corpus_words) + (L"_" + std::to_wstring(m_fresh_names++));
+		}
+
+		static std::wstring vocabulary_name(uint64_t index) {
+			constexpr auto count = std::size(detail::corpus_words);
+			std::wstring name = detail::corpus_words[index % count];
+			if (index >= count) {
+				name += std::to_wstring(index / count);
+			}
+			return name;
+		}
+
+		template<size_t N>
+		const wchar_t *pick(const wchar_t *const (&words)[N]) {
+			return words[m_random.between(0, N - 1)];
+		}
+
+		std::wstring uuid() {
+			constexpr wchar_t hex[] = L"0123456789abcdef";
+			std::wstring id = L"urn:uuid:xxxxxxxx-xxxx-4xxx-xxxx-xxxxxxxxxxxx";
+			auto bits = m_random.next();
+			auto left = 16u;
+			for (auto &c : id) {
+				if (c == L'x') {
+					if (!left) {
+						bits = m_random.next();
+						left = 16u;
+					}
+					c = hex[bits & 0xFu];
+					bits >>= 4u;
+					--left;
+				}
+			}
+			return id;
+		}
+
+		NbfxCorpusOptions m_options;
+		detail::NbfxCorpusRandom m_random;
+		uint64_t m_fresh_names = 0;
+	};
+}
@@ -4,6 +4,8 @@
 #include "NbfxAttribute.hpp"
 #include "NbfxValue.hpp"
 #include "NbfxElement.hpp"
+#include "stats.hpp"
+#include "hooks.hpp"
 
 #include <string>
 #include <vector>
@@ -14,12 +16,16 @@
 #include <codecvt>
 #include <locale>
 #include <iomanip>
+#include <iterator>
+#include <optional>
+#include <type_traits>
 
 namespace nbfx {
 
 	namespace detail {
 		namespace {
-			std::wstring_convert<std::codecvt_utf8<wchar_t>> utf_to_wstring;
+			// wstring_convert keeps conversion state, each parsing thread needs its own
+			thread_local std::wstring_convert<std::codecvt_utf8<wchar_t>> utf_to_wstring;
 
 
             template<typename T, typename TIter>
@@ -58,16 +64,50 @@ namespace nbfx {
                 return result;
             }
 
-            template<typename TIter>
-            std::wstring parseString(TIter& p) {
-                // handle highest bit?
-                long length = static_cast<long>(parseMultiByteInt21(p));
+            inline std::wstring decodeChars(const char* from, const char* to) {
+                auto str = utf_to_wstring.from_bytes(from, to);
+                if constexpr (stats_enabled) {
+                    threadStats().parse.characters(str.size());
+                }
+                return str;
+            }
 
-                std::string str(p, p + length);
+            template<typename TIter>
+            constexpr bool isContiguousIterator() {
+#if defined(__cpp_lib_concepts)
+                return std::contiguous_iterator<TIter>;
+#else
+                using T = std::remove_const_t<typename std::iterator_traits<TIter>::value_type>;
+                return std::is_pointer_v<TIter> ||
+                       std::is_same_v<TIter, typename std::vector<T>::iterator> ||
+                       std::is_same_v<TIter, typename std::vector<T>::const_iterator> ||
+                       std::is_same_v<TIter, std::string::iterator> ||
+                       std::is_same_v<TIter, std::string::const_iterator>;
+#endif
+            }
 
-                p += length;
+            /**
+             * Decodes length bytes of UTF-8 at p, in place if the input is contiguous
+             */
+            template<typename TIter>
+            std::wstring readChars(TIter& p, size_t length) {
+                const auto from = p;
+                p += static_cast<typename std::iterator_traits<TIter>::difference_type>(length);
+
+                if constexpr (isContiguousIterator<TIter>()) {
+                    const auto data = reinterpret_cast<const char*>(&*from);
+                    return decodeChars(data, data + length);
+                } else {
+                    const std::string str(from, p);
+                    return decodeChars(str.data(), str.data() + str.size());
+                }
+            }
 
-                return utf_to_wstring.from_bytes(str);
+            template<typename TIter>
+            std::wstring parseString(TIter& p) {
+                // handle highest bit?
+                const auto length = static_cast<size_t>(parseMultiByteInt21(p));
+                return readChars(p, length);
             }
 
             template<typename TIter>
@@ -79,7 +119,7 @@ namespace nbfx {
 
             template<typename TIter>
             NbfxValue parseValue(TIter& p, bool* outWithEnd = nullptr) {
-                TIter from, to;
+                TIter from;
 
                 if (outWithEnd) {
                     *outWithEnd = *p & 1;
@@ -101,29 +141,17 @@ namespace nbfx {
                     case NbfxRecordType::Chars8Text:
                     {
                         auto len = *(p++);
-                        from = p;
-                        to = p + len;
-                        p += len;
-                        return utf_to_wstring.from_bytes(reinterpret_cast<const char*>(&*from),
-                                                         reinterpret_cast<const char*>(&*to));
+                        return readChars(p, len);
                     }
                     case NbfxRecordType::Chars16Text:
                     {
                         auto len = read_and_advance<uint16_t>(p);
-                        from = p;
-                        to = p + len;
-                        p += len;
-                        return utf_to_wstring.from_bytes(reinterpret_cast<const char*>(&*from),
-                                                         reinterpret_cast<const char*>(&*to));
+                        return readChars(p, len);
                     }
                     case NbfxRecordType::Chars32Text:
                     {
                         auto len = read_and_advance<uint32_t>(p);
-                        from = p;
-                        to = p + len;
-                        p += len;
-                        return utf_to_wstring.from_bytes(reinterpret_cast<const char*>(&*from),
-                                                         reinterpret_cast<const char*>(&*to));
+                        return readChars(p, len);
                     }
 
                     case NbfxRecordType::Int8Text:
@@ -304,62 +332,368 @@ namespace nbfx {
 
 	}
 
-	template<typename TIter>
-	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1, NbfxElement>
-	parse(TIter p) {
-        using namespace detail;
-		auto type = static_cast<NbfxRecordType>(*p);
+	struct NbfxReaderQuotas;
+
+	template<typename T>
+	constexpr bool is_quotas_v = std::is_same_v<std::decay_t<T>, NbfxReaderQuotas>;
 
-		if (!IsElement(type)) {
-			throw std::invalid_argument("expected element as a topmost node");
+	/**
+	 * Bytes sink that keeps every chunk in the tree
+	 */
+	struct NbfxNullSink {
+		bool on_bytes(const std::vector<NbfxElement> &, const uint8_t *, size_t) noexcept {
+			return false;
 		}
+	};
 
-		std::stack<NbfxElement> stack;
+	namespace detail {
+		constexpr bool isBytesRecord(NbfxRecordType type) noexcept {
+			return type >= NbfxRecordType::Bytes8Text && type <= NbfxRecordType::Bytes32TextWithEndElement;
+		}
 
-		for (;;) {
-			type = static_cast<NbfxRecordType>(*p);
+		constexpr bool isCharsRecord(NbfxRecordType type) noexcept {
+			return type >= NbfxRecordType::Chars8Text && type <= NbfxRecordType::Chars32TextWithEndElement;
+		}
 
-			if (IsElement(type)) {
-				stack.emplace(parseElement(p));
+		template<typename TIter>
+		size_t parseBytesLength(TIter &p, NbfxRecordType type) {
+			switch (static_cast<NbfxRecordType>(static_cast<uint8_t>(type) & 0xFEu)) {
+				case NbfxRecordType::Bytes8Text:
+					return read_and_advance<uint8_t>(p);
+				case NbfxRecordType::Bytes16Text:
+					return read_and_advance<uint16_t>(p);
+				default:
+					return read_and_advance<uint32_t>(p);
 			}
-			else if (IsAttribute(type)) {
-				stack.top().attributes().emplace_back(parseAttribute(p));
+		}
+
+		/**
+		 * Record checks of parse without quotas, none
+		 */
+		struct NbfxNoGuard {
+			template<typename TIter>
+			void before_record(const TIter &, const std::vector<NbfxElement> &) noexcept {}
+		};
+
+		/**
+		 * Length of a Chars*Text or UnicodeChars*Text record's payload in bytes, 0 for other records
+		 */
+		template<typename TIter>
+		size_t peekCharsLength(TIter p, NbfxRecordType type) {
+			++p;
+			switch (static_cast<NbfxRecordType>(static_cast<uint8_t>(type) & 0xFEu)) {
+				case NbfxRecordType::Chars8Text:
+				case NbfxRecordType::UnicodeChars8Text:
+					return read_and_advance<uint8_t>(p);
+				case NbfxRecordType::Chars16Text:
+				case NbfxRecordType::UnicodeChars16Text:
+					return read_and_advance<uint16_t>(p);
+				case NbfxRecordType::Chars32Text:
+				case NbfxRecordType::UnicodeChars32Text:
+					return read_and_advance<uint32_t>(p);
+				default:
+					return 0;
 			}
-			else if (IsTextRecord(type)) {
-				bool valueWithEnd;
-				auto &value = stack.top().value();
-				if (value.type() == NbfxValueType::Bytes && value.bytes().size()) {
-					// weird thing with two bytes text records
-					auto new_chunk = parseValue(p, &valueWithEnd);
-					if (new_chunk.type() != NbfxValueType::Bytes) {
-						throw std::runtime_error("expected bytes to append to bytes");
+		}
+
+		/**
+		 * Builds the tree one record at a time
+		 */
+		class NbfxDomBuilder {
+		public:
+			/**
+			 * Parses one record, returns true when the topmost element is complete
+			 */
+			template<typename TIter, typename TSink>
+			bool record(TIter &p, TSink &sink) {
+				NbfxNoHooks hooks;
+				return record(p, sink, hooks);
+			}
+
+			/**
+			 * Parses one record reporting elements and large payloads to the hooks
+			 */
+			template<typename TIter, typename TSink, typename THooks>
+			bool record(TIter &p, TSink &sink, THooks &hooks) {
+				NbfxNoGuard guard;
+				return record(p, sink, hooks, guard);
+			}
+
+			/**
+			 * Parses one record after the guard has checked it, the guard throws to reject the record
+			 */
+			template<typename TIter, typename TSink, typename THooks, typename TGuard>
+			bool record(TIter &p, TSink &sink, THooks &hooks, TGuard &guard) {
+				guard.before_record(p, m_stack);
+				if constexpr (stats_enabled) {
+					const auto begin = p;
+					const auto raw = static_cast<uint8_t>(*p);
+					const auto done = parse_record(p, sink, hooks);
+					threadStats().parse.record(raw, static_cast<size_t>(p - begin), m_stack.size());
+					return done;
+				}
+				return parse_record(p, sink, hooks);
+			}
+
+			/**
+			 * Checks if the topmost element has been opened
+			 */
+			bool started() const noexcept {
+				return !m_stack.empty();
+			}
+
+			/**
+			 * Offers payload of a bytes record to the sink, returns true if the sink consumed it
+			 */
+			template<typename TSink>
+			bool offer_bytes(TSink &sink, const uint8_t *data, size_t size) {
+				return sink.on_bytes(m_stack, data, size);
+			}
+
+			/**
+			 * Appends payload of a bytes record to the value of the current element
+			 */
+			void append_bytes(std::vector<uint8_t> chunk) {
+				auto &value = m_stack.back().value();
+				if (value.type() == NbfxValueType::Bytes && value.bytes_size()) {
+					value.append_bytes(std::move(chunk));
+					if constexpr (stats_enabled) {
+						threadStats().parse.bytes_chunk();
 					}
-					value.bytes().insert(value.bytes().end(), new_chunk.bytes().cbegin(), new_chunk.bytes().cend());
 				}
 				else {
-					value = parseValue(p, &valueWithEnd);
+					value = std::move(chunk);
 				}
-				if (valueWithEnd) {
-					type = NbfxRecordType::EndElement;
-					--p;
+			}
+
+			/**
+			 * Sets text of the current element decoded outside of parse_record
+			 */
+			void set_text(NbfxValue text) {
+				auto &value = m_stack.back().value();
+				if (value.type() == NbfxValueType::Bytes && value.bytes_size()) {
+					throw std::runtime_error("expected bytes to append to bytes");
 				}
+				value = std::move(text);
 			}
 
-			if (type == NbfxRecordType::EndElement) {
-				++p;
+			/**
+			 * Closes the current element, returns true when the topmost element is complete
+			 */
+			bool end_element() {
+				NbfxNoHooks hooks;
+				return end_element(hooks);
+			}
 
-				auto element = std::move(stack.top());
-				stack.pop();
+			template<typename THooks>
+			bool end_element(THooks &hooks) {
+				// chunks are collected while the element is open and copied together once
+				auto &value = m_stack.back().value();
+				if (value.type() == NbfxValueType::Bytes && value.chunk_count() > 1) {
+					value.bytes();
+				}
+				hooks.on_element_end(m_stack.back(), hookTime<THooks>());
+				auto element = std::move(m_stack.back());
+				m_stack.pop_back();
 
-				if (stack.size() == 0) {
-					return element;
+				if (m_stack.empty()) {
+					m_result.emplace(std::move(element));
+					return true;
+				}
+
+				m_stack.back().children().emplace_back(std::move(element));
+				return false;
+			}
+
+			NbfxElement result() {
+				auto element = std::move(*m_result);
+				m_result.reset();
+				return element;
+			}
+
+		private:
+			template<typename TIter, typename TSink, typename THooks>
+			bool parse_record(TIter &p, TSink &sink, THooks &hooks) {
+				auto type = static_cast<NbfxRecordType>(*p);
+
+				if (m_stack.empty() && !IsElement(type)) {
+					throw std::invalid_argument("expected element as a topmost node");
+				}
+
+				if (IsElement(type)) {
+					m_stack.emplace_back(parseElement(p));
+					hooks.on_element_begin(m_stack.back(), hookTime<THooks>());
+				}
+				else if (IsAttribute(type)) {
+					m_stack.back().attributes().emplace_back(parseAttribute(p));
+				}
+				else if (isBytesRecord(type)) {
+					// consecutive bytes records are chunks of the same value
+					++p;
+					const auto size = parseBytesLength(p, type);
+					const auto large = isLargePayload<THooks>(size);
+					if (large) {
+						hooks.on_payload_begin(size, hookTime<THooks>());
+					}
+
+					if constexpr (isContiguousIterator<TIter>()) {
+						const auto data = size ? reinterpret_cast<const uint8_t *>(&*p) : nullptr;
+						if (!offer_bytes(sink, data, size)) {
+							append_bytes(std::vector<uint8_t>(p, p + size));
+						}
+					} else {
+						// the sink reads a pointer, other input is gathered into the chunk first
+						std::vector<uint8_t> chunk(p, p + size);
+						if (!offer_bytes(sink, chunk.data(), size)) {
+							append_bytes(std::move(chunk));
+						}
+					}
+					p += size;
+
+					if (large) {
+						hooks.on_payload_end(size, hookTime<THooks>());
+					}
+					return (static_cast<uint8_t>(type) & 1u) && end_element(hooks);
+				}
+				else if (IsTextRecord(type)) {
+					auto &value = m_stack.back().value();
+					if (value.type() == NbfxValueType::Bytes && value.bytes_size()) {
+						throw std::runtime_error("expected bytes to append to bytes");
+					}
+
+					bool valueWithEnd;
+					if constexpr (THooks::large_payload != SIZE_MAX) {
+						const auto size = peekCharsLength(p, type);
+						const auto large = isLargePayload<THooks>(size);
+						if (large) {
+							hooks.on_payload_begin(size, hookTime<THooks>());
+						}
+						value = parseValue(p, &valueWithEnd);
+						if (large) {
+							hooks.on_payload_end(size, hookTime<THooks>());
+						}
+					}
+					else {
+						value = parseValue(p, &valueWithEnd);
+					}
+					return valueWithEnd && end_element(hooks);
+				}
+				else if (type == NbfxRecordType::EndElement) {
+					++p;
+					return end_element(hooks);
 				}
 				else {
-					stack.top().children().emplace_back(std::move(element));
+					throw_unexpected(type);
 				}
+
+				return false;
+			}
+
+			[[noreturn]] static void throw_unexpected(NbfxRecordType type) {
+				std::ostringstream ss;
+				ss << "unexpected record type 0x"
+				   << std::uppercase
+				   << std::setfill('0')
+				   << std::setw(2)
+				   << std::hex
+				   << static_cast<int>(type);
+
+				throw std::invalid_argument(ss.str());
+			}
+
+			std::vector<NbfxElement> m_stack;
+			std::optional<NbfxElement> m_result;
+		};
+
+		template<typename TIter, typename TSink, typename THooks, typename TGuard>
+		NbfxElement parseDocument(TIter &p, TSink &sink, THooks &hooks, TGuard &guard) {
+			NbfxStatsTimer timer(true);
+			hooks.on_document_begin(hookTime<THooks>());
+			NbfxDomBuilder builder;
+			while (!builder.record(p, sink, hooks, guard)) {
 			}
+			hooks.on_document_end(hookTime<THooks>());
+			return builder.result();
+		}
 
+		template<typename TIter, typename TSink, typename THooks>
+		NbfxElement parseDocument(TIter &p, TSink &sink, THooks &hooks) {
+			NbfxNoGuard guard;
+			return parseDocument(p, sink, hooks, guard);
+		}
+
+		template<typename TIter, typename TSink>
+		NbfxElement parseDocument(TIter &p, TSink &sink) {
+			NbfxNoHooks hooks;
+			return parseDocument(p, sink, hooks);
 		}
 	}
-}
 
+	template<typename TIter>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1, NbfxElement>
+	parse(TIter p) {
+		NbfxNullSink sink;
+		return detail::parseDocument(p, sink);
+	}
+
+	/**
+	 * Parses the document passing payload of Bytes*Text records to the sink as it goes
+	 *
+	 * Sink is called as `bool on_bytes(const std::vector<NbfxElement> &path, const uint8_t *data, size_t size)`,
+	 * path holds incomplete open elements from the topmost one to the owner of the chunk and data points
+	 * into the input. Chunks the sink returns true for are consumed and not kept in the tree.
+	 */
+	template<typename TIter, typename TSink>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1 && !is_hooks_v<TSink> && !is_quotas_v<TSink>, NbfxElement>
+	parse(TIter p, TSink &sink) {
+		return detail::parseDocument(p, sink);
+	}
+
+	/**
+	 * Parses the document calling the hooks, see NbfxNoHooks
+	 */
+	template<typename TIter, typename THooks>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1 && is_hooks_v<THooks>, NbfxElement>
+	parse(TIter p, THooks &hooks) {
+		NbfxNullSink sink;
+		return detail::parseDocument(p, sink, hooks);
+	}
+
+	/**
+	 * Parses the document with a sink like parse(p, sink), calling the hooks
+	 */
+	template<typename TIter, typename TSink, typename THooks>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1 && is_hooks_v<THooks>, NbfxElement>
+	parse(TIter p, TSink &sink, THooks &hooks) {
+		return detail::parseDocument(p, sink, hooks);
+	}
+
+	/**
+	 * Parses the document and moves p past its last record, to the start of the next document if any
+	 */
+	template<typename TIter>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1, NbfxElement>
+	parse_next(TIter &p) {
+		NbfxNullSink sink;
+		return detail::parseDocument(p, sink);
+	}
+
+	/**
+	 * Parses the document with a sink like parse(p, sink) and moves p past its last record
+	 */
+	template<typename TIter, typename TSink>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1 && !is_hooks_v<TSink> && !is_quotas_v<TSink>, NbfxElement>
+	parse_next(TIter &p, TSink &sink) {
+		return detail::parseDocument(p, sink);
+	}
+
+	/**
+	 * Parses the document calling the hooks and moves p past its last record
+	 */
+	template<typename TIter, typename THooks>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1 && is_hooks_v<THooks>, NbfxElement>
+	parse_next(TIter &p, THooks &hooks) {
+		NbfxNullSink sink;
+		return detail::parseDocument(p, sink, hooks);
+	}
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "deserializer.hpp"
+#include "reader.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace nbfx {
+
+	/**
+	 * Returns the end of the document starting at begin without decoding it
+	 *
+	 * Records are only measured, so this is much cheaper than parsing. Throws if the document
+	 * doesn't end before end.
+	 */
+	inline const uint8_t *find_document_end(const uint8_t *begin, const uint8_t *end) {
+		auto p = begin;
+		size_t depth = 0;
+
+		do {
+			const auto size = detail::measureRecord(p, static_cast<size_t>(end - p));
+			if (!size) {
+				throw std::invalid_argument("truncated document");
+			}
+
+			const auto raw = *p;
+			const auto type = static_cast<NbfxRecordType>(raw);
+			if (IsElement(type)) {
+				++depth;
+			} else if (depth == 0) {
+				throw std::invalid_argument("expected element as a topmost node");
+			} else if (type == NbfxRecordType::EndElement || (IsTextRecord(type) && (raw & 1u))) {
+				--depth;
+			}
+
+			p += size;
+		} while (depth);
+
+		return p;
+	}
+
+	/**
+	 * Splits a buffer of back to back documents into document boundaries
+	 */
+	inline std::vector<NbfxBytesView> split_documents(const uint8_t *begin, const uint8_t *end) {
+		std::vector<NbfxBytesView> documents;
+		while (begin != end) {
+			const auto next = find_document_end(begin, end);
+			documents.push_back(NbfxBytesView{begin, static_cast<size_t>(next - begin)});
+			begin = next;
+		}
+		return documents;
+	}
+
+	/**
+	 * Range of documents stored back to back, parsed one by one as it's iterated
+	 */
+	class NbfxDocumentRange {
+	public:
+		class iterator {
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = NbfxElement;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const NbfxElement *;
+			using reference = const NbfxElement &;
+
+			iterator() = default;
+
+			iterator(const uint8_t *p, const uint8_t *end) : m_p(p), m_end(end) {
+				next();
+			}
+
+			reference operator*() const noexcept {
+				return *m_current;
+			}
+
+			pointer operator->() const noexcept {
+				return &*m_current;
+			}
+
+			/**
+			 * Returns position right after the current document
+			 */
+			const uint8_t *position() const noexcept {
+				return m_p;
+			}
+
+			iterator &operator++() {
+				next();
+				return *this;
+			}
+
+			bool operator==(const iterator &other) const noexcept {
+				return m_current.has_value() == other.m_current.has_value() &&
+				       (!m_current || m_p == other.m_p);
+			}
+
+			bool operator!=(const iterator &other) const noexcept {
+				return !(*this == other);
+			}
+
+		private:
+			void next() {
+				m_current.reset();
+				if (m_p == m_end) {
+					return;
+				}
+
+				const auto document_end = find_document_end(m_p, m_end);
+				m_current.emplace(parse_next(m_p));
+				if (m_p != document_end) {
+					throw std::logic_error("document boundary mismatch");
+				}
+			}
+
+			const uint8_t *m_p = nullptr;
+			const uint8_t *m_end = nullptr;
+			std::optional<NbfxElement> m_current;
+		};
+
+		NbfxDocumentRange(const uint8_t *begin, const uint8_t *end) : m_begin(begin), m_end(end) {}
+
+		iterator begin() const {
+			return iterator(m_begin, m_end);
+		}
+
+		iterator end() const noexcept {
+			return iterator();
+		}
+
+	private:
+		const uint8_t *m_begin;
+		const uint8_t *m_end;
+	};
+
+	/**
+	 * Iterates documents stored back to back in a contiguous range
+	 */
+	template<typename TIter>
+	NbfxDocumentRange parse_all(TIter begin, TIter end) {
+		static_assert(sizeof(typename std::iterator_traits<TIter>::value_type) == 1, "expected byte range");
+		const auto size = static_cast<size_t>(std::distance(begin, end));
+		const auto data = size ? reinterpret_cast<const uint8_t *>(&*begin) : nullptr;
+		return NbfxDocumentRange(data, data + size);
+	}
+
+	/**
+	 * Parses documents stored back to back in a contiguous range on several threads
+	 *
+	 * Boundaries are found by a measuring pre-pass, then documents are parsed in parallel.
+	 * The first failure is rethrown after all threads finish.
+	 */
+	template<typename TIter>
+	std::vector<NbfxElement> parse_all_parallel(TIter begin, TIter end, unsigned threads = std::thread::hardware_concurrency()) {
+		static_assert(sizeof(typename std::iterator_traits<TIter>::value_type) == 1, "expected byte range");
+		const auto size = static_cast<size_t>(std::distance(begin, end));
+		const auto data = size ? reinterpret_cast<const uint8_t *>(&*begin) : nullptr;
+
+		const auto documents = split_documents(data, data + size);
+		std::vector<std::optional<NbfxElement>> parsed(documents.size());
+		std::vector<std::exception_ptr> errors(documents.size());
+
+		const auto parse_slice = [&](size_t first, size_t last) {
+			for (auto i = first; i < last; ++i) {
+				try {
+					parsed[i].emplace(parse(documents[i].data));
+				} catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		threads = static_cast<unsigned>(std::min<size_t>(std::max(1u, threads), documents.size()));
+		if (threads <= 1) {
+			parse_slice(0, documents.size());
+		} else {
+			std::vector<std::thread> workers;
+			const auto slice = (documents.size() + threads - 1) / threads;
+			for (size_t first = 0; first < documents.size(); first += slice) {
+				workers.emplace_back(parse_slice, first, std::min(first + slice, documents.size()));
+			}
+			for (auto &worker : workers) {
+				worker.join();
+			}
+		}
+
+		for (const auto &error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+		std::vector<NbfxElement> result;
+		result.reserve(parsed.size());
+		for (auto &element : parsed) {
+			result.emplace_back(std::move(*element));
+		}
+		return result;
+	}
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "deserializer.hpp"
+#include "view.hpp"
+#include "documents.hpp"
+
+#include <string>
+#include <cstdint>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define NBFX_HAS_MMAP 1
+#else
+#include <fstream>
+#endif
+
+namespace nbfx {
+
+	namespace detail {
+		/**
+		 * Rejects records that don't end before the end of the input, so a truncated capture isn't decoded past it
+		 */
+		class NbfxBoundsGuard {
+		public:
+			explicit NbfxBoundsGuard(const uint8_t *end) noexcept : m_end(end) {}
+
+			void before_record(const uint8_t *p, const std::vector<NbfxElement> &) const {
+				if (p >= m_end || !measureRecord(p, static_cast<size_t>(m_end - p))) {
+					throw std::invalid_argument("truncated document");
+				}
+			}
+
+		private:
+			const uint8_t *m_end;
+		};
+	}
+
+	/**
+	 * Read-only memory mapping of a whole file
+	 *
+	 * Falls back to reading the file into memory where mmap is not available.
+	 */
+	class NbfxMappedFile {
+	public:
+		explicit NbfxMappedFile(const std::string &path) {
+#ifdef NBFX_HAS_MMAP
+			const auto fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				throw std::system_error(errno, std::generic_category(), "failed to open " + path);
+			}
+
+			struct stat st{};
+			if (::fstat(fd, &st) != 0) {
+				const auto error = errno;
+				::close(fd);
+				throw std::system_error(error, std::generic_category(), "failed to stat " + path);
+			}
+
+			m_size = static_cast<size_t>(st.st_size);
+			if (m_size) {
+				auto data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data == MAP_FAILED) {
+					const auto error = errno;
+					::close(fd);
+					throw std::system_error(error, std::generic_category(), "failed to map " + path);
+				}
+				m_data = static_cast<const uint8_t *>(data);
+			}
+			::close(fd);
+#else
+			std::ifstream stream(path, std::ios::binary);
+			if (!stream) {
+				throw std::runtime_error("failed to open " + path);
+			}
+			m_buffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+			m_data = m_buffer.data();
+			m_size = m_buffer.size();
+#endif
+		}
+
+		NbfxMappedFile(NbfxMappedFile &&other) noexcept :
+#ifndef NBFX_HAS_MMAP
+				m_buffer(std::move(other.m_buffer)),
+#endif
+				m_data(other.m_data), m_size(other.m_size) {
+			other.m_data = nullptr;
+			other.m_size = 0;
+		}
+
+		NbfxMappedFile(const NbfxMappedFile &) = delete;
+
+		NbfxMappedFile &operator=(const NbfxMappedFile &) = delete;
+
+		NbfxMappedFile &operator=(NbfxMappedFile &&other) noexcept {
+			std::swap(m_data, other.m_data);
+			std::swap(m_size, other.m_size);
+#ifndef NBFX_HAS_MMAP
+			std::swap(m_buffer, other.m_buffer);
+#endif
+			return *this;
+		}
+
+		~NbfxMappedFile() {
+#ifdef NBFX_HAS_MMAP
+			if (m_data) {
+				::munmap(const_cast<uint8_t *>(m_data), m_size);
+			}
+#endif
+		}
+
+		const uint8_t *data() const noexcept {
+			return m_data;
+		}
+
+		size_t size() const noexcept {
+			return m_size;
+		}
+
+		const uint8_t *begin() const noexcept {
+			return m_data;
+		}
+
+		const uint8_t *end() const noexcept {
+			return m_data + m_size;
+		}
+
+		/**
+		 * Hints the kernel to read ahead aggressively and drop pages behind
+		 */
+		void advise_sequential() const noexcept {
+#ifdef NBFX_HAS_MMAP
+			if (m_data) {
+				::madvise(const_cast<uint8_t *>(m_data), m_size, MADV_SEQUENTIAL);
+			}
+#endif
+		}
+
+		/**
+		 * Restores default paging for random access
+		 */
+		void advise_normal() const noexcept {
+#ifdef NBFX_HAS_MMAP
+			if (m_data) {
+				::madvise(const_cast<uint8_t *>(m_data), m_size, MADV_NORMAL);
+			}
+#endif
+		}
+
+		/**
+		 * Drops pages of [begin, end) from memory, they are read from the file again if accessed
+		 *
+		 * Keeps memory of a sequential pass over a large file bounded.
+		 */
+		void release(const uint8_t *begin, const uint8_t *end) const noexcept {
+#ifdef NBFX_HAS_MMAP
+			const auto page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+			const auto first = (reinterpret_cast<uintptr_t>(begin) + page - 1) / page * page;
+			const auto last = reinterpret_cast<uintptr_t>(end) / page * page;
+			if (first < last) {
+				::madvise(reinterpret_cast<void *>(first), last - first, MADV_DONTNEED);
+			}
+#else
+			(void) begin;
+			(void) end;
+#endif
+		}
+
+	private:
+#ifndef NBFX_HAS_MMAP
+		std::vector<uint8_t> m_buffer;
+#endif
+		const uint8_t *m_data = nullptr;
+		size_t m_size = 0;
+	};
+
+	/**
+	 * View tree of a mapped file, owns the mapping the tree points into
+	 */
+	class NbfxDocumentView {
+	public:
+		explicit NbfxDocumentView(NbfxMappedFile file) :
+				m_file(std::move(file)),
+				m_root(parse(m_file)) {}
+
+		const NbfxElementView &root() const noexcept {
+			return m_root;
+		}
+
+		const NbfxMappedFile &file() const noexcept {
+			return m_file;
+		}
+
+	private:
+		static NbfxElementView parse(const NbfxMappedFile &file) {
+			if (!file.size()) {
+				throw std::invalid_argument("empty file");
+			}
+			// a truncated or corrupt capture must not be decoded past the mapping; the view is built
+			// by a second pass over the same pages, so they aren't dropped behind the first one
+			find_document_end(file.data(), file.end());
+			return parse_view(file.data());
+		}
+
+		NbfxMappedFile m_file;
+		NbfxElementView m_root;
+	};
+
+	/**
+	 * Parses file without reading it into intermediate buffer
+	 */
+	inline NbfxElement parse_file(const std::string &path) {
+		const NbfxMappedFile file(path);
+		if (!file.size()) {
+			throw std::invalid_argument("empty file");
+		}
+		file.advise_sequential();
+		// each record is measured against the end of the mapping right before it is decoded
+		NbfxNullSink sink;
+		NbfxNoHooks hooks;
+		detail::NbfxBoundsGuard guard(file.end());
+		auto p = file.data();
+		return detail::parseDocument(p, sink, hooks, guard);
+	}
+
+	/**
+	 * Parses file into a view tree pointing into the mapped file
+	 */
+	inline NbfxDocumentView parse_file_view(const std::string &path) {
+		return NbfxDocumentView(NbfxMappedFile(path));
+	}
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "reader.hpp"
+#include "serializer.hpp"
+#include "stream.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace nbfx {
+
+	/**
+	 * .NET Message Framing record types
+	 */
+	enum class NbfxNmfRecordType : uint8_t {
+		Version = 0x00,
+		Mode = 0x01,
+		Via = 0x02,
+		KnownEncoding = 0x03,
+		ExtensibleEncoding = 0x04,
+		UnsizedEnvelope = 0x05,
+		SizedEnvelope = 0x06,
+		End = 0x07,
+		Fault = 0x08,
+		UpgradeRequest = 0x09,
+		UpgradeResponse = 0x0A,
+		PreambleAck = 0x0B,
+		PreambleEnd = 0x0C
+	};
+
+	enum class NbfxNmfMode : uint8_t {
+		SingletonUnsized = 0x01,
+		Duplex = 0x02,
+		Simplex = 0x03,
+		SingletonSized = 0x04
+	};
+
+	enum class NbfxNmfEncoding : uint8_t {
+		Soap11Utf8 = 0x00,
+		Soap11Utf16 = 0x01,
+		Soap11UnicodeLE = 0x02,
+		Soap12Utf8 = 0x03,
+		Soap12Utf16 = 0x04,
+		Soap12UnicodeLE = 0x05,
+		Soap12Mtom = 0x06,
+		Soap12Nbfs = 0x07,
+		Soap12Nbfse = 0x08
+	};
+
+	/**
+	 * Decoded framing record, text and payload point into the decoded buffer
+	 */
+	struct NbfxNmfRecord {
+		NbfxNmfRecordType type;
+		// version major, mode or known encoding
+		uint8_t value;
+		// version minor
+		uint8_t minor;
+		// via, extensible encoding, fault or upgrade protocol
+		std::string_view text;
+		// sized envelope
+		NbfxBytesView payload;
+	};
+
+	/**
+	 * Decodes the framing record at data without copying it
+	 *
+	 * Returns size of the record, or 0 if more than available bytes are needed.
+	 * Unsized envelopes are not supported.
+	 */
+	inline size_t decode_nmf_record(const uint8_t *data, size_t available, NbfxNmfRecord &record) {
+		detail::NbfxRecordMeasure m(data, available);
+
+		uint8_t raw;
+		if (!m.byte(raw)) {
+			return 0;
+		}
+
+		record = NbfxNmfRecord{static_cast<NbfxNmfRecordType>(raw), 0, 0, {}, {nullptr, 0}};
+
+		switch (record.type) {
+			case NbfxNmfRecordType::Version:
+				return m.byte(record.value) && m.byte(record.minor) ? m.position() : 0;
+			case NbfxNmfRecordType::Mode:
+			case NbfxNmfRecordType::KnownEncoding:
+				return m.byte(record.value) ? m.position() : 0;
+			case NbfxNmfRecordType::Via:
+			case NbfxNmfRecordType::ExtensibleEncoding:
+			case NbfxNmfRecordType::Fault:
+			case NbfxNmfRecordType::UpgradeRequest: {
+				uint32_t size;
+				if (!m.uint31(size)) {
+					return 0;
+				}
+				const auto text = data + m.position();
+				if (!m.skip(size)) {
+					return 0;
+				}
+				record.text = std::string_view(reinterpret_cast<const char *>(text), size);
+				return m.position();
+			}
+			case NbfxNmfRecordType::SizedEnvelope: {
+				uint32_t size;
+				if (!m.uint31(size)) {
+					return 0;
+				}
+				const auto payload = data + m.position();
+				if (!m.skip(size)) {
+					return 0;
+				}
+				record.payload = NbfxBytesView{payload, size};
+				return m.position();
+			}
+			case NbfxNmfRecordType::End:
+			case NbfxNmfRecordType::UpgradeResponse:
+			case NbfxNmfRecordType::PreambleAck:
+			case NbfxNmfRecordType::PreambleEnd:
+				return m.position();
+			case NbfxNmfRecordType::UnsizedEnvelope:
+				throw std::invalid_argument("unsized envelopes are not supported");
+			default:
+				throw std::invalid_argument("unexpected framing record");
+		}
+	}
+
+	/**
+	 * Reads framing records from an input source, see NbfxStreamParser for the source requirements
+	 *
+	 * Envelopes are kept whole in the receive buffer and handed out in place,
+	 * text and payload of a record stay valid until the next call to next().
+	 */
+	template<typename TSource>
+	class NbfxNmfReader {
+	public:
+		static constexpr size_t default_buffer_size = 64 * 1024;
+		static constexpr size_t default_max_envelope_size = 64 * 1024 * 1024;
+
+		explicit NbfxNmfReader(TSource source,
+		                       size_t buffer_size = default_buffer_size,
+		                       size_t max_envelope_size = default_max_envelope_size) :
+				m_source(std::move(source)),
+				m_buffer(std::max<size_t>(buffer_size, 16)),
+				m_max_envelope_size(max_envelope_size) {}
+
+		/**
+		 * Reads the next record, returns false if the source ended between records
+		 */
+		bool next(NbfxNmfRecord &record) {
+			m_begin += m_consumed;
+			m_consumed = 0;
+
+			for (;;) {
+				if (m_end > m_begin) {
+					if (const auto size = decode_nmf_record(m_buffer.data() + m_begin, m_end - m_begin, record)) {
+						m_consumed = size;
+						return true;
+					}
+				}
+
+				if (!read()) {
+					if (m_end == m_begin) {
+						return false;
+					}
+					throw std::runtime_error("unexpected end of stream");
+				}
+			}
+		}
+
+	private:
+		size_t read() {
+			if (m_begin == m_end) {
+				m_begin = m_end = 0;
+			} else if (m_end == m_buffer.size()) {
+				if (m_begin) {
+					std::memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+					m_end -= m_begin;
+					m_begin = 0;
+				} else if (m_buffer.size() >= m_max_envelope_size + 6) {
+					throw std::length_error("envelope exceeds maximum size");
+				} else {
+					m_buffer.resize(std::min(2 * m_buffer.size(), m_max_envelope_size + 6));
+				}
+			}
+
+			const auto n = m_source.read(m_buffer.data() + m_end, m_buffer.size() - m_end);
+			m_end += n;
+			return n;
+		}
+
+		TSource m_source;
+		std::vector<uint8_t> m_buffer;
+		size_t m_max_envelope_size;
+		size_t m_begin = 0;
+		size_t m_end = 0;
+		size_t m_consumed = 0;
+	};
+
+	namespace detail {
+		template<typename TIt>
+		TIt writeNmfUint31(TIt out, uint32_t val) {
+			while (val >= 0x80u) {
+				*out++ = static_cast<uint8_t>(val | 0x80u);
+				val >>= 7u;
+			}
+			*out++ = static_cast<uint8_t>(val);
+			return out;
+		}
+
+		template<typename TIt>
+		TIt writeNmfString(TIt out, NbfxNmfRecordType type, std::string_view text) {
+			*out++ = static_cast<uint8_t>(type);
+			out = writeNmfUint31(out, static_cast<uint32_t>(text.size()));
+			return std::copy(text.begin(), text.end(), out);
+		}
+	}
+
+	/**
+	 * Writes a record without payload: End, PreambleAck, PreambleEnd or UpgradeResponse
+	 */
+	template<typename TIt>
+	TIt write_nmf_record(NbfxNmfRecordType type, TIt out) {
+		*out++ = static_cast<uint8_t>(type);
+		return out;
+	}
+
+	/**
+	 * Writes the preamble of version 1.0: mode, via, known encoding and preamble end
+	 */
+	template<typename TIt>
+	TIt write_nmf_preamble(std::string_view via,
+	                       TIt out,
+	                       NbfxNmfMode mode = NbfxNmfMode::Duplex,
+	                       NbfxNmfEncoding encoding = NbfxNmfEncoding::Soap12Nbfs) {
+		*out++ = static_cast<uint8_t>(NbfxNmfRecordType::Version);
+		*out++ = 1;
+		*out++ = 0;
+		*out++ = static_cast<uint8_t>(NbfxNmfRecordType::Mode);
+		*out++ = static_cast<uint8_t>(mode);
+		out = detail::writeNmfString(out, NbfxNmfRecordType::Via, via);
+		*out++ = static_cast<uint8_t>(NbfxNmfRecordType::KnownEncoding);
+		*out++ = static_cast<uint8_t>(encoding);
+		return write_nmf_record(NbfxNmfRecordType::PreambleEnd, out);
+	}
+
+	/**
+	 * Appends a sized envelope record whose payload is written by write(std::back_insert_iterator)
+	 *
+	 * The size is reserved as a 5 byte MultiByteInt31 padded with continuation bits and
+	 * patched once the payload is written, so the payload is not buffered separately.
+	 */
+	template<typename F>
+	void write_nmf_envelope(std::vector<uint8_t> &out, F &&write) {
+		out.push_back(static_cast<uint8_t>(NbfxNmfRecordType::SizedEnvelope));
+		const auto prefix = out.size();
+		out.insert(out.end(), 5, 0);
+
+		write(std::back_inserter(out));
+
+		const auto size = out.size() - prefix - 5;
+		if (size > 0x7FFFFFFFu) {
+			throw std::length_error("envelope exceeds maximum size");
+		}
+		for (auto i = 0u; i < 5u; ++i) {
+			out[prefix + i] = static_cast<uint8_t>(((size >> (7u * i)) & 0x7Fu) | (i < 4u ? 0x80u : 0u));
+		}
+	}
+
+	/**
+	 * Appends the element as a sized envelope record
+	 */
+	inline void write_nmf_envelope(const NbfxElement &element, std::vector<uint8_t> &out) {
+		write_nmf_envelope(out, [&](auto it) { serialize(element, it); });
+	}
+}
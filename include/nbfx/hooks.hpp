@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace nbfx {
+
+	class NbfxElement;
+
+	/**
+	 * Tracing hooks that do nothing, the default of parse and serialize
+	 *
+	 * Hooks derive from this class and hide the calls they need. Calls are resolved at compile time,
+	 * so the calls left empty cost nothing.
+	 */
+	struct NbfxNoHooks {
+		using time_point = std::chrono::steady_clock::time_point;
+
+		// calls get steady_clock time if true and a default time point otherwise
+		static constexpr bool timestamps = false;
+		// Chars and Bytes payloads of at least this size are reported
+		static constexpr size_t large_payload = SIZE_MAX;
+
+		void on_document_begin(time_point) noexcept {}
+
+		void on_document_end(time_point) noexcept {}
+
+		/**
+		 * Called when an element starts, parse calls it before attributes and children are read
+		 */
+		void on_element_begin(const NbfxElement &, time_point) noexcept {}
+
+		/**
+		 * Called when an element and everything in it has been read or written
+		 */
+		void on_element_end(const NbfxElement &, time_point) noexcept {}
+
+		void on_payload_begin(size_t, time_point) noexcept {}
+
+		void on_payload_end(size_t, time_point) noexcept {}
+	};
+
+	template<typename T>
+	constexpr bool is_hooks_v = std::is_base_of_v<NbfxNoHooks, std::decay_t<T>>;
+
+	namespace detail {
+		template<typename THooks>
+		NbfxNoHooks::time_point hookTime() noexcept {
+			if constexpr (THooks::timestamps) {
+				return std::chrono::steady_clock::now();
+			} else {
+				return {};
+			}
+		}
+
+		/**
+		 * Reference to the hooks of a writer, empty for NbfxNoHooks so the default writer doesn't grow
+		 */
+		template<typename THooks>
+		class NbfxHooksHolder {
+		public:
+			explicit NbfxHooksHolder(THooks &hooks) noexcept : m_hooks(hooks) {}
+
+			THooks &hooks() noexcept {
+				return m_hooks;
+			}
+
+		private:
+			THooks &m_hooks;
+		};
+
+		template<>
+		class NbfxHooksHolder<NbfxNoHooks> : NbfxNoHooks {
+		public:
+			NbfxHooksHolder() noexcept = default;
+
+			explicit NbfxHooksHolder(NbfxNoHooks &) noexcept {}
+
+			NbfxNoHooks &hooks() noexcept {
+				return *this;
+			}
+		};
+
+		template<typename THooks>
+		constexpr bool isLargePayload(size_t size) noexcept {
+			return THooks::large_payload != SIZE_MAX && size >= THooks::large_payload;
+		}
+	}
+}
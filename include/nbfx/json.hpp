@@ -0,0 +1,653 @@
+#pragma once
+
+#include "reader.hpp"
+#include "text.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nbfx {
+
+	/**
+	 * Mapping of NBFX documents to JSON
+	 *
+	 * The document becomes an object with the topmost element as its only member. An element with
+	 * text only becomes the typed value of the text, an element without content becomes null, others
+	 * become objects with attributes, children and text as members.
+	 */
+	struct NbfxJsonOptions {
+		// prefix of attribute members
+		std::string attribute_prefix = "@";
+		// member holding text of elements written as objects
+		std::string text_member = "#text";
+		// adjacent children of the same name become one member holding an array, children of the same
+		// name separated by other nodes become members with the same key
+		bool arrays = true;
+		// keep namespace prefixes in member names
+		bool prefixes = false;
+		// write namespace declarations as attributes
+		bool xmlns = false;
+		// strings of dictionary ids, written as parse names them ("D:<id>") if not set
+		std::function<std::string_view(uint32_t)> dictionary;
+	};
+
+	namespace detail {
+		struct NbfxJsonEscapes {
+			char control[32][7];
+
+			constexpr NbfxJsonEscapes() : control() {
+				constexpr char hex[] = "0123456789abcdef";
+				for (auto i = 0u; i < 32u; ++i) {
+					const char escape[] = {'\\', 'u', '0', '0', hex[i >> 4u], hex[i & 0xFu], 0};
+					for (auto j = 0u; j < 7u; ++j) {
+						control[i][j] = escape[j];
+					}
+				}
+			}
+		};
+
+		inline constexpr NbfxJsonEscapes json_escapes{};
+
+		inline std::string_view jsonEscape(uint8_t c) noexcept {
+			switch (c) {
+				case '"':
+					return "\\\"";
+				case '\\':
+					return "\\\\";
+				case '\n':
+					return "\\n";
+				case '\r':
+					return "\\r";
+				case '\t':
+					return "\\t";
+				default:
+					return c < 0x20u ? std::string_view(json_escapes.control[c], 6) : std::string_view();
+			}
+		}
+
+		inline void appendJsonEscaped(std::string &out, std::string_view text) {
+			appendEscaped(out, text, [](uint64_t v) {
+				return swarMatch(v, '"') | swarMatch(v, '\\') | swarBelow(v, 0x20);
+			}, jsonEscape);
+		}
+
+		/**
+		 * Returns the record after the element starting at p, skipping comments
+		 */
+		inline const uint8_t *nextSibling(const uint8_t *p) {
+			constexpr auto unbounded = std::numeric_limits<size_t>::max() / 2;
+			size_t depth = 0;
+			do {
+				const auto raw = *p;
+				const auto type = static_cast<NbfxRecordType>(raw);
+				if (IsElement(type)) {
+					++depth;
+				} else if (type == NbfxRecordType::EndElement || (IsTextRecord(type) && (raw & 1u))) {
+					--depth;
+				}
+				p += measureRecord(p, unbounded);
+			} while (depth);
+
+			while (*p == static_cast<uint8_t>(NbfxRecordType::Comment)) {
+				p += measureRecord(p, unbounded);
+			}
+			return p;
+		}
+
+		/**
+		 * Tells if an element record follows the text record at p before its element ends, skipping comments
+		 */
+		inline bool followedByElement(const uint8_t *p) {
+			constexpr auto unbounded = std::numeric_limits<size_t>::max() / 2;
+			for (;;) {
+				const auto raw = *p;
+				const auto type = static_cast<NbfxRecordType>(raw);
+				if (IsElement(type)) {
+					return true;
+				}
+				if (IsTextRecord(type) ? (raw & 1u) != 0 : type != NbfxRecordType::Comment) {
+					return false;
+				}
+				p += measureRecord(p, unbounded);
+			}
+		}
+
+		/**
+		 * Writes JSON straight from the records of a document
+		 *
+		 * Text is held back as views until the next node shows whether it's the whole element value.
+		 * Held back text that grows past the flush threshold can only be a string, it is written right away
+		 * and the rest of it follows record by record. A child is written as a plain member, '[' is inserted
+		 * before its value when the next sibling has the same record. Before a value grows past the flush threshold its next sibling is found by
+		 * measuring past it instead, so the output is flushed in bounded pieces.
+		 */
+		class NbfxJsonWriter {
+		public:
+			NbfxJsonWriter(NbfxTextOutput &output, const NbfxJsonOptions &options) :
+					m_output(output), m_out(output.buffer()), m_options(options) {}
+
+			const uint8_t *write(const uint8_t *begin) {
+				NbfxReader<const uint8_t *> reader(begin);
+				while (reader.read()) {
+					switch (reader.node_type()) {
+						case NbfxNodeType::Element:
+							start_element(reader);
+							break;
+						case NbfxNodeType::Attribute:
+							if (reader.is_xmlns() && !m_options.xmlns) {
+								break;
+							}
+							open_object();
+							m_key.assign(m_options.attribute_prefix);
+							if (reader.is_xmlns()) {
+								m_key += "xmlns";
+								if (!reader.prefix().empty()) {
+									m_key += ':';
+									m_key.append(reader.prefix());
+								}
+							} else {
+								append_name(m_key, reader);
+							}
+							member(m_key);
+							m_pending.push_back(reader.text());
+							write_pending();
+							break;
+						case NbfxNodeType::Text:
+							if (m_in_string) {
+								append_item(reader.text());
+								break;
+							}
+							m_pending.push_back(reader.text());
+							m_pending_size += static_cast<size_t>(reader.position() - reader.record_begin());
+							if (m_pending_size >= NbfxTextOutput::flush_threshold) {
+								start_string(reader.record_begin());
+							}
+							break;
+						case NbfxNodeType::EndElement:
+							end_element();
+							flush_if_full();
+							break;
+						default:
+							break;
+					}
+				}
+				return reader.position();
+			}
+
+		private:
+			struct Frame {
+				// element record of the last child, children with equal records have equal names
+				std::string_view last_child;
+				// offset of the last child value in the output while it may still become an array item
+				size_t value_start = 0;
+				bool candidate = false;
+				bool object = false;
+				bool members = false;
+				bool array = false;
+			};
+
+			Frame &top() noexcept {
+				return m_frames[m_depth - 1];
+			}
+
+			void member(std::string_view key) {
+				auto &frame = top();
+				if (frame.members) {
+					m_out += ',';
+				}
+				frame.members = true;
+				m_out += '"';
+				appendJsonEscaped(m_out, key);
+				m_out += "\":";
+			}
+
+			void close_array(Frame &frame) {
+				if (frame.array) {
+					m_out += ']';
+					frame.array = false;
+				}
+				frame.candidate = false;
+			}
+
+			/**
+			 * Measures past the last child of the frame to find out if it starts an array
+			 */
+			void resolve(size_t depth) {
+				auto &frame = m_frames[depth];
+				const auto record = frame.last_child;
+				const auto next = nextSibling(reinterpret_cast<const uint8_t *>(record.data()));
+				if (IsElement(static_cast<NbfxRecordType>(*next)) &&
+				    measureRecord(next, record.size()) == record.size() &&
+				    std::memcmp(next, record.data(), record.size()) == 0) {
+					m_out.insert(frame.value_start, 1, '[');
+					frame.array = true;
+					for (auto i = depth + 1; i < m_depth; ++i) {
+						++m_frames[i].value_start;
+					}
+				}
+				frame.candidate = false;
+			}
+
+			/**
+			 * Flushes the output up to the first value that may still become an array item
+			 */
+			void flush_if_full() {
+				constexpr auto threshold = NbfxTextOutput::flush_threshold;
+				if (m_out.size() < threshold) {
+					return;
+				}
+
+				auto keep = m_out.size();
+				for (size_t i = 0; i < m_depth; ++i) {
+					const auto &frame = m_frames[i];
+					if (!frame.candidate) {
+						continue;
+					}
+					if (m_out.size() - frame.value_start >= threshold) {
+						resolve(i);
+					} else {
+						keep = std::min(keep, frame.value_start);
+					}
+				}
+
+				const auto flushed = m_output.flush(keep);
+				for (size_t i = 0; i < m_depth; ++i) {
+					m_frames[i].value_start -= std::min(m_frames[i].value_start, flushed);
+				}
+			}
+
+			void open_object() {
+				auto &frame = top();
+				if (!frame.object) {
+					frame.object = true;
+					m_out += '{';
+				}
+			}
+
+			void start_element(const NbfxReader<const uint8_t *> &reader) {
+				const auto record = std::string_view(reinterpret_cast<const char *>(reader.record_begin()),
+				                                     static_cast<size_t>(reader.position() - reader.record_begin()));
+
+				if (m_depth == 0) {
+					m_out += '{';
+					m_out += '"';
+					m_key.clear();
+					append_name(m_key, reader);
+					appendJsonEscaped(m_out, m_key);
+					m_out += "\":";
+				} else {
+					open_object();
+					auto &parent = top();
+					if (m_in_string) {
+						end_string();
+					} else if (!m_pending.empty()) {
+						close_array(parent);
+						member(m_options.text_member);
+						write_pending();
+					}
+
+					if ((parent.array || parent.candidate) && parent.last_child == record) {
+						if (!parent.array) {
+							m_out.insert(parent.value_start, 1, '[');
+							parent.array = true;
+						}
+						parent.candidate = false;
+						m_out += ',';
+					} else {
+						close_array(parent);
+						m_key.clear();
+						append_name(m_key, reader);
+						member(m_key);
+						parent.candidate = m_options.arrays;
+						parent.value_start = m_out.size();
+					}
+					parent.last_child = record;
+				}
+
+				if (m_frames.size() == m_depth) {
+					m_frames.emplace_back();
+				}
+				m_frames[m_depth++] = Frame();
+			}
+
+			void end_element() {
+				auto &frame = top();
+				if (m_in_string) {
+					end_string();
+					if (frame.object) {
+						m_out += '}';
+					}
+				} else if (!frame.object) {
+					if (m_pending.empty()) {
+						m_out += "null";
+					} else {
+						write_pending();
+					}
+				} else {
+					close_array(frame);
+					if (!m_pending.empty()) {
+						member(m_options.text_member);
+						write_pending();
+					}
+					m_out += '}';
+				}
+
+				if (--m_depth == 0) {
+					m_out += '}';
+				}
+			}
+
+			void append_dictionary(std::string &out, uint32_t id) const {
+				if (m_options.dictionary) {
+					out.append(m_options.dictionary(id));
+				} else {
+					out += "D:";
+					appendNumber(out, id);
+				}
+			}
+
+			void append_name(std::string &out, const NbfxReader<const uint8_t *> &reader) const {
+				if (m_options.prefixes && !reader.prefix().empty()) {
+					out.append(reader.prefix());
+					out += ':';
+				}
+				if (reader.is_dictionary_name()) {
+					append_dictionary(out, reader.name_id());
+				} else {
+					out.append(reader.name());
+				}
+			}
+
+			/**
+			 * Writes held back text as one value, typed if it's a single record
+			 */
+			void write_pending() {
+				if (m_pending.size() == 1 && append_typed(m_pending.front())) {
+					m_pending.clear();
+					m_pending_size = 0;
+					return;
+				}
+
+				begin_string();
+				for (const auto &text : m_pending) {
+					append_item(text);
+				}
+				end_string();
+				m_pending.clear();
+				m_pending_size = 0;
+			}
+
+			/**
+			 * Writes held back text as a string which stays open for the rest of the element's text
+			 *
+			 * Records after the text record at record tell if it's the element value or the text member of an object.
+			 */
+			void start_string(const uint8_t *record) {
+				auto &frame = top();
+				if (frame.object || followedByElement(record)) {
+					open_object();
+					close_array(frame);
+					member(m_options.text_member);
+				}
+
+				begin_string();
+				for (const auto &text : m_pending) {
+					append_item(text);
+				}
+				m_pending.clear();
+				m_pending_size = 0;
+			}
+
+			void begin_string() {
+				m_out += '"';
+				m_carry_size = 0;
+				m_list = false;
+				m_first = true;
+				m_in_string = true;
+			}
+
+			void end_string() {
+				flush_bytes();
+				m_out += '"';
+				m_in_string = false;
+			}
+
+			/**
+			 * Writes one text record of a string, items of a list are separated by spaces
+			 */
+			void append_item(const NbfxTextView &text) {
+				const auto type = text.type();
+				if (type == NbfxRecordType::StartListText || type == NbfxRecordType::EndListText) {
+					m_list = type == NbfxRecordType::StartListText;
+					m_first = true;
+					return;
+				}
+				if (m_list && !m_first) {
+					m_out += ' ';
+				}
+				m_first = false;
+				append_string(text);
+			}
+
+			/**
+			 * Writes the text as a JSON number, boolean or string, returns false for list delimiters
+			 */
+			bool append_typed(const NbfxTextView &text) {
+				switch (text.type()) {
+					case NbfxRecordType::ZeroText:
+					case NbfxRecordType::OneText:
+					case NbfxRecordType::Int8Text:
+					case NbfxRecordType::Int16Text:
+					case NbfxRecordType::Int32Text:
+					case NbfxRecordType::Int64Text:
+						appendNumber(m_out, text.integer());
+						return true;
+					case NbfxRecordType::UInt64Text:
+						appendNumber(m_out, text.uint64());
+						return true;
+					case NbfxRecordType::TrueText:
+					case NbfxRecordType::FalseText:
+					case NbfxRecordType::BoolText:
+						m_out += text.boolean() ? "true" : "false";
+						return true;
+					case NbfxRecordType::FloatText:
+					case NbfxRecordType::DoubleText: {
+						const auto value = text.float_double();
+						if (value - value != 0) {
+							return false;
+						}
+						if (text.type() == NbfxRecordType::FloatText) {
+							appendNumber(m_out, text.float_single());
+						} else {
+							appendNumber(m_out, value);
+						}
+						return true;
+					}
+					case NbfxRecordType::StartListText:
+					case NbfxRecordType::EndListText:
+						return false;
+					default:
+						m_out += '"';
+						m_carry_size = 0;
+						append_string(text);
+						flush_bytes();
+						m_out += '"';
+						return true;
+				}
+			}
+
+			/**
+			 * Writes the text inside of a JSON string
+			 */
+			void append_string(const NbfxTextView &text) {
+				const auto type = text.type();
+				if (type != NbfxRecordType::Bytes8Text && type != NbfxRecordType::Bytes16Text &&
+				    type != NbfxRecordType::Bytes32Text) {
+					flush_bytes();
+				}
+
+				switch (type) {
+					case NbfxRecordType::EmptyText:
+						break;
+					case NbfxRecordType::Chars8Text:
+					case NbfxRecordType::Chars16Text:
+					case NbfxRecordType::Chars32Text:
+						append_chars(text.chars());
+						break;
+					case NbfxRecordType::UnicodeChars8Text:
+					case NbfxRecordType::UnicodeChars16Text:
+					case NbfxRecordType::UnicodeChars32Text:
+						m_scratch.clear();
+						appendUtf16(m_scratch, text.bytes());
+						append_chars(m_scratch);
+						break;
+					case NbfxRecordType::Bytes8Text:
+					case NbfxRecordType::Bytes16Text:
+					case NbfxRecordType::Bytes32Text:
+						append_bytes(text.bytes());
+						break;
+					case NbfxRecordType::DictionaryText:
+						m_scratch.clear();
+						append_dictionary(m_scratch, text.id());
+						appendJsonEscaped(m_out, m_scratch);
+						break;
+					case NbfxRecordType::ZeroText:
+					case NbfxRecordType::OneText:
+					case NbfxRecordType::Int8Text:
+					case NbfxRecordType::Int16Text:
+					case NbfxRecordType::Int32Text:
+					case NbfxRecordType::Int64Text:
+						appendNumber(m_out, text.integer());
+						break;
+					case NbfxRecordType::UInt64Text:
+						appendNumber(m_out, text.uint64());
+						break;
+					case NbfxRecordType::TrueText:
+					case NbfxRecordType::FalseText:
+					case NbfxRecordType::BoolText:
+						m_out += text.boolean() ? "true" : "false";
+						break;
+					case NbfxRecordType::FloatText:
+					case NbfxRecordType::DoubleText: {
+						const auto value = text.float_double();
+						if (value != value) {
+							m_out += "NaN";
+						} else if (value - value != 0) {
+							m_out += value > 0 ? "INF" : "-INF";
+						} else if (type == NbfxRecordType::FloatText) {
+							appendNumber(m_out, text.float_single());
+						} else {
+							appendNumber(m_out, value);
+						}
+						break;
+					}
+					case NbfxRecordType::DateTimeText:
+						appendDateTime(m_out, text.datetime());
+						break;
+					default:
+						m_scratch = utf_to_wstring.to_bytes(text.value().to_string());
+						appendJsonEscaped(m_out, m_scratch);
+						break;
+				}
+				flush_if_full();
+			}
+
+			/**
+			 * Escapes large text in slices, so the output is flushed in between
+			 *
+			 * An escape is at most six characters long, so a slice adds less than the flush threshold.
+			 */
+			void append_chars(std::string_view chars) {
+				constexpr auto slice = NbfxTextOutput::flush_threshold / 8;
+				for (size_t done = 0; done < chars.size(); done += slice) {
+					appendJsonEscaped(m_out, chars.substr(done, slice));
+					flush_if_full();
+				}
+			}
+
+			/**
+			 * Encodes bytes records in groups of three, so consecutive chunks of one value make one base64 string
+			 */
+			void append_bytes(NbfxBytesView bytes) {
+				auto data = bytes.data;
+				auto size = bytes.size;
+				while (m_carry_size && m_carry_size < 3 && size) {
+					m_carry[m_carry_size++] = *data++;
+					--size;
+				}
+				if (m_carry_size == 3) {
+					appendBase64(m_out, m_carry, 3);
+					m_carry_size = 0;
+				}
+
+				// large payloads are encoded in slices, so the output is flushed in between
+				constexpr size_t slice = NbfxTextOutput::flush_threshold / 4 * 3;
+				const auto whole = size / 3 * 3;
+				for (size_t done = 0; done < whole; done += slice) {
+					appendBase64(m_out, data + done, std::min(slice, whole - done));
+					flush_if_full();
+				}
+				for (auto i = whole; i < size; ++i) {
+					m_carry[m_carry_size++] = data[i];
+				}
+			}
+
+			void flush_bytes() {
+				if (m_carry_size) {
+					appendBase64(m_out, m_carry, m_carry_size);
+					m_carry_size = 0;
+				}
+			}
+
+			NbfxTextOutput &m_output;
+			std::string &m_out;
+			const NbfxJsonOptions &m_options;
+			// frames are reused, so memory depends on depth only
+			std::vector<Frame> m_frames;
+			size_t m_depth = 0;
+			std::vector<NbfxTextView> m_pending;
+			// encoded size of the held back records
+			size_t m_pending_size = 0;
+			// held back text has been written as a string that is still open
+			bool m_in_string = false;
+			bool m_list = false;
+			bool m_first = true;
+			std::string m_key;
+			std::string m_scratch;
+			uint8_t m_carry[3] = {};
+			size_t m_carry_size = 0;
+		};
+	}
+
+	/**
+	 * Appends the document at begin to out as JSON, returns position right after the document
+	 */
+	inline const uint8_t *to_json(const uint8_t *begin, std::string &out, const NbfxJsonOptions &options = {}) {
+		detail::NbfxTextOutput output(out);
+		return detail::NbfxJsonWriter(output, options).write(begin);
+	}
+
+	/**
+	 * Writes the document at begin to the stream as JSON, buffering at most about 64 KiB at a time
+	 */
+	inline const uint8_t *to_json(const uint8_t *begin, std::ostream &out, const NbfxJsonOptions &options = {}) {
+		std::string buffer;
+		detail::NbfxTextOutput output(buffer, &out);
+		const auto end = detail::NbfxJsonWriter(output, options).write(begin);
+		output.flush();
+		return end;
+	}
+
+	inline std::string to_json(const uint8_t *begin, const NbfxJsonOptions &options = {}) {
+		std::string out;
+		to_json(begin, out, options);
+		return out;
+	}
+}
@@ -0,0 +1,476 @@
+#pragma once
+
+#include "deserializer.hpp"
+#include "documents.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace nbfx {
+
+	namespace detail {
+		/**
+		 * Spins, then yields, then sleeps while a queue stays empty or full
+		 */
+		class NbfxBackoff {
+		public:
+			void wait() {
+				if (m_step < 64) {
+					++m_step;
+				} else if (m_step < 128) {
+					++m_step;
+					std::this_thread::yield();
+				} else {
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			}
+
+		private:
+			unsigned m_step = 0;
+		};
+
+		inline uint64_t nowNs() {
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+	}
+
+	/**
+	 * Bounded lock-free multi-producer, multi-consumer queue (Vyukov)
+	 *
+	 * push() and pop() wait with backoff while the queue is full or empty, pop() returns nothing
+	 * once the queue is closed and drained.
+	 */
+	template<typename T>
+	class NbfxMpmcQueue {
+	public:
+		explicit NbfxMpmcQueue(size_t capacity) {
+			size_t rounded = 2;
+			while (rounded < capacity) {
+				rounded *= 2;
+			}
+			m_mask = rounded - 1;
+			m_cells.reset(new Cell[rounded]);
+			for (size_t i = 0; i < rounded; ++i) {
+				m_cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		NbfxMpmcQueue(const NbfxMpmcQueue &) = delete;
+
+		NbfxMpmcQueue &operator=(const NbfxMpmcQueue &) = delete;
+
+		~NbfxMpmcQueue() {
+			while (try_pop()) {
+			}
+		}
+
+		size_t capacity() const noexcept {
+			return m_mask + 1;
+		}
+
+		/**
+		 * Returns approximate number of queued items
+		 */
+		size_t size() const noexcept {
+			const auto tail = m_dequeue.load(std::memory_order_relaxed);
+			const auto head = m_enqueue.load(std::memory_order_relaxed);
+			return head > tail ? head - tail : 0;
+		}
+
+		bool try_push(T &&value) {
+			auto pos = m_enqueue.load(std::memory_order_relaxed);
+			for (;;) {
+				auto &cell = m_cells[pos & m_mask];
+				const auto seq = cell.sequence.load(std::memory_order_acquire);
+				const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+				if (diff == 0) {
+					if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						new(cell.storage) T(std::move(value));
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = m_enqueue.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		std::optional<T> try_pop() {
+			auto pos = m_dequeue.load(std::memory_order_relaxed);
+			for (;;) {
+				auto &cell = m_cells[pos & m_mask];
+				const auto seq = cell.sequence.load(std::memory_order_acquire);
+				const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+				if (diff == 0) {
+					if (m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						auto item = reinterpret_cast<T *>(cell.storage);
+						std::optional<T> result(std::move(*item));
+						item->~T();
+						cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+						return result;
+					}
+				} else if (diff < 0) {
+					return std::nullopt;
+				} else {
+					pos = m_dequeue.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/**
+		 * Waits for space, returns false if the queue is closed
+		 */
+		bool push(T &&value) {
+			detail::NbfxBackoff backoff;
+			while (!m_closed.load(std::memory_order_acquire)) {
+				if (try_push(std::move(value))) {
+					return true;
+				}
+				backoff.wait();
+			}
+			return false;
+		}
+
+		/**
+		 * Waits for an item, returns nothing once the queue is closed and drained
+		 */
+		std::optional<T> pop() {
+			detail::NbfxBackoff backoff;
+			for (;;) {
+				if (auto item = try_pop()) {
+					return item;
+				}
+				if (m_closed.load(std::memory_order_acquire)) {
+					return try_pop();
+				}
+				backoff.wait();
+			}
+		}
+
+		/**
+		 * Waits for an item and takes up to max_items, returns false once the queue is closed and drained
+		 */
+		bool pop_batch(std::vector<T> &out, size_t max_items) {
+			auto first = pop();
+			if (!first) {
+				return false;
+			}
+			out.emplace_back(std::move(*first));
+			while (out.size() < max_items) {
+				auto item = try_pop();
+				if (!item) {
+					break;
+				}
+				out.emplace_back(std::move(*item));
+			}
+			return true;
+		}
+
+		void close() noexcept {
+			m_closed.store(true, std::memory_order_release);
+		}
+
+		bool closed() const noexcept {
+			return m_closed.load(std::memory_order_acquire);
+		}
+
+	private:
+		struct alignas(64) Cell {
+			std::atomic<size_t> sequence;
+			alignas(T) unsigned char storage[sizeof(T)];
+		};
+
+		std::unique_ptr<Cell[]> m_cells;
+		size_t m_mask;
+		alignas(64) std::atomic<size_t> m_enqueue{0};
+		alignas(64) std::atomic<size_t> m_dequeue{0};
+		alignas(64) std::atomic<bool> m_closed{false};
+	};
+
+	/**
+	 * Recycles message buffers between stages, keeping their capacity
+	 */
+	class NbfxBufferPool {
+	public:
+		explicit NbfxBufferPool(size_t buffers, size_t buffer_capacity = 0) :
+				m_free(buffers),
+				m_buffer_capacity(buffer_capacity) {}
+
+		std::vector<uint8_t> acquire() {
+			if (auto buffer = m_free.try_pop()) {
+				return std::move(*buffer);
+			}
+			std::vector<uint8_t> buffer;
+			buffer.reserve(m_buffer_capacity);
+			return buffer;
+		}
+
+		void release(std::vector<uint8_t> &&buffer) {
+			buffer.clear();
+			m_free.try_push(std::move(buffer));
+		}
+
+		size_t available() const noexcept {
+			return m_free.size();
+		}
+
+	private:
+		NbfxMpmcQueue<std::vector<uint8_t>> m_free;
+		size_t m_buffer_capacity;
+	};
+
+	struct NbfxPipelineOptions {
+		size_t queue_capacity = 1024;
+		unsigned parse_workers = std::max(1u, std::thread::hardware_concurrency());
+		unsigned handler_workers = 1;
+		size_t batch_size = 16;
+	};
+
+	/**
+	 * Snapshot of a stage: items waiting in its input queue, processed items and
+	 * time from entering the queue to being processed
+	 */
+	struct NbfxStageStats {
+		size_t queue_depth;
+		uint64_t processed;
+		uint64_t errors;
+		uint64_t total_latency_ns;
+		uint64_t max_latency_ns;
+
+		double mean_latency_ns() const noexcept {
+			return processed ? static_cast<double>(total_latency_ns) / static_cast<double>(processed) : 0.0;
+		}
+	};
+
+	struct NbfxPipelineStats {
+		uint64_t framed;
+		NbfxStageStats parse;
+		NbfxStageStats dispatch;
+	};
+
+	/**
+	 * Framing, parsing and dispatching stages connected by bounded queues
+	 *
+	 * The framer runs on its own thread and fills pooled buffers with one message each until it returns false.
+	 * Parse workers turn buffers into trees and hand the buffers back to the pool, handler workers consume the trees.
+	 * Full queues block the stage before them. Failed parses and throwing handlers are counted as stage errors
+	 * and reported to the error callback.
+	 */
+	class NbfxPipeline {
+	public:
+		using framer = std::function<bool(std::vector<uint8_t> &buffer)>;
+		using handler = std::function<void(NbfxElement &&element)>;
+		using error_handler = std::function<void(std::exception_ptr error)>;
+
+		NbfxPipeline(framer frame, handler handle, NbfxPipelineOptions options = {}, error_handler on_error = {}) :
+				m_frame(std::move(frame)),
+				m_handle(std::move(handle)),
+				m_on_error(std::move(on_error)),
+				m_options(options),
+				m_pool(options.queue_capacity * 2),
+				m_framed(options.queue_capacity),
+				m_parsed(options.queue_capacity) {
+			m_options.parse_workers = std::max(1u, m_options.parse_workers);
+			m_options.handler_workers = std::max(1u, m_options.handler_workers);
+			m_options.batch_size = std::max<size_t>(1, m_options.batch_size);
+		}
+
+		NbfxPipeline(const NbfxPipeline &) = delete;
+
+		NbfxPipeline &operator=(const NbfxPipeline &) = delete;
+
+		~NbfxPipeline() {
+			stop();
+			wait();
+		}
+
+		void start() {
+			if (!m_threads.empty()) {
+				throw std::logic_error("pipeline already started");
+			}
+
+			m_parsers_left.store(m_options.parse_workers);
+			m_threads.emplace_back([this]() { frame_stage(); });
+			for (auto i = 0u; i < m_options.parse_workers; ++i) {
+				m_threads.emplace_back([this]() { parse_stage(); });
+			}
+			for (auto i = 0u; i < m_options.handler_workers; ++i) {
+				m_threads.emplace_back([this]() { dispatch_stage(); });
+			}
+		}
+
+		/**
+		 * Waits until the framer is exhausted and every message is handled
+		 */
+		void wait() {
+			for (auto &thread : m_threads) {
+				if (thread.joinable()) {
+					thread.join();
+				}
+			}
+		}
+
+		void run() {
+			start();
+			wait();
+		}
+
+		/**
+		 * Stops framing, messages already framed are still handled
+		 */
+		void stop() noexcept {
+			m_stopping.store(true, std::memory_order_release);
+		}
+
+		NbfxPipelineStats stats() const noexcept {
+			return {
+					m_framed_count.load(std::memory_order_relaxed),
+					m_parse_counters.snapshot(m_framed.size()),
+					m_dispatch_counters.snapshot(m_parsed.size())
+			};
+		}
+
+	private:
+		struct Framed {
+			std::vector<uint8_t> buffer;
+			uint64_t enqueued_ns;
+		};
+
+		struct Parsed {
+			NbfxElement element;
+			uint64_t enqueued_ns;
+		};
+
+		struct Counters {
+			std::atomic<uint64_t> processed{0};
+			std::atomic<uint64_t> errors{0};
+			std::atomic<uint64_t> total_latency_ns{0};
+			std::atomic<uint64_t> max_latency_ns{0};
+
+			void record(uint64_t enqueued_ns) noexcept {
+				const auto latency = detail::nowNs() - enqueued_ns;
+				processed.fetch_add(1, std::memory_order_relaxed);
+				total_latency_ns.fetch_add(latency, std::memory_order_relaxed);
+				auto max = max_latency_ns.load(std::memory_order_relaxed);
+				while (latency > max && !max_latency_ns.compare_exchange_weak(max, latency, std::memory_order_relaxed)) {
+				}
+			}
+
+			NbfxStageStats snapshot(size_t depth) const noexcept {
+				return {
+						depth,
+						processed.load(std::memory_order_relaxed),
+						errors.load(std::memory_order_relaxed),
+						total_latency_ns.load(std::memory_order_relaxed),
+						max_latency_ns.load(std::memory_order_relaxed)
+				};
+			}
+		};
+
+		void report(Counters &counters) noexcept {
+			counters.errors.fetch_add(1, std::memory_order_relaxed);
+			if (m_on_error) {
+				try {
+					m_on_error(std::current_exception());
+				} catch (...) {
+				}
+			}
+		}
+
+		void frame_stage() {
+			try {
+				while (!m_stopping.load(std::memory_order_acquire)) {
+					auto buffer = m_pool.acquire();
+					if (!m_frame(buffer)) {
+						break;
+					}
+					m_framed_count.fetch_add(1, std::memory_order_relaxed);
+					if (!m_framed.push(Framed{std::move(buffer), detail::nowNs()})) {
+						break;
+					}
+				}
+			} catch (...) {
+				report(m_parse_counters);
+			}
+			m_framed.close();
+		}
+
+		void parse_stage() {
+			std::vector<Framed> batch;
+			batch.reserve(m_options.batch_size);
+
+			while (m_framed.pop_batch(batch, m_options.batch_size)) {
+				for (auto &item : batch) {
+					try {
+						if (item.buffer.empty()) {
+							throw std::invalid_argument("empty message");
+						}
+						// buffers come from the peer, the document has to end exactly where the message does
+						const auto data = item.buffer.data();
+						if (find_document_end(data, data + item.buffer.size()) != data + item.buffer.size()) {
+							throw std::invalid_argument("trailing data after document");
+						}
+						auto element = parse(data);
+						m_parse_counters.record(item.enqueued_ns);
+						m_parsed.push(Parsed{std::move(element), detail::nowNs()});
+					} catch (...) {
+						report(m_parse_counters);
+					}
+					m_pool.release(std::move(item.buffer));
+				}
+				batch.clear();
+			}
+
+			if (m_parsers_left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				m_parsed.close();
+			}
+		}
+
+		void dispatch_stage() {
+			std::vector<Parsed> batch;
+			batch.reserve(m_options.batch_size);
+
+			while (m_parsed.pop_batch(batch, m_options.batch_size)) {
+				for (auto &item : batch) {
+					try {
+						m_handle(std::move(item.element));
+						m_dispatch_counters.record(item.enqueued_ns);
+					} catch (...) {
+						report(m_dispatch_counters);
+					}
+				}
+				batch.clear();
+			}
+		}
+
+		framer m_frame;
+		handler m_handle;
+		error_handler m_on_error;
+		NbfxPipelineOptions m_options;
+
+		NbfxBufferPool m_pool;
+		NbfxMpmcQueue<Framed> m_framed;
+		NbfxMpmcQueue<Parsed> m_parsed;
+		std::vector<std::thread> m_threads;
+
+		std::atomic<bool> m_stopping{false};
+		std::atomic<unsigned> m_parsers_left{0};
+		std::atomic<uint64_t> m_framed_count{0};
+		Counters m_parse_counters;
+		Counters m_dispatch_counters;
+	};
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "deserializer.hpp"
+#include "reader.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace nbfx {
+
+	/**
+	 * Limits parse enforces on untrusted input, each record is checked before anything is allocated for it
+	 *
+	 * Exceeding a limit throws std::length_error.
+	 */
+	struct NbfxReaderQuotas {
+		// nesting of elements, the topmost element is at depth 1
+		size_t max_depth = 64;
+		// longest name, prefix or Chars payload in encoded bytes
+		size_t max_string_length = 1024 * 1024;
+		// bytes of one value, including consecutive chunks and chunks offered to a sink
+		size_t max_bytes_length = 64 * 1024 * 1024;
+		// element and attribute names in the document
+		size_t max_name_count = 64 * 1024;
+		// estimate of memory the tree takes, an upper bound based on record sizes
+		size_t max_memory = 256 * 1024 * 1024;
+
+		/**
+		 * Quotas that don't limit anything
+		 */
+		static constexpr NbfxReaderQuotas max() noexcept {
+			return NbfxReaderQuotas{SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX};
+		}
+	};
+
+	namespace detail {
+		/**
+		 * Checks records against quotas and keeps the document totals, reset() starts the next document
+		 */
+		class NbfxQuotaGuard {
+		public:
+			explicit NbfxQuotaGuard(const NbfxReaderQuotas &quotas) noexcept : m_quotas(quotas) {}
+
+			template<typename TIter>
+			void before_record(const TIter &p, const std::vector<NbfxElement> &stack) {
+				const auto raw = static_cast<uint8_t>(*p);
+				const auto type = static_cast<NbfxRecordType>(raw);
+
+				// lengths are read through the iterator, the input doesn't have to be contiguous
+				NbfxRecordMeasure<TIter> m(p, SIZE_MAX);
+				const auto size = measureRecord(m);
+
+				check_string(m.longest_string());
+
+				if (IsElement(type) || IsAttribute(type)) {
+					if (IsElement(type) && stack.size() >= m_quotas.max_depth) {
+						throw std::length_error("element depth exceeds max_depth quota");
+					}
+					if (++m_names > m_quotas.max_name_count) {
+						throw std::length_error("names exceed max_name_count quota");
+					}
+					charge((IsElement(type) ? sizeof(NbfxElement) : sizeof(NbfxAttribute)) + size * sizeof(wchar_t));
+				}
+				else if (isBytesRecord(type)) {
+					before_bytes(size - 1 - textLayout(type).length_size, (raw & 1u) == 1u);
+					return;
+				}
+				else if (IsTextRecord(type)) {
+					charge(size * sizeof(wchar_t));
+				}
+				m_value_bytes = 0;
+			}
+
+			/**
+			 * Checks a name, prefix or Chars length, callable as soon as the length prefix is read
+			 */
+			void check_string(size_t length) const {
+				if (length > m_quotas.max_string_length) {
+					throw std::length_error("string exceeds max_string_length quota");
+				}
+			}
+
+			/**
+			 * Checks payload of a Chars record read outside of before_record
+			 */
+			void before_text(size_t length) {
+				check_string(length);
+				charge(length * sizeof(wchar_t));
+				m_value_bytes = 0;
+			}
+
+			void reset() noexcept {
+				m_names = 0;
+				m_memory = 0;
+				m_value_bytes = 0;
+			}
+
+			/**
+			 * Checks payload of a bytes record, consecutive records are chunks of one value whether
+			 * they're kept or consumed by a sink
+			 */
+			void before_bytes(size_t length, bool with_end) {
+				if (length > m_quotas.max_bytes_length - m_value_bytes) {
+					throw std::length_error("bytes exceed max_bytes_length quota");
+				}
+				charge(length);
+				m_value_bytes = with_end ? 0 : m_value_bytes + length;
+			}
+
+		private:
+			void charge(size_t size) {
+				if (size > m_quotas.max_memory - m_memory) {
+					throw std::length_error("document exceeds max_memory quota");
+				}
+				m_memory += size;
+			}
+
+			NbfxReaderQuotas m_quotas;
+			size_t m_names = 0;
+			size_t m_memory = 0;
+			// bytes of the value the current bytes records belong to
+			size_t m_value_bytes = 0;
+		};
+	}
+
+	/**
+	 * Parses the document rejecting it as soon as a record exceeds the quotas
+	 */
+	template<typename TIter>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1, NbfxElement>
+	parse(TIter p, const NbfxReaderQuotas &quotas) {
+		NbfxNullSink sink;
+		NbfxNoHooks hooks;
+		detail::NbfxQuotaGuard guard(quotas);
+		return detail::parseDocument(p, sink, hooks, guard);
+	}
+
+	/**
+	 * Parses the document with a sink like parse(p, sink) and enforces the quotas
+	 */
+	template<typename TIter, typename TSink>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1 && !is_hooks_v<TSink>, NbfxElement>
+	parse(TIter p, TSink &sink, const NbfxReaderQuotas &quotas) {
+		NbfxNoHooks hooks;
+		detail::NbfxQuotaGuard guard(quotas);
+		return detail::parseDocument(p, sink, hooks, guard);
+	}
+
+	/**
+	 * Parses the document enforcing the quotas and moves p past its last record
+	 */
+	template<typename TIter>
+	std::enable_if_t<sizeof(typename std::iterator_traits<TIter>::value_type) == 1, NbfxElement>
+	parse_next(TIter &p, const NbfxReaderQuotas &quotas) {
+		NbfxNullSink sink;
+		NbfxNoHooks hooks;
+		detail::NbfxQuotaGuard guard(quotas);
+		return detail::parseDocument(p, sink, hooks, guard);
+	}
+}
@@ -0,0 +1,759 @@
+#pragma once
+
+#include "NbfxRecord.hpp"
+#include "NbfxValue.hpp"
+#include "deserializer.hpp"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace nbfx {
+
+	enum struct NbfxNodeType {
+		None,
+		Element,
+		Attribute,
+		Text,
+		EndElement
+	};
+
+	/**
+	 * Non-owning view of a bytes payload
+	 */
+	struct NbfxBytesView {
+		const uint8_t *data;
+		size_t size;
+	};
+
+	namespace detail {
+		constexpr char prefix_letters[] = "abcdefghijklmnopqrstuvwxyz";
+
+		template<typename T>
+		T load(const uint8_t *p) noexcept {
+			T result;
+			std::memcpy(&result, p, sizeof(T));
+			return result;
+		}
+
+		/**
+		 * Payload layout of a text record: fixed size, width of the length prefix or MultiByteInt31 id
+		 */
+		struct NbfxTextLayout {
+			uint8_t fixed;
+			uint8_t length_size;
+			bool id;
+			bool valid;
+		};
+
+		constexpr NbfxTextLayout textLayout(NbfxRecordType type) noexcept {
+			switch (static_cast<NbfxRecordType>(static_cast<uint8_t>(type) & 0xFEu)) {
+				case NbfxRecordType::ZeroText:
+				case NbfxRecordType::OneText:
+				case NbfxRecordType::FalseText:
+				case NbfxRecordType::TrueText:
+				case NbfxRecordType::EmptyText:
+				case NbfxRecordType::StartListText:
+				case NbfxRecordType::EndListText:
+					return {0, 0, false, true};
+				case NbfxRecordType::Int8Text:
+				case NbfxRecordType::BoolText:
+					return {1, 0, false, true};
+				case NbfxRecordType::Int16Text:
+					return {2, 0, false, true};
+				case NbfxRecordType::Int32Text:
+				case NbfxRecordType::FloatText:
+				case NbfxRecordType::QNameDictionaryText:
+					return {4, 0, false, true};
+				case NbfxRecordType::Int64Text:
+				case NbfxRecordType::UInt64Text:
+				case NbfxRecordType::DoubleText:
+				case NbfxRecordType::DateTimeText:
+				case NbfxRecordType::TimeSpanText:
+					return {8, 0, false, true};
+				case NbfxRecordType::DecimalText:
+				case NbfxRecordType::UniqueIdText:
+				case NbfxRecordType::UuidText:
+					return {16, 0, false, true};
+				case NbfxRecordType::Chars8Text:
+				case NbfxRecordType::Bytes8Text:
+				case NbfxRecordType::UnicodeChars8Text:
+					return {0, 1, false, true};
+				case NbfxRecordType::Chars16Text:
+				case NbfxRecordType::Bytes16Text:
+				case NbfxRecordType::UnicodeChars16Text:
+					return {0, 2, false, true};
+				case NbfxRecordType::Chars32Text:
+				case NbfxRecordType::Bytes32Text:
+				case NbfxRecordType::UnicodeChars32Text:
+					return {0, 4, false, true};
+				case NbfxRecordType::DictionaryText:
+					return {0, 0, true, true};
+				default:
+					return {0, 0, false, false};
+			}
+		}
+
+		[[noreturn]] inline void throw_unexpected_record(uint8_t type) {
+			std::ostringstream ss;
+			ss << "unexpected record type 0x"
+			   << std::uppercase
+			   << std::setfill('0')
+			   << std::setw(2)
+			   << std::hex
+			   << static_cast<int>(type);
+
+			throw std::invalid_argument(ss.str());
+		}
+
+		/**
+		 * Walks a record in a partially available buffer, bytes are read through a random access iterator
+		 */
+		template<typename TIter = const uint8_t *>
+		class NbfxRecordMeasure {
+		public:
+			NbfxRecordMeasure(TIter p, size_t available) : m_p(p), m_available(available) {}
+
+			size_t position() const noexcept {
+				return m_pos;
+			}
+
+			bool byte(uint8_t &out) {
+				if (m_pos >= m_available) {
+					return false;
+				}
+				out = at(m_pos++);
+				return true;
+			}
+
+			bool skip(size_t size) {
+				if (m_available - m_pos < size) {
+					return false;
+				}
+				m_pos += size;
+				return true;
+			}
+
+			bool uint31(uint32_t &out) {
+				out = 0;
+				for (auto i = 0u; i < 5u; ++i) {
+					uint8_t b;
+					if (!byte(b)) {
+						return false;
+					}
+					out |= static_cast<uint32_t>(b & 0x7Fu) << (7u * i);
+					if (!(b & 0x80u)) {
+						return true;
+					}
+				}
+				throw std::invalid_argument("invalid MultiByteInt31");
+			}
+
+			/**
+			 * Longest string or Chars payload walked so far, in encoded bytes
+			 */
+			size_t longest_string() const noexcept {
+				return m_longest_string;
+			}
+
+			void rewind() noexcept {
+				m_pos = 0;
+			}
+
+			bool string() {
+				uint32_t length;
+				if (!uint31(length)) {
+					return false;
+				}
+				m_longest_string = std::max<size_t>(m_longest_string, length);
+				return skip(length);
+			}
+
+			bool name(bool dictionary) {
+				uint32_t id;
+				return dictionary ? uint31(id) : string();
+			}
+
+			bool text() {
+				uint8_t raw;
+				if (!byte(raw)) {
+					return false;
+				}
+
+				const auto layout = textLayout(static_cast<NbfxRecordType>(raw));
+				if (!layout.valid) {
+					throw_unexpected_record(raw);
+				}
+
+				size_t size = layout.fixed;
+				if (layout.length_size) {
+					if (m_available - m_pos < layout.length_size) {
+						return false;
+					}
+					size = 0;
+					for (auto i = 0u; i < layout.length_size; ++i) {
+						size |= static_cast<size_t>(at(m_pos + i)) << (8u * i);
+					}
+					m_pos += layout.length_size;
+					if (!isBytesRecord(static_cast<NbfxRecordType>(raw))) {
+						m_longest_string = std::max(m_longest_string, size);
+					}
+				}
+
+				uint32_t id;
+				return (!layout.id || uint31(id)) && skip(size);
+			}
+
+		private:
+			uint8_t at(size_t pos) const {
+				return static_cast<uint8_t>(m_p[static_cast<typename std::iterator_traits<TIter>::difference_type>(pos)]);
+			}
+
+			TIter m_p;
+			size_t m_available;
+			size_t m_pos = 0;
+			size_t m_longest_string = 0;
+		};
+
+		/**
+		 * Returns size of the record m starts at, or 0 if more than available bytes are needed to tell
+		 */
+		template<typename TIter>
+		size_t measureRecord(NbfxRecordMeasure<TIter> &m) {
+			uint8_t raw;
+			if (!m.byte(raw)) {
+				return 0;
+			}
+
+			const auto type = static_cast<NbfxRecordType>(raw);
+			bool complete;
+
+			if (IsElement(type)) {
+				const bool prefixed = type == NbfxRecordType::Element || type == NbfxRecordType::DictionaryElement;
+				const bool dictionary =
+						type == NbfxRecordType::ShortDictionaryElement ||
+						type == NbfxRecordType::DictionaryElement ||
+						(type >= NbfxRecordType::PrefixDictionaryElementA && type <= NbfxRecordType::PrefixDictionaryElementZ);
+				complete = (!prefixed || m.string()) && m.name(dictionary);
+			} else if (type >= NbfxRecordType::PrefixAttributeA && type <= NbfxRecordType::PrefixAttributeZ) {
+				complete = m.string() && m.text();
+			} else if (type >= NbfxRecordType::PrefixDictionaryAttributeA && type <= NbfxRecordType::PrefixDictionaryAttributeZ) {
+				complete = m.name(true) && m.text();
+			} else if (IsAttribute(type)) {
+				const bool prefixed = (raw & 1u) == 1u;
+				const bool dictionary = (raw & 2u) == 2u;
+				const bool xmlns = type >= NbfxRecordType::ShortXmlnsAttribute;
+				complete = (!prefixed || m.string()) && m.name(dictionary) && (xmlns || m.text());
+			} else if (IsTextRecord(type)) {
+				m.rewind();
+				complete = m.text();
+			} else if (type == NbfxRecordType::EndElement) {
+				complete = true;
+			} else if (type == NbfxRecordType::Comment) {
+				complete = m.string();
+			} else {
+				throw_unexpected_record(raw);
+			}
+
+			return complete ? m.position() : 0;
+		}
+
+		/**
+		 * Returns size of the record at p, or 0 if more than available bytes are needed to tell
+		 */
+		inline size_t measureRecord(const uint8_t *p, size_t available) {
+			NbfxRecordMeasure m(p, available);
+			return measureRecord(m);
+		}
+	}
+
+	/**
+	 * Non-owning view of a decoded text record
+	 *
+	 * Namespace declarations are reported as Chars32Text or DictionaryText without record.
+	 */
+	class NbfxTextView {
+	public:
+		/**
+		 * Text record type without end element flag
+		 */
+		NbfxRecordType type() const noexcept {
+			return m_type;
+		}
+
+		/**
+		 * The whole text record, nullptr for namespace declarations
+		 */
+		const uint8_t *record() const noexcept {
+			return m_record;
+		}
+
+		/**
+		 * UTF-8 text of Chars*Text records and namespace declarations
+		 */
+		std::string_view chars() const {
+			switch (m_type) {
+				case NbfxRecordType::Chars8Text:
+				case NbfxRecordType::Chars16Text:
+				case NbfxRecordType::Chars32Text:
+				case NbfxRecordType::EmptyText:
+					return {reinterpret_cast<const char *>(m_data), m_size};
+				default:
+					throw std::runtime_error("Invalid value type, expected Chars");
+			}
+		}
+
+		/**
+		 * Payload of Bytes*Text records, UTF-16LE payload of UnicodeChars*Text records
+		 */
+		NbfxBytesView bytes() const {
+			switch (m_type) {
+				case NbfxRecordType::Bytes8Text:
+				case NbfxRecordType::Bytes16Text:
+				case NbfxRecordType::Bytes32Text:
+				case NbfxRecordType::UnicodeChars8Text:
+				case NbfxRecordType::UnicodeChars16Text:
+				case NbfxRecordType::UnicodeChars32Text:
+				case NbfxRecordType::EmptyText:
+					return {m_data, m_size};
+				default:
+					throw std::runtime_error("Invalid value type, expected Bytes");
+			}
+		}
+
+		int64_t integer() const {
+			switch (m_type) {
+				case NbfxRecordType::ZeroText:
+					return 0;
+				case NbfxRecordType::OneText:
+					return 1;
+				case NbfxRecordType::Int8Text:
+					return detail::load<int8_t>(m_data);
+				case NbfxRecordType::Int16Text:
+					return detail::load<int16_t>(m_data);
+				case NbfxRecordType::Int32Text:
+					return detail::load<int32_t>(m_data);
+				case NbfxRecordType::Int64Text:
+					return detail::load<int64_t>(m_data);
+				default:
+					throw std::runtime_error("Invalid value type, expected Integer");
+			}
+		}
+
+		uint64_t uint64() const {
+			if (m_type == NbfxRecordType::UInt64Text) {
+				return detail::load<uint64_t>(m_data);
+			}
+			return static_cast<uint64_t>(integer());
+		}
+
+		bool boolean() const {
+			switch (m_type) {
+				case NbfxRecordType::FalseText:
+					return false;
+				case NbfxRecordType::TrueText:
+					return true;
+				case NbfxRecordType::BoolText:
+					return *m_data != 0;
+				default:
+					throw std::runtime_error("Invalid value type, expected Boolean");
+			}
+		}
+
+		float float_single() const {
+			if (m_type != NbfxRecordType::FloatText) {
+				throw std::runtime_error("Invalid value type, expected Float");
+			}
+			return detail::load<float>(m_data);
+		}
+
+		double float_double() const {
+			switch (m_type) {
+				case NbfxRecordType::FloatText:
+					return detail::load<float>(m_data);
+				case NbfxRecordType::DoubleText:
+					return detail::load<double>(m_data);
+				default:
+					throw std::runtime_error("Invalid value type, expected Double");
+			}
+		}
+
+		datetime_t datetime() const {
+			if (m_type != NbfxRecordType::DateTimeText) {
+				throw std::runtime_error("Invalid value type, expected DateTime");
+			}
+			auto p = m_data;
+			return detail::parseDateTime(p);
+		}
+
+		/**
+		 * Dictionary id of DictionaryText value
+		 */
+		uint32_t id() const {
+			if (m_type != NbfxRecordType::DictionaryText) {
+				throw std::runtime_error("Invalid value type, expected DictionaryText");
+			}
+			return m_id;
+		}
+
+		/**
+		 * Decodes the text the same way parse does
+		 */
+		NbfxValue value() const {
+			if (!m_record) {
+				if (m_type == NbfxRecordType::DictionaryText) {
+					return L"D:" + std::to_wstring(m_id);
+				}
+				const auto chars = reinterpret_cast<const char *>(m_data);
+				return detail::utf_to_wstring.from_bytes(chars, chars + m_size);
+			}
+			auto p = m_record;
+			return detail::parseValue(p);
+		}
+
+		/**
+		 * Decodes text record at p and advances p past it, returns true if the record has end element flag
+		 */
+		bool decode(const uint8_t *&p) {
+			m_record = p;
+			const auto raw = *p++;
+			const auto type = static_cast<NbfxRecordType>(raw & 0xFEu);
+			const auto layout = detail::textLayout(type);
+			size_t size = layout.fixed;
+
+			switch (layout.length_size) {
+				case 1:
+					size = *p++;
+					break;
+				case 2:
+					size = detail::load<uint16_t>(p);
+					p += 2;
+					break;
+				case 4:
+					size = detail::load<uint32_t>(p);
+					p += 4;
+					break;
+				default:
+					break;
+			}
+
+			if (!layout.valid) {
+				detail::throw_unexpected_record(raw);
+			}
+			if (layout.id) {
+				m_id = static_cast<uint32_t>(detail::parseMultiByteInt21(p));
+			}
+
+			m_type = type;
+			m_data = size ? p : nullptr;
+			m_size = size;
+			p += size;
+
+			return (raw & 1u) && type != NbfxRecordType::StartListText && type != NbfxRecordType::EndListText;
+		}
+
+		/**
+		 * Sets the view to a namespace declaration value
+		 */
+		void assign_xmlns(std::string_view chars) noexcept {
+			m_record = nullptr;
+			m_type = NbfxRecordType::Chars32Text;
+			m_data = reinterpret_cast<const uint8_t *>(chars.data());
+			m_size = chars.size();
+		}
+
+		void assign_xmlns(uint32_t id) noexcept {
+			m_record = nullptr;
+			m_type = NbfxRecordType::DictionaryText;
+			m_data = nullptr;
+			m_size = 0;
+			m_id = id;
+		}
+
+	private:
+		NbfxRecordType m_type = NbfxRecordType::EmptyText;
+		const uint8_t *m_record = nullptr;
+		const uint8_t *m_data = nullptr;
+		size_t m_size = 0;
+		uint32_t m_id = 0;
+	};
+
+	/**
+	 * Forward-only pull reader over NBFX records of a single document
+	 *
+	 * Unlike parse it builds nothing: names and payloads are views into the input, so the input
+	 * has to be contiguous and outlive the views. Attributes are reported as separate nodes after
+	 * their element, text record with end element is reported as Text node followed by EndElement node.
+	 */
+	template<typename TIter>
+	class NbfxReader {
+	public:
+		explicit NbfxReader(TIter p) : m_p(p), m_record_begin(p) {}
+
+		/**
+		 * Advances to the next node, returns false after the end of the topmost element
+		 */
+		bool read() {
+			if (m_pending_end) {
+				m_pending_end = false;
+				m_record_begin = m_p;
+				return end_element();
+			}
+
+			if (m_node_type == NbfxNodeType::EndElement && m_depth == 0) {
+				m_node_type = NbfxNodeType::None;
+				return false;
+			}
+
+			if (m_node_type == NbfxNodeType::None && m_depth == 0 && m_started) {
+				return false;
+			}
+
+			for (;;) {
+				m_record_begin = m_p;
+				const auto raw = static_cast<uint8_t>(*m_p);
+				const auto type = static_cast<NbfxRecordType>(raw);
+
+				if (!m_started && !IsElement(type)) {
+					throw std::invalid_argument("expected element as a topmost node");
+				}
+
+				if (IsElement(type)) {
+					m_started = true;
+					read_element();
+					++m_depth;
+					m_node_type = NbfxNodeType::Element;
+					return true;
+				} else if (IsAttribute(type)) {
+					read_attribute();
+					m_node_type = NbfxNodeType::Attribute;
+					return true;
+				} else if (IsTextRecord(type)) {
+					m_pending_end = read_text();
+					m_record_type = m_text.type();
+					m_node_type = NbfxNodeType::Text;
+					return true;
+				} else if (type == NbfxRecordType::EndElement) {
+					++m_p;
+					return end_element();
+				} else if (type == NbfxRecordType::Comment) {
+					++m_p;
+					read_chars();
+				} else {
+					detail::throw_unexpected_record(raw);
+				}
+			}
+		}
+
+		/**
+		 * Skips the current element with all its content, the current node becomes its EndElement
+		 *
+		 * Does nothing for other node types.
+		 */
+		void skip() {
+			if (m_node_type != NbfxNodeType::Element) {
+				return;
+			}
+
+			const auto depth = m_depth - 1;
+			while (read()) {
+				if (m_node_type == NbfxNodeType::EndElement && m_depth == depth) {
+					return;
+				}
+			}
+		}
+
+		NbfxNodeType node_type() const noexcept {
+			return m_node_type;
+		}
+
+		/**
+		 * Record type of the current node, text records are reported without end element flag
+		 */
+		NbfxRecordType record_type() const noexcept {
+			return m_record_type;
+		}
+
+		/**
+		 * Number of open elements, the current element included
+		 */
+		size_t depth() const noexcept {
+			return m_depth;
+		}
+
+		/**
+		 * Position of the current record; EndElement produced by a text record has empty record
+		 */
+		TIter record_begin() const {
+			return m_record_begin;
+		}
+
+		/**
+		 * Position right after the current record
+		 */
+		TIter position() const {
+			return m_p;
+		}
+
+		/**
+		 * UTF-8 prefix of the current element or attribute
+		 */
+		std::string_view prefix() const noexcept {
+			return m_prefix;
+		}
+
+		/**
+		 * UTF-8 name of the current element or attribute, empty for dictionary names
+		 */
+		std::string_view name() const noexcept {
+			return m_name;
+		}
+
+		bool is_dictionary_name() const noexcept {
+			return m_dictionary_name;
+		}
+
+		uint32_t name_id() const noexcept {
+			return m_name_id;
+		}
+
+		/**
+		 * Checks if the current attribute is a namespace declaration, its value is the namespace
+		 */
+		bool is_xmlns() const noexcept {
+			return m_node_type == NbfxNodeType::Attribute &&
+				   m_record_type >= NbfxRecordType::ShortXmlnsAttribute &&
+				   m_record_type <= NbfxRecordType::DictionaryXmlnsAttribute;
+		}
+
+		/**
+		 * Text of the current Text node or value of the current Attribute node
+		 */
+		const NbfxTextView &text() const noexcept {
+			return m_text;
+		}
+
+	private:
+		const uint8_t *ptr() const {
+			return reinterpret_cast<const uint8_t *>(&*m_p);
+		}
+
+		uint32_t read_uint31() {
+			return static_cast<uint32_t>(detail::parseMultiByteInt21(m_p));
+		}
+
+		std::string_view read_chars() {
+			const auto length = read_uint31();
+			const auto p = length ? reinterpret_cast<const char *>(ptr()) : nullptr;
+			m_p += length;
+			return {p, length};
+		}
+
+		void read_name(bool dictionary) {
+			m_dictionary_name = dictionary;
+			if (dictionary) {
+				m_name = {};
+				m_name_id = read_uint31();
+			} else {
+				m_name = read_chars();
+				m_name_id = 0;
+			}
+		}
+
+		bool end_element() {
+			if (m_depth == 0) {
+				throw std::invalid_argument("unexpected end of element");
+			}
+			--m_depth;
+			m_node_type = NbfxNodeType::EndElement;
+			m_record_type = NbfxRecordType::EndElement;
+			return true;
+		}
+
+		void read_element() {
+			const auto type = static_cast<NbfxRecordType>(*m_p++);
+			m_record_type = type;
+
+			if (type == NbfxRecordType::Element || type == NbfxRecordType::DictionaryElement) {
+				m_prefix = read_chars();
+				read_name(type == NbfxRecordType::DictionaryElement);
+			} else if (type >= NbfxRecordType::PrefixElementA) {
+				m_prefix = {detail::prefix_letters + static_cast<uint8_t>(type) -
+							static_cast<uint8_t>(NbfxRecordType::PrefixElementA), 1};
+				read_name(false);
+			} else if (type >= NbfxRecordType::PrefixDictionaryElementA) {
+				m_prefix = {detail::prefix_letters + static_cast<uint8_t>(type) -
+							static_cast<uint8_t>(NbfxRecordType::PrefixDictionaryElementA), 1};
+				read_name(true);
+			} else {
+				m_prefix = {};
+				read_name(type == NbfxRecordType::ShortDictionaryElement);
+			}
+		}
+
+		void read_attribute() {
+			const auto type = static_cast<NbfxRecordType>(*m_p++);
+			m_record_type = type;
+
+			if (type >= NbfxRecordType::PrefixAttributeA) {
+				m_prefix = {detail::prefix_letters + static_cast<uint8_t>(type) -
+							static_cast<uint8_t>(NbfxRecordType::PrefixAttributeA), 1};
+				read_name(false);
+			} else if (type >= NbfxRecordType::PrefixDictionaryAttributeA) {
+				m_prefix = {detail::prefix_letters + static_cast<uint8_t>(type) -
+							static_cast<uint8_t>(NbfxRecordType::PrefixDictionaryAttributeA), 1};
+				read_name(true);
+			} else {
+				const bool prefixed = (static_cast<uint8_t>(type) & 1) == 1;
+				const bool dictionary = (static_cast<uint8_t>(type) & 2) == 2;
+				m_prefix = prefixed ? read_chars() : std::string_view();
+
+				if (type >= NbfxRecordType::ShortXmlnsAttribute) {
+					m_name = "xmlns";
+					m_dictionary_name = false;
+					m_name_id = 0;
+					if (dictionary) {
+						m_text.assign_xmlns(read_uint31());
+					} else {
+						m_text.assign_xmlns(read_chars());
+					}
+					return;
+				}
+
+				read_name(dictionary);
+			}
+
+			read_text();
+		}
+
+		/**
+		 * Reads text record, returns true if it has end element flag
+		 */
+		bool read_text() {
+			auto p = ptr();
+			const auto with_end = m_text.decode(p);
+			m_p += p - ptr();
+			return with_end;
+		}
+
+		TIter m_p;
+		TIter m_record_begin;
+
+		NbfxNodeType m_node_type = NbfxNodeType::None;
+		NbfxRecordType m_record_type = NbfxRecordType::EndElement;
+		size_t m_depth = 0;
+		bool m_started = false;
+		bool m_pending_end = false;
+
+		std::string_view m_prefix;
+		std::string_view m_name;
+		bool m_dictionary_name = false;
+		uint32_t m_name_id = 0;
+
+		NbfxTextView m_text;
+	};
+}
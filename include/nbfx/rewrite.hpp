@@ -0,0 +1,322 @@
+#pragma once
+
+#include "deserializer.hpp"
+#include "documents.hpp"
+#include "reader.hpp"
+#include "serializer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace nbfx {
+
+	enum class NbfxRewriteAction {
+		Remove,
+		Replace,
+		ReplaceValue
+	};
+
+	namespace detail {
+		struct NbfxPathSegment {
+			std::string name;
+			uint32_t id = 0;
+			bool dictionary = false;
+			bool any = false;
+		};
+
+		struct NbfxPathFrame {
+			std::string_view name;
+			uint32_t id = 0;
+			bool dictionary = false;
+		};
+
+		inline uint32_t readUint31(const uint8_t *&p) {
+			return static_cast<uint32_t>(parseMultiByteInt21(p));
+		}
+
+		inline std::string_view readName(const uint8_t *&p) {
+			const auto length = readUint31(p);
+			const auto name = std::string_view(reinterpret_cast<const char *>(p), length);
+			p += length;
+			return name;
+		}
+
+		/**
+		 * Decodes the name of an element record which is known to be complete
+		 */
+		inline NbfxPathFrame elementFrame(const uint8_t *p) {
+			const auto type = static_cast<NbfxRecordType>(*p++);
+			NbfxPathFrame frame;
+			switch (type) {
+				case NbfxRecordType::ShortElement:
+					frame.name = readName(p);
+					break;
+				case NbfxRecordType::Element:
+					readName(p);
+					frame.name = readName(p);
+					break;
+				case NbfxRecordType::ShortDictionaryElement:
+					frame.dictionary = true;
+					frame.id = readUint31(p);
+					break;
+				case NbfxRecordType::DictionaryElement:
+					readName(p);
+					frame.dictionary = true;
+					frame.id = readUint31(p);
+					break;
+				default:
+					if (type >= NbfxRecordType::PrefixDictionaryElementA && type <= NbfxRecordType::PrefixDictionaryElementZ) {
+						frame.dictionary = true;
+						frame.id = readUint31(p);
+					} else {
+						frame.name = readName(p);
+					}
+			}
+			return frame;
+		}
+
+		inline std::vector<NbfxPathSegment> parsePath(std::string_view path) {
+			std::vector<NbfxPathSegment> segments;
+			while (!path.empty()) {
+				const auto slash = path.find('/');
+				const auto part = path.substr(0, slash);
+				path = slash == std::string_view::npos ? std::string_view() : path.substr(slash + 1);
+				if (part.empty()) {
+					continue;
+				}
+
+				NbfxPathSegment segment;
+				if (part == "*") {
+					segment.any = true;
+				} else if (part.size() > 2 && part.substr(0, 2) == "D:" &&
+				           part.find_first_not_of("0123456789", 2) == std::string_view::npos) {
+					segment.dictionary = true;
+					segment.id = static_cast<uint32_t>(std::stoul(std::string(part.substr(2))));
+				} else {
+					segment.name = std::string(part);
+				}
+				segments.push_back(std::move(segment));
+			}
+
+			if (segments.empty()) {
+				throw std::invalid_argument("empty rewrite path");
+			}
+			return segments;
+		}
+
+		inline bool matches(const NbfxPathSegment &segment, const NbfxPathFrame &frame) noexcept {
+			if (segment.any) {
+				return true;
+			}
+			return segment.dictionary == frame.dictionary &&
+			       (frame.dictionary ? segment.id == frame.id : segment.name == frame.name);
+		}
+
+		/**
+		 * Appends rewritten bytes to an output iterator
+		 */
+		template<typename TIt>
+		struct NbfxIteratorOutput {
+			TIt it;
+
+			void raw(const uint8_t *from, const uint8_t *to) {
+				it = std::copy(from, to, it);
+			}
+
+			template<typename F>
+			void serialized(F &&write) {
+				it = write(it);
+			}
+		};
+
+		/**
+		 * Appends rewritten bytes to a vector, verbatim ranges are inserted in one go
+		 */
+		struct NbfxVectorOutput {
+			std::vector<uint8_t> &out;
+
+			void raw(const uint8_t *from, const uint8_t *to) {
+				out.insert(out.end(), from, to);
+			}
+
+			template<typename F>
+			void serialized(F &&write) {
+				write(std::back_inserter(out));
+			}
+		};
+	}
+
+	/**
+	 * Streaming NBFX to NBFX transform
+	 *
+	 * Rules match elements by path of local names from the root, e.g. "Envelope/Header/To".
+	 * A segment can be "*" to match any element, or "D:<id>" to match a dictionary name.
+	 * Records outside of the matched elements are measured, not decoded, and copied as is,
+	 * subtrees no rule can match are skipped whole. Replacements are serialized without sorting.
+	 */
+	class NbfxRewriter {
+	public:
+		/**
+		 * Drops matched elements with their content
+		 */
+		NbfxRewriter &remove(std::string_view path) {
+			m_rules.push_back(Rule{detail::parsePath(path), NbfxRewriteAction::Remove, NbfxElement(QName(L"")), {}});
+			return *this;
+		}
+
+		/**
+		 * Writes the element instead of matched ones
+		 */
+		NbfxRewriter &replace(std::string_view path, NbfxElement element) {
+			m_rules.push_back(Rule{detail::parsePath(path), NbfxRewriteAction::Replace, std::move(element), {}});
+			return *this;
+		}
+
+		/**
+		 * Keeps matched elements and their attributes, their content is replaced with the value
+		 */
+		NbfxRewriter &replace_value(std::string_view path, NbfxValue value) {
+			m_rules.push_back(Rule{detail::parsePath(path), NbfxRewriteAction::ReplaceValue, NbfxElement(QName(L"")), std::move(value)});
+			return *this;
+		}
+
+		/**
+		 * Rewrites the document starting at begin, returns position right after it in the input
+		 */
+		const uint8_t *rewrite(const uint8_t *begin, const uint8_t *end, std::vector<uint8_t> &out) const {
+			detail::NbfxVectorOutput output{out};
+			return apply(begin, end, output);
+		}
+
+		/**
+		 * Rewrites the document starting at begin, returns output iterator past the last written byte
+		 */
+		template<typename TIt>
+		TIt rewrite(const uint8_t *begin, const uint8_t *end, TIt out) const {
+			detail::NbfxIteratorOutput<TIt> output{out};
+			apply(begin, end, output);
+			return output.it;
+		}
+
+		std::vector<uint8_t> rewrite(const uint8_t *begin, const uint8_t *end) const {
+			std::vector<uint8_t> out;
+			out.reserve(static_cast<size_t>(end - begin));
+			rewrite(begin, end, out);
+			return out;
+		}
+
+	private:
+		struct Rule {
+			std::vector<detail::NbfxPathSegment> path;
+			NbfxRewriteAction action;
+			NbfxElement element;
+			NbfxValue value;
+		};
+
+		/**
+		 * Returns the rule matching the path, sets descend if a rule may match below it
+		 */
+		const Rule *match(const std::vector<detail::NbfxPathFrame> &path, bool &descend) const noexcept {
+			descend = false;
+			for (const auto &rule : m_rules) {
+				if (rule.path.size() < path.size()) {
+					continue;
+				}
+				if (!std::equal(path.begin(), path.end(), rule.path.begin(),
+				                [](const detail::NbfxPathFrame &frame, const detail::NbfxPathSegment &segment) {
+					                return detail::matches(segment, frame);
+				                })) {
+					continue;
+				}
+				if (rule.path.size() == path.size()) {
+					return &rule;
+				}
+				descend = true;
+			}
+			return nullptr;
+		}
+
+		template<typename TOutput>
+		const uint8_t *apply(const uint8_t *begin, const uint8_t *end, TOutput &output) const {
+			std::vector<detail::NbfxPathFrame> path;
+			auto p = begin;
+			auto verbatim = begin;
+
+			do {
+				const auto size = detail::measureRecord(p, static_cast<size_t>(end - p));
+				if (!size) {
+					throw std::invalid_argument("truncated document");
+				}
+
+				const auto raw = *p;
+				const auto type = static_cast<NbfxRecordType>(raw);
+				if (IsElement(type)) {
+					path.push_back(detail::elementFrame(p));
+
+					bool descend;
+					if (const auto rule = match(path, descend)) {
+						output.raw(verbatim, p);
+						p = verbatim = apply(*rule, p, end, output);
+						path.pop_back();
+					} else if (!descend) {
+						p = find_document_end(p, end);
+						path.pop_back();
+					} else {
+						p += size;
+					}
+					continue;
+				}
+
+				if (path.empty()) {
+					throw std::invalid_argument("expected element as a topmost node");
+				}
+				if (type == NbfxRecordType::EndElement || (IsTextRecord(type) && (raw & 1u))) {
+					path.pop_back();
+				}
+				p += size;
+			} while (!path.empty());
+
+			output.raw(verbatim, p);
+			return p;
+		}
+
+		/**
+		 * Writes the replacement of the element at p, returns the end of the element in the input
+		 */
+		template<typename TOutput>
+		static const uint8_t *apply(const Rule &rule, const uint8_t *p, const uint8_t *end, TOutput &output) {
+			const auto element_end = find_document_end(p, end);
+
+			switch (rule.action) {
+				case NbfxRewriteAction::Remove:
+					break;
+				case NbfxRewriteAction::Replace:
+					output.serialized([&](auto it) { return serialize(rule.element, it, false); });
+					break;
+				case NbfxRewriteAction::ReplaceValue: {
+					auto content = p + detail::measureRecord(p, static_cast<size_t>(element_end - p));
+					while (IsAttribute(static_cast<NbfxRecordType>(*content))) {
+						content += detail::measureRecord(content, static_cast<size_t>(element_end - content));
+					}
+					output.raw(p, content);
+					output.serialized([&](auto it) {
+						NbfxWriter<decltype(it)> writer(it);
+						writer.write(rule.value, true);
+						return writer.position();
+					});
+					break;
+				}
+			}
+
+			return element_end;
+		}
+
+		std::vector<Rule> m_rules;
+	};
+}
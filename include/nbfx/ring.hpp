@@ -0,0 +1,522 @@
+#pragma once
+
+#if defined(__linux__)
+
+#include "reader.hpp"
+#include "serializer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace nbfx {
+
+	namespace detail {
+		constexpr uint32_t ring_magic = 0x4E424652u;
+		constexpr uint32_t ring_padding = 1u;
+		constexpr size_t ring_record_header = 8;
+
+		/**
+		 * Control block at the start of the shared mapping, positions grow monotonically
+		 */
+		struct NbfxRingHeader {
+			uint32_t magic;
+			std::atomic<uint32_t> closed;
+			uint64_t capacity;
+
+			alignas(64) std::atomic<uint64_t> head;
+			std::atomic<uint32_t> data_seq;
+			std::atomic<uint32_t> consumer_waiting;
+
+			alignas(64) std::atomic<uint64_t> tail;
+			std::atomic<uint32_t> space_seq;
+			std::atomic<uint32_t> producer_waiting;
+		};
+
+		static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions have to be lock free");
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word has to be plain 32 bits");
+
+		constexpr size_t ring_data_offset = (sizeof(NbfxRingHeader) + 63) & ~size_t{63};
+
+		inline void futex_wait(std::atomic<uint32_t> &word, uint32_t expected) {
+			syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+		}
+
+		inline void futex_wake(std::atomic<uint32_t> &word) {
+			syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+		}
+
+		/**
+		 * Spins, then sleeps on seq until ready() holds
+		 */
+		template<typename F>
+		void ring_wait(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting, unsigned spins, F &&ready) {
+			for (auto i = 0u; i < spins; ++i) {
+				if (ready()) {
+					return;
+				}
+			}
+
+			for (;;) {
+				const auto observed = seq.load(std::memory_order_acquire);
+				waiting.store(1, std::memory_order_seq_cst);
+				if (ready()) {
+					waiting.store(0, std::memory_order_relaxed);
+					return;
+				}
+				futex_wait(seq, observed);
+				waiting.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		inline void ring_notify(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &waiting) {
+			seq.fetch_add(1, std::memory_order_seq_cst);
+			if (waiting.load(std::memory_order_seq_cst)) {
+				futex_wake(seq);
+			}
+		}
+
+		constexpr size_t ring_align(size_t size) noexcept {
+			return (size + 7) & ~size_t{7};
+		}
+
+		/**
+		 * Output iterator writing into a fixed range, bytes past its end are dropped and flag an overflow
+		 */
+		class NbfxRingIterator {
+		public:
+			using iterator_category = std::output_iterator_tag;
+			using value_type = void;
+			using difference_type = std::ptrdiff_t;
+			using pointer = void;
+			using reference = void;
+
+			NbfxRingIterator(uint8_t *begin, size_t size) noexcept : m_begin(begin), m_pos(begin), m_end(begin + size) {}
+
+			size_t written() const noexcept {
+				return static_cast<size_t>(m_pos - m_begin);
+			}
+
+			bool overflow() const noexcept {
+				return m_overflow;
+			}
+
+			NbfxRingIterator &operator*() noexcept {
+				return *this;
+			}
+
+			NbfxRingIterator &operator=(uint8_t byte) noexcept {
+				if (m_pos != m_end) {
+					*m_pos++ = byte;
+				} else {
+					m_overflow = true;
+				}
+				return *this;
+			}
+
+			NbfxRingIterator &operator++() noexcept {
+				return *this;
+			}
+
+			NbfxRingIterator &operator++(int) noexcept {
+				return *this;
+			}
+
+		private:
+			uint8_t *m_begin;
+			uint8_t *m_pos;
+			uint8_t *m_end;
+			bool m_overflow = false;
+		};
+
+		/**
+		 * Tells if the tree holds values backed by NbfxBytesSource, those can be read only once
+		 */
+		inline bool has_bytes_source(const NbfxElement &element) noexcept {
+			if (element.value().type() == NbfxValueType::BytesSource) {
+				return true;
+			}
+			for (const auto &child : element.children()) {
+				if (has_bytes_source(child)) {
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+
+	/**
+	 * Shared memory mapping holding a single producer, single consumer message ring
+	 *
+	 * Named rings live in POSIX shared memory and are opened by name from the other process,
+	 * anonymous rings are shared with children created by fork().
+	 */
+	class NbfxSharedRing {
+	public:
+		/**
+		 * Creates a named ring, capacity is rounded up to a power of two
+		 */
+		static NbfxSharedRing create(const std::string &name, size_t capacity) {
+			const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+			if (fd < 0) {
+				throw std::system_error(errno, std::generic_category(), "failed to create ring " + name);
+			}
+
+			const auto size = detail::ring_data_offset + round_capacity(capacity);
+			if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+				const auto error = errno;
+				::close(fd);
+				::shm_unlink(name.c_str());
+				throw std::system_error(error, std::generic_category(), "failed to size ring " + name);
+			}
+
+			NbfxSharedRing ring(map(fd, size), size);
+			::close(fd);
+			ring.initialize(round_capacity(capacity));
+			return ring;
+		}
+
+		/**
+		 * Opens a named ring created by another process
+		 */
+		static NbfxSharedRing open(const std::string &name) {
+			const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+			if (fd < 0) {
+				throw std::system_error(errno, std::generic_category(), "failed to open ring " + name);
+			}
+
+			const auto size = static_cast<size_t>(::lseek(fd, 0, SEEK_END));
+			if (size < detail::ring_data_offset) {
+				::close(fd);
+				throw std::invalid_argument("not a ring: " + name);
+			}
+
+			NbfxSharedRing ring(map(fd, size), size);
+			::close(fd);
+
+			if (ring.header().magic != detail::ring_magic ||
+			    detail::ring_data_offset + ring.header().capacity != size) {
+				throw std::invalid_argument("not a ring: " + name);
+			}
+			return ring;
+		}
+
+		/**
+		 * Creates a ring in anonymous shared memory
+		 */
+		static NbfxSharedRing anonymous(size_t capacity) {
+			const auto size = detail::ring_data_offset + round_capacity(capacity);
+			NbfxSharedRing ring(map(-1, size), size);
+			ring.initialize(round_capacity(capacity));
+			return ring;
+		}
+
+		/**
+		 * Removes the name of a ring, existing mappings stay valid
+		 */
+		static void remove(const std::string &name) noexcept {
+			::shm_unlink(name.c_str());
+		}
+
+		NbfxSharedRing(NbfxSharedRing &&other) noexcept :
+				m_memory(std::exchange(other.m_memory, nullptr)),
+				m_size(std::exchange(other.m_size, 0)) {}
+
+		NbfxSharedRing &operator=(NbfxSharedRing &&other) noexcept {
+			if (this != &other) {
+				unmap();
+				m_memory = std::exchange(other.m_memory, nullptr);
+				m_size = std::exchange(other.m_size, 0);
+			}
+			return *this;
+		}
+
+		NbfxSharedRing(const NbfxSharedRing &) = delete;
+
+		NbfxSharedRing &operator=(const NbfxSharedRing &) = delete;
+
+		~NbfxSharedRing() {
+			unmap();
+		}
+
+		size_t capacity() const noexcept {
+			return header().capacity;
+		}
+
+		detail::NbfxRingHeader &header() const noexcept {
+			return *static_cast<detail::NbfxRingHeader *>(m_memory);
+		}
+
+		uint8_t *data() const noexcept {
+			return static_cast<uint8_t *>(m_memory) + detail::ring_data_offset;
+		}
+
+	private:
+		NbfxSharedRing(void *memory, size_t size) noexcept : m_memory(memory), m_size(size) {}
+
+		static size_t round_capacity(size_t capacity) {
+			size_t rounded = 64;
+			while (rounded < capacity) {
+				rounded *= 2;
+			}
+			return rounded;
+		}
+
+		static void *map(int fd, size_t size) {
+			const int flags = fd < 0 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED;
+			void *memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+			if (memory == MAP_FAILED) {
+				const auto error = errno;
+				if (fd >= 0) {
+					::close(fd);
+				}
+				throw std::system_error(error, std::generic_category(), "failed to map ring");
+			}
+			return memory;
+		}
+
+		void initialize(size_t capacity) noexcept {
+			auto &h = *new(m_memory) detail::NbfxRingHeader{};
+			h.capacity = capacity;
+			h.head.store(0, std::memory_order_relaxed);
+			h.tail.store(0, std::memory_order_relaxed);
+			h.magic = detail::ring_magic;
+		}
+
+		void unmap() noexcept {
+			if (m_memory) {
+				::munmap(m_memory, m_size);
+				m_memory = nullptr;
+			}
+		}
+
+		void *m_memory;
+		size_t m_size;
+	};
+
+	/**
+	 * Writing end of a ring, only one producer may use a ring at a time
+	 *
+	 * Messages are written in place: reserve() returns contiguous space inside the ring,
+	 * publish() makes the message visible to the consumer.
+	 */
+	class NbfxRingProducer {
+	public:
+		explicit NbfxRingProducer(NbfxSharedRing &ring, unsigned spins = 1000) :
+				m_header(ring.header()),
+				m_data(ring.data()),
+				m_mask(ring.capacity() - 1),
+				m_spins(spins),
+				m_head(m_header.head.load(std::memory_order_relaxed)) {}
+
+		/**
+		 * Waits for contiguous space for a message of size bytes and returns it
+		 */
+		uint8_t *reserve(size_t size) {
+			const auto capacity = m_mask + 1;
+			auto need = detail::ring_record_header + detail::ring_align(size);
+			if (need > capacity / 2 || size > UINT32_MAX) {
+				throw std::length_error("message exceeds ring capacity");
+			}
+
+			const auto offset = m_head & m_mask;
+			const auto padding = offset + need > capacity ? capacity - offset : 0;
+
+			detail::ring_wait(m_header.space_seq, m_header.producer_waiting, m_spins, [&]() {
+				return m_head + padding + need - m_header.tail.load(std::memory_order_acquire) <= capacity;
+			});
+
+			return place(padding, size);
+		}
+
+		/**
+		 * Publishes the reserved message
+		 */
+		void publish() {
+			m_head += m_reserved;
+			m_reserved = 0;
+			m_header.head.store(m_head, std::memory_order_seq_cst);
+			detail::ring_notify(m_header.data_seq, m_header.consumer_waiting);
+		}
+
+		/**
+		 * Serializes the tree into the ring
+		 *
+		 * The message is written straight into the free space of the ring. When it doesn't fit there,
+		 * or the tree holds values backed by NbfxBytesSource, which can't be read twice, it is serialized
+		 * into a buffer the producer keeps and copied into the ring once enough space is released.
+		 */
+		void send(const NbfxElement &root, bool sort_members = true) {
+			if (!detail::has_bytes_source(root)) {
+				uint64_t padding = 0;
+				const auto room = free_space(padding);
+				if (room) {
+					const auto offset = (m_head + padding) & m_mask;
+					const auto it = serialize(root, detail::NbfxRingIterator(m_data + offset + detail::ring_record_header, room), sort_members);
+					if (!it.overflow()) {
+						place(padding, it.written());
+						publish();
+						return;
+					}
+				}
+			}
+
+			m_scratch.clear();
+			serialize(root, std::back_inserter(m_scratch), sort_members);
+			send(m_scratch.data(), m_scratch.size());
+		}
+
+		/**
+		 * Copies a pre-encoded message into the ring
+		 */
+		void send(const uint8_t *data, size_t size) {
+			std::memcpy(reserve(size), data, size);
+			publish();
+		}
+
+		/**
+		 * Tells the consumer no more messages follow
+		 */
+		void close() {
+			m_header.closed.store(1, std::memory_order_seq_cst);
+			detail::ring_notify(m_header.data_seq, m_header.consumer_waiting);
+		}
+
+	private:
+		/**
+		 * Returns the largest message that fits the ring without waiting, padding is set if it starts at the ring start
+		 */
+		size_t free_space(uint64_t &padding) const noexcept {
+			const auto capacity = m_mask + 1;
+			const auto offset = m_head & m_mask;
+			const auto free = capacity - (m_head - m_header.tail.load(std::memory_order_acquire));
+			const auto to_end = capacity - offset;
+
+			auto space = std::min(free, to_end);
+			padding = 0;
+			if (free > to_end && free - to_end > space) {
+				space = free - to_end;
+				padding = to_end;
+			}
+
+			space = std::min(space, capacity / 2);
+			return space > detail::ring_record_header ? (space - detail::ring_record_header) & ~size_t{7} : 0;
+		}
+
+		/**
+		 * Writes the padding and message headers at the head, the message is published by publish()
+		 */
+		uint8_t *place(uint64_t padding, size_t size) noexcept {
+			if (padding) {
+				write_record_header(m_head & m_mask, static_cast<uint32_t>(padding), detail::ring_padding);
+				m_head += padding;
+			}
+
+			write_record_header(m_head & m_mask, static_cast<uint32_t>(size), 0);
+			m_reserved = detail::ring_record_header + detail::ring_align(size);
+			return m_data + (m_head & m_mask) + detail::ring_record_header;
+		}
+
+		void write_record_header(uint64_t offset, uint32_t size, uint32_t kind) noexcept {
+			std::memcpy(m_data + offset, &size, sizeof(size));
+			std::memcpy(m_data + offset + 4, &kind, sizeof(kind));
+		}
+
+		detail::NbfxRingHeader &m_header;
+		uint8_t *m_data;
+		uint64_t m_mask;
+		unsigned m_spins;
+		uint64_t m_head;
+		size_t m_reserved = 0;
+		std::vector<uint8_t> m_scratch;
+	};
+
+	/**
+	 * Reading end of a ring, only one consumer may use a ring at a time
+	 *
+	 * Messages are handed out in place and stay valid until release().
+	 */
+	class NbfxRingConsumer {
+	public:
+		explicit NbfxRingConsumer(NbfxSharedRing &ring, unsigned spins = 1000) :
+				m_header(ring.header()),
+				m_data(ring.data()),
+				m_mask(ring.capacity() - 1),
+				m_spins(spins),
+				m_tail(m_header.tail.load(std::memory_order_relaxed)) {}
+
+		/**
+		 * Returns the next message without waiting, false if there is none
+		 */
+		bool try_receive(NbfxBytesView &message) {
+			const auto head = m_header.head.load(std::memory_order_acquire);
+
+			while (m_tail != head) {
+				uint32_t size, kind;
+				std::memcpy(&size, m_data + (m_tail & m_mask), sizeof(size));
+				std::memcpy(&kind, m_data + (m_tail & m_mask) + 4, sizeof(kind));
+
+				if (kind == detail::ring_padding) {
+					m_tail += size;
+					continue;
+				}
+
+				message = NbfxBytesView{m_data + (m_tail & m_mask) + detail::ring_record_header, size};
+				m_next = m_tail + detail::ring_record_header + detail::ring_align(size);
+				return true;
+			}
+
+			return false;
+		}
+
+		/**
+		 * Waits for the next message, returns false once the producer closed the ring and it's drained
+		 */
+		bool receive(NbfxBytesView &message) {
+			bool received = false;
+			detail::ring_wait(m_header.data_seq, m_header.consumer_waiting, m_spins, [&]() {
+				return (received = try_receive(message)) || closed();
+			});
+			return received || try_receive(message);
+		}
+
+		/**
+		 * Returns space of the last received message to the producer
+		 */
+		void release() {
+			m_tail = m_next;
+			m_header.tail.store(m_tail, std::memory_order_seq_cst);
+			detail::ring_notify(m_header.space_seq, m_header.producer_waiting);
+		}
+
+	private:
+		bool closed() const noexcept {
+			return m_header.closed.load(std::memory_order_seq_cst) != 0;
+		}
+
+		detail::NbfxRingHeader &m_header;
+		uint8_t *m_data;
+		uint64_t m_mask;
+		unsigned m_spins;
+		uint64_t m_tail;
+		uint64_t m_next = 0;
+	};
+}
+
+#endif
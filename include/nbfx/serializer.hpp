@@ -2,6 +2,8 @@
 
 #include "nbfx/NbfxElement.hpp"
 #include "nbfx/NbfxAttribute.hpp"
+#include "nbfx/stats.hpp"
+#include "nbfx/hooks.hpp"
 
 #include <vector>
 #include <cstdint>
@@ -9,31 +11,82 @@
 #include <iterator>
 #include <type_traits>
 #include <iomanip>
-#include <codecvt>
 #include <cstdint>
 #include <algorithm>
+#include <stdexcept>
 
 namespace nbfx {
 
+	class NbfxCountingIterator;
+
 	namespace {
 		constexpr uint64_t ticks_between_epochs = 621355968000000000ull;
 
-		template<typename TIter>
-		class NbfxWriter {
+		template<typename TIter, typename THooks = NbfxNoHooks>
+		class NbfxWriter : detail::NbfxHooksHolder<THooks> {
 		public:
 			explicit NbfxWriter(const TIter &it) : m_it(it) {}
 
+			NbfxWriter(const TIter &it, THooks &hooks) : detail::NbfxHooksHolder<THooks>(hooks), m_it(it) {}
+
+			NbfxWriter(const NbfxWriter &) = delete;
+
+			NbfxWriter &operator=(const NbfxWriter &) = delete;
+
+			~NbfxWriter() {
+				if constexpr (stats) {
+					count_record();
+				}
+			}
+
 		private:
-			std::wstring_convert<std::codecvt_utf8<wchar_t>> utf_to_wstring;
+			// serialized_size runs the writer with a counting iterator, it isn't counted twice
+			static constexpr bool stats = detail::stats_enabled && !std::is_same_v<TIter, NbfxCountingIterator>;
+
 			TIter m_it;
+			// child orders of the elements being written, the tree itself is never modified
+			std::vector<uint32_t> m_sort_scratch;
+			// statistics of the record being written, unused unless stats are enabled
+			size_t m_written = 0;
+			size_t m_record_start = 0;
+			size_t m_depth = 0;
+			int m_record = -1;
+			bool m_in_attribute = false;
 
 			void put(uint8_t byte) {
 				*m_it++ = byte;
+				if constexpr (stats) {
+					++m_written;
+				}
+			}
+
+			/**
+			 * Writes the first byte of a record
+			 */
+			void put_record(uint8_t code) {
+				if constexpr (stats) {
+					if (!m_in_attribute) {
+						count_record();
+						m_record = code;
+						m_record_start = m_written;
+					}
+				}
+				put(code);
+			}
+
+			void count_record() {
+				if (m_record >= 0) {
+					detail::threadStats().serialize.record(static_cast<uint8_t>(m_record), m_written - m_record_start, m_depth);
+					m_record = -1;
+				}
 			}
 
 			template<class T, typename = typename T::iterator>
 			void put(const T &str) {
-				std::copy(str.cbegin(), str.cend(), m_it);
+				m_it = std::copy(str.cbegin(), str.cend(), m_it);
+				if constexpr (stats) {
+					m_written += str.size();
+				}
 			}
 
 			void write_uint31(uint64_t val) {
@@ -43,53 +96,124 @@ namespace nbfx {
 				} while (val != 0);
 			}
 
+			/**
+			 * Size of UTF-8 encoding of the string, every wchar_t is a code point as codecvt_utf8 takes it
+			 */
+			static size_t utf8_size(const std::wstring &str) {
+				size_t size = 0;
+				for (const auto c : str) {
+					const auto cp = static_cast<uint32_t>(c);
+					if (cp > 0x10FFFFu) {
+						throw std::range_error("invalid code point");
+					}
+					size += cp < 0x80u ? 1 : cp < 0x800u ? 2 : cp < 0x10000u ? 3 : 4;
+				}
+				return size;
+			}
+
+			/**
+			 * Encodes the string straight into the output, no temporary string is allocated
+			 */
+			void put_utf8(const std::wstring &str) {
+				if constexpr (stats) {
+					detail::threadStats().serialize.characters(str.size());
+				}
+				for (const auto c : str) {
+					const auto cp = static_cast<uint32_t>(c);
+					if (cp < 0x80u) {
+						put(static_cast<uint8_t>(cp));
+					} else if (cp < 0x800u) {
+						put(static_cast<uint8_t>(0xC0u | cp >> 6u));
+						put(static_cast<uint8_t>(0x80u | (cp & 0x3Fu)));
+					} else if (cp < 0x10000u) {
+						put(static_cast<uint8_t>(0xE0u | cp >> 12u));
+						put(static_cast<uint8_t>(0x80u | (cp >> 6u & 0x3Fu)));
+						put(static_cast<uint8_t>(0x80u | (cp & 0x3Fu)));
+					} else {
+						put(static_cast<uint8_t>(0xF0u | cp >> 18u));
+						put(static_cast<uint8_t>(0x80u | (cp >> 12u & 0x3Fu)));
+						put(static_cast<uint8_t>(0x80u | (cp >> 6u & 0x3Fu)));
+						put(static_cast<uint8_t>(0x80u | (cp & 0x3Fu)));
+					}
+				}
+			}
+
 			void write_name(const std::wstring &name) {
-				auto utf8 = utf_to_wstring.to_bytes(name);
-				auto utf8_size = utf8.size();
-				write_uint31(utf8_size);
-				put(utf8);
+				write_uint31(utf8_size(name));
+				put_utf8(name);
 			}
 
 		public:
+			/**
+			 * Returns output iterator past the last written byte
+			 */
+			TIter position() const {
+				return m_it;
+			}
+
+			/**
+			 * Writes bytes as is, as a part of the current record
+			 */
+			void write_raw(const uint8_t *data, size_t size) {
+				m_it = std::copy(data, data + size, m_it);
+				if constexpr (stats) {
+					m_written += size;
+				}
+			}
+
+			/**
+			 * Writes pre-encoded records as is
+			 */
+			void write_records(const uint8_t *data, size_t size) {
+				if constexpr (stats) {
+					count_record();
+					detail::threadStats().serialize.raw(size);
+				}
+				m_it = std::copy(data, data + size, m_it);
+			}
+
 			void write(const NbfxElement &el, bool sort_members) {
+				this->hooks().on_element_begin(el, detail::hookTime<THooks>());
+				write_open(el, sort_members);
+				write(el.value(), true);
+				if constexpr (stats) {
+					--m_depth;
+				}
+				this->hooks().on_element_end(el, detail::hookTime<THooks>());
+			}
+
+			/**
+			 * Writes the element with attributes and children, but without its value and end
+			 */
+			void write_open(const NbfxElement &el, bool sort_members) {
 				const auto &prefix = el.prefix();
 				const auto &name = el.name();
 
+				if constexpr (stats) {
+					++m_depth;
+				}
 				write_element(prefix, name);
 
 				for (const auto &attr : el.attributes()) {
 					write(attr);
 				}
 
-				auto& children = el.children();
-
-
 				if (sort_members) {
-					std::vector<std::reference_wrapper<const NbfxElement>> sorted_children(children.begin(), children.end());
-					std::stable_sort(begin(sorted_children),
-									 end(sorted_children),
-									 [](auto left, auto right) {
-										 return left.get().name() < right.get().name();
-									 });
-
-					for (auto ch : sorted_children) {
-						write(ch.get(), true);
-					}
+					el.for_each_sorted_child(m_sort_scratch, [this](const NbfxElement &child) {
+						write(child, true);
+					});
 				} else {
-					for(const auto& child: children) {
+					for (const auto &child : el.children()) {
 						write(child, false);
 					}
 				}
-
-
-				write(el.value(), true);
 			}
 
 			void write(const NbfxAttribute &attr) {
-				auto type = attr.type();
-				auto name = attr.name();
-				auto prefix = attr.prefix();
-				put(static_cast<uint8_t>(type));
+				const auto type = attr.type();
+				const auto &name = attr.name();
+				const auto &prefix = attr.prefix();
+				put_record(static_cast<uint8_t>(type));
 				switch (type) {
 					//case NbfxRecordType::DictionaryXmlnsAttribute:
 					case NbfxRecordType::XmlnsAttribute:
@@ -105,20 +229,68 @@ namespace nbfx {
 					case NbfxRecordType::ShortDictionaryAttribute:
 					default:
 						write_name(name);
+						// a source is written in chunks of unknown count, an attribute holds a single record
+						if (attr.value().type() == NbfxValueType::BytesSource) {
+							throw std::invalid_argument("bytes source can't be an attribute value");
+						}
+						// the value is a part of the attribute record
+						m_in_attribute = true;
 						write(attr.value());
+						m_in_attribute = false;
 						break;
 				}
 			}
 
 			void write(const NbfxValue &text, bool withEnd = false) {
+				if constexpr (THooks::large_payload != SIZE_MAX) {
+					const auto size = payload_size(text);
+					if (detail::isLargePayload<THooks>(size)) {
+						this->hooks().on_payload_begin(size, detail::hookTime<THooks>());
+						write_value(text, withEnd);
+						this->hooks().on_payload_end(size, detail::hookTime<THooks>());
+						return;
+					}
+				}
+				write_value(text, withEnd);
+			}
+
+			/**
+			 * Bytes of String and Bytes payloads hooks are told about, sources are read lazily and report 0
+			 */
+			size_t payload_size(const NbfxValue &text) const {
+				switch (text.type()) {
+					case NbfxValueType::String:
+						return utf8_size(text.string());
+					case NbfxValueType::Bytes:
+						return text.bytes_size();
+					default:
+						return 0;
+				}
+			}
+
+			void write_value(const NbfxValue &text, bool withEnd) {
 				switch (text.type()) {
-					case NbfxValueType::String: {
-						auto utf8 = utf_to_wstring.to_bytes(text.string());
-						write_string(utf8, withEnd);
+					case NbfxValueType::String:
+						write_string(text.string(), withEnd);
+						break;
+					case NbfxValueType::Bytes: {
+						if (m_in_attribute) {
+							// an attribute holds a single text record, chunks are joined into its payload
+							write_strvec_header(text.bytes_size(), false, false);
+							text.for_each_chunk([&](const std::vector<uint8_t> &chunk) {
+								put(chunk);
+							});
+							break;
+						}
+						// chunks are written as consecutive records, parse joins them back
+						auto left = text.chunk_count();
+						text.for_each_chunk([&](const std::vector<uint8_t> &chunk) {
+							write_vector(chunk, withEnd && --left == 0);
+						});
 						break;
 					}
-					case NbfxValueType::Bytes:
-						write_vector(text.bytes(), withEnd);
+					case NbfxValueType::BytesSource:
+						write_bytes(text.bytes_source(), withEnd);
 						break;
 					case NbfxValueType::Boolean:
 						write_bool(text.boolean(), withEnd);
@@ -144,7 +316,7 @@ namespace nbfx {
 
 
 			void write_element(const std::wstring &name) {
-				put(0x40);
+				put_record(0x40);
 				write_name(name);
 			}
 
@@ -156,23 +328,23 @@ namespace nbfx {
 					case 1: {
 						auto p = prefix[0];
 						if (p >= L'a' && p <= L'z') {
-							put(0x5E + static_cast<uint8_t>(p) - 'a');
+							put_record(0x5E + static_cast<uint8_t>(p) - 'a');
 							break;
 						}
 					}
 					default:
-						put(0x41);
+						put_record(0x41);
 						write_name(prefix);
 				};
 				write_name(name);
 			}
 
 			void write_element_end() {
-				put(1);
+				put_record(1);
 			}
 
 			void write_attribute(const std::string &name) {
-				put(0x04);
+				put_record(0x04);
 				if (name.size() > 127) {
 					throw std::invalid_argument("name is too long");
 				}
@@ -182,7 +354,7 @@ namespace nbfx {
 
 			void write_attribute(char prefix, const std::string &name) {
 				assert(prefix >= 'a' && prefix <= 'z');
-				put(0x26 + prefix - 'a');
+				put_record(0x26 + prefix - 'a');
 				if (name.size() > 127) {
 					throw std::invalid_argument("name is too long");
 				}
@@ -191,7 +363,7 @@ namespace nbfx {
 			}
 
 			void write_xmlns(const std::string &prefix, const std::string &uri) {
-				put(0x09);
+				put_record(0x09);
 
 				if (prefix.size() > 127) {
 					throw std::invalid_argument("prefix is too long");
@@ -207,7 +379,7 @@ namespace nbfx {
 			}
 
 			void write_bool(bool v, bool withend = false) {
-				put((v ? 0x86 : 0x84) + static_cast<uint8_t>(withend));
+				put_record((v ? 0x86 : 0x84) + static_cast<uint8_t>(withend));
 			}
 
 			void write_int(int64_t v, bool withend = false) {
@@ -245,7 +417,7 @@ namespace nbfx {
 						break;
 				}
 
-				put(code);
+				put_record(code);
 				for (auto i = 0u; i < size; ++i) {
 					put(v & 0xFFu);
 					v = v >> 8u;
@@ -253,19 +425,17 @@ namespace nbfx {
 			}
 
 			void write_uint64(uint64_t v, bool withend = false) {
-				put(0xB2u + static_cast<uint8_t>(withend));
+				put_record(0xB2u + static_cast<uint8_t>(withend));
 				for (auto i = 0u; i < 8u; ++i) {
 					put(v & 0xFFu);
 					v = v >> 8u;
 				}
 			}
 
-			template<typename T>
-			void write_strvec(const T &buf, bool asText, bool withend) {
-				size_t len = buf.size();
+			void write_strvec_header(size_t len, bool asText, bool withend) {
 				uint8_t sl = len & 0xFFFF0000u ? 4u : len & 0xFFFFFF00u ? 2u : 0;
 				uint8_t code = (asText ? 0x98u : 0x9Eu) + sl + static_cast<uint8_t>(withend);
-				put(code);
+				put_record(code);
 
 				put(len & 0xFFu);
 
@@ -275,14 +445,60 @@ namespace nbfx {
 						put(tmp & 0xFFu);
 					}
 				}
+			}
 
+			template<typename T>
+			void write_strvec(const T &buf, bool asText, bool withend) {
+				write_strvec_header(buf.size(), asText, withend);
 				put(buf);
 			}
 
+			/**
+			 * Writes the source as consecutive Bytes*Text records of at most chunk_size bytes
+			 */
+			void write_bytes(const NbfxBytesSource &source, bool withend = false) {
+				std::vector<uint8_t> chunk(source.chunk_size());
+				bool empty = true;
+
+				for (;;) {
+					size_t size = 0;
+					while (size < chunk.size()) {
+						const auto n = source.read(chunk.data() + size, chunk.size() - size);
+						if (!n) {
+							break;
+						}
+						size += n;
+					}
+
+					if (!size) {
+						break;
+					}
+
+					write_strvec_header(size, false, false);
+					write_raw(chunk.data(), size);
+					empty = false;
+
+					if (size < chunk.size()) {
+						break;
+					}
+				}
+
+				if (empty) {
+					write_strvec_header(0, false, withend);
+				} else if (withend) {
+					write_element_end();
+				}
+			}
+
 			void write_string(const std::string &str, bool withend = false) {
 				write_strvec(str, true, withend);
 			}
 
+			void write_string(const std::wstring &str, bool withend = false) {
+				write_strvec_header(utf8_size(str), true, withend);
+				put_utf8(str);
+			}
+
 			void write_vector(const std::vector<uint8_t> &buf, bool withend = false) {
 				write_strvec(buf, false, withend);
 			}
@@ -294,12 +510,22 @@ namespace nbfx {
 				write_strvec(tmp, false, withend);
 			}
 
+			void write_float(float v, bool withend = false) {
+				put_record(0x90u + static_cast<uint8_t>(withend));
+				write_raw(reinterpret_cast<const uint8_t *>(&v), sizeof(v));
+			}
+
+			void write_double(double v, bool withend = false) {
+				put_record(0x92u + static_cast<uint8_t>(withend));
+				write_raw(reinterpret_cast<const uint8_t *>(&v), sizeof(v));
+			}
+
 			void write_datetime(datetime_t tp, bool withend = false) {
 				auto v = tp.time_since_epoch().count() / 100ull + ticks_between_epochs;
 
 				v = v | 0x8000000000000000ull;
 
-				put(0x96u + static_cast<uint8_t>(withend));
+				put_record(0x96u + static_cast<uint8_t>(withend));
 				for (auto i = 0u; i < 8u; ++i) {
 					put(v & 0xFFu);
 					v = v >> 8u;
@@ -323,9 +549,99 @@ namespace nbfx {
 		};
 	}
 
+	/**
+	 * Serializes the tree, returns output iterator past the last written byte
+	 */
 	template<typename TIt>
-	void serialize(const NbfxElement& root, TIt out_iterator, bool sort_members = true) {
+	TIt serialize(const NbfxElement& root, TIt out_iterator, bool sort_members = true) {
+		detail::NbfxStatsTimer timer(false, !std::is_same_v<TIt, NbfxCountingIterator>);
 		NbfxWriter<TIt>	writer(out_iterator);
 		writer.write(root, sort_members);
+		return writer.position();
+	}
+
+	/**
+	 * Serializes the tree calling the hooks, see NbfxNoHooks
+	 *
+	 * Payload hooks are called for String and Bytes values, not for values backed by NbfxBytesSource.
+	 */
+	template<typename TIt, typename THooks>
+	std::enable_if_t<is_hooks_v<THooks>, TIt>
+	serialize(const NbfxElement& root, TIt out_iterator, bool sort_members, THooks &hooks) {
+		detail::NbfxStatsTimer timer(false, !std::is_same_v<TIt, NbfxCountingIterator>);
+		hooks.on_document_begin(detail::hookTime<THooks>());
+		auto end = [&] {
+			NbfxWriter<TIt, THooks> writer(out_iterator, hooks);
+			writer.write(root, sort_members);
+			return writer.position();
+		}();
+		hooks.on_document_end(detail::hookTime<THooks>());
+		return end;
+	}
+
+	/**
+	 * Serializes the tree with pre-encoded records inserted after its last child
+	 *
+	 * Used to forward content without decoding it, e.g. SOAP Body of a routed message.
+	 * The root can't have a value.
+	 */
+	template<typename TIt>
+	TIt serialize_spliced(const NbfxElement& root, const uint8_t *records, size_t size, TIt out_iterator, bool sort_members = true) {
+		if (root.value().type() != NbfxValueType::Null) {
+			throw std::invalid_argument("element with value can't have spliced content");
+		}
+
+		detail::NbfxStatsTimer timer(false);
+		NbfxWriter<TIt> writer(out_iterator);
+		writer.write_open(root, sort_members);
+		writer.write_records(records, size);
+		writer.write_element_end();
+		return writer.position();
+	}
+
+	/**
+	 * Output iterator that counts written bytes and discards them
+	 */
+	class NbfxCountingIterator {
+	public:
+		using iterator_category = std::output_iterator_tag;
+		using value_type = void;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = void;
+
+		size_t count() const noexcept {
+			return m_count;
+		}
+
+		NbfxCountingIterator &operator*() noexcept {
+			return *this;
+		}
+
+		template<typename T>
+		NbfxCountingIterator &operator=(const T &) noexcept {
+			++m_count;
+			return *this;
+		}
+
+		NbfxCountingIterator &operator++() noexcept {
+			return *this;
+		}
+
+		NbfxCountingIterator &operator++(int) noexcept {
+			return *this;
+		}
+
+	private:
+		size_t m_count = 0;
+	};
+
+	/**
+	 * Returns number of bytes serialize() writes for the tree
+	 *
+	 * Values backed by NbfxBytesSource are read by this pass, so they have to be re-readable
+	 */
+	inline size_t serialized_size(const NbfxElement& root, bool sort_members = true) {
+		return serialize(root, NbfxCountingIterator(), sort_members).count();
 	}
 }
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "contract.hpp"
+#include "deserializer.hpp"
+#include "documents.hpp"
+#include "reader.hpp"
+#include "serializer.hpp"
+
+#include <algorithm>
+#include <codecvt>
+#include <cstdint>
+#include <locale>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace nbfx {
+
+	namespace detail {
+		// MS-NBFS static dictionary
+		constexpr uint32_t soap_envelope_id = 0x02;
+		constexpr uint32_t soap_header_id = 0x08;
+		constexpr uint32_t soap_action_id = 0x0A;
+		constexpr uint32_t soap_to_id = 0x0C;
+		constexpr uint32_t soap_body_id = 0x0E;
+		constexpr uint32_t soap_message_id_id = 0x1A;
+
+		template<typename TReader>
+		bool isSoapName(const TReader &reader, std::string_view name, uint32_t id) {
+			return reader.is_dictionary_name() ? reader.name_id() == id : reader.name() == name;
+		}
+
+		inline bool isSoapName(const std::wstring &name, const wchar_t *literal, uint32_t id) {
+			return name == literal || name == L"D:" + std::to_wstring(id);
+		}
+
+		inline std::string soapText(const NbfxValue &value) {
+			thread_local std::wstring_convert<std::codecvt_utf8<wchar_t>> utf8;
+			return utf8.to_bytes(value.to_string());
+		}
+	}
+
+	/**
+	 * SOAP envelope with decoded header and undecoded body
+	 *
+	 * Ranges point into the parsed input.
+	 */
+	struct NbfxSoapEnvelope {
+		// records of the Header element, empty if there's no header
+		NbfxBytesView header_records{nullptr, 0};
+		// records of the Body element
+		NbfxBytesView body{nullptr, 0};
+		std::optional<NbfxElement> header;
+		std::string action;
+		std::string to;
+		std::string message_id;
+	};
+
+	/**
+	 * Decodes the header of the envelope stored in [begin, end) and locates its body without decoding it
+	 *
+	 * Records before Body are checked against end, Body has to be the last child of Envelope and isn't walked,
+	 * so the cost depends on the header only.
+	 * Action, To and MessageID are looked up among header children by local name or static dictionary id.
+	 */
+	inline NbfxSoapEnvelope parse_soap_envelope(const uint8_t *begin, const uint8_t *end) {
+		// only records up to the Body start are walked, each one is measured against end before it's read
+		const auto measure = [end](const uint8_t *p) {
+			const auto size = p < end ? detail::measureRecord(p, static_cast<size_t>(end - p)) : 0;
+			if (!size) {
+				throw std::invalid_argument("truncated SOAP Envelope");
+			}
+			return size;
+		};
+
+		if (begin == end || !IsElement(static_cast<NbfxRecordType>(*begin))) {
+			throw std::invalid_argument("expected SOAP Envelope");
+		}
+		auto p = begin + measure(begin);
+		NbfxReader<const uint8_t *> envelope_reader(begin);
+		if (!envelope_reader.read() || !detail::isSoapName(envelope_reader, "Envelope", detail::soap_envelope_id)) {
+			throw std::invalid_argument("expected SOAP Envelope");
+		}
+
+		NbfxSoapEnvelope envelope;
+		const uint8_t *body = nullptr;
+
+		while (!body) {
+			const auto size = measure(p);
+			const auto raw = *p;
+			const auto type = static_cast<NbfxRecordType>(raw);
+
+			if (IsElement(type)) {
+				NbfxReader<const uint8_t *> reader(p);
+				reader.read();
+				if (detail::isSoapName(reader, "Body", detail::soap_body_id)) {
+					body = p;
+					break;
+				}
+
+				const auto child_end = find_document_end(p, end);
+				if (detail::isSoapName(reader, "Header", detail::soap_header_id)) {
+					envelope.header_records = NbfxBytesView{p, static_cast<size_t>(child_end - p)};
+					envelope.header.emplace(parse(p));
+				}
+				p = child_end;
+			} else if (type == NbfxRecordType::EndElement || (IsTextRecord(type) && (raw & 1u))) {
+				throw std::invalid_argument("SOAP Body not found");
+			} else {
+				p += size;
+			}
+		}
+
+		// Body is the last child, so it spans to the Envelope end record
+		if (end - body < 2 || *(end - 1) != static_cast<uint8_t>(NbfxRecordType::EndElement)) {
+			throw std::invalid_argument("expected SOAP Envelope to end after Body");
+		}
+		envelope.body = NbfxBytesView{body, static_cast<size_t>(end - 1 - body)};
+
+		if (envelope.header) {
+			for (const auto &child : envelope.header->children()) {
+				const auto &name = child.name();
+				if (detail::isSoapName(name, L"Action", detail::soap_action_id)) {
+					envelope.action = detail::soapText(child.value());
+				} else if (detail::isSoapName(name, L"To", detail::soap_to_id)) {
+					envelope.to = detail::soapText(child.value());
+				} else if (detail::isSoapName(name, L"MessageID", detail::soap_message_id_id)) {
+					envelope.message_id = detail::soapText(child.value());
+				}
+			}
+		}
+
+		return envelope;
+	}
+
+	/**
+	 * Serializes a new envelope around the body of a parsed one, the body is copied as is
+	 *
+	 * The new envelope has to declare the namespace prefixes the body uses.
+	 */
+	template<typename TIt>
+	TIt serialize_soap_envelope(const NbfxElement &envelope, const NbfxSoapEnvelope &forwarded, TIt out, bool sort_members = true) {
+		return serialize_spliced(envelope, forwarded.body.data, forwarded.body.size, out, sort_members);
+	}
+
+	/**
+	 * Action lookup table with a perfect hash built once
+	 *
+	 * The hash seed and table size are searched at construction until every action gets its own slot,
+	 * a lookup is one hash, one slot and one comparison.
+	 */
+	template<typename T>
+	class NbfxActionTable {
+	public:
+		explicit NbfxActionTable(std::vector<std::pair<std::string, T>> routes) : m_routes(std::move(routes)) {
+			std::vector<std::string_view> actions;
+			for (const auto &route : m_routes) {
+				actions.emplace_back(route.first);
+			}
+			std::sort(actions.begin(), actions.end());
+			if (std::adjacent_find(actions.begin(), actions.end()) != actions.end()) {
+				throw std::invalid_argument("duplicate action");
+			}
+
+			size_t size = 1;
+			while (size < 2 * m_routes.size()) {
+				size *= 2;
+			}
+
+			for (;; size *= 2) {
+				for (uint32_t seed = 1; seed < 1000; ++seed) {
+					if (try_build(seed, size)) {
+						return;
+					}
+				}
+			}
+		}
+
+		/**
+		 * Returns the route of the action or nullptr
+		 */
+		const T *find(std::string_view action) const noexcept {
+			const auto slot = m_slots[hash(m_seed, action) & m_mask];
+			if (slot < 0 || m_routes[static_cast<size_t>(slot)].first != action) {
+				return nullptr;
+			}
+			return &m_routes[static_cast<size_t>(slot)].second;
+		}
+
+		size_t size() const noexcept {
+			return m_routes.size();
+		}
+
+	private:
+		static uint32_t hash(uint32_t seed, std::string_view action) noexcept {
+			return detail::hash_name(seed, action.data(), 0, action.size());
+		}
+
+		bool try_build(uint32_t seed, size_t size) {
+			std::vector<int> slots(size, -1);
+			for (size_t i = 0; i < m_routes.size(); ++i) {
+				auto &slot = slots[hash(seed, m_routes[i].first) & (size - 1)];
+				if (slot >= 0) {
+					return false;
+				}
+				slot = static_cast<int>(i);
+			}
+
+			m_seed = seed;
+			m_mask = size - 1;
+			m_slots = std::move(slots);
+			return true;
+		}
+
+		std::vector<std::pair<std::string, T>> m_routes;
+		std::vector<int> m_slots;
+		uint32_t m_seed = 0;
+		size_t m_mask = 0;
+	};
+}
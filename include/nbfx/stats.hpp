@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace nbfx {
+
+	/**
+	 * Groups of record types statistics report bytes for
+	 */
+	enum class NbfxRecordFamily : uint8_t {
+		Element,
+		Attribute,
+		End,
+		// Chars, UnicodeChars, Empty and Dictionary text
+		Text,
+		Bytes,
+		// numbers, booleans, DateTime, UniqueId, TimeSpan and Uuid
+		Scalar,
+		// pre-encoded records written as is, e.g. by serialize_spliced
+		Raw,
+		Other
+	};
+
+	constexpr size_t record_family_count = static_cast<size_t>(NbfxRecordFamily::Other) + 1;
+
+	constexpr NbfxRecordFamily record_family(uint8_t raw) noexcept {
+		if (raw == 0x01) {
+			return NbfxRecordFamily::End;
+		}
+		if (raw >= 0x04 && raw <= 0x3F) {
+			return NbfxRecordFamily::Attribute;
+		}
+		if (raw >= 0x40 && raw <= 0x77) {
+			return NbfxRecordFamily::Element;
+		}
+		if (raw < 0x80 || raw > 0xBD) {
+			return NbfxRecordFamily::Other;
+		}
+
+		const auto type = static_cast<uint8_t>(raw & 0xFEu);
+		if (type >= 0x9E && type <= 0xA2) {
+			return NbfxRecordFamily::Bytes;
+		}
+		if ((type >= 0x98 && type <= 0x9C) || (type >= 0xB6 && type <= 0xBC) || type == 0xA8 || type == 0xAA) {
+			return NbfxRecordFamily::Text;
+		}
+		if (type == 0xA4 || type == 0xA6) {
+			return NbfxRecordFamily::Other;
+		}
+		return NbfxRecordFamily::Scalar;
+	}
+
+	/**
+	 * Counters of parse or serialize
+	 */
+	struct NbfxCodecStats {
+		// records by type byte, so records with and without end are counted apart
+		std::array<uint64_t, 256> records{};
+		std::array<uint64_t, record_family_count> family_bytes{};
+		uint64_t documents = 0;
+		uint64_t max_depth = 0;
+		// wide characters converted from or to UTF-8
+		uint64_t characters = 0;
+		// bytes records appended to a value already holding bytes
+		uint64_t bytes_chunks = 0;
+		uint64_t nanoseconds = 0;
+
+		uint64_t family(NbfxRecordFamily family) const noexcept {
+			return family_bytes[static_cast<size_t>(family)];
+		}
+
+		void merge(const NbfxCodecStats &other) noexcept {
+			for (size_t i = 0; i < records.size(); ++i) {
+				records[i] += other.records[i];
+			}
+			for (size_t i = 0; i < family_bytes.size(); ++i) {
+				family_bytes[i] += other.family_bytes[i];
+			}
+			documents += other.documents;
+			max_depth = max_depth < other.max_depth ? other.max_depth : max_depth;
+			characters += other.characters;
+			bytes_chunks += other.bytes_chunks;
+			nanoseconds += other.nanoseconds;
+		}
+	};
+
+	/**
+	 * Statistics of parse and NbfxWriter, collected only if NBFX_ENABLE_STATS is defined
+	 */
+	struct NbfxStats {
+		NbfxCodecStats parse;
+		NbfxCodecStats serialize;
+
+		void merge(const NbfxStats &other) noexcept {
+			parse.merge(other.parse);
+			serialize.merge(other.serialize);
+		}
+	};
+
+	namespace detail {
+#ifdef NBFX_ENABLE_STATS
+		constexpr bool stats_enabled = true;
+#else
+		constexpr bool stats_enabled = false;
+#endif
+
+		/**
+		 * Counters of one thread, only the owner writes them so relaxed loads and stores are enough
+		 */
+		class NbfxCodecCounters {
+		public:
+			void record(uint8_t raw, size_t size, size_t depth) noexcept {
+				add(m_records[raw], 1);
+				add(m_family_bytes[static_cast<size_t>(record_family(raw))], size);
+				if (depth > m_max_depth.load(std::memory_order_relaxed)) {
+					m_max_depth.store(depth, std::memory_order_relaxed);
+				}
+			}
+
+			void raw(size_t size) noexcept {
+				add(m_family_bytes[static_cast<size_t>(NbfxRecordFamily::Raw)], size);
+			}
+
+			void characters(size_t count) noexcept {
+				add(m_characters, count);
+			}
+
+			void bytes_chunk() noexcept {
+				add(m_bytes_chunks, 1);
+			}
+
+			void document(uint64_t nanoseconds) noexcept {
+				add(m_documents, 1);
+				add(m_nanoseconds, nanoseconds);
+			}
+
+			void add_to(NbfxCodecStats &stats) const noexcept {
+				for (size_t i = 0; i < m_records.size(); ++i) {
+					stats.records[i] += m_records[i].load(std::memory_order_relaxed);
+				}
+				for (size_t i = 0; i < m_family_bytes.size(); ++i) {
+					stats.family_bytes[i] += m_family_bytes[i].load(std::memory_order_relaxed);
+				}
+				const auto depth = m_max_depth.load(std::memory_order_relaxed);
+				stats.max_depth = stats.max_depth < depth ? depth : stats.max_depth;
+				stats.documents += m_documents.load(std::memory_order_relaxed);
+				stats.characters += m_characters.load(std::memory_order_relaxed);
+				stats.bytes_chunks += m_bytes_chunks.load(std::memory_order_relaxed);
+				stats.nanoseconds += m_nanoseconds.load(std::memory_order_relaxed);
+			}
+
+			void reset() noexcept {
+				for (auto &counter : m_records) {
+					counter.store(0, std::memory_order_relaxed);
+				}
+				for (auto &counter : m_family_bytes) {
+					counter.store(0, std::memory_order_relaxed);
+				}
+				for (auto counter : {&m_documents, &m_max_depth, &m_characters, &m_bytes_chunks, &m_nanoseconds}) {
+					counter->store(0, std::memory_order_relaxed);
+				}
+			}
+
+		private:
+			static void add(std::atomic<uint64_t> &counter, uint64_t value) noexcept {
+				counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+			}
+
+			std::array<std::atomic<uint64_t>, 256> m_records{};
+			std::array<std::atomic<uint64_t>, record_family_count> m_family_bytes{};
+			std::atomic<uint64_t> m_documents{0};
+			std::atomic<uint64_t> m_max_depth{0};
+			std::atomic<uint64_t> m_characters{0};
+			std::atomic<uint64_t> m_bytes_chunks{0};
+			std::atomic<uint64_t> m_nanoseconds{0};
+		};
+
+		struct NbfxThreadStats {
+			NbfxCodecCounters parse;
+			NbfxCodecCounters serialize;
+
+			NbfxThreadStats();
+
+			~NbfxThreadStats();
+		};
+
+		/**
+		 * Counters of live threads and totals of threads that have exited
+		 */
+		class NbfxStatsRegistry {
+		public:
+			static NbfxStatsRegistry &instance() {
+				static NbfxStatsRegistry registry;
+				return registry;
+			}
+
+			void add(NbfxThreadStats *stats) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_threads.push_back(stats);
+			}
+
+			void remove(NbfxThreadStats *stats) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				stats->parse.add_to(m_exited.parse);
+				stats->serialize.add_to(m_exited.serialize);
+				m_threads.erase(std::find(m_threads.begin(), m_threads.end(), stats));
+			}
+
+			NbfxStats collect() {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				auto stats = m_exited;
+				for (const auto thread : m_threads) {
+					thread->parse.add_to(stats.parse);
+					thread->serialize.add_to(stats.serialize);
+				}
+				return stats;
+			}
+
+			void reset() {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_exited = NbfxStats();
+				for (const auto thread : m_threads) {
+					thread->parse.reset();
+					thread->serialize.reset();
+				}
+			}
+
+		private:
+			std::mutex m_mutex;
+			std::vector<NbfxThreadStats *> m_threads;
+			NbfxStats m_exited;
+		};
+
+		inline NbfxThreadStats::NbfxThreadStats() {
+			NbfxStatsRegistry::instance().add(this);
+		}
+
+		inline NbfxThreadStats::~NbfxThreadStats() {
+			NbfxStatsRegistry::instance().remove(this);
+		}
+
+		inline NbfxThreadStats &threadStats() {
+			thread_local NbfxThreadStats stats;
+			return stats;
+		}
+
+		/**
+		 * Counts a document and the time until it goes out of scope, does nothing unless stats are enabled
+		 */
+		class NbfxStatsTimer {
+		public:
+			explicit NbfxStatsTimer(bool parse, bool active = true) noexcept : m_parse(parse), m_active(active) {
+				if constexpr (stats_enabled) {
+					m_start = std::chrono::steady_clock::now();
+				}
+			}
+
+			~NbfxStatsTimer() {
+				if constexpr (stats_enabled) {
+					if (!m_active) {
+						return;
+					}
+					const auto elapsed = std::chrono::steady_clock::now() - m_start;
+					auto &stats = threadStats();
+					(m_parse ? stats.parse : stats.serialize).document(static_cast<uint64_t>(
+							std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+				}
+			}
+
+			NbfxStatsTimer(const NbfxStatsTimer &) = delete;
+
+			NbfxStatsTimer &operator=(const NbfxStatsTimer &) = delete;
+
+		private:
+			bool m_parse;
+			bool m_active;
+			std::chrono::steady_clock::time_point m_start;
+		};
+	}
+
+	/**
+	 * Statistics of all threads, empty unless NBFX_ENABLE_STATS is defined
+	 *
+	 * Counters of running threads are read while they change, so the snapshot is not atomic.
+	 */
+	inline NbfxStats collect_stats() {
+		if constexpr (detail::stats_enabled) {
+			return detail::NbfxStatsRegistry::instance().collect();
+		}
+		return NbfxStats();
+	}
+
+	/**
+	 * Sets all counters to zero
+	 */
+	inline void reset_stats() {
+		if constexpr (detail::stats_enabled) {
+			detail::NbfxStatsRegistry::instance().reset();
+		}
+	}
+}
@@ -0,0 +1,457 @@
+#pragma once
+
+#include "deserializer.hpp"
+#include "quotas.hpp"
+#include "reader.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <istream>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace nbfx {
+
+	/**
+	 * Input source reading from std::istream, the stream has to outlive the source
+	 */
+	struct NbfxIstreamSource {
+		std::istream &stream;
+
+		size_t read(uint8_t *buffer, size_t size) {
+			stream.read(reinterpret_cast<char *>(buffer), static_cast<std::streamsize>(size));
+			if (stream.bad()) {
+				throw std::runtime_error("failed to read input stream");
+			}
+			return static_cast<size_t>(stream.gcount());
+		}
+	};
+
+	/**
+	 * Input source reading from FILE*, the file is not closed
+	 */
+	struct NbfxFileSource {
+		std::FILE *file;
+
+		size_t read(uint8_t *buffer, size_t size) {
+			const auto n = std::fread(buffer, 1, size, file);
+			if (n == 0 && std::ferror(file)) {
+				throw std::runtime_error("failed to read input file");
+			}
+			return n;
+		}
+	};
+
+#if defined(__unix__) || defined(__APPLE__)
+	/**
+	 * Input source reading from file descriptor, the descriptor is not closed
+	 */
+	struct NbfxFdSource {
+		int fd;
+
+		size_t read(uint8_t *buffer, size_t size) {
+			for (;;) {
+				const auto n = ::read(fd, buffer, size);
+				if (n >= 0) {
+					return static_cast<size_t>(n);
+				}
+				if (errno != EINTR) {
+					throw std::system_error(errno, std::generic_category(), "failed to read input");
+				}
+			}
+		}
+	};
+#endif
+
+	/**
+	 * Writable part of the parser buffer
+	 */
+	struct NbfxBufferSpan {
+		uint8_t *data;
+		size_t size;
+	};
+
+	/**
+	 * Resumable parser fed with input as it arrives
+	 *
+	 * Input is written to prepare() and committed with commit(), or copied in with feed().
+	 * next() parses the records that are complete and returns a document once its topmost element ends.
+	 * Bytes records larger than the buffer are passed to the sink in pieces or collected in their own vector,
+	 * prepare() then points right into that vector so the payload is not copied twice. The vector grows as
+	 * the payload arrives. Chars records larger than the buffer are collected the same way and decoded once complete.
+	 * Bytes records longer than max_bytes_length are rejected as soon as their header is read, other records
+	 * longer than max_record_length as soon as their length prefix or that much of them has arrived.
+	 * A parser constructed with quotas checks every record against them like parse(p, quotas) does,
+	 * lengths of strings are checked as soon as their length prefix arrives.
+	 */
+	class NbfxIncrementalParser {
+	public:
+		static constexpr size_t default_buffer_size = 64 * 1024;
+		static constexpr size_t default_max_bytes_length = 64 * 1024 * 1024;
+		static constexpr size_t default_max_record_length = default_max_bytes_length;
+
+		explicit NbfxIncrementalParser(size_t buffer_size = default_buffer_size,
+		                               size_t max_bytes_length = default_max_bytes_length,
+		                               size_t max_record_length = default_max_record_length) :
+				m_buffer(std::max<size_t>(buffer_size, 16)),
+				m_max_bytes_length(max_bytes_length),
+				m_max_record_length(max_record_length) {}
+
+		NbfxIncrementalParser(size_t buffer_size, const NbfxReaderQuotas &quotas,
+		                      size_t max_record_length = default_max_record_length) :
+				m_buffer(std::max<size_t>(buffer_size, 16)),
+				m_max_bytes_length(quotas.max_bytes_length),
+				m_max_record_length(max_record_length),
+				m_guard(std::in_place, quotas) {}
+
+		/**
+		 * Returns space for the next portion of input, never empty
+		 */
+		NbfxBufferSpan prepare() {
+			if (m_pending && !m_pending_sink) {
+				grow_chunk();
+			}
+			m_direct = m_pending && !m_pending_sink && !buffered() && m_chunk_filled < m_chunk.size();
+			if (m_direct) {
+				return {m_chunk.data() + m_chunk_filled, m_chunk.size() - m_chunk_filled};
+			}
+
+			if (m_begin == m_end) {
+				m_begin = m_end = 0;
+			} else if (m_begin && m_buffer.size() - m_end < m_buffer.size() / 2) {
+				std::memmove(m_buffer.data(), data(), buffered());
+				m_end -= m_begin;
+				m_begin = 0;
+			}
+
+			if (m_end == m_buffer.size()) {
+				m_buffer.resize(2 * m_buffer.size());
+			}
+
+			return {m_buffer.data() + m_end, m_buffer.size() - m_end};
+		}
+
+		/**
+		 * Marks size bytes written to the last prepared span as input
+		 */
+		void commit(size_t size) noexcept {
+			if (m_direct) {
+				m_chunk_filled += size;
+			} else {
+				m_end += size;
+			}
+			m_direct = false;
+		}
+
+		/**
+		 * Copies input into the parser
+		 */
+		void feed(const uint8_t *input, size_t size) {
+			while (size) {
+				const auto span = prepare();
+				const auto n = std::min(size, span.size);
+				std::memcpy(span.data, input, n);
+				commit(n);
+				input += n;
+				size -= n;
+			}
+		}
+
+		/**
+		 * Parses buffered input, returns the document once it's complete
+		 */
+		std::optional<NbfxElement> next() {
+			NbfxNullSink sink;
+			return next(sink);
+		}
+
+		/**
+		 * Parses buffered input passing payload of bytes records to the sink like parse(p, sink) does
+		 *
+		 * Records larger than the buffer are passed in pieces: if the sink consumes the first piece
+		 * it receives the rest of the record as well. The same sink has to be used until the document is complete.
+		 */
+		template<typename TSink>
+		std::optional<NbfxElement> next(TSink &sink) {
+			for (;;) {
+				if (m_pending) {
+					if (!pending_payload(sink)) {
+						return std::nullopt;
+					}
+					if (m_pending_end && m_builder.end_element()) {
+						return result();
+					}
+					continue;
+				}
+
+				if (!buffered()) {
+					return std::nullopt;
+				}
+
+				const auto raw = data()[0];
+				const auto type = static_cast<NbfxRecordType>(raw);
+
+				const auto bytes = detail::isBytesRecord(type);
+				if (bytes || detail::isCharsRecord(type)) {
+					const auto header = 1u + detail::textLayout(type).length_size;
+					if (buffered() < header) {
+						return std::nullopt;
+					}
+
+					size_t size = 0;
+					for (auto i = 1u; i < header; ++i) {
+						size |= static_cast<size_t>(data()[i]) << (8u * (i - 1));
+					}
+					if (bytes && size > m_max_bytes_length) {
+						throw std::length_error("bytes record exceeds max_bytes_length");
+					}
+					if (!bytes && size > m_max_record_length) {
+						throw std::length_error("record exceeds max_record_length");
+					}
+
+					if (header + size > m_buffer.size()) {
+						if (!m_builder.started()) {
+							throw std::invalid_argument("expected element as a topmost node");
+						}
+						const auto withEnd = (raw & 1u) == 1u;
+						if (m_guard && bytes) {
+							m_guard->before_bytes(size, withEnd);
+						} else if (m_guard) {
+							m_guard->before_text(size);
+						}
+						consume(header);
+						start_payload(sink, size, withEnd, !bytes);
+						continue;
+					}
+				}
+
+				detail::NbfxRecordMeasure m(data(), buffered());
+				const auto size = detail::measureRecord(m);
+				if (!size) {
+					// lengths of names and text that have arrived are checked before the rest is buffered
+					if (m_guard) {
+						m_guard->check_string(m.longest_string());
+					}
+					if (m.longest_string() > m_max_record_length || buffered() >= m_max_record_length) {
+						throw std::length_error("record exceeds max_record_length");
+					}
+					return std::nullopt;
+				}
+				if (size > m_max_record_length) {
+					throw std::length_error("record exceeds max_record_length");
+				}
+
+				auto p = data();
+				const auto done = m_guard ? m_builder.record(p, sink, m_hooks, *m_guard) : m_builder.record(p, sink);
+				consume(size);
+
+				if (done) {
+					return result();
+				}
+			}
+		}
+
+		/**
+		 * Checks if no document is in progress and no input is buffered
+		 */
+		bool idle() const noexcept {
+			return !m_pending && !buffered() && !m_builder.started();
+		}
+
+	private:
+		NbfxElement result() {
+			if (m_guard) {
+				m_guard->reset();
+			}
+			return m_builder.result();
+		}
+
+		const uint8_t *data() const noexcept {
+			return m_buffer.data() + m_begin;
+		}
+
+		size_t buffered() const noexcept {
+			return m_end - m_begin;
+		}
+
+		void consume(size_t size) noexcept {
+			m_begin += size;
+		}
+
+		/**
+		 * Starts a bytes or Chars record larger than the buffer, only bytes are offered to the sink
+		 */
+		template<typename TSink>
+		void start_payload(TSink &sink, size_t size, bool withEnd, bool text) {
+			const auto first = std::min(size, buffered());
+
+			m_pending = true;
+			m_pending_end = withEnd;
+			m_pending_text = text;
+			m_pending_left = size - first;
+			m_pending_sink = !text && m_builder.offer_bytes(sink, data(), first);
+
+			if (!m_pending_sink) {
+				// the length is untrusted, memory is only taken for the payload that has arrived
+				m_chunk_size = size;
+				m_chunk.resize(std::min(size, std::max(first, m_buffer.size())));
+				std::memcpy(m_chunk.data(), data(), first);
+				m_chunk_filled = first;
+			}
+			consume(first);
+		}
+
+		/**
+		 * Doubles the payload vector of a large record once it's full, up to the record length
+		 */
+		void grow_chunk() {
+			if (m_chunk_filled == m_chunk.size() && m_chunk.size() < m_chunk_size) {
+				m_chunk.resize(std::min(m_chunk_size, 2 * m_chunk.size()));
+			}
+		}
+
+		/**
+		 * Moves buffered payload of a large record along, returns true when the record is complete
+		 */
+		template<typename TSink>
+		bool pending_payload(TSink &sink) {
+			if (m_pending_sink) {
+				const auto piece = std::min(m_pending_left, buffered());
+				if (piece) {
+					m_builder.offer_bytes(sink, data(), piece);
+					consume(piece);
+					m_pending_left -= piece;
+				}
+			} else {
+				while (m_chunk_filled < m_chunk_size && buffered()) {
+					grow_chunk();
+					const auto piece = std::min(m_chunk.size() - m_chunk_filled, buffered());
+					std::memcpy(m_chunk.data() + m_chunk_filled, data(), piece);
+					consume(piece);
+					m_chunk_filled += piece;
+				}
+				m_pending_left = m_chunk_size - m_chunk_filled;
+			}
+
+			if (m_pending_left) {
+				return false;
+			}
+
+			if (m_pending_text) {
+				const auto chars = reinterpret_cast<const char *>(m_chunk.data());
+				m_builder.set_text(NbfxValue(detail::decodeChars(chars, chars + m_chunk.size())));
+				m_chunk = {};
+				m_chunk_size = 0;
+			} else if (!m_pending_sink) {
+				m_builder.append_bytes(std::move(m_chunk));
+				m_chunk = {};
+				m_chunk_size = 0;
+			}
+			m_pending = false;
+			return true;
+		}
+
+		detail::NbfxDomBuilder m_builder;
+		std::vector<uint8_t> m_buffer;
+		size_t m_begin = 0;
+		size_t m_end = 0;
+		bool m_direct = false;
+
+		bool m_pending = false;
+		bool m_pending_end = false;
+		bool m_pending_sink = false;
+		bool m_pending_text = false;
+		size_t m_pending_left = 0;
+		std::vector<uint8_t> m_chunk;
+		size_t m_chunk_filled = 0;
+		size_t m_chunk_size = 0;
+		size_t m_max_bytes_length;
+		size_t m_max_record_length;
+		std::optional<detail::NbfxQuotaGuard> m_guard;
+		NbfxNoHooks m_hooks;
+	};
+
+	/**
+	 * Parses documents from an input source
+	 *
+	 * Source is anything with `size_t read(uint8_t *buffer, size_t size)` returning 0 at the end of data.
+	 * The source is read in buffer sized portions, data read past the end of a document stays buffered for the next one.
+	 */
+	template<typename TSource>
+	class NbfxStreamParser {
+	public:
+		static constexpr size_t default_buffer_size = NbfxIncrementalParser::default_buffer_size;
+		static constexpr size_t default_max_bytes_length = NbfxIncrementalParser::default_max_bytes_length;
+		static constexpr size_t default_max_record_length = NbfxIncrementalParser::default_max_record_length;
+
+		explicit NbfxStreamParser(TSource source,
+		                          size_t buffer_size = default_buffer_size,
+		                          size_t max_bytes_length = default_max_bytes_length,
+		                          size_t max_record_length = default_max_record_length) :
+				m_source(std::move(source)),
+				m_parser(buffer_size, max_bytes_length, max_record_length) {}
+
+		NbfxStreamParser(TSource source, size_t buffer_size, const NbfxReaderQuotas &quotas,
+		                 size_t max_record_length = default_max_record_length) :
+				m_source(std::move(source)),
+				m_parser(buffer_size, quotas, max_record_length) {}
+
+		/**
+		 * Checks if the source has no more data
+		 */
+		bool at_end() {
+			return m_parser.idle() && !read();
+		}
+
+		/**
+		 * Parses the next document
+		 */
+		NbfxElement parse() {
+			NbfxNullSink sink;
+			return parse(sink);
+		}
+
+		/**
+		 * Parses the next document passing payload of bytes records to the sink, see NbfxIncrementalParser::next
+		 */
+		template<typename TSink>
+		NbfxElement parse(TSink &sink) {
+			for (;;) {
+				if (auto element = m_parser.next(sink)) {
+					return std::move(*element);
+				}
+				if (!read()) {
+					throw std::runtime_error("unexpected end of stream");
+				}
+			}
+		}
+
+	private:
+		size_t read() {
+			const auto span = m_parser.prepare();
+			const auto n = m_source.read(span.data, span.size);
+			m_parser.commit(n);
+			return n;
+		}
+
+		TSource m_source;
+		NbfxIncrementalParser m_parser;
+	};
+
+	/**
+	 * Parses single document from the source, data read past its end is dropped
+	 */
+	template<typename TSource>
+	NbfxElement parse_stream(TSource source, size_t buffer_size = NbfxStreamParser<TSource>::default_buffer_size) {
+		return NbfxStreamParser<TSource>(std::move(source), buffer_size).parse();
+	}
+}
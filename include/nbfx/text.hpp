@@ -0,0 +1,256 @@
+#pragma once
+
+#include "NbfxRecord.hpp"
+#include "reader.hpp"
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace nbfx {
+
+	namespace detail {
+		constexpr uint64_t swar_ones = 0x0101010101010101ull;
+		constexpr uint64_t swar_highs = 0x8080808080808080ull;
+
+		/**
+		 * Sets the high bit of every zero byte of v, bytes above the first zero may be reported falsely
+		 */
+		constexpr uint64_t swarZeroBytes(uint64_t v) noexcept {
+			return (v - swar_ones) & ~v & swar_highs;
+		}
+
+		constexpr uint64_t swarMatch(uint64_t v, uint8_t c) noexcept {
+			return swarZeroBytes(v ^ (swar_ones * c));
+		}
+
+		/**
+		 * Sets the high bit of bytes below c, c has to be at most 0x80
+		 */
+		constexpr uint64_t swarBelow(uint64_t v, uint8_t c) noexcept {
+			return (v - swar_ones * c) & ~v & swar_highs;
+		}
+
+		/**
+		 * Appends text to out with bytes replaced by escape(c) where it's not empty
+		 *
+		 * Eight bytes are tested at a time with needs(word), only words with a hit are scanned bytewise,
+		 * runs of bytes that need no escaping are appended in one go.
+		 */
+		template<typename FNeeds, typename FEscape>
+		void appendEscaped(std::string &out, std::string_view text, FNeeds needs, FEscape escape) {
+			auto p = text.data();
+			const auto end = p + text.size();
+			auto run = p;
+
+			const auto scan = [&](const char *last) {
+				for (; p < last; ++p) {
+					const auto replacement = escape(static_cast<uint8_t>(*p));
+					if (!replacement.empty()) {
+						out.append(run, p);
+						out.append(replacement);
+						run = p + 1;
+					}
+				}
+			};
+
+			while (end - p >= 8) {
+				if (needs(load<uint64_t>(reinterpret_cast<const uint8_t *>(p)))) {
+					scan(p + 8);
+				} else {
+					p += 8;
+				}
+			}
+			scan(end);
+			out.append(run, end);
+		}
+
+		struct NbfxBase64Pairs {
+			char pairs[4096][2];
+
+			constexpr NbfxBase64Pairs() : pairs() {
+				constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+				for (auto i = 0u; i < 4096u; ++i) {
+					pairs[i][0] = alphabet[i >> 6u];
+					pairs[i][1] = alphabet[i & 0x3Fu];
+				}
+			}
+		};
+
+		// two base64 digits for every 12 bits of input
+		inline constexpr NbfxBase64Pairs base64_pairs{};
+
+		inline void appendBase64(std::string &out, const uint8_t *data, size_t size) {
+			const auto offset = out.size();
+			out.resize(offset + (size + 2) / 3 * 4);
+			auto o = &out[offset];
+
+			size_t i = 0;
+			for (; size - i >= 3; i += 3, o += 4) {
+				const auto v = static_cast<uint32_t>(data[i]) << 16u | static_cast<uint32_t>(data[i + 1]) << 8u | data[i + 2];
+				std::memcpy(o, base64_pairs.pairs[v >> 12u], 2);
+				std::memcpy(o + 2, base64_pairs.pairs[v & 0xFFFu], 2);
+			}
+
+			if (i < size) {
+				auto v = static_cast<uint32_t>(data[i]) << 16u;
+				if (size - i == 2) {
+					v |= static_cast<uint32_t>(data[i + 1]) << 8u;
+				}
+				std::memcpy(o, base64_pairs.pairs[v >> 12u], 2);
+				o[2] = size - i == 2 ? base64_pairs.pairs[v & 0xFFFu][0] : '=';
+				o[3] = '=';
+			}
+		}
+
+		template<typename T>
+		void appendNumber(std::string &out, T value) {
+			char buffer[32];
+			const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			out.append(buffer, result.ptr);
+		}
+
+		inline void appendUtf8(std::string &out, uint32_t cp) {
+			if (cp < 0x80u) {
+				out += static_cast<char>(cp);
+			} else if (cp < 0x800u) {
+				out += static_cast<char>(0xC0u | cp >> 6u);
+				out += static_cast<char>(0x80u | (cp & 0x3Fu));
+			} else if (cp < 0x10000u) {
+				out += static_cast<char>(0xE0u | cp >> 12u);
+				out += static_cast<char>(0x80u | (cp >> 6u & 0x3Fu));
+				out += static_cast<char>(0x80u | (cp & 0x3Fu));
+			} else {
+				out += static_cast<char>(0xF0u | cp >> 18u);
+				out += static_cast<char>(0x80u | (cp >> 12u & 0x3Fu));
+				out += static_cast<char>(0x80u | (cp >> 6u & 0x3Fu));
+				out += static_cast<char>(0x80u | (cp & 0x3Fu));
+			}
+		}
+
+		/**
+		 * Appends UTF-16LE payload of UnicodeChars*Text as UTF-8, unpaired surrogates become U+FFFD
+		 */
+		inline void appendUtf16(std::string &out, NbfxBytesView text) {
+			const auto units = text.size / 2;
+			for (size_t i = 0; i < units; ++i) {
+				uint32_t cp = load<uint16_t>(text.data + 2 * i);
+				if (cp >= 0xD800u && cp < 0xDC00u && i + 1 < units) {
+					const uint32_t low = load<uint16_t>(text.data + 2 * i + 2);
+					if (low >= 0xDC00u && low < 0xE000u) {
+						cp = 0x10000u + ((cp - 0xD800u) << 10u) + (low - 0xDC00u);
+						++i;
+					}
+				}
+				appendUtf8(out, cp >= 0xD800u && cp < 0xE000u ? 0xFFFDu : cp);
+			}
+		}
+
+		inline void appendDigits(std::string &out, uint32_t value, int width) {
+			char buffer[10];
+			for (auto i = width - 1; i >= 0; --i, value /= 10) {
+				buffer[i] = static_cast<char>('0' + value % 10);
+			}
+			out.append(buffer, static_cast<size_t>(width));
+		}
+
+		/**
+		 * Appends xsd:dateTime with 100ns precision, NBFX DateTime carries no time zone offset
+		 */
+		inline void appendDateTime(std::string &out, datetime_t value) {
+			constexpr int64_t ticks_per_day = 864000000000ll;
+			const auto ticks = value.time_since_epoch().count() / 100;
+			auto days = ticks / ticks_per_day;
+			auto rest = ticks % ticks_per_day;
+			if (rest < 0) {
+				rest += ticks_per_day;
+				--days;
+			}
+
+			// days to civil date, see http://howardhinnant.github.io/date_algorithms.html
+			const auto z = days + 719468;
+			const auto era = (z >= 0 ? z : z - 146096) / 146097;
+			const auto doe = static_cast<uint32_t>(z - era * 146097);
+			const auto yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+			const auto doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+			const auto mp = (5 * doy + 2) / 153;
+			const auto day = doy - (153 * mp + 2) / 5 + 1;
+			const auto month = mp < 10 ? mp + 3 : mp - 9;
+			const auto year = static_cast<int64_t>(yoe) + era * 400 + (month <= 2);
+
+			if (year < 0) {
+				out += '-';
+			}
+			appendDigits(out, static_cast<uint32_t>(year < 0 ? -year : year), 4);
+			out += '-';
+			appendDigits(out, month, 2);
+			out += '-';
+			appendDigits(out, day, 2);
+			out += 'T';
+
+			const auto seconds = static_cast<uint32_t>(rest / 10000000);
+			appendDigits(out, seconds / 3600, 2);
+			out += ':';
+			appendDigits(out, seconds / 60 % 60, 2);
+			out += ':';
+			appendDigits(out, seconds % 60, 2);
+
+			auto fraction = static_cast<uint32_t>(rest % 10000000);
+			if (fraction) {
+				auto width = 7;
+				for (; fraction % 10 == 0; fraction /= 10) {
+					--width;
+				}
+				out += '.';
+				appendDigits(out, fraction, width);
+			}
+		}
+
+		/**
+		 * Text buffer which is written out to a stream whenever it grows past the threshold
+		 */
+		class NbfxTextOutput {
+		public:
+			static constexpr size_t flush_threshold = 64 * 1024;
+
+			explicit NbfxTextOutput(std::string &buffer, std::ostream *stream = nullptr) :
+					m_buffer(buffer), m_stream(stream) {}
+
+			std::string &buffer() noexcept {
+				return m_buffer;
+			}
+
+			void flush_if_full() {
+				if (m_stream && m_buffer.size() >= flush_threshold) {
+					flush();
+				}
+			}
+
+			void flush() {
+				if (m_stream) {
+					m_stream->write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+					m_buffer.clear();
+				}
+			}
+
+			/**
+			 * Writes the first size bytes of the buffer, returns how many bytes left the buffer
+			 */
+			size_t flush(size_t size) {
+				if (!m_stream) {
+					return 0;
+				}
+				m_stream->write(m_buffer.data(), static_cast<std::streamsize>(size));
+				m_buffer.erase(0, size);
+				return size;
+			}
+
+		private:
+			std::string &m_buffer;
+			std::ostream *m_stream;
+		};
+	}
+}
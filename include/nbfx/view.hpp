@@ -0,0 +1,280 @@
+#pragma once
+
+#include "reader.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <string_view>
+#include <functional>
+#include <queue>
+
+namespace nbfx {
+
+	/**
+	 * Value of an element in a view tree
+	 *
+	 * Consecutive bytes records are kept as chunks of one value, any other text replaces the value like parse does.
+	 */
+	class NbfxValueView {
+	public:
+		bool empty() const noexcept {
+			return m_count == 0;
+		}
+
+		size_t record_count() const noexcept {
+			return m_count;
+		}
+
+		/**
+		 * The first text record of the value
+		 */
+		const NbfxTextView &text() const noexcept {
+			return m_first;
+		}
+
+		/**
+		 * Calls f for each text record of the value
+		 */
+		template<typename F>
+		void for_each_text(F &&f) const {
+			if (m_count == 1) {
+				f(m_first);
+				return;
+			}
+
+			auto p = m_first.record();
+			NbfxTextView text;
+			for (size_t i = 0; i < m_count; ++i) {
+				text.decode(p);
+				f(text);
+			}
+		}
+
+		/**
+		 * Decodes the value into owning NbfxValue
+		 */
+		NbfxValue value() const {
+			if (m_count == 0) {
+				return NbfxValue();
+			}
+			if (m_count == 1) {
+				return m_first.value();
+			}
+
+			NbfxValue result{std::vector<uint8_t>()};
+			auto &joined = result.bytes();
+			for_each_text([&joined](const NbfxTextView &text) {
+				const auto bytes = text.bytes();
+				joined.insert(joined.end(), bytes.data, bytes.data + bytes.size);
+			});
+			return result;
+		}
+
+		void append(const NbfxTextView &text, const uint8_t *end) {
+			if (m_count && m_end == text.record() && is_bytes(m_first.type()) && is_bytes(text.type())) {
+				++m_count;
+			} else {
+				m_first = text;
+				m_count = 1;
+			}
+			m_end = end;
+		}
+
+	private:
+		static bool is_bytes(NbfxRecordType type) noexcept {
+			return type >= NbfxRecordType::Bytes8Text && type <= NbfxRecordType::Bytes32Text;
+		}
+
+		NbfxTextView m_first;
+		size_t m_count = 0;
+		const uint8_t *m_end = nullptr;
+	};
+
+	/**
+	 * Attribute of an element in a view tree
+	 */
+	class NbfxAttributeView {
+	public:
+		template<typename TIter>
+		explicit NbfxAttributeView(const NbfxReader<TIter> &reader) :
+				m_type(reader.record_type()),
+				m_prefix(reader.prefix()),
+				m_name(reader.name()),
+				m_dictionary_name(reader.is_dictionary_name()),
+				m_name_id(reader.name_id()),
+				m_value(reader.text()) {}
+
+		NbfxRecordType type() const noexcept {
+			return m_type;
+		}
+
+		std::string_view prefix() const noexcept {
+			return m_prefix;
+		}
+
+		std::string_view name() const noexcept {
+			return m_name;
+		}
+
+		bool is_dictionary_name() const noexcept {
+			return m_dictionary_name;
+		}
+
+		uint32_t name_id() const noexcept {
+			return m_name_id;
+		}
+
+		const NbfxTextView &value() const noexcept {
+			return m_value;
+		}
+
+	private:
+		NbfxRecordType m_type;
+		std::string_view m_prefix;
+		std::string_view m_name;
+		bool m_dictionary_name;
+		uint32_t m_name_id;
+		NbfxTextView m_value;
+	};
+
+	/**
+	 * Element of a view tree, names and values point into the parsed input
+	 */
+	class NbfxElementView {
+	public:
+		template<typename TIter>
+		explicit NbfxElementView(const NbfxReader<TIter> &reader) :
+				m_type(reader.record_type()),
+				m_prefix(reader.prefix()),
+				m_name(reader.name()),
+				m_dictionary_name(reader.is_dictionary_name()),
+				m_name_id(reader.name_id()) {}
+
+		NbfxRecordType type() const noexcept {
+			return m_type;
+		}
+
+		std::string_view prefix() const noexcept {
+			return m_prefix;
+		}
+
+		std::string_view name() const noexcept {
+			return m_name;
+		}
+
+		bool is_dictionary_name() const noexcept {
+			return m_dictionary_name;
+		}
+
+		uint32_t name_id() const noexcept {
+			return m_name_id;
+		}
+
+		std::vector<NbfxAttributeView> &attributes() noexcept {
+			return m_attributes;
+		}
+
+		const std::vector<NbfxAttributeView> &attributes() const noexcept {
+			return m_attributes;
+		}
+
+		std::vector<NbfxElementView> &children() noexcept {
+			return m_children;
+		}
+
+		const std::vector<NbfxElementView> &children() const noexcept {
+			return m_children;
+		}
+
+		NbfxValueView &value() noexcept {
+			return m_value;
+		}
+
+		const NbfxValueView &value() const noexcept {
+			return m_value;
+		}
+
+		/**
+		 * Returns first descendant with matching UTF-8 name or nullptr if none found
+		 *
+		 * Search is performed breath-first
+		 */
+		const NbfxElementView *find_descendant(std::string_view name) const {
+			std::queue<std::reference_wrapper<const NbfxElementView>> q1;
+			q1.emplace(*this);
+
+			while (!q1.empty()) {
+				const auto &current = q1.front().get();
+				q1.pop();
+
+				if (current.name() == name) {
+					return &current;
+				}
+
+				for (const auto &ch : current.children()) {
+					q1.emplace(ch);
+				}
+			}
+
+			return nullptr;
+		}
+
+		/**
+		 * Returns first child with matching UTF-8 name or nullptr if none found
+		 */
+		const NbfxElementView *first_child(std::string_view name) const {
+			const auto it = std::find_if(m_children.cbegin(), m_children.cend(),
+										 [name](const auto &child) { return child.name() == name; });
+
+			return it == m_children.cend() ? nullptr : &(*it);
+		}
+
+	private:
+		NbfxRecordType m_type;
+		std::string_view m_prefix;
+		std::string_view m_name;
+		bool m_dictionary_name;
+		uint32_t m_name_id;
+		std::vector<NbfxAttributeView> m_attributes;
+		std::vector<NbfxElementView> m_children;
+		NbfxValueView m_value;
+	};
+
+	/**
+	 * Parses the document into a view tree, the input has to outlive the tree
+	 */
+	template<typename TIter>
+	NbfxElementView parse_view(TIter p) {
+		NbfxReader<TIter> reader(p);
+		std::vector<NbfxElementView> stack;
+
+		while (reader.read()) {
+			switch (reader.node_type()) {
+				case NbfxNodeType::Element:
+					stack.emplace_back(reader);
+					break;
+				case NbfxNodeType::Attribute:
+					stack.back().attributes().emplace_back(reader);
+					break;
+				case NbfxNodeType::Text:
+					stack.back().value().append(reader.text(),
+												reader.text().record() + (reader.position() - reader.record_begin()));
+					break;
+				case NbfxNodeType::EndElement: {
+					auto element = std::move(stack.back());
+					stack.pop_back();
+
+					if (stack.empty()) {
+						return element;
+					}
+					stack.back().children().emplace_back(std::move(element));
+					break;
+				}
+				default:
+					break;
+			}
+		}
+
+		throw std::invalid_argument("unexpected end of document");
+	}
+}
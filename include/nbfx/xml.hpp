@@ -0,0 +1,664 @@
+#pragma once
+
+#include "reader.hpp"
+#include "text.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace nbfx {
+
+	struct NbfxXmlOptions {
+		// strings of dictionary ids, names are written as parse names them ("D:<id>") if not set
+		std::function<std::string_view(uint32_t)> dictionary;
+		// keep text nodes of whitespace only when encoding XML
+		bool keep_whitespace = false;
+	};
+
+	namespace detail {
+		inline std::string_view xmlTextEscape(uint8_t c) noexcept {
+			switch (c) {
+				case '&':
+					return "&amp;";
+				case '<':
+					return "&lt;";
+				case '>':
+					return "&gt;";
+				case '\r':
+					return "&#13;";
+				default:
+					return {};
+			}
+		}
+
+		inline std::string_view xmlAttributeEscape(uint8_t c) noexcept {
+			switch (c) {
+				case '"':
+					return "&quot;";
+				case '\t':
+					return "&#9;";
+				case '\n':
+					return "&#10;";
+				default:
+					return xmlTextEscape(c);
+			}
+		}
+
+		inline void appendXmlEscaped(std::string &out, std::string_view text, bool attribute) {
+			if (attribute) {
+				appendEscaped(out, text, [](uint64_t v) {
+					return swarMatch(v, '&') | swarMatch(v, '<') | swarMatch(v, '>') | swarMatch(v, '"') | swarBelow(v, 0x0E);
+				}, xmlAttributeEscape);
+			} else {
+				appendEscaped(out, text, [](uint64_t v) {
+					return swarMatch(v, '&') | swarMatch(v, '<') | swarMatch(v, '>') | swarMatch(v, '\r');
+				}, xmlTextEscape);
+			}
+		}
+
+		/**
+		 * Writes XML text straight from the records of a document
+		 */
+		class NbfxXmlWriter {
+		public:
+			NbfxXmlWriter(NbfxTextOutput &output, const NbfxXmlOptions &options) :
+					m_output(output), m_out(output.buffer()), m_options(options) {}
+
+			const uint8_t *write(const uint8_t *begin) {
+				NbfxReader<const uint8_t *> reader(begin);
+				while (reader.read()) {
+					if (reader.node_type() != NbfxNodeType::Text || !is_bytes(reader.record_type())) {
+						flush_bytes();
+					}
+
+					switch (reader.node_type()) {
+						case NbfxNodeType::Element:
+							close_start();
+							m_ends.push_back(m_names.size());
+							append_qname(m_names, reader.prefix(), reader);
+							m_out += '<';
+							m_out.append(m_names, m_ends.back(), std::string::npos);
+							m_open = true;
+							break;
+						case NbfxNodeType::Attribute:
+							m_out += ' ';
+							if (reader.is_xmlns()) {
+								m_out += "xmlns";
+								if (!reader.prefix().empty()) {
+									m_out += ':';
+									m_out.append(reader.prefix());
+								}
+							} else {
+								append_qname(m_out, reader.prefix(), reader);
+							}
+							m_out += "=\"";
+							append_text(reader.text(), true);
+							flush_bytes();
+							m_out += '"';
+							break;
+						case NbfxNodeType::Text:
+							close_start();
+							append_text(reader.text(), false);
+							break;
+						case NbfxNodeType::EndElement:
+							if (m_open) {
+								m_out += "/>";
+								m_open = false;
+							} else {
+								m_out += "</";
+								m_out.append(m_names, m_ends.back(), std::string::npos);
+								m_out += '>';
+							}
+							m_names.resize(m_ends.back());
+							m_ends.pop_back();
+							m_output.flush_if_full();
+							break;
+						default:
+							break;
+					}
+				}
+				return reader.position();
+			}
+
+		private:
+			void close_start() {
+				if (m_open) {
+					m_out += '>';
+					m_open = false;
+				}
+			}
+
+			void append_dictionary(std::string &out, uint32_t id) const {
+				if (m_options.dictionary) {
+					out.append(m_options.dictionary(id));
+				} else {
+					out += "D:";
+					appendNumber(out, id);
+				}
+			}
+
+			void append_qname(std::string &out, std::string_view prefix, const NbfxReader<const uint8_t *> &reader) const {
+				if (!prefix.empty()) {
+					out.append(prefix);
+					out += ':';
+				}
+				if (reader.is_dictionary_name()) {
+					append_dictionary(out, reader.name_id());
+				} else {
+					out.append(reader.name());
+				}
+			}
+
+			void append_text(const NbfxTextView &text, bool attribute) {
+				const auto type = text.type();
+				if (m_list && type != NbfxRecordType::EndListText) {
+					if (!m_list_first) {
+						m_out += ' ';
+					}
+					m_list_first = false;
+				}
+
+				switch (type) {
+					case NbfxRecordType::EmptyText:
+						break;
+					case NbfxRecordType::Chars8Text:
+					case NbfxRecordType::Chars16Text:
+					case NbfxRecordType::Chars32Text:
+						append_chars(text.chars(), attribute);
+						break;
+					case NbfxRecordType::UnicodeChars8Text:
+					case NbfxRecordType::UnicodeChars16Text:
+					case NbfxRecordType::UnicodeChars32Text:
+						m_scratch.clear();
+						appendUtf16(m_scratch, text.bytes());
+						append_chars(m_scratch, attribute);
+						break;
+					case NbfxRecordType::Bytes8Text:
+					case NbfxRecordType::Bytes16Text:
+					case NbfxRecordType::Bytes32Text:
+						append_bytes(text.bytes());
+						break;
+					case NbfxRecordType::DictionaryText:
+						m_scratch.clear();
+						append_dictionary(m_scratch, text.id());
+						appendXmlEscaped(m_out, m_scratch, attribute);
+						break;
+					case NbfxRecordType::ZeroText:
+					case NbfxRecordType::OneText:
+					case NbfxRecordType::Int8Text:
+					case NbfxRecordType::Int16Text:
+					case NbfxRecordType::Int32Text:
+					case NbfxRecordType::Int64Text:
+						appendNumber(m_out, text.integer());
+						break;
+					case NbfxRecordType::UInt64Text:
+						appendNumber(m_out, text.uint64());
+						break;
+					case NbfxRecordType::TrueText:
+					case NbfxRecordType::FalseText:
+					case NbfxRecordType::BoolText:
+						m_out += text.boolean() ? "true" : "false";
+						break;
+					case NbfxRecordType::FloatText:
+						append_float(text.float_single());
+						break;
+					case NbfxRecordType::DoubleText:
+						append_float(text.float_double());
+						break;
+					case NbfxRecordType::DateTimeText:
+						appendDateTime(m_out, text.datetime());
+						break;
+					case NbfxRecordType::StartListText:
+						m_list = true;
+						m_list_first = true;
+						break;
+					case NbfxRecordType::EndListText:
+						m_list = false;
+						break;
+					default: {
+						m_scratch = utf_to_wstring.to_bytes(text.value().to_string());
+						appendXmlEscaped(m_out, m_scratch, attribute);
+						break;
+					}
+				}
+				m_output.flush_if_full();
+			}
+
+			/**
+			 * Escapes large text in slices, so the output is flushed in between
+			 *
+			 * An escape is at most six characters long, so a slice adds less than the flush threshold.
+			 */
+			void append_chars(std::string_view chars, bool attribute) {
+				constexpr auto slice = NbfxTextOutput::flush_threshold / 8;
+				for (size_t done = 0; done < chars.size(); done += slice) {
+					appendXmlEscaped(m_out, chars.substr(done, slice), attribute);
+					m_output.flush_if_full();
+				}
+			}
+
+			static bool is_bytes(NbfxRecordType type) noexcept {
+				return type == NbfxRecordType::Bytes8Text || type == NbfxRecordType::Bytes16Text ||
+				       type == NbfxRecordType::Bytes32Text;
+			}
+
+			/**
+			 * Encodes bytes records in groups of three, so consecutive chunks of one value make one base64 text
+			 */
+			void append_bytes(NbfxBytesView bytes) {
+				auto data = bytes.data;
+				auto size = bytes.size;
+				while (m_carry_size && m_carry_size < 3 && size) {
+					m_carry[m_carry_size++] = *data++;
+					--size;
+				}
+				if (m_carry_size == 3) {
+					appendBase64(m_out, m_carry, 3);
+					m_carry_size = 0;
+				}
+
+				// large payloads are encoded in slices, so the output is flushed in between
+				constexpr size_t slice = NbfxTextOutput::flush_threshold / 4 * 3;
+				const auto whole = size / 3 * 3;
+				for (size_t done = 0; done < whole; done += slice) {
+					appendBase64(m_out, data + done, std::min(slice, whole - done));
+					m_output.flush_if_full();
+				}
+				for (auto i = whole; i < size; ++i) {
+					m_carry[m_carry_size++] = data[i];
+				}
+			}
+
+			void flush_bytes() {
+				if (m_carry_size) {
+					appendBase64(m_out, m_carry, m_carry_size);
+					m_carry_size = 0;
+				}
+			}
+
+			template<typename T>
+			void append_float(T value) {
+				if (value != value) {
+					m_out += "NaN";
+				} else if (value == std::numeric_limits<T>::infinity()) {
+					m_out += "INF";
+				} else if (value == -std::numeric_limits<T>::infinity()) {
+					m_out += "-INF";
+				} else {
+					appendNumber(m_out, value);
+				}
+			}
+
+			NbfxTextOutput &m_output;
+			std::string &m_out;
+			const NbfxXmlOptions &m_options;
+			// qualified names of open elements back to back
+			std::string m_names;
+			std::vector<size_t> m_ends;
+			std::string m_scratch;
+			uint8_t m_carry[3] = {};
+			size_t m_carry_size = 0;
+			bool m_open = false;
+			bool m_list = false;
+			bool m_list_first = false;
+		};
+
+		/**
+		 * Encodes XML text to NBFX records without building a tree
+		 *
+		 * Supports elements, attributes, namespace declarations, character and entity references,
+		 * CDATA sections and comments. Text is written as Chars*Text, DTDs are rejected.
+		 */
+		class NbfxXmlEncoder {
+		public:
+			NbfxXmlEncoder(std::string_view xml, std::vector<uint8_t> &out, const NbfxXmlOptions &options) :
+					m_p(xml.data()), m_end(xml.data() + xml.size()), m_out(out), m_options(options) {}
+
+			/**
+			 * Encodes the topmost element, returns position right after it
+			 */
+			const char *encode() {
+				skip_misc();
+				if (!starts_with("<") || starts_with("</")) {
+					fail("expected element");
+				}
+
+				do {
+					if (m_p == m_end) {
+						fail("unexpected end");
+					}
+					if (*m_p != '<') {
+						const auto text = static_cast<const char *>(std::memchr(m_p, '<', static_cast<size_t>(m_end - m_p)));
+						const auto raw = std::string_view(m_p, static_cast<size_t>((text ? text : m_end) - m_p));
+						m_p += raw.size();
+						if (m_options.keep_whitespace || raw.find_first_not_of(" \t\r\n") != std::string_view::npos) {
+							write_text(unescape(raw));
+							m_text_end = m_out.size();
+						}
+					} else if (starts_with("</")) {
+						end_tag();
+					} else if (starts_with("<!--")) {
+						until("<!--", "-->");
+					} else if (starts_with("<![CDATA[")) {
+						write_text(until("<![CDATA[", "]]>"));
+						m_text_end = m_out.size();
+					} else if (starts_with("<?")) {
+						until("<?", "?>");
+					} else if (starts_with("<!")) {
+						fail("DTD is not supported");
+					} else {
+						start_tag();
+					}
+				} while (!m_names.empty());
+
+				return m_p;
+			}
+
+		private:
+			[[noreturn]] static void fail(const char *message) {
+				throw std::invalid_argument(std::string("invalid XML: ") + message);
+			}
+
+			bool starts_with(std::string_view token) const noexcept {
+				return static_cast<size_t>(m_end - m_p) >= token.size() && std::memcmp(m_p, token.data(), token.size()) == 0;
+			}
+
+			static bool is_space(char c) noexcept {
+				return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+			}
+
+			void skip_space() noexcept {
+				while (m_p != m_end && is_space(*m_p)) {
+					++m_p;
+				}
+			}
+
+			/**
+			 * Returns content between open and close tokens, the input has to start with open
+			 */
+			std::string_view until(std::string_view open, std::string_view close) {
+				const auto begin = m_p + open.size();
+				const auto found = std::string_view(begin, static_cast<size_t>(m_end - begin)).find(close);
+				if (found == std::string_view::npos) {
+					fail("unterminated markup");
+				}
+				m_p = begin + found + close.size();
+				return {begin, found};
+			}
+
+			void skip_misc() {
+				for (;;) {
+					skip_space();
+					if (starts_with("<?")) {
+						until("<?", "?>");
+					} else if (starts_with("<!--")) {
+						until("<!--", "-->");
+					} else {
+						return;
+					}
+				}
+			}
+
+			std::string_view name() {
+				const auto begin = m_p;
+				while (m_p != m_end && !is_space(*m_p) && *m_p != '/' && *m_p != '>' && *m_p != '=') {
+					++m_p;
+				}
+				if (m_p == begin) {
+					fail("expected name");
+				}
+				return {begin, static_cast<size_t>(m_p - begin)};
+			}
+
+			void start_tag() {
+				++m_p;
+				const auto qname = name();
+				m_names.push_back(qname);
+				write_element(qname);
+
+				for (;;) {
+					skip_space();
+					if (starts_with("/>")) {
+						m_p += 2;
+						m_names.pop_back();
+						m_out.push_back(static_cast<uint8_t>(NbfxRecordType::EndElement));
+						return;
+					}
+					if (starts_with(">")) {
+						++m_p;
+						return;
+					}
+
+					const auto attribute = name();
+					skip_space();
+					if (!starts_with("=")) {
+						fail("expected '='");
+					}
+					++m_p;
+					skip_space();
+					if (m_p == m_end || (*m_p != '"' && *m_p != '\'')) {
+						fail("expected quoted value");
+					}
+					const auto quote = *m_p++;
+					const auto close = static_cast<const char *>(std::memchr(m_p, quote, static_cast<size_t>(m_end - m_p)));
+					if (!close) {
+						fail("unterminated attribute value");
+					}
+					const auto value = std::string_view(m_p, static_cast<size_t>(close - m_p));
+					m_p = close + 1;
+					write_attribute(attribute, unescape(value));
+				}
+			}
+
+			void end_tag() {
+				m_p += 2;
+				const auto qname = name();
+				skip_space();
+				if (!starts_with(">")) {
+					fail("expected '>'");
+				}
+				++m_p;
+				if (m_names.empty() || m_names.back() != qname) {
+					fail("mismatched end tag");
+				}
+				m_names.pop_back();
+
+				if (m_text_end == m_out.size()) {
+					m_text_end = static_cast<size_t>(-1);
+					// text right before the end tag closes the element itself
+					m_out[m_text_record] |= 1u;
+				} else {
+					m_out.push_back(static_cast<uint8_t>(NbfxRecordType::EndElement));
+				}
+			}
+
+			void write_uint31(size_t value) {
+				if (value > 0x7FFFFFFFu) {
+					fail("string is too long");
+				}
+				do {
+					m_out.push_back(static_cast<uint8_t>(value > 0x7Fu ? value | 0x80u : value));
+					value >>= 7u;
+				} while (value);
+			}
+
+			void write_chars(std::string_view chars) {
+				write_uint31(chars.size());
+				m_out.insert(m_out.end(), chars.begin(), chars.end());
+			}
+
+			static std::pair<std::string_view, std::string_view> split(std::string_view qname) noexcept {
+				const auto colon = qname.find(':');
+				if (colon == std::string_view::npos) {
+					return {{}, qname};
+				}
+				return {qname.substr(0, colon), qname.substr(colon + 1)};
+			}
+
+			static bool is_letter_prefix(std::string_view prefix) noexcept {
+				return prefix.size() == 1 && prefix[0] >= 'a' && prefix[0] <= 'z';
+			}
+
+			void write_element(std::string_view qname) {
+				const auto [prefix, local] = split(qname);
+				if (prefix.empty()) {
+					m_out.push_back(static_cast<uint8_t>(NbfxRecordType::ShortElement));
+				} else if (is_letter_prefix(prefix)) {
+					m_out.push_back(static_cast<uint8_t>(static_cast<uint8_t>(NbfxRecordType::PrefixElementA) + prefix[0] - 'a'));
+				} else {
+					m_out.push_back(static_cast<uint8_t>(NbfxRecordType::Element));
+					write_chars(prefix);
+				}
+				write_chars(local);
+			}
+
+			void write_attribute(std::string_view qname, std::string_view value) {
+				const auto [prefix, local] = split(qname);
+				if (qname == "xmlns") {
+					m_out.push_back(static_cast<uint8_t>(NbfxRecordType::ShortXmlnsAttribute));
+					write_chars(value);
+					return;
+				}
+				if (prefix == "xmlns") {
+					m_out.push_back(static_cast<uint8_t>(NbfxRecordType::XmlnsAttribute));
+					write_chars(local);
+					write_chars(value);
+					return;
+				}
+
+				if (prefix.empty()) {
+					m_out.push_back(static_cast<uint8_t>(NbfxRecordType::ShortAttribute));
+				} else if (is_letter_prefix(prefix)) {
+					m_out.push_back(static_cast<uint8_t>(static_cast<uint8_t>(NbfxRecordType::PrefixAttributeA) + prefix[0] - 'a'));
+				} else {
+					m_out.push_back(static_cast<uint8_t>(NbfxRecordType::Attribute));
+					write_chars(prefix);
+				}
+				write_chars(local);
+				write_text(value);
+			}
+
+			void write_text(std::string_view text) {
+				m_text_record = m_out.size();
+				const auto size = text.size();
+				if (!size) {
+					m_out.push_back(static_cast<uint8_t>(NbfxRecordType::EmptyText));
+					return;
+				}
+
+				uint8_t length_size = size > 0xFFFFu ? 4 : size > 0xFFu ? 2 : 1;
+				m_out.push_back(static_cast<uint8_t>(length_size == 4 ? NbfxRecordType::Chars32Text :
+				                                     length_size == 2 ? NbfxRecordType::Chars16Text :
+				                                     NbfxRecordType::Chars8Text));
+				for (auto i = 0u; i < length_size; ++i) {
+					m_out.push_back(static_cast<uint8_t>(size >> (8u * i)));
+				}
+				m_out.insert(m_out.end(), text.begin(), text.end());
+			}
+
+			/**
+			 * Replaces entity and character references, returns raw when there are none
+			 */
+			std::string_view unescape(std::string_view raw) {
+				auto amp = raw.find('&');
+				if (amp == std::string_view::npos) {
+					return raw;
+				}
+
+				m_scratch.clear();
+				while (amp != std::string_view::npos) {
+					m_scratch.append(raw.data(), amp);
+					const auto semicolon = raw.find(';', amp);
+					if (semicolon == std::string_view::npos) {
+						fail("unterminated reference");
+					}
+					const auto entity = raw.substr(amp + 1, semicolon - amp - 1);
+					if (entity == "lt") {
+						m_scratch += '<';
+					} else if (entity == "gt") {
+						m_scratch += '>';
+					} else if (entity == "amp") {
+						m_scratch += '&';
+					} else if (entity == "quot") {
+						m_scratch += '"';
+					} else if (entity == "apos") {
+						m_scratch += '\'';
+					} else if (entity.size() > 1 && entity[0] == '#') {
+						const bool hex = entity[1] == 'x';
+						const auto digits = entity.substr(hex ? 2 : 1);
+						uint32_t cp = 0;
+						const auto result = std::from_chars(digits.data(), digits.data() + digits.size(), cp, hex ? 16 : 10);
+						if (digits.empty() || result.ptr != digits.data() + digits.size() || cp > 0x10FFFFu) {
+							fail("invalid character reference");
+						}
+						appendUtf8(m_scratch, cp);
+					} else {
+						fail("unknown entity");
+					}
+					raw.remove_prefix(semicolon + 1);
+					amp = raw.find('&');
+				}
+				m_scratch.append(raw);
+				return m_scratch;
+			}
+
+			const char *m_p;
+			const char *m_end;
+			std::vector<uint8_t> &m_out;
+			const NbfxXmlOptions &m_options;
+			std::vector<std::string_view> m_names;
+			std::string m_scratch;
+			size_t m_text_record = 0;
+			size_t m_text_end = static_cast<size_t>(-1);
+		};
+	}
+
+	/**
+	 * Appends the document at begin to out as XML, returns position right after the document
+	 */
+	inline const uint8_t *to_xml(const uint8_t *begin, std::string &out, const NbfxXmlOptions &options = {}) {
+		detail::NbfxTextOutput output(out);
+		return detail::NbfxXmlWriter(output, options).write(begin);
+	}
+
+	/**
+	 * Writes the document at begin to the stream as XML, buffering at most about 64 KiB at a time
+	 */
+	inline const uint8_t *to_xml(const uint8_t *begin, std::ostream &out, const NbfxXmlOptions &options = {}) {
+		std::string buffer;
+		detail::NbfxTextOutput output(buffer, &out);
+		const auto end = detail::NbfxXmlWriter(output, options).write(begin);
+		output.flush();
+		return end;
+	}
+
+	inline std::string to_xml(const uint8_t *begin, const NbfxXmlOptions &options = {}) {
+		std::string out;
+		to_xml(begin, out, options);
+		return out;
+	}
+
+	/**
+	 * Appends the topmost element of the XML text to out as NBFX, returns position right after it
+	 */
+	inline const char *from_xml(std::string_view xml, std::vector<uint8_t> &out, const NbfxXmlOptions &options = {}) {
+		return detail::NbfxXmlEncoder(xml, out, options).encode();
+	}
+
+	inline std::vector<uint8_t> from_xml(std::string_view xml, const NbfxXmlOptions &options = {}) {
+		std::vector<uint8_t> out;
+		out.reserve(xml.size());
+		from_xml(xml, out, options);
+		return out;
+	}
+}
@@ -5,7 +5,7 @@
 namespace nbfx
 {
 	namespace {
-		std::wstring_convert<std::codecvt_utf8<wchar_t>> utf_to_wstring;
+		thread_local std::wstring_convert<std::codecvt_utf8<wchar_t>> utf_to_wstring;
 	}
 
 	std::wstring NbfxValue::to_string() const
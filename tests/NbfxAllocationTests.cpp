@@ -0,0 +1,161 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/corpus.hpp"
+#include "nbfx/documents.hpp"
+#include "nbfx/stream.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    std::atomic<size_t> allocation_count{0};
+    std::atomic<size_t> allocation_bytes{0};
+
+    struct Allocations {
+        size_t count;
+        size_t bytes;
+    };
+
+    /**
+     * Heap allocations made by f, the suite runs on one thread so nothing else is counted
+     */
+    template<typename F>
+    Allocations count_allocations(F &&f) {
+        const auto count = allocation_count.load();
+        const auto bytes = allocation_bytes.load();
+        f();
+        return Allocations{allocation_count.load() - count, allocation_bytes.load() - bytes};
+    }
+
+    size_t count_nodes(const uint8_t *document) {
+        NbfxReader<const uint8_t *> reader(document);
+        size_t nodes = 0;
+        while (reader.read()) {
+            ++nodes;
+        }
+        return nodes;
+    }
+}
+
+// the replacements pair malloc with free, GCC can't see that through the inlined operators
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (auto p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+TEST_CASE("parse allocations per corpus message stay within bounds", "[nbfx::allocations]") {
+    for (const auto preset : {"soap12", "soap12-arrays", "wide"}) {
+        const auto corpus = NbfxCorpusGenerator(corpus_preset(preset)).generate(50);
+        const auto end = corpus.data() + corpus.size();
+
+        for (auto p = corpus.data(); p != end; p = find_document_end(p, end)) {
+            const auto nodes = count_nodes(p);
+            const auto parsed = count_allocations([&] { parse(p); });
+            CAPTURE(preset);
+            CAPTURE(nodes);
+            // a name or string and a slot in the parent's vector per node, vectors grow a few times
+            REQUIRE(parsed.count <= 2 * nodes + 8);
+        }
+    }
+}
+
+TEST_CASE("parse doesn't copy names before converting them", "[nbfx::allocations]") {
+    // <ElementNameLongerThanSmallStringBuffer/> and the same name as text
+    std::vector<uint8_t> element = {0x40, 38};
+    const std::string name = "ElementNameLongerThanSmallStringBuffer";
+    element.insert(element.end(), name.begin(), name.end());
+    element.push_back(0x01);
+
+    std::vector<uint8_t> text = {0x40, 0x01, 'a', 0x99, 38};
+    text.insert(text.end(), name.begin(), name.end());
+
+    // the element name is converted the same way as the text, without a temporary std::string
+    const auto named = count_allocations([&] { parse(element.data()); });
+    const auto valued = count_allocations([&] { parse(text.data()); });
+    REQUIRE(named.count <= valued.count);
+}
+
+TEST_CASE("serialize to a fixed buffer doesn't allocate", "[nbfx::allocations]") {
+    const auto corpus = NbfxCorpusGenerator(corpus_preset("soap12")).generate(50);
+    const auto end = corpus.data() + corpus.size();
+    std::vector<uint8_t> buffer(corpus.size());
+    std::vector<uint8_t> reserved;
+    reserved.reserve(corpus.size());
+
+    for (auto p = corpus.data(); p != end; p = find_document_end(p, end)) {
+        const auto element = parse(p);
+        const auto written = count_allocations([&] { serialize(element, buffer.data(), false); });
+        REQUIRE(written.count == 0);
+
+        reserved.clear();
+        const auto appended = count_allocations([&] { serialize(element, std::back_inserter(reserved), false); });
+        REQUIRE(appended.count == 0);
+    }
+}
+
+TEST_CASE("reading records doesn't allocate", "[nbfx::allocations]") {
+    const auto corpus = NbfxCorpusGenerator(corpus_preset("soap12-blobs")).generate(50);
+    const auto end = corpus.data() + corpus.size();
+
+    const auto walked = count_allocations([&] {
+        for (auto p = corpus.data(); p != end; p = find_document_end(p, end)) {
+            NbfxReader<const uint8_t *> reader(p);
+            while (reader.read()) {
+                switch (reader.text().type()) {
+                    case NbfxRecordType::Chars8Text:
+                    case NbfxRecordType::Chars16Text:
+                    case NbfxRecordType::Chars32Text:
+                        reader.text().chars();
+                        break;
+                    case NbfxRecordType::Bytes8Text:
+                    case NbfxRecordType::Bytes16Text:
+                    case NbfxRecordType::Bytes32Text:
+                        reader.text().bytes();
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    });
+    REQUIRE(walked.count == 0);
+}
+
+TEST_CASE("incremental parser takes memory for bytes as they arrive", "[nbfx::allocations]") {
+    // <doc> with Bytes32Text claiming 32 MiB of which only the first bytes arrive
+    std::vector<uint8_t> header = {0x40, 0x03, 'd', 'o', 'c', 0xA2, 0x00, 0x00, 0x00, 0x02};
+    header.resize(header.size() + 1000, 0x33);
+
+    NbfxIncrementalParser parser(64);
+    const auto fed = count_allocations([&] {
+        parser.feed(header.data(), header.size());
+        REQUIRE_FALSE(parser.next().has_value());
+    });
+    REQUIRE(fed.bytes < 64 * 1024);
+}
@@ -0,0 +1,190 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/async.hpp"
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <string>
+
+using namespace nbfx;
+
+namespace {
+    /**
+     * Single threaded scheduler resuming suspended reads in order
+     */
+    struct Loop {
+        std::deque<std::coroutine_handle<>> ready;
+
+        void run() {
+            while (!ready.empty()) {
+                const auto handle = ready.front();
+                ready.pop_front();
+                handle.resume();
+            }
+        }
+    };
+
+    /**
+     * Stand-in for a slow connection delivering a few bytes per wakeup
+     */
+    struct SlowSource {
+        Loop &loop;
+        std::vector<uint8_t> data;
+        size_t step;
+        size_t position = 0;
+
+        auto async_read(uint8_t *buffer, size_t size) {
+            struct awaiter {
+                SlowSource &source;
+                uint8_t *buffer;
+                size_t size;
+
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                void await_suspend(std::coroutine_handle<> handle) {
+                    source.loop.ready.push_back(handle);
+                }
+
+                size_t await_resume() {
+                    const auto n = std::min({size, source.step, source.data.size() - source.position});
+                    std::copy_n(source.data.data() + source.position, n, buffer);
+                    source.position += n;
+                    return n;
+                }
+            };
+            return awaiter{*this, buffer, size};
+        }
+    };
+
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() noexcept {
+                return {};
+            }
+
+            std::suspend_never initial_suspend() noexcept {
+                return {};
+            }
+
+            std::suspend_never final_suspend() noexcept {
+                return {};
+            }
+
+            void return_void() noexcept {}
+
+            void unhandled_exception() noexcept {
+                std::terminate();
+            }
+        };
+    };
+
+    Detached spawn(NbfxTask<NbfxElement> task, std::optional<NbfxElement> &result, std::exception_ptr &error) {
+        try {
+            result.emplace(co_await task);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+
+    std::vector<uint8_t> serialize_to_vector(const NbfxElement &root) {
+        std::vector<uint8_t> data;
+        serialize(root, std::back_inserter(data));
+        return data;
+    }
+}
+
+TEST_CASE("async_parse interleaves many slow sources on one thread", "[nbfx::async_parse]") {
+    constexpr size_t connections = 100;
+    Loop loop;
+
+    std::vector<SlowSource> sources;
+    sources.reserve(connections);
+    for (size_t i = 0; i < connections; ++i) {
+        const NbfxElement root(L"message", {}, {
+                NbfxElement(L"Id", {}, NbfxValue(static_cast<int64_t>(i))),
+                NbfxElement(L"Blob", {}, NbfxValue(std::vector<uint8_t>(200 + i, static_cast<uint8_t>(i))))
+        });
+        sources.push_back(SlowSource{loop, serialize_to_vector(root), 1 + i % 5});
+    }
+
+    std::vector<std::optional<NbfxElement>> results(connections);
+    std::vector<std::exception_ptr> errors(connections);
+    for (size_t i = 0; i < connections; ++i) {
+        spawn(async_parse(sources[i], 64), results[i], errors[i]);
+    }
+
+    REQUIRE(loop.ready.size() == connections);
+    loop.run();
+
+    for (size_t i = 0; i < connections; ++i) {
+        REQUIRE_FALSE(errors[i]);
+        REQUIRE(results[i]);
+        REQUIRE(results[i]->first_child(L"Id")->value().integer() == static_cast<int64_t>(i));
+        REQUIRE(results[i]->first_child(L"Blob")->value().bytes_size() == 200 + i);
+    }
+}
+
+TEST_CASE("NbfxAsyncParser parses consecutive documents", "[nbfx::async_parse]") {
+    Loop loop;
+    auto data = serialize_to_vector(NbfxElement(L"first", {}, NbfxValue(L"alpha")));
+    const auto tail = serialize_to_vector(NbfxElement(L"second", {}, NbfxValue(L"beta")));
+    data.insert(data.end(), tail.begin(), tail.end());
+    SlowSource source{loop, data, 4};
+
+    std::vector<std::wstring> names;
+    bool finished = false;
+    auto run = [&]() -> Detached {
+        NbfxAsyncParser<SlowSource> parser(source);
+        while (!co_await parser.at_end()) {
+            names.push_back((co_await parser.parse()).name());
+        }
+        finished = true;
+    };
+    run();
+    loop.run();
+
+    REQUIRE(finished);
+    REQUIRE((names == std::vector<std::wstring>{L"first", L"second"}));
+}
+
+TEST_CASE("NbfxAsyncParser checks records against quotas", "[nbfx::async_parse]") {
+    Loop loop;
+    const auto data = serialize_to_vector(NbfxElement(L"root", {}, NbfxValue(std::wstring(100, L'x'))));
+    SlowSource source{loop, data, 4};
+
+    auto quotas = NbfxReaderQuotas::max();
+    quotas.max_string_length = 99;
+    std::exception_ptr error;
+    auto run = [&]() -> Detached {
+        NbfxAsyncParser<SlowSource> parser(source, 64, quotas);
+        try {
+            co_await parser.parse();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    };
+    run();
+    loop.run();
+
+    REQUIRE_THROWS_AS(std::rethrow_exception(error), std::length_error);
+}
+
+TEST_CASE("async_parse reports truncated source", "[nbfx::async_parse]") {
+    Loop loop;
+    auto data = serialize_to_vector(NbfxElement(L"root", {}, NbfxValue(L"value")));
+    data.pop_back();
+    SlowSource source{loop, data, 2};
+
+    std::optional<NbfxElement> result;
+    std::exception_ptr error;
+    spawn(async_parse(source), result, error);
+    loop.run();
+
+    REQUIRE_FALSE(result);
+    REQUIRE_THROWS_AS(std::rethrow_exception(error), std::runtime_error);
+}
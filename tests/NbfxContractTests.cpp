@@ -0,0 +1,149 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <optional>
+
+using namespace nbfx;
+
+namespace {
+    struct Status {
+        bool Ok;
+        std::string Reason;
+    };
+
+    struct Response {
+        int32_t Code;
+        std::wstring Message;
+        Status State;
+        std::vector<uint64_t> Ids;
+        std::optional<std::vector<uint8_t>> Payload;
+        int64_t Known;
+    };
+}
+
+namespace nbfx {
+    template<>
+    struct contract<Status> {
+        static constexpr auto name = contract_name("Status");
+        static constexpr auto members = std::make_tuple(
+                contract_member("Ok", &Status::Ok),
+                contract_member("Reason", &Status::Reason));
+    };
+
+    template<>
+    struct contract<Response> {
+        static constexpr auto name = contract_name("s", "Response");
+        static constexpr auto members = std::make_tuple(
+                contract_member("Code", &Response::Code),
+                contract_member("s", "Message", &Response::Message),
+                contract_member("State", &Response::State),
+                contract_member("Id", &Response::Ids),
+                contract_member("Payload", &Response::Payload),
+                contract_member(7u, &Response::Known));
+    };
+}
+
+TEST_CASE("contract names are encoded at compile time", "[nbfx::contract]") {
+    constexpr auto name = contract_name("pre", "doc");
+    static_assert(name.size == 9, "element record size");
+
+    const std::array<uint8_t, 9> expected = {0x41, 0x03, 0x70, 0x72, 0x65, 0x03, 0x64, 0x6F, 0x63};
+    REQUIRE(std::equal(expected.cbegin(), expected.cend(), name.data()));
+
+    constexpr auto dictionary = contract_name("s", 300);
+    static_assert(dictionary.size == 3, "dictionary element record size");
+    REQUIRE(dictionary.record[0] == 0x56);
+    REQUIRE(dictionary.record[1] == 0xAC);
+    REQUIRE(dictionary.record[2] == 0x02);
+}
+
+TEST_CASE("serialize_object matches serialization of equivalent tree", "[nbfx::contract]") {
+    Response response{-5, L"h\u00E9llo", {true, "fine"}, {1, 2}, std::nullopt, 1ll << 40};
+
+    std::vector<uint8_t> result;
+    serialize_object(response, std::back_inserter(result));
+
+    NbfxElement tree(QName(L"s", L"Response"), {}, {
+            NbfxElement(L"Code", {}, NbfxValue(static_cast<int32_t>(-5))),
+            NbfxElement(QName(L"s", L"Message"), {}, NbfxValue(L"h\u00E9llo")),
+            NbfxElement(L"State", {}, {
+                    NbfxElement(L"Ok", {}, NbfxValue(true)),
+                    NbfxElement(L"Reason", {}, NbfxValue(L"fine"))
+            }),
+            NbfxElement(L"Id", {}, NbfxValue(static_cast<uint64_t>(1))),
+            NbfxElement(L"Id", {}, NbfxValue(static_cast<uint64_t>(2))),
+            NbfxElement(L"Known", {}, NbfxValue(static_cast<int64_t>(1ll << 40)))
+    });
+
+    std::vector<uint8_t> expected;
+    serialize(tree, std::back_inserter(expected), false);
+
+    // the last member uses dictionary name 7 instead of "Known"
+    const std::vector<uint8_t> known = {0x40, 0x05, 0x4B, 0x6E, 0x6F, 0x77, 0x6E};
+    const auto pos = std::search(expected.begin(), expected.end(), known.cbegin(), known.cend());
+    REQUIRE(pos != expected.end());
+    *pos = 0x42;
+    *(pos + 1) = 0x07;
+    expected.erase(pos + 2, pos + known.size());
+
+    REQUIRE(result == expected);
+}
+
+TEST_CASE("serialize_object writes through raw pointer", "[nbfx::contract]") {
+    Status status{false, "broken"};
+
+    std::array<uint8_t, 64> buffer{};
+    const auto end = serialize_object(status, buffer.data());
+
+    const auto result = parse(buffer.data());
+    REQUIRE(static_cast<size_t>(end - buffer.data()) == 30u);
+    REQUIRE(result.name() == L"Status");
+    REQUIRE(result.children().size() == 2);
+    REQUIRE_FALSE(result.first_child(L"Ok")->value().boolean());
+    REQUIRE(result.first_child(L"Reason")->value().string() == L"broken");
+}
+
+TEST_CASE("parse_object reads what serialize_object writes", "[nbfx::contract]") {
+    Response response{-5, L"h\u00E9llo", {true, "fine"}, {1, 2, 3}, std::vector<uint8_t>{9, 8, 7}, 1ll << 40};
+
+    std::vector<uint8_t> buffer;
+    serialize_object(response, std::back_inserter(buffer));
+    const auto result = parse_object<Response>(buffer.cbegin());
+
+    REQUIRE(result.Code == -5);
+    REQUIRE(result.Message == L"h\u00E9llo");
+    REQUIRE(result.State.Ok);
+    REQUIRE(result.State.Reason == "fine");
+    REQUIRE((result.Ids == std::vector<uint64_t>{1, 2, 3}));
+    REQUIRE(result.Payload);
+    REQUIRE((*result.Payload == std::vector<uint8_t>{9, 8, 7}));
+    REQUIRE(result.Known == 1ll << 40);
+}
+
+TEST_CASE("parse_object skips unknown elements", "[nbfx::contract]") {
+    NbfxElement tree(L"Status", {NbfxAttribute(L"version", NbfxValue(2))}, {
+            NbfxElement(L"Extra", {}, {
+                    NbfxElement(L"Reason", {}, NbfxValue(L"nested, not ours"))
+            }),
+            NbfxElement(L"Ok", {}, NbfxValue(true)),
+            NbfxElement(L"Reason", {}, NbfxValue(L"fine")),
+            NbfxElement(L"Zzz", {}, NbfxValue(std::vector<uint8_t>(1000, 0)))
+    });
+
+    std::vector<uint8_t> buffer;
+    serialize(tree, std::back_inserter(buffer));
+    const auto result = parse_object<Status>(buffer.data());
+
+    REQUIRE(result.Ok);
+    REQUIRE(result.Reason == "fine");
+}
+
+TEST_CASE("parse_object rejects unexpected topmost element", "[nbfx::contract]") {
+    std::vector<uint8_t> buffer;
+    serialize(NbfxElement(L"Other"), std::back_inserter(buffer));
+
+    REQUIRE_THROWS_AS(parse_object<Status>(buffer.data()), std::invalid_argument);
+}
@@ -0,0 +1,77 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/corpus.hpp"
+#include "nbfx/documents.hpp"
+#include "nbfx/soap.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+using namespace nbfx;
+
+TEST_CASE("corpus generator is deterministic for a seed", "[nbfx::corpus]") {
+    const auto a = NbfxCorpusGenerator(corpus_preset("soap12", 7)).generate(50);
+    const auto b = NbfxCorpusGenerator(corpus_preset("soap12", 7)).generate(50);
+    const auto c = NbfxCorpusGenerator(corpus_preset("soap12", 8)).generate(50);
+
+    REQUIRE(!a.empty());
+    REQUIRE(a == b);
+    REQUIRE(a != c);
+}
+
+TEST_CASE("corpus presets produce parsable documents", "[nbfx::corpus]") {
+    for (const auto preset : {"soap12", "soap12-blobs", "soap12-arrays", "wide", "deep"}) {
+        const auto data = NbfxCorpusGenerator(corpus_preset(preset)).generate(20);
+
+        size_t documents = 0;
+        for (auto p = data.data(), end = data.data() + data.size(); p != end; p = find_document_end(p, end)) {
+            REQUIRE_NOTHROW(parse(p));
+            ++documents;
+        }
+        REQUIRE(documents == 20);
+    }
+
+    REQUIRE_THROWS_AS(corpus_preset("soap11"), std::invalid_argument);
+}
+
+TEST_CASE("corpus soap12 preset has WS-Addressing headers", "[nbfx::corpus]") {
+    NbfxCorpusGenerator generator(corpus_preset("soap12"));
+    std::vector<uint8_t> data;
+    generator.write(std::back_inserter(data));
+
+    const auto envelope = parse_soap_envelope(data.data(), data.data() + data.size());
+    REQUIRE(envelope.action.rfind("http://tempuri.org/IService/", 0) == 0);
+    REQUIRE(envelope.to == "net.tcp://services.example.com/Service.svc");
+    REQUIRE(envelope.message_id.size() == 45);
+    REQUIRE(envelope.body.size > 0);
+}
+
+TEST_CASE("corpus options shape the generated tree", "[nbfx::corpus]") {
+    NbfxCorpusOptions options;
+    options.depth = 1;
+    options.fan_out = 3;
+    options.name_reuse = 1;
+    options.vocabulary = 1;
+    options.text_weight = 0;
+    options.boolean_weight = 0;
+    options.datetime_weight = 0;
+
+    NbfxCorpusGenerator generator(options);
+    const auto root = generator.next();
+    REQUIRE(root.name() == L"Order");
+    REQUIRE(!root.children().empty());
+    REQUIRE(root.children().size() <= 5);
+    for (const auto &child : root.children()) {
+        REQUIRE(child.name() == L"Order");
+        REQUIRE(child.value().type() == NbfxValueType::Integer);
+    }
+
+    options.array_rate = 1;
+    options.array_min = 10;
+    options.array_max = 10;
+    REQUIRE(NbfxCorpusGenerator(options).next().children().size() == 10);
+
+    options.fan_out = 0;
+    REQUIRE_THROWS_AS(NbfxCorpusGenerator(options), std::invalid_argument);
+}
@@ -23,4 +23,54 @@ TEST_CASE("findDescendant searches breadth-first", "[nbfx::NbfxElement]") {
     REQUIRE(c2 != nullptr);
     REQUIRE(c->value().boolean());
     REQUIRE(c2->value().boolean());
-}
\ No newline at end of file
+}
+TEST_CASE("memory_usage counts objects, payloads and slack by category", "[nbfx::NbfxElement]") {
+    const nbfx::NbfxElement leaf(L"a", {}, nbfx::NbfxValue(int64_t{1}));
+    const auto small = leaf.memory_usage();
+    REQUIRE(small.elements == sizeof(nbfx::NbfxElement));
+    REQUIRE(small.element_count == 1);
+    REQUIRE(small.names == 0);
+    REQUIRE(small.strings == 0);
+    REQUIRE(small.slack == 0);
+    REQUIRE(small.empty_values == 0);
+    REQUIRE(small.total() == sizeof(nbfx::NbfxElement));
+
+    const std::wstring text(100, L'x');
+    const std::wstring name(40, L'n');
+    nbfx::NbfxElement root(L"root", {nbfx::NbfxAttribute(L"id", nbfx::NbfxValue(int64_t{7}))}, {});
+    root.children().reserve(4);
+    root.children().push_back(nbfx::NbfxElement(name, {}, nbfx::NbfxValue(text)));
+    nbfx::NbfxValue bytes(std::vector<uint8_t>(10));
+    bytes.append_bytes(std::vector<uint8_t>(20));
+    root.children().push_back(nbfx::NbfxElement(L"b", {}, std::move(bytes)));
+
+    const auto usage = root.memory_usage();
+    REQUIRE(usage.element_count == 3);
+    REQUIRE(usage.attribute_count == 1);
+    REQUIRE(usage.elements == 3 * sizeof(nbfx::NbfxElement));
+    REQUIRE(usage.attributes == sizeof(nbfx::NbfxAttribute));
+    REQUIRE(usage.names >= (name.size() + 1) * sizeof(wchar_t));
+    REQUIRE(usage.strings == (text.size() + 1) * sizeof(wchar_t));
+    // the appended chunk lives in a side object next to the shared pointer reserved for bytes sources
+    REQUIRE(usage.bytes == 30 + sizeof(std::vector<uint8_t>) + sizeof(std::vector<std::vector<uint8_t>>) +
+                           sizeof(std::shared_ptr<const nbfx::NbfxBytesSource>));
+    REQUIRE(usage.slack >= 2 * sizeof(nbfx::NbfxElement));
+    REQUIRE(usage.empty_values == sizeof(nbfx::NbfxValue));
+    REQUIRE(usage.total() == usage.elements + usage.attributes + usage.names + usage.strings + usage.bytes +
+                             usage.slack);
+}
+
+TEST_CASE("NbfxValue keeps chunks outside of the value object", "[nbfx::NbfxValue]") {
+    REQUIRE(sizeof(nbfx::NbfxValue) <= 8 + sizeof(uint64_t) + sizeof(std::vector<uint8_t>) + sizeof(std::wstring) +
+                                       sizeof(void *));
+
+    nbfx::NbfxValue value(std::vector<uint8_t>{1, 2});
+    value.append_bytes({3});
+    auto copy = value;
+    copy.append_bytes({4});
+    REQUIRE(value.chunk_count() == 2);
+    REQUIRE(copy.chunk_count() == 3);
+    REQUIRE((value.bytes() == std::vector<uint8_t>{1, 2, 3}));
+    REQUIRE((copy.bytes() == std::vector<uint8_t>{1, 2, 3, 4}));
+    REQUIRE(copy.chunk_count() == 1);
+}
@@ -0,0 +1,80 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/file.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+using namespace nbfx;
+
+namespace {
+    std::string write_temp_file(const std::vector<uint8_t> &data) {
+        const std::string path = "nbfx_file_test.bin";
+        std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+        stream.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+        return path;
+    }
+}
+
+TEST_CASE("parse_file and parse_file_view read mapped file", "[nbfx::parse_file]") {
+    NbfxElement root(L"archive", {}, {
+            NbfxElement(L"Blob", {}, NbfxValue(std::vector<uint8_t>(100000, 0xAB))),
+            NbfxElement(L"Name", {}, NbfxValue(L"capture"))
+    });
+
+    std::vector<uint8_t> data;
+    serialize(root, std::back_inserter(data));
+    const auto path = write_temp_file(data);
+
+    const auto parsed = parse_file(path);
+    REQUIRE(parsed.first_child(L"Blob")->value().bytes_size() == 100000);
+    REQUIRE(parsed.first_child(L"Name")->value().string() == L"capture");
+
+    const auto document = parse_file_view(path);
+    REQUIRE(document.file().size() == data.size());
+    REQUIRE(document.root().name() == "archive");
+    REQUIRE(document.root().first_child("Name")->value().text().chars() == "capture");
+    REQUIRE(document.root().first_child("Blob")->value().text().bytes().data > document.file().data());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("parse_file rejects missing and empty files", "[nbfx::parse_file]") {
+    REQUIRE_THROWS_AS(parse_file("nbfx_no_such_file.bin"), std::system_error);
+
+    const auto path = write_temp_file({});
+    REQUIRE_THROWS_AS(parse_file(path), std::invalid_argument);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("parse_file rejects truncated files", "[nbfx::parse_file]") {
+    NbfxElement root(L"archive", {}, {
+            NbfxElement(L"Blob", {}, NbfxValue(std::vector<uint8_t>(100000, 0xAB)))
+    });
+
+    std::vector<uint8_t> data;
+    serialize(root, std::back_inserter(data));
+    data.resize(data.size() / 2);
+    const auto path = write_temp_file(data);
+
+    REQUIRE_THROWS_AS(parse_file(path), std::invalid_argument);
+    REQUIRE_THROWS_AS(parse_file_view(path), std::invalid_argument);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("parse_file rejects files truncated at any record", "[nbfx::parse_file]") {
+    const NbfxElement root(L"doc", {NbfxAttribute(L"id", NbfxValue(L"abc"))}, {
+            NbfxElement(L"Blob", {}, NbfxValue(std::vector<uint8_t>(300, 0xAB))),
+            NbfxElement(L"Text", {}, NbfxValue(std::wstring(L"hello")))
+    });
+
+    std::vector<uint8_t> data;
+    serialize(root, std::back_inserter(data));
+    for (size_t size = 1; size < data.size(); ++size) {
+        const auto path = write_temp_file(std::vector<uint8_t>(data.begin(), data.begin() + size));
+        REQUIRE_THROWS_AS(parse_file(path), std::invalid_argument);
+        std::remove(path.c_str());
+    }
+}
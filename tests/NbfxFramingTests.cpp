@@ -0,0 +1,152 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/framing.hpp"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace nbfx;
+
+namespace {
+    std::vector<uint8_t> framed_session(const std::vector<NbfxElement> &envelopes) {
+        std::vector<uint8_t> data;
+        write_nmf_preamble("net.tcp://localhost/service", std::back_inserter(data));
+        for (const auto &envelope : envelopes) {
+            write_nmf_envelope(envelope, data);
+        }
+        write_nmf_record(NbfxNmfRecordType::End, std::back_inserter(data));
+        return data;
+    }
+}
+
+TEST_CASE("decode_nmf_record decodes preamble records", "[nbfx::framing]") {
+    std::vector<uint8_t> data;
+    write_nmf_preamble("net.tcp://host/a", std::back_inserter(data));
+
+    NbfxNmfRecord record{};
+    size_t position = 0;
+
+    position += decode_nmf_record(data.data() + position, data.size() - position, record);
+    REQUIRE(record.type == NbfxNmfRecordType::Version);
+    REQUIRE(record.value == 1);
+    REQUIRE(record.minor == 0);
+
+    position += decode_nmf_record(data.data() + position, data.size() - position, record);
+    REQUIRE(record.type == NbfxNmfRecordType::Mode);
+    REQUIRE(record.value == static_cast<uint8_t>(NbfxNmfMode::Duplex));
+
+    position += decode_nmf_record(data.data() + position, data.size() - position, record);
+    REQUIRE(record.type == NbfxNmfRecordType::Via);
+    REQUIRE(record.text == "net.tcp://host/a");
+
+    position += decode_nmf_record(data.data() + position, data.size() - position, record);
+    REQUIRE(record.type == NbfxNmfRecordType::KnownEncoding);
+    REQUIRE(record.value == static_cast<uint8_t>(NbfxNmfEncoding::Soap12Nbfs));
+
+    position += decode_nmf_record(data.data() + position, data.size() - position, record);
+    REQUIRE(record.type == NbfxNmfRecordType::PreambleEnd);
+    REQUIRE(position == data.size());
+}
+
+TEST_CASE("decode_nmf_record waits for the whole envelope", "[nbfx::framing]") {
+    const NbfxElement root(L"Envelope", {}, NbfxValue(L"payload"));
+    std::vector<uint8_t> data;
+    write_nmf_envelope(root, data);
+
+    std::vector<uint8_t> body;
+    serialize(root, std::back_inserter(body));
+    REQUIRE(data.size() == 1 + 5 + body.size());
+
+    NbfxNmfRecord record{};
+    for (size_t available = 0; available < data.size(); ++available) {
+        REQUIRE(decode_nmf_record(data.data(), available, record) == 0);
+    }
+    REQUIRE(decode_nmf_record(data.data(), data.size(), record) == data.size());
+    REQUIRE(record.type == NbfxNmfRecordType::SizedEnvelope);
+    REQUIRE(record.payload.data == data.data() + 6);
+    REQUIRE(record.payload.size == body.size());
+    REQUIRE(parse(record.payload.data).value().string() == L"payload");
+}
+
+TEST_CASE("decode_nmf_record accepts minimal size prefix", "[nbfx::framing]") {
+    const std::vector<uint8_t> data{0x06, 0x04, 0x40, 0x01, 0x61, 0x01};
+
+    NbfxNmfRecord record{};
+    REQUIRE(decode_nmf_record(data.data(), data.size(), record) == data.size());
+    REQUIRE(record.payload.size == 4);
+    REQUIRE(parse(record.payload.data).name() == L"a");
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST_CASE("NbfxNmfReader splits envelopes from a socket", "[nbfx::framing]") {
+    int fds[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    std::vector<NbfxElement> envelopes;
+    for (int i = 0; i < 20; ++i) {
+        envelopes.push_back(NbfxElement(L"Envelope", {}, {
+                NbfxElement(L"Id", {}, NbfxValue(static_cast<int64_t>(i))),
+                NbfxElement(L"Body", {}, NbfxValue(std::vector<uint8_t>(1000 * i, static_cast<uint8_t>(i))))
+        }));
+    }
+    const auto data = framed_session(envelopes);
+
+    std::thread writer([&]() {
+        for (size_t position = 0; position < data.size();) {
+            const auto n = ::write(fds[0], data.data() + position, std::min<size_t>(4096, data.size() - position));
+            if (n <= 0) {
+                break;
+            }
+            position += static_cast<size_t>(n);
+        }
+        ::close(fds[0]);
+    });
+
+    NbfxNmfReader<NbfxFdSource> reader(NbfxFdSource{fds[1]}, 1024);
+    NbfxNmfRecord record{};
+    std::vector<NbfxElement> received;
+    bool ended = false;
+    while (reader.next(record)) {
+        if (record.type == NbfxNmfRecordType::SizedEnvelope) {
+            received.emplace_back(parse(record.payload.data));
+        } else if (record.type == NbfxNmfRecordType::End) {
+            ended = true;
+        }
+    }
+
+    writer.join();
+    ::close(fds[1]);
+
+    REQUIRE(ended);
+    REQUIRE(received.size() == envelopes.size());
+    for (size_t i = 0; i < received.size(); ++i) {
+        REQUIRE(received[i].first_child(L"Id")->value().integer() == static_cast<int64_t>(i));
+        REQUIRE(received[i].first_child(L"Body")->value().bytes_size() == 1000 * i);
+    }
+}
+#endif
+
+TEST_CASE("NbfxNmfReader rejects truncated and oversized envelopes", "[nbfx::framing]") {
+    const NbfxElement root(L"Envelope", {}, NbfxValue(std::vector<uint8_t>(5000, 1)));
+    auto data = framed_session({root});
+
+    {
+        std::istringstream stream(std::string(data.begin(), data.end() - 10));
+        NbfxNmfReader<NbfxIstreamSource> reader(NbfxIstreamSource{stream});
+        NbfxNmfRecord record{};
+        REQUIRE_THROWS_AS([&]() { while (reader.next(record)) {} }(), std::runtime_error);
+    }
+    {
+        std::istringstream stream(std::string(data.begin(), data.end()));
+        NbfxNmfReader<NbfxIstreamSource> reader(NbfxIstreamSource{stream}, 256, 1024);
+        NbfxNmfRecord record{};
+        REQUIRE_THROWS_AS([&]() { while (reader.next(record)) {} }(), std::length_error);
+    }
+}
@@ -0,0 +1,132 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    // <a x="1"><b>hi</b><c/></a>
+    const std::vector<uint8_t> document = {
+            0x40, 0x01, 'a', 0x04, 0x01, 'x', 0x98, 0x01, '1',
+            0x40, 0x01, 'b', 0x99, 0x02, 'h', 'i',
+            0x40, 0x01, 'c', 0x01,
+            0x01};
+
+    /**
+     * Records calls as a string of events, e.g. "D<a<b>b>D"
+     */
+    struct EventHooks : NbfxNoHooks {
+        static constexpr size_t large_payload = 4;
+
+        std::wstring events;
+        std::vector<size_t> payloads;
+
+        void on_document_begin(time_point) {
+            events += L"D";
+        }
+
+        void on_document_end(time_point) {
+            events += L"D";
+        }
+
+        void on_element_begin(const NbfxElement &element, time_point) {
+            events += L"<" + element.name();
+        }
+
+        void on_element_end(const NbfxElement &element, time_point) {
+            events += L">" + element.name();
+        }
+
+        void on_payload_begin(size_t size, time_point) {
+            events += L"[";
+            payloads.push_back(size);
+        }
+
+        void on_payload_end(size_t, time_point) {
+            events += L"]";
+        }
+    };
+
+    struct TimedHooks : NbfxNoHooks {
+        static constexpr bool timestamps = true;
+
+        time_point begin;
+        time_point end;
+
+        void on_document_begin(time_point t) {
+            begin = t;
+        }
+
+        void on_document_end(time_point t) {
+            end = t;
+        }
+    };
+
+    struct UntimedHooks : TimedHooks {
+        static constexpr bool timestamps = false;
+    };
+}
+
+TEST_CASE("parse calls hooks in document order", "[nbfx::hooks]") {
+    EventHooks hooks;
+    const auto element = parse(document.data(), hooks);
+
+    REQUIRE(hooks.events == L"D<a<b>b<c>c>aD");
+    REQUIRE(hooks.payloads.empty());
+    REQUIRE(element.children().size() == 2);
+
+    // hooks and a sink together
+    EventHooks more;
+    NbfxNullSink sink;
+    parse(document.data(), sink, more);
+    REQUIRE(more.events == hooks.events);
+}
+
+TEST_CASE("parse reports payloads of at least large_payload bytes", "[nbfx::hooks]") {
+    // <a>hello</a><b> with 4 bytes in two records
+    const std::vector<uint8_t> text = {0x40, 0x01, 'a', 0x99, 0x05, 'h', 'e', 'l', 'l', 'o'};
+    const std::vector<uint8_t> bytes = {0x40, 0x01, 'b', 0x9E, 0x04, 1, 2, 3, 4, 0x9F, 0x01, 5};
+
+    EventHooks hooks;
+    parse(text.data(), hooks);
+    REQUIRE(hooks.events == L"D<a[]>aD");
+    REQUIRE(hooks.payloads == std::vector<size_t>{5});
+
+    EventHooks chunks;
+    const auto element = parse(bytes.data(), chunks);
+    REQUIRE(chunks.events == L"D<b[]>bD");
+    REQUIRE(chunks.payloads == std::vector<size_t>{4});
+    REQUIRE(element.value().bytes_size() == 5);
+}
+
+TEST_CASE("serialize calls hooks with the same events as parse", "[nbfx::hooks]") {
+    const auto element = parse(document.data());
+
+    EventHooks hooks;
+    std::vector<uint8_t> data;
+    serialize(element, std::back_inserter(data), false, hooks);
+    REQUIRE(data == document);
+    REQUIRE(hooks.events == L"D<a<b>b<c>c>aD");
+
+    NbfxElement large(L"a", {}, {});
+    large.value() = std::wstring(L"hello");
+    EventHooks payload;
+    data.clear();
+    serialize(large, std::back_inserter(data), false, payload);
+    REQUIRE(payload.events == L"D<a[]>aD");
+    REQUIRE(payload.payloads == std::vector<size_t>{5});
+}
+
+TEST_CASE("hooks get timestamps only when they ask for them", "[nbfx::hooks]") {
+    TimedHooks timed;
+    parse(document.data(), timed);
+    REQUIRE(timed.begin != NbfxNoHooks::time_point());
+    REQUIRE(timed.end >= timed.begin);
+
+    UntimedHooks untimed;
+    parse(document.data(), untimed);
+    REQUIRE(untimed.begin == NbfxNoHooks::time_point());
+}
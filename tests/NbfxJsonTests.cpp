@@ -0,0 +1,177 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/json.hpp"
+#include "nbfx/xml.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    std::vector<uint8_t> to_bytes(const NbfxElement &element) {
+        std::vector<uint8_t> data;
+        serialize(element, std::back_inserter(data), false);
+        return data;
+    }
+}
+
+TEST_CASE("to_json writes typed values, attributes and nested objects", "[nbfx::json]") {
+    const NbfxElement element(QName(L"s", L"Order"), {
+            NbfxAttribute(QName(L"s", L"xmlns"), NbfxValue(L"urn:orders")),
+            NbfxAttribute(L"id", NbfxValue(int64_t{42}))
+    }, {
+            NbfxElement(L"Customer", {}, NbfxValue(L"Jane \"JJ\" Doe\n")),
+            NbfxElement(L"Paid", {}, NbfxValue(true)),
+            NbfxElement(L"Total", {}, NbfxValue(uint64_t{18446744073709551615ull})),
+            NbfxElement(L"Note", {}, {}),
+            NbfxElement(L"Data", {}, NbfxValue(std::vector<uint8_t>{'M', 'a', 'n'})),
+            NbfxElement(L"Address", {}, {NbfxElement(L"City", {}, NbfxValue(L"Oslo"))})
+    });
+    const auto data = to_bytes(element);
+
+    REQUIRE(to_json(data.data()) ==
+            R"({"Order":{"@id":42,"Customer":"Jane \"JJ\" Doe\n","Paid":true,"Total":18446744073709551615,)"
+            R"("Note":null,"Data":"TWFu","Address":{"City":"Oslo"}}})");
+
+    NbfxJsonOptions options;
+    options.prefixes = true;
+    options.xmlns = true;
+    options.attribute_prefix = "-";
+    REQUIRE(to_json(data.data(), options).substr(0, 45) == R"({"s:Order":{"-xmlns:s":"urn:orders","-id":42,)");
+}
+
+TEST_CASE("to_json writes adjacent repeated children as arrays", "[nbfx::json]") {
+    const auto data = from_xml(
+            "<r><item>1</item><item>2</item><other/><item>3</item>"
+            "<list><x a='1'/><x>y</x></list><x/><x/></r>");
+
+    REQUIRE(to_json(data.data()) ==
+            R"({"r":{"item":["1","2"],"other":null,"item":"3",)"
+            R"("list":{"x":[{"@a":"1"},"y"]},"x":[null,null]}})");
+
+    const auto text_after = from_xml("<a><x/><x/>t</a>");
+    REQUIRE(to_json(text_after.data()) == R"({"a":{"x":[null,null],"#text":"t"}})");
+    const auto text_between = from_xml("<a><x/><x/>t<x/><x/></a>");
+    REQUIRE(to_json(text_between.data()) == R"({"a":{"x":[null,null],"#text":"t","x":[null,null]}})");
+
+    NbfxJsonOptions options;
+    options.arrays = false;
+    REQUIRE(to_json(data.data(), options) ==
+            R"({"r":{"item":"1","item":"2","other":null,"item":"3",)"
+            R"("list":{"x":{"@a":"1"},"x":"y"},"x":null,"x":null}})");
+}
+
+TEST_CASE("to_json writes mixed content and special values as strings", "[nbfx::json]") {
+    const auto mixed = from_xml("<p a='b'>one<b>two</b>three</p>");
+    REQUIRE(to_json(mixed.data()) == R"({"p":{"@a":"b","#text":"one","b":"two","#text":"three"}})");
+
+    // <a>NaN</a> as Double, then a control character in a Chars8Text record
+    const std::vector<uint8_t> nan = {0x40, 0x01, 'a', 0x93, 0, 0, 0, 0, 0, 0, 0xF8, 0x7F};
+    REQUIRE(to_json(nan.data()) == R"({"a":"NaN"})");
+    const std::vector<uint8_t> control = {0x40, 0x01, 'a', 0x99, 0x02, 0x01, '\\'};
+    REQUIRE(to_json(control.data()) == R"({"a":"\u0001\\"})");
+
+    // consecutive bytes records make one base64 string
+    const std::vector<uint8_t> chunks = {0x40, 0x01, 'b', 0x9E, 0x01, 'M', 0x9E, 0x02, 'a', 'n', 0x9F, 0x01, 'y'};
+    REQUIRE(to_json(chunks.data()) == R"({"b":"TWFueQ=="})");
+}
+
+TEST_CASE("to_json writes to a stream and returns the end of the document", "[nbfx::json]") {
+    NbfxElement element(L"root", {}, {});
+    for (auto i = 0; i < 5000; ++i) {
+        element.children().push_back(NbfxElement(L"item", {}, NbfxValue(int64_t{i})));
+    }
+    auto data = to_bytes(element);
+    const auto size = data.size();
+    data.push_back(0x40);
+
+    std::string text;
+    REQUIRE(to_json(data.data(), text) == data.data() + size);
+    REQUIRE(text.substr(0, 25) == R"({"root":{"item":[0,1,2,3,)");
+
+    std::ostringstream stream;
+    REQUIRE(to_json(data.data(), stream) == data.data() + size);
+    REQUIRE(stream.str() == text);
+}
+
+TEST_CASE("to_json decides arrays of values larger than the stream buffer", "[nbfx::json]") {
+    NbfxElement big(L"big", {}, {});
+    for (auto i = 0; i < 20000; ++i) {
+        big.children().push_back(NbfxElement(L"item", {}, NbfxValue(int64_t{i})));
+    }
+    const NbfxElement element(L"root", {}, {big, big, NbfxElement(L"other", {}, {}), big});
+    const auto data = to_bytes(element);
+
+    std::string text;
+    to_json(data.data(), text);
+    REQUIRE(text.substr(0, 31) == R"({"root":{"big":[{"item":[0,1,2,)");
+    REQUIRE(text.find(R"(19999]}],"other":null,"big":{"item":[0,)") != std::string::npos);
+    REQUIRE(text.substr(text.size() - 10) == R"(,19999]}}})");
+
+    std::ostringstream stream;
+    to_json(data.data(), stream);
+    REQUIRE(stream.str() == text);
+}
+
+namespace {
+    struct WriteRecorder : std::streambuf {
+        std::string data;
+        std::streamsize largest = 0;
+
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            data.append(s, static_cast<size_t>(n));
+            largest = std::max(largest, n);
+            return n;
+        }
+
+        int overflow(int c) override {
+            if (c != EOF) {
+                data += static_cast<char>(c);
+            }
+            return c;
+        }
+    };
+
+    void require_streamed(const std::vector<uint8_t> &data, const std::string &prefix) {
+        std::string text;
+        to_json(data.data(), text);
+        REQUIRE(text.substr(0, prefix.size()) == prefix);
+
+        WriteRecorder recorder;
+        std::ostream stream(&recorder);
+        to_json(data.data(), stream);
+        REQUIRE(recorder.data == text);
+        REQUIRE(recorder.largest < 4 * 64 * 1024);
+    }
+}
+
+TEST_CASE("to_json streams large text without holding it back", "[nbfx::json]") {
+    NbfxValue chunked{std::vector<uint8_t>(600000, 0xAB)};
+    chunked.append_bytes(std::vector<uint8_t>(600001, 0xCD));
+    const NbfxElement blob(L"blob", {}, chunked);
+    const NbfxElement text(L"text", {}, NbfxValue(std::wstring(1000000, L'x')));
+
+    // repeated children keep the array check alive while their values are written
+    require_streamed(to_bytes(NbfxElement(L"root", {}, {blob, blob, text})), R"({"root":{"blob":["q6ur)");
+    require_streamed(to_bytes(NbfxElement(L"root", {NbfxAttribute(L"id", NbfxValue(int64_t{1}))}, text.value())),
+                     R"({"root":{"@id":1,"#text":"xxx)");
+
+    // escapes make the text six times longer
+    require_streamed(to_bytes(NbfxElement(L"root", {}, NbfxValue(std::wstring(500000, L'\x01')))),
+                     R"({"root":"\u0001\u0001)");
+
+    // <a>x...x<b/></a>, text before a child is the text member
+    std::vector<uint8_t> mixed = {0x40, 0x01, 'a', 0x9C, 0x40, 0x42, 0x0F, 0x00};
+    mixed.insert(mixed.end(), 1000000, 'x');
+    mixed.insert(mixed.end(), {0x40, 0x01, 'b', 0x01, 0x01});
+    require_streamed(mixed, R"({"a":{"#text":"xxx)");
+
+    std::string json;
+    to_json(mixed.data(), json);
+    REQUIRE(json.substr(json.size() - 15) == R"(xxx","b":null}})");
+}
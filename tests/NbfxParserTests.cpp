@@ -0,0 +1,179 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+using namespace nbfx;
+
+namespace {
+    /*
+        <doc><Base64>AAEC AwQ=</Base64><Text>abc</Text></doc>
+     */
+    const std::vector<uint8_t> chunked = {
+            0x40, 0x03, 0x64, 0x6F, 0x63,
+            0x40, 0x06, 0x42, 0x61, 0x73, 0x65, 0x36, 0x34,
+            0x9E, 0x03, 0x00, 0x01, 0x02,
+            0x9F, 0x02, 0x03, 0x04,
+            0x40, 0x04, 0x54, 0x65, 0x78, 0x74, 0x99, 0x03, 0x61, 0x62, 0x63,
+            0x01
+    };
+
+    struct CollectingSink {
+        std::vector<uint8_t> data;
+        std::vector<std::wstring> owners;
+        size_t depth = 0;
+
+        bool on_bytes(const std::vector<NbfxElement> &path, const uint8_t *p, size_t size) {
+            data.insert(data.end(), p, p + size);
+            owners.push_back(path.back().name());
+            depth = path.size();
+            return true;
+        }
+    };
+}
+
+TEST_CASE("parse joins consecutive bytes records when the element ends", "[nbfx::parse]") {
+    const auto root = parse(chunked.cbegin());
+    const auto &value = root.first_child(L"Base64")->value();
+
+    REQUIRE(value.chunk_count() == 1);
+    REQUIRE(value.bytes_size() == 5);
+    REQUIRE((value.bytes() == std::vector<uint8_t>{0x00, 0x01, 0x02, 0x03, 0x04}));
+}
+
+TEST_CASE("chunked bytes serialize back to the same records", "[nbfx::parse]") {
+    NbfxValue base64{std::vector<uint8_t>{0x00, 0x01, 0x02}};
+    base64.append_bytes({0x03, 0x04});
+    const NbfxElement root(L"doc", {}, {
+            NbfxElement(L"Base64", {}, base64),
+            NbfxElement(L"Text", {}, NbfxValue(std::wstring(L"abc")))
+    });
+
+    std::vector<uint8_t> buffer;
+    serialize(root, std::back_inserter(buffer), false);
+    REQUIRE(buffer == chunked);
+}
+
+TEST_CASE("const access to chunked bytes doesn't join them", "[nbfx::parse]") {
+    NbfxValue value{std::vector<uint8_t>{1, 2}};
+    value.append_bytes({3});
+    const auto &shared = value;
+
+    REQUIRE_THROWS_AS(shared.bytes(), std::logic_error);
+    REQUIRE(shared.chunk_count() == 2);
+    REQUIRE((value.bytes() == std::vector<uint8_t>{1, 2, 3}));
+    REQUIRE(shared.chunk_count() == 1);
+}
+
+TEST_CASE("parse passes bytes to the sink", "[nbfx::parse]") {
+    CollectingSink sink;
+    const auto root = parse(chunked.cbegin(), sink);
+
+    REQUIRE((sink.data == std::vector<uint8_t>{0x00, 0x01, 0x02, 0x03, 0x04}));
+    REQUIRE((sink.owners == std::vector<std::wstring>{L"Base64", L"Base64"}));
+    REQUIRE(sink.depth == 2);
+    REQUIRE(root.first_child(L"Base64")->value().type() == NbfxValueType::Null);
+    REQUIRE(root.first_child(L"Text")->value().string() == L"abc");
+}
+
+TEST_CASE("parse reads names and text from non-contiguous input", "[nbfx::parse]") {
+    const std::wstring name(600, L'n');
+    const std::wstring text(600, L't');
+    std::vector<uint8_t> buffer;
+    serialize(NbfxElement(name, {}, NbfxValue(text)), std::back_inserter(buffer));
+
+    const std::deque<uint8_t> data(buffer.begin(), buffer.end());
+    const auto root = parse(data.cbegin());
+    REQUIRE(root.name() == name);
+    REQUIRE(root.value().string() == text);
+}
+
+TEST_CASE("parse passes bytes of non-contiguous input to the sink", "[nbfx::parse]") {
+    std::vector<uint8_t> payload(2000);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i * 7);
+    }
+    std::vector<uint8_t> buffer;
+    serialize(NbfxElement(L"doc", {}, {NbfxElement(L"Blob", {}, NbfxValue(payload))}), std::back_inserter(buffer));
+
+    // the payload spans several blocks of the deque
+    const std::deque<uint8_t> data(buffer.begin(), buffer.end());
+    CollectingSink sink;
+    const auto root = parse(data.cbegin(), sink);
+    REQUIRE(sink.data == payload);
+    REQUIRE((sink.owners == std::vector<std::wstring>{L"Blob"}));
+    REQUIRE(root.first_child(L"Blob")->value().type() == NbfxValueType::Null);
+}
+
+namespace {
+    std::vector<uint8_t> concatenated(size_t count) {
+        std::vector<uint8_t> data;
+        for (size_t i = 0; i < count; ++i) {
+            serialize(NbfxElement(L"Message", {}, {
+                    NbfxElement(L"Id", {}, NbfxValue(static_cast<int64_t>(i))),
+                    NbfxElement(L"Text", {}, NbfxValue(std::wstring(i % 7, L'a')))
+            }), std::back_inserter(data));
+        }
+        return data;
+    }
+}
+
+TEST_CASE("parse_next advances past the document", "[nbfx::parse_next]") {
+    const auto data = concatenated(3);
+    auto p = data.cbegin();
+
+    for (int64_t i = 0; i < 3; ++i) {
+        const auto root = parse_next(p);
+        REQUIRE(root.first_child(L"Id")->value().integer() == i);
+    }
+    REQUIRE(p == data.cend());
+}
+
+TEST_CASE("find_document_end matches parse_next", "[nbfx::parse_next]") {
+    const auto data = concatenated(5);
+    const auto begin = data.data();
+    const auto end = begin + data.size();
+
+    const auto documents = split_documents(begin, end);
+    REQUIRE(documents.size() == 5);
+
+    auto p = begin;
+    for (const auto &document : documents) {
+        REQUIRE(document.data == p);
+        parse_next(p);
+        REQUIRE(document.data + document.size == p);
+    }
+
+    REQUIRE_THROWS_AS(find_document_end(begin, begin + documents[0].size - 1), std::invalid_argument);
+}
+
+TEST_CASE("parse_all iterates concatenated documents", "[nbfx::parse_all]") {
+    const auto data = concatenated(10);
+
+    int64_t expected = 0;
+    for (const auto &root : parse_all(data.begin(), data.end())) {
+        REQUIRE(root.first_child(L"Id")->value().integer() == expected);
+        ++expected;
+    }
+    REQUIRE(expected == 10);
+
+    const std::vector<uint8_t> empty;
+    const auto range = parse_all(empty.begin(), empty.end());
+    REQUIRE(range.begin() == range.end());
+}
+
+TEST_CASE("parse_all_parallel keeps document order", "[nbfx::parse_all]") {
+    const auto data = concatenated(1000);
+    const auto documents = parse_all_parallel(data.begin(), data.end(), 4);
+
+    REQUIRE(documents.size() == 1000);
+    bool ordered = true;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        ordered = ordered && documents[i].first_child(L"Id")->value().integer() == static_cast<int64_t>(i);
+    }
+    REQUIRE(ordered);
+}
@@ -0,0 +1,151 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/pipeline.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+using namespace nbfx;
+
+namespace {
+    std::vector<uint8_t> make_message(int64_t id) {
+        std::vector<uint8_t> data;
+        serialize(NbfxElement(L"Message", {}, {
+                NbfxElement(L"Id", {}, NbfxValue(id))
+        }), std::back_inserter(data));
+        return data;
+    }
+}
+
+TEST_CASE("NbfxMpmcQueue delivers every item once across threads", "[nbfx::NbfxMpmcQueue]") {
+    NbfxMpmcQueue<uint64_t> queue(64);
+    constexpr uint64_t per_producer = 20000;
+    constexpr unsigned producers = 4;
+
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> count{0};
+    std::vector<std::thread> threads;
+
+    for (unsigned c = 0; c < 4; ++c) {
+        threads.emplace_back([&]() {
+            while (auto item = queue.pop()) {
+                sum += *item;
+                ++count;
+            }
+        });
+    }
+
+    std::vector<std::thread> producer_threads;
+    for (unsigned p = 0; p < producers; ++p) {
+        producer_threads.emplace_back([&, p]() {
+            for (uint64_t i = 0; i < per_producer; ++i) {
+                queue.push(p * per_producer + i + 1);
+            }
+        });
+    }
+    for (auto &thread : producer_threads) {
+        thread.join();
+    }
+    queue.close();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    const auto n = producers * per_producer;
+    REQUIRE(count == n);
+    REQUIRE(sum == n * (n + 1) / 2);
+}
+
+TEST_CASE("NbfxMpmcQueue reports full and empty", "[nbfx::NbfxMpmcQueue]") {
+    NbfxMpmcQueue<std::vector<uint8_t>> queue(4);
+    REQUIRE(queue.capacity() == 4);
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE(queue.try_push(std::vector<uint8_t>(i + 1)));
+    }
+    REQUIRE_FALSE(queue.try_push(std::vector<uint8_t>(9)));
+    REQUIRE(queue.size() == 4);
+    REQUIRE(queue.try_pop()->size() == 1);
+    queue.close();
+    REQUIRE_FALSE(queue.push(std::vector<uint8_t>(9)));
+    REQUIRE(queue.pop()->size() == 2);
+}
+
+TEST_CASE("NbfxPipeline frames, parses and dispatches every message", "[nbfx::NbfxPipeline]") {
+    constexpr int64_t messages = 5000;
+    std::atomic<int64_t> next{0};
+    std::atomic<int64_t> sum{0};
+    std::atomic<int64_t> handled{0};
+
+    NbfxPipelineOptions options;
+    options.queue_capacity = 16;
+    options.parse_workers = 3;
+    options.handler_workers = 2;
+    options.batch_size = 4;
+
+    NbfxPipeline pipeline(
+            [&](std::vector<uint8_t> &buffer) {
+                const auto id = next++;
+                if (id >= messages) {
+                    return false;
+                }
+                const auto data = make_message(id);
+                buffer.assign(data.begin(), data.end());
+                return true;
+            },
+            [&](NbfxElement &&element) {
+                sum += element.first_child(L"Id")->value().integer();
+                ++handled;
+            },
+            options);
+    pipeline.run();
+
+    const auto stats = pipeline.stats();
+    REQUIRE(handled == messages);
+    REQUIRE(sum == messages * (messages - 1) / 2);
+    REQUIRE(stats.framed == static_cast<uint64_t>(messages));
+    REQUIRE(stats.parse.processed == static_cast<uint64_t>(messages));
+    REQUIRE(stats.dispatch.processed == static_cast<uint64_t>(messages));
+    REQUIRE(stats.parse.queue_depth == 0);
+    REQUIRE(stats.dispatch.max_latency_ns >= static_cast<uint64_t>(stats.dispatch.mean_latency_ns()));
+}
+
+TEST_CASE("NbfxPipeline counts malformed messages and failing handlers", "[nbfx::NbfxPipeline]") {
+    int64_t next = 0;
+    std::atomic<int> reported{0};
+
+    NbfxPipelineOptions options;
+    options.parse_workers = 2;
+
+    NbfxPipeline pipeline(
+            [&](std::vector<uint8_t> &buffer) {
+                const auto id = next++;
+                if (id >= 30) {
+                    return false;
+                }
+                if (id % 6 == 0) {
+                    buffer = {0x00};
+                } else if (id % 6 == 3) {
+                    buffer = make_message(id);
+                    buffer.resize(buffer.size() / 2);
+                } else {
+                    buffer = make_message(id);
+                }
+                return true;
+            },
+            [&](NbfxElement &&element) {
+                if (element.first_child(L"Id")->value().integer() % 3 == 1) {
+                    throw std::runtime_error("handler failed");
+                }
+            },
+            options,
+            [&](std::exception_ptr) { ++reported; });
+    pipeline.run();
+
+    const auto stats = pipeline.stats();
+    REQUIRE(stats.parse.errors == 10);
+    REQUIRE(stats.parse.processed == 20);
+    REQUIRE(stats.dispatch.errors == 10);
+    REQUIRE(stats.dispatch.processed == 10);
+    REQUIRE(reported == 20);
+}
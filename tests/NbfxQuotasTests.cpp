@@ -0,0 +1,148 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/corpus.hpp"
+#include "nbfx/documents.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    // <a x="1"><b>hi</b></a>
+    const std::vector<uint8_t> document = {
+            0x40, 0x01, 'a', 0x04, 0x01, 'x', 0x98, 0x01, '1',
+            0x40, 0x01, 'b', 0x99, 0x02, 'h', 'i',
+            0x01};
+
+    NbfxReaderQuotas unlimited() {
+        return NbfxReaderQuotas::max();
+    }
+
+    struct ConsumingSink {
+        size_t received = 0;
+
+        bool on_bytes(const std::vector<NbfxElement> &, const uint8_t *, size_t size) {
+            received += size;
+            return true;
+        }
+    };
+
+    std::vector<uint8_t> to_bytes(const NbfxElement &element) {
+        std::vector<uint8_t> data;
+        serialize(element, std::back_inserter(data), false);
+        return data;
+    }
+}
+
+TEST_CASE("parse with quotas accepts documents within them", "[nbfx::quotas]") {
+    const auto corpus = NbfxCorpusGenerator(corpus_preset("soap12-blobs")).generate(20);
+    const auto end = corpus.data() + corpus.size();
+
+    NbfxReaderQuotas quotas;
+    for (auto p = corpus.data(); p != end; p = find_document_end(p, end)) {
+        REQUIRE(to_bytes(parse(p, quotas)) == to_bytes(parse(p)));
+    }
+
+    auto p = document.data();
+    REQUIRE(to_bytes(parse_next(p, quotas)) == document);
+    REQUIRE(p == document.data() + document.size());
+}
+
+TEST_CASE("parse rejects documents nested too deeply", "[nbfx::quotas]") {
+    auto quotas = unlimited();
+    quotas.max_depth = 2;
+    REQUIRE_NOTHROW(parse(document.data(), quotas));
+
+    quotas.max_depth = 1;
+    REQUIRE_THROWS_AS(parse(document.data(), quotas), std::length_error);
+}
+
+TEST_CASE("parse rejects long strings and names", "[nbfx::quotas]") {
+    auto quotas = unlimited();
+    quotas.max_string_length = 2;
+    REQUIRE_NOTHROW(parse(document.data(), quotas));
+
+    quotas.max_string_length = 1;
+    REQUIRE_THROWS_AS(parse(document.data(), quotas), std::length_error);
+
+    quotas = unlimited();
+    quotas.max_name_count = 3;
+    REQUIRE_NOTHROW(parse(document.data(), quotas));
+
+    quotas.max_name_count = 2;
+    REQUIRE_THROWS_AS(parse(document.data(), quotas), std::length_error);
+}
+
+TEST_CASE("parse checks quotas of non-contiguous input", "[nbfx::quotas]") {
+    // name and text span several blocks of the deque
+    const auto data = to_bytes(NbfxElement(std::wstring(600, L'n'), {}, NbfxValue(std::wstring(700, L't'))));
+    const std::deque<uint8_t> input(data.begin(), data.end());
+
+    auto quotas = unlimited();
+    quotas.max_string_length = 700;
+    REQUIRE(to_bytes(parse(input.cbegin(), quotas)) == data);
+
+    quotas.max_string_length = 699;
+    REQUIRE_THROWS_AS(parse(input.cbegin(), quotas), std::length_error);
+}
+
+TEST_CASE("parse rejects a huge bytes length before reading the payload", "[nbfx::quotas]") {
+    // <a> with Bytes32Text claiming 2^31 bytes and no payload
+    const std::vector<uint8_t> hostile = {0x40, 0x01, 'a', 0xA3, 0x00, 0x00, 0x00, 0x80};
+
+    NbfxReaderQuotas quotas;
+    REQUIRE_THROWS_AS(parse(hostile.data(), quotas), std::length_error);
+
+    quotas = unlimited();
+    quotas.max_memory = 1024 * 1024;
+    REQUIRE_THROWS_AS(parse(hostile.data(), quotas), std::length_error);
+}
+
+TEST_CASE("bytes quota covers all chunks of a value", "[nbfx::quotas]") {
+    // <b> with 4 bytes in two records
+    const std::vector<uint8_t> chunks = {0x40, 0x01, 'b', 0x9E, 0x02, 1, 2, 0x9F, 0x02, 3, 4};
+
+    auto quotas = unlimited();
+    quotas.max_bytes_length = 4;
+    REQUIRE(parse(chunks.data(), quotas).value().bytes_size() == 4);
+
+    quotas.max_bytes_length = 3;
+    REQUIRE_THROWS_AS(parse(chunks.data(), quotas), std::length_error);
+
+    NbfxNullSink sink;
+    REQUIRE_THROWS_AS(parse(chunks.data(), sink, quotas), std::length_error);
+}
+
+TEST_CASE("bytes quota covers chunks consumed by a sink", "[nbfx::quotas]") {
+    // <a><b> with 4 bytes in two records</b><b> with 2 bytes</b></a>
+    const std::vector<uint8_t> chunks = {
+            0x40, 0x01, 'a',
+            0x40, 0x01, 'b', 0x9E, 0x02, 1, 2, 0x9F, 0x02, 3, 4,
+            0x40, 0x01, 'b', 0x9F, 0x02, 5, 6,
+            0x01};
+
+    auto quotas = unlimited();
+    quotas.max_bytes_length = 4;
+    ConsumingSink sink;
+    REQUIRE_NOTHROW(parse(chunks.data(), sink, quotas));
+    REQUIRE(sink.received == 6);
+
+    quotas.max_bytes_length = 3;
+    REQUIRE_THROWS_AS(parse(chunks.data(), sink, quotas), std::length_error);
+}
+
+TEST_CASE("memory quota limits the whole document", "[nbfx::quotas]") {
+    const auto element = parse(document.data());
+
+    auto quotas = unlimited();
+    quotas.max_memory = element.memory_usage().total() * 4;
+    REQUIRE_NOTHROW(parse(document.data(), quotas));
+
+    quotas.max_memory = sizeof(NbfxElement);
+    REQUIRE_THROWS_AS(parse(document.data(), quotas), std::length_error);
+}
@@ -0,0 +1,108 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+using namespace nbfx;
+
+TEST_CASE("NbfxReader reports nodes in document order", "[nbfx::NbfxReader]") {
+    /*
+        <s:doc xmlns:s="http://abc" attr="false"><a>hello</a><b/>1</s:doc>
+     */
+    std::vector<uint8_t> data = {
+            0x70, 0x03, 0x64, 0x6F, 0x63,
+            0x09, 0x01, 0x73, 0x0A, 0x68, 0x74, 0x74, 0x70, 0x3A, 0x2F, 0x2F, 0x61, 0x62, 0x63,
+            0x04, 0x04, 0x61, 0x74, 0x74, 0x72, 0x84,
+            0x40, 0x01, 0x61, 0x99, 0x05, 0x68, 0x65, 0x6C, 0x6C, 0x6F,
+            0x40, 0x01, 0x62, 0x01,
+            0x83
+    };
+
+    NbfxReader<std::vector<uint8_t>::const_iterator> reader(data.cbegin());
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::Element);
+    REQUIRE(reader.record_type() == NbfxRecordType::PrefixElementS);
+    REQUIRE(reader.prefix() == "s");
+    REQUIRE(reader.name() == "doc");
+    REQUIRE(reader.depth() == 1);
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::Attribute);
+    REQUIRE(reader.is_xmlns());
+    REQUIRE(reader.prefix() == "s");
+    REQUIRE(reader.text().chars() == "http://abc");
+    REQUIRE(reader.text().value().string() == L"http://abc");
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::Attribute);
+    REQUIRE_FALSE(reader.is_xmlns());
+    REQUIRE(reader.name() == "attr");
+    REQUIRE_FALSE(reader.text().boolean());
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::Element);
+    REQUIRE(reader.name() == "a");
+    REQUIRE(reader.depth() == 2);
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::Text);
+    REQUIRE(reader.text().chars() == "hello");
+    REQUIRE(reader.position() - data.cbegin() == 36);
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::EndElement);
+    REQUIRE(reader.record_begin() == reader.position());
+    REQUIRE(reader.depth() == 1);
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.name() == "b");
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::EndElement);
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::Text);
+    REQUIRE(reader.text().integer() == 1);
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.node_type() == NbfxNodeType::EndElement);
+    REQUIRE(reader.depth() == 0);
+    REQUIRE(reader.position() == data.cend());
+
+    REQUIRE_FALSE(reader.read());
+}
+
+TEST_CASE("NbfxReader skips whole elements", "[nbfx::NbfxReader]") {
+    NbfxElement root(L"root", {}, {
+            NbfxElement(L"a", {NbfxAttribute(L"x", NbfxValue(5))}, {
+                    NbfxElement(L"deep", {}, NbfxValue(std::vector<uint8_t>(300, 0x55))),
+                    NbfxElement(L"deeper", {}, {NbfxElement(L"c", {}, NbfxValue(L"text"))})
+            }),
+            NbfxElement(L"b", {}, NbfxValue(static_cast<uint64_t>(42)))
+    });
+
+    std::vector<uint8_t> data;
+    serialize(root, std::back_inserter(data));
+
+    NbfxReader<const uint8_t *> reader(data.data());
+    REQUIRE(reader.read());
+    REQUIRE(reader.read());
+    REQUIRE(reader.name() == "a");
+
+    reader.skip();
+    REQUIRE(reader.node_type() == NbfxNodeType::EndElement);
+    REQUIRE(reader.depth() == 1);
+
+    REQUIRE(reader.read());
+    REQUIRE(reader.name() == "b");
+    REQUIRE(reader.read());
+    REQUIRE(reader.text().type() == NbfxRecordType::UInt64Text);
+    REQUIRE(reader.text().uint64() == 42);
+    REQUIRE(reader.read());
+    REQUIRE(reader.read());
+    REQUIRE(reader.depth() == 0);
+    REQUIRE(reader.position() == data.data() + data.size());
+    REQUIRE_FALSE(reader.read());
+}
@@ -0,0 +1,135 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/rewrite.hpp"
+
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    NbfxElement make_header(const NbfxValue &to = NbfxValue(L"net.tcp://backend/service"),
+                            const NbfxValue *secret = nullptr,
+                            const NbfxValue &trace = NbfxValue(int64_t{7})) {
+        const NbfxValue hidden(L"hunter2");
+        NbfxElement header(QName(L"s", L"Header"), {}, {NbfxElement(L"To", {}, to)});
+        header.children().push_back(NbfxElement(L"Secret", {NbfxAttribute(L"kind", NbfxValue(L"token"))}, secret ? *secret : hidden));
+        header.children().push_back(NbfxElement(L"Trace", {}, trace));
+        return header;
+    }
+
+    NbfxElement make_message(NbfxElement header = make_header()) {
+        NbfxElement message(QName(L"s", L"Envelope"), {
+                NbfxAttribute(QName(L"s", L"xmlns"), NbfxValue(L"http://www.w3.org/2003/05/soap-envelope"))
+        }, {});
+        message.children().push_back(std::move(header));
+        message.children().push_back(NbfxElement(QName(L"s", L"Body"), {}, {
+                        NbfxElement(L"Zeta", {}, NbfxValue(std::vector<uint8_t>(300, 0x11))),
+                        NbfxElement(L"Alpha", {}, NbfxValue(L"first"))
+                }));
+        return message;
+    }
+
+    std::vector<uint8_t> to_bytes(const NbfxElement &element) {
+        std::vector<uint8_t> data;
+        serialize(element, std::back_inserter(data), false);
+        return data;
+    }
+
+    std::vector<uint8_t> rewrite(const NbfxRewriter &rewriter, const std::vector<uint8_t> &data) {
+        return rewriter.rewrite(data.data(), data.data() + data.size());
+    }
+}
+
+TEST_CASE("Rewriter without matching rules copies the document as is", "[nbfx::rewrite]") {
+    const auto data = to_bytes(make_message());
+
+    NbfxRewriter rewriter;
+    rewriter.remove("Envelope/Header/Missing").remove("Other");
+
+    REQUIRE(rewrite(rewriter, data) == data);
+}
+
+TEST_CASE("Rewriter removes matched elements and keeps member order", "[nbfx::rewrite]") {
+    NbfxElement header(QName(L"s", L"Header"), {}, {
+            NbfxElement(L"To", {}, NbfxValue(L"net.tcp://backend/service")),
+            NbfxElement(L"Trace", {}, NbfxValue(int64_t{7}))
+    });
+    const auto expected = make_message(std::move(header));
+
+    NbfxRewriter rewriter;
+    rewriter.remove("Envelope/Header/Secret");
+
+    REQUIRE(rewrite(rewriter, to_bytes(make_message())) == to_bytes(expected));
+}
+
+TEST_CASE("Rewriter replaces matched elements", "[nbfx::rewrite]") {
+    const NbfxValue other(L"net.tcp://other/service");
+    const NbfxElement to(L"To", {}, other);
+    const auto expected = make_message(make_header(other));
+
+    NbfxRewriter rewriter;
+    rewriter.replace("/Envelope/Header/To", to);
+
+    REQUIRE(rewrite(rewriter, to_bytes(make_message())) == to_bytes(expected));
+}
+
+TEST_CASE("Rewriter replaces values and keeps attributes", "[nbfx::rewrite]") {
+    const NbfxValue masked(L"***");
+    const auto expected = make_message(make_header(NbfxValue(L"net.tcp://backend/service"), &masked, NbfxValue()));
+
+    NbfxRewriter rewriter;
+    rewriter.replace_value("Envelope/Header/Secret", NbfxValue(L"***"))
+            .replace_value("Envelope/Header/Trace", NbfxValue());
+
+    const auto result = rewrite(rewriter, to_bytes(make_message()));
+    REQUIRE(result == to_bytes(expected));
+
+    const auto parsed = parse(result.begin());
+    REQUIRE(parsed.children()[0].children()[1].attributes()[0].value().to_string() == L"token");
+}
+
+TEST_CASE("Rewriter matches wildcards and dictionary names", "[nbfx::rewrite]") {
+    // <D:2><D:8><a>1</a></D:8><D:14><a>2</a></D:14></D:2>
+    const std::vector<uint8_t> data = {
+            0x42, 0x02,
+            0x42, 0x08, 0x40, 0x01, 'a', 0x83, 0x01,
+            0x42, 0x0E, 0x40, 0x01, 'a', 0x83, 0x01,
+            0x01
+    };
+
+    NbfxRewriter wildcard;
+    wildcard.remove("D:2/*/a");
+    REQUIRE((rewrite(wildcard, data) == std::vector<uint8_t>{0x42, 0x02, 0x42, 0x08, 0x01, 0x42, 0x0E, 0x01, 0x01}));
+
+    NbfxRewriter dictionary;
+    dictionary.replace_value("D:2/D:14/a", NbfxValue(false));
+    REQUIRE((rewrite(dictionary, data) == std::vector<uint8_t>{
+            0x42, 0x02,
+            0x42, 0x08, 0x40, 0x01, 'a', 0x83, 0x01,
+            0x42, 0x0E, 0x40, 0x01, 'a', 0x85, 0x01,
+            0x01
+    }));
+}
+
+TEST_CASE("Rewriter stops at the end of the document", "[nbfx::rewrite]") {
+    auto data = to_bytes(make_message());
+    const auto size = data.size();
+    data.push_back(0x40);
+
+    NbfxRewriter rewriter;
+    rewriter.remove("Envelope/Body");
+
+    std::vector<uint8_t> out;
+    const auto next = rewriter.rewrite(data.data(), data.data() + data.size(), out);
+    REQUIRE(next == data.data() + size);
+    REQUIRE(parse(out.begin()).children().size() == 1);
+
+    std::vector<uint8_t> pointer_out(size);
+    const auto written = rewriter.rewrite(data.data(), data.data() + data.size(), pointer_out.data());
+    REQUIRE(std::vector<uint8_t>(pointer_out.data(), written) == out);
+
+    REQUIRE_THROWS(rewriter.rewrite(data.data(), data.data() + size - 1));
+    REQUIRE_THROWS_AS(NbfxRewriter().remove("/"), std::invalid_argument);
+}
@@ -0,0 +1,155 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/ring.hpp"
+
+#if defined(__linux__)
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace nbfx;
+
+namespace {
+    NbfxElement make_message(int64_t id) {
+        return NbfxElement(L"Message", {}, {
+                NbfxElement(L"Id", {}, NbfxValue(id)),
+                NbfxElement(L"Body", {}, NbfxValue(std::vector<uint8_t>(static_cast<size_t>(id % 300), 0x42)))
+        });
+    }
+}
+
+TEST_CASE("serialized_size matches serialize output", "[nbfx::serialized_size]") {
+    const auto root = make_message(123);
+    std::vector<uint8_t> data;
+    serialize(root, std::back_inserter(data));
+    REQUIRE(serialized_size(root) == data.size());
+}
+
+TEST_CASE("NbfxRingProducer and NbfxRingConsumer pass messages between threads", "[nbfx::ring]") {
+    auto ring = NbfxSharedRing::anonymous(4096);
+    constexpr int64_t count = 2000;
+
+    std::thread producer_thread([&]() {
+        NbfxRingProducer producer(ring);
+        for (int64_t i = 0; i < count; ++i) {
+            producer.send(make_message(i));
+        }
+        producer.close();
+    });
+
+    NbfxRingConsumer consumer(ring);
+    NbfxBytesView message{nullptr, 0};
+    int64_t expected = 0;
+    bool ordered = true;
+    while (consumer.receive(message)) {
+        REQUIRE(message.data >= ring.data());
+        REQUIRE(message.data + message.size <= ring.data() + ring.capacity());
+        const auto view = parse_view(message.data);
+        ordered = ordered && view.first_child("Id")->value().text().integer() == expected;
+        ++expected;
+        consumer.release();
+    }
+    producer_thread.join();
+
+    REQUIRE(ordered);
+    REQUIRE(expected == count);
+}
+
+TEST_CASE("NbfxRingProducer reads bytes sources once", "[nbfx::ring]") {
+    auto ring = NbfxSharedRing::anonymous(4096);
+    std::string payload(100, 'x');
+    std::istringstream stream(payload);
+
+    NbfxRingProducer producer(ring);
+    producer.send(NbfxElement(L"Message", {}, {
+            NbfxElement(L"Blob", {}, NbfxValue(NbfxBytesSource::from_istream(stream, 64)))
+    }));
+    producer.close();
+
+    NbfxRingConsumer consumer(ring);
+    NbfxBytesView message{nullptr, 0};
+    REQUIRE(consumer.receive(message));
+    REQUIRE(find_document_end(message.data, message.data + message.size) == message.data + message.size);
+    const auto parsed = parse(message.data);
+    REQUIRE(parsed.first_child(L"Blob")->value().bytes() == std::vector<uint8_t>(payload.begin(), payload.end()));
+    consumer.release();
+    REQUIRE_FALSE(consumer.receive(message));
+}
+
+TEST_CASE("NbfxRingProducer serializes messages into the free space of the ring", "[nbfx::ring]") {
+    auto ring = NbfxSharedRing::anonymous(1024);
+    NbfxRingProducer producer(ring);
+    NbfxRingConsumer consumer(ring);
+    NbfxBytesView message{nullptr, 0};
+
+    const auto check = [&](int64_t id) {
+        std::vector<uint8_t> expected;
+        serialize(make_message(id), std::back_inserter(expected));
+        REQUIRE(consumer.receive(message));
+        REQUIRE(std::vector<uint8_t>(message.data, message.data + message.size) == expected);
+        consumer.release();
+    };
+
+    // three messages fill most of the ring, the fourth only fits after the first is released and wraps around
+    for (int64_t id = 250; id < 253; ++id) {
+        producer.send(make_message(id));
+    }
+    check(250);
+    producer.send(make_message(253));
+    REQUIRE(ring.header().head.load() % ring.capacity() < 300);
+
+    for (int64_t id = 251; id < 254; ++id) {
+        check(id);
+    }
+    producer.close();
+    REQUIRE_FALSE(consumer.receive(message));
+}
+
+TEST_CASE("NbfxSharedRing is shared by name between processes", "[nbfx::ring]") {
+    const auto name = "/nbfx_ring_test_" + std::to_string(::getpid());
+    auto ring = NbfxSharedRing::create(name, 1024);
+
+    const auto child = ::fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        auto opened = NbfxSharedRing::open(name);
+        NbfxRingProducer producer(opened);
+        for (int64_t i = 0; i < 500; ++i) {
+            producer.send(make_message(i));
+        }
+        producer.close();
+        ::_exit(0);
+    }
+
+    NbfxRingConsumer consumer(ring);
+    NbfxBytesView message{nullptr, 0};
+    int64_t received = 0;
+    int64_t sum = 0;
+    while (consumer.receive(message)) {
+        sum += parse(message.data).first_child(L"Id")->value().integer();
+        ++received;
+        consumer.release();
+    }
+
+    int status = 0;
+    ::waitpid(child, &status, 0);
+    NbfxSharedRing::remove(name);
+
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE(received == 500);
+    REQUIRE(sum == 499 * 500 / 2);
+}
+
+TEST_CASE("NbfxRingProducer rejects messages larger than half the ring", "[nbfx::ring]") {
+    auto ring = NbfxSharedRing::anonymous(256);
+    NbfxRingProducer producer(ring);
+    REQUIRE_THROWS_AS(producer.reserve(200), std::length_error);
+}
+
+#endif
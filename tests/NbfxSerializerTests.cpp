@@ -4,6 +4,8 @@
 #include <array>
 #include <cstdint>
 #include <string>
+#include <thread>
+#include <vector>
 
 
 using namespace nbfx;
@@ -87,4 +89,152 @@ TEST_CASE("Bytes8TextWithEndSerialize", "[nbfx::serialize]") {
             0x40, 0x06, 0x42, 0x61, 0x73, 0x65, 0x36, 0x34, 0x9F, 0x08, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
             0x06, 0x07
     });
-}
\ No newline at end of file
+}
+
+TEST_CASE("nbfx_serializer sorts many children stably", "[nbfx::serialize]") {
+    NbfxElement el(L"Parent");
+    for (auto i = 0; i < 40; ++i) {
+        el.children().push_back(NbfxElement(i % 2 ? L"odd" : L"even", {NbfxAttribute(L"o", NbfxValue(i))}, NbfxValue()));
+    }
+
+    std::vector<uint8_t> buffer;
+    serialize(el, std::back_inserter(buffer));
+    const auto result = parse(buffer.begin());
+
+    REQUIRE(result.children().size() == 40);
+    for (auto i = 0u; i < 20u; ++i) {
+        REQUIRE(result.children().at(i).name() == L"even");
+        REQUIRE(result.children().at(i).attributes().at(0).value().integer() == 2 * i);
+        REQUIRE(result.children().at(20 + i).name() == L"odd");
+        REQUIRE(result.children().at(20 + i).attributes().at(0).value().integer() == 2 * i + 1);
+    }
+}
+
+TEST_CASE("nbfx_serializer picks up children added after serialization", "[nbfx::serialize]") {
+    NbfxElement el(QName(L"s", L"Parent"), {}, {
+            NbfxElement(QName(L"s", L"zombie")),
+            NbfxElement(QName(L"s", L"kremlin"))
+    });
+
+    std::vector<uint8_t> buffer;
+    serialize(el, std::back_inserter(buffer));
+    el.children().emplace_back(QName(L"s", L"ansible"));
+
+    buffer.clear();
+    serialize(el, std::back_inserter(buffer));
+    const auto result = parse(buffer.begin());
+
+    REQUIRE(result.children().size() == 3);
+    REQUIRE(result.children().at(0).name() == L"ansible");
+    REQUIRE(result.children().at(1).name() == L"kremlin");
+    REQUIRE(result.children().at(2).name() == L"zombie");
+}
+
+TEST_CASE("nbfx_serializer follows explicit member order", "[nbfx::serialize]") {
+    NbfxElement el(QName(L"s", L"Parent"), {}, {
+            NbfxElement(QName(L"s", L"qwerty")),
+            NbfxElement(QName(L"s", L"kremlin")),
+            NbfxElement(QName(L"s", L"zombie")),
+            NbfxElement(QName(L"s", L"ansible"))
+    });
+    el.set_member_order(std::make_shared<NbfxMemberOrder>(NbfxMemberOrder{{L"zombie", 1}, {L"ansible", 2}}));
+
+    std::vector<uint8_t> buffer;
+    serialize(el, std::back_inserter(buffer));
+    const auto result = parse(buffer.begin());
+
+    REQUIRE(result.children().size() == 4);
+    REQUIRE(result.children().at(0).name() == L"kremlin");
+    REQUIRE(result.children().at(1).name() == L"qwerty");
+    REQUIRE(result.children().at(2).name() == L"zombie");
+    REQUIRE(result.children().at(3).name() == L"ansible");
+}
+
+TEST_CASE("nbfx_serializer sorts a const tree from several threads", "[nbfx::serialize]") {
+    // more unsorted children than fit the in-place sort, nested so orders of two levels are live at once
+    NbfxElement root(L"root", {}, {});
+    for (auto i = 40; i > 0; --i) {
+        NbfxElement child(L"c" + std::to_wstring(i), {}, {});
+        for (auto j = 20; j > 0; --j) {
+            child.children().emplace_back(QName(L"g" + std::to_wstring(j)));
+        }
+        root.children().push_back(std::move(child));
+    }
+    const auto &tree = root;
+
+    std::vector<uint8_t> expected;
+    serialize(tree, std::back_inserter(expected));
+    const auto sorted = parse(expected.begin());
+    REQUIRE(sorted.children().front().name() == L"c1");
+    REQUIRE(sorted.children().front().children().front().name() == L"g1");
+    REQUIRE(sorted.children().back().name() == L"c9");
+
+    std::vector<std::vector<uint8_t>> results(4);
+    std::vector<std::thread> threads;
+    for (auto &result : results) {
+        threads.emplace_back([&tree, &result] {
+            for (auto i = 0; i < 20; ++i) {
+                result.clear();
+                serialize(tree, std::back_inserter(result));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const auto &result : results) {
+        REQUIRE(result == expected);
+    }
+}
+
+TEST_CASE("nbfx_serializer writes bytes source in chunks", "[nbfx::serialize]") {
+    std::vector<uint8_t> payload(200000);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    NbfxElement el(L"doc", {}, {
+            NbfxElement(L"Blob", {}, NbfxValue(NbfxBytesSource::from_range(payload.cbegin(), payload.cend(), 70000))),
+            NbfxElement(L"Next", {}, NbfxValue(true))
+    });
+
+    std::vector<uint8_t> buffer;
+    serialize(el, std::back_inserter(buffer));
+    const auto result = parse(buffer.begin());
+
+    const auto &value = result.first_child(L"Blob")->value();
+    REQUIRE(value.chunk_count() == 1);
+    REQUIRE(value.bytes() == payload);
+    REQUIRE(result.first_child(L"Next")->value().boolean());
+}
+
+TEST_CASE("nbfx_serializer writes empty bytes source", "[nbfx::serialize]") {
+    std::istringstream stream;
+
+    test(NbfxElement(L"doc", {}, NbfxValue(NbfxBytesSource::from_istream(stream))),
+         {0x40, 0x03, 0x64, 0x6F, 0x63, 0x9F, 0x00});
+}
+
+TEST_CASE("nbfx_serializer rejects bytes source as attribute value", "[nbfx::serialize]") {
+    const std::vector<uint8_t> payload{1, 2, 3};
+    const NbfxElement el(L"a", {
+            NbfxAttribute(L"x", NbfxValue(NbfxBytesSource::from_range(payload.cbegin(), payload.cend())))
+    }, {});
+
+    std::vector<uint8_t> buffer;
+    REQUIRE_THROWS_AS(serialize(el, std::back_inserter(buffer)), std::invalid_argument);
+}
+
+TEST_CASE("nbfx_serializer writes chunked attribute value as one record", "[nbfx::serialize]") {
+    NbfxValue chunked{std::vector<uint8_t>{1, 2, 3}};
+    chunked.append_bytes({4, 5});
+    const NbfxElement el(L"a", {NbfxAttribute(L"x", chunked)}, NbfxValue(true));
+
+    std::vector<uint8_t> buffer;
+    serialize(el, std::back_inserter(buffer));
+    REQUIRE((buffer == std::vector<uint8_t>{0x40, 0x01, 0x61, 0x04, 0x01, 0x78, 0x9E, 0x05, 1, 2, 3, 4, 5, 0x87}));
+
+    auto result = parse(buffer.cbegin());
+    REQUIRE((result.attributes()[0].value().bytes() == std::vector<uint8_t>{1, 2, 3, 4, 5}));
+    REQUIRE(result.value().boolean());
+}
@@ -0,0 +1,138 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/soap.hpp"
+
+#include <cstdint>
+#include <string>
+
+using namespace nbfx;
+
+namespace {
+    NbfxElement make_envelope(const std::wstring &action, NbfxElement body_content) {
+        NbfxElement envelope(QName(L"s", L"Envelope"), {
+                NbfxAttribute(QName(L"s", L"xmlns"), NbfxValue(L"http://www.w3.org/2003/05/soap-envelope")),
+                NbfxAttribute(QName(L"a", L"xmlns"), NbfxValue(L"http://www.w3.org/2005/08/addressing"))
+        }, {
+                NbfxElement(QName(L"s", L"Header"), {}, {
+                        NbfxElement(QName(L"a", L"Action"), {}, NbfxValue(action)),
+                        NbfxElement(QName(L"a", L"MessageID"), {}, NbfxValue(L"urn:uuid:0001")),
+                        NbfxElement(QName(L"a", L"To"), {}, NbfxValue(L"net.tcp://backend/service"))
+                })
+        });
+        envelope.children().push_back(NbfxElement(QName(L"s", L"Body"), {}, {std::move(body_content)}));
+        return envelope;
+    }
+
+    NbfxElement make_payload() {
+        return NbfxElement(L"Order", {}, {
+                NbfxElement(L"Id", {}, NbfxValue(int64_t{42})),
+                NbfxElement(L"Blob", {}, NbfxValue(std::vector<uint8_t>(500, 0x33)))
+        });
+    }
+}
+
+TEST_CASE("parse_soap_envelope decodes header and locates body", "[nbfx::soap]") {
+    const auto envelope = make_envelope(L"urn:orders/Create", make_payload());
+    std::vector<uint8_t> data;
+    serialize(envelope, std::back_inserter(data), false);
+
+    const auto parsed = parse_soap_envelope(data.data(), data.data() + data.size());
+    REQUIRE(parsed.action == "urn:orders/Create");
+    REQUIRE(parsed.to == "net.tcp://backend/service");
+    REQUIRE(parsed.message_id == "urn:uuid:0001");
+    REQUIRE(parsed.header);
+    REQUIRE(parsed.header->children().size() == 3);
+
+    std::vector<uint8_t> body;
+    serialize(envelope.children()[1], std::back_inserter(body), false);
+    REQUIRE(parsed.body.size == body.size());
+    REQUIRE(std::equal(body.begin(), body.end(), parsed.body.data));
+    REQUIRE(parsed.body.data + parsed.body.size == data.data() + data.size() - 1);
+}
+
+TEST_CASE("parse_soap_envelope matches dictionary names", "[nbfx::soap]") {
+    // <s:Envelope xmlns:s="D:4"><s:Header><a:Action>urn:x</a:Action></s:Header><s:Body><x/></s:Body></s:Envelope>
+    const std::vector<uint8_t> data{
+            0x56, 0x02, 0x0B, 0x01, 0x73, 0x04,
+            0x56, 0x08,
+            0x44, 0x0A, 0x99, 0x05, 0x75, 0x72, 0x6E, 0x3A, 0x78,
+            0x01,
+            0x56, 0x0E,
+            0x40, 0x01, 0x78, 0x01,
+            0x01,
+            0x01
+    };
+
+    const auto parsed = parse_soap_envelope(data.data(), data.data() + data.size());
+    REQUIRE(parsed.action == "urn:x");
+    REQUIRE(parsed.body.data == data.data() + 18);
+    REQUIRE(parsed.body.size == 7);
+}
+
+TEST_CASE("parse_soap_envelope rejects documents without body", "[nbfx::soap]") {
+    std::vector<uint8_t> data;
+    serialize(NbfxElement(QName(L"s", L"Envelope"), {}, {NbfxElement(QName(L"s", L"Header"), {}, NbfxValue(L""))}), std::back_inserter(data));
+    REQUIRE_THROWS_AS(parse_soap_envelope(data.data(), data.data() + data.size()), std::invalid_argument);
+
+    data.clear();
+    serialize(NbfxElement(L"Other", {}, NbfxValue(L"")), std::back_inserter(data));
+    REQUIRE_THROWS_AS(parse_soap_envelope(data.data(), data.data() + data.size()), std::invalid_argument);
+}
+
+TEST_CASE("parse_soap_envelope rejects truncated envelopes", "[nbfx::soap]") {
+    const auto envelope = make_envelope(L"urn:orders/Create", make_payload());
+    std::vector<uint8_t> data;
+    serialize(envelope, std::back_inserter(data), false);
+    const auto parsed = parse_soap_envelope(data.data(), data.data() + data.size());
+
+    // inside the header, right before the body and inside the body
+    const auto header_end = static_cast<size_t>(parsed.body.data - data.data());
+    for (const auto size : {size_t{1}, header_end / 2, header_end, header_end + 10}) {
+        REQUIRE_THROWS_AS(parse_soap_envelope(data.data(), data.data() + size), std::invalid_argument);
+    }
+}
+
+TEST_CASE("serialize_soap_envelope forwards body without decoding", "[nbfx::soap]") {
+    const auto original = make_envelope(L"urn:orders/Create", make_payload());
+    std::vector<uint8_t> data;
+    serialize(original, std::back_inserter(data), false);
+    const auto incoming = parse_soap_envelope(data.data(), data.data() + data.size());
+
+    NbfxElement outgoing(QName(L"s", L"Envelope"), {
+            NbfxAttribute(QName(L"s", L"xmlns"), NbfxValue(L"http://www.w3.org/2003/05/soap-envelope"))
+    }, {
+            NbfxElement(QName(L"s", L"Header"), {}, {NbfxElement(L"Routed", {}, NbfxValue(true))})
+    });
+
+    std::vector<uint8_t> forwarded;
+    serialize_soap_envelope(outgoing, incoming, std::back_inserter(forwarded));
+
+    const auto result = parse(forwarded.cbegin());
+    REQUIRE(result.children().size() == 2);
+    REQUIRE(result.first_child(QName(L"s", L"Header"))->first_child(L"Routed")->value().boolean());
+    const auto order = result.first_child(QName(L"s", L"Body"))->first_child(L"Order");
+    REQUIRE(order->first_child(L"Id")->value().integer() == 42);
+    REQUIRE(order->first_child(L"Blob")->value().bytes_size() == 500);
+
+    NbfxElement with_value(QName(L"s", L"Envelope"), {}, NbfxValue(L"text"));
+    REQUIRE_THROWS_AS(serialize_soap_envelope(with_value, incoming, std::back_inserter(forwarded)), std::invalid_argument);
+}
+
+TEST_CASE("NbfxActionTable finds every action", "[nbfx::soap]") {
+    std::vector<std::pair<std::string, int>> routes;
+    for (int i = 0; i < 200; ++i) {
+        routes.emplace_back("urn:service/Operation" + std::to_string(i), i);
+    }
+    const NbfxActionTable<int> table(routes);
+
+    REQUIRE(table.size() == 200);
+    for (const auto &route : routes) {
+        const auto found = table.find(route.first);
+        REQUIRE(found != nullptr);
+        REQUIRE(*found == route.second);
+    }
+    REQUIRE(table.find("urn:service/Unknown") == nullptr);
+    REQUIRE(table.find("") == nullptr);
+
+    REQUIRE_THROWS_AS(NbfxActionTable<int>({{"a", 1}, {"a", 2}}), std::invalid_argument);
+}
@@ -0,0 +1,91 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/stats.hpp"
+
+#include <cstdint>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    // <a x="1">hi</a>
+    const std::vector<uint8_t> document = {0x40, 0x01, 'a', 0x04, 0x01, 'x', 0x98, 0x01, '1', 0x99, 0x02, 'h', 'i'};
+}
+
+TEST_CASE("parse counts records, bytes by family and characters", "[nbfx::stats]") {
+    reset_stats();
+    parse(document.data());
+
+    const auto stats = collect_stats().parse;
+    REQUIRE(stats.documents == 1);
+    REQUIRE(stats.records[0x40] == 1);
+    REQUIRE(stats.records[0x04] == 1);
+    REQUIRE(stats.records[0x99] == 1);
+    REQUIRE(stats.family(NbfxRecordFamily::Element) == 3);
+    REQUIRE(stats.family(NbfxRecordFamily::Attribute) == 6);
+    REQUIRE(stats.family(NbfxRecordFamily::Text) == 4);
+    REQUIRE(stats.max_depth == 1);
+    REQUIRE(stats.characters == 5);
+    REQUIRE(collect_stats().serialize.documents == 0);
+
+    // <b> with bytes in two records and an element below
+    const std::vector<uint8_t> chunks = {0x40, 0x01, 'b', 0x40, 0x01, 'c', 0x9E, 0x01, 'M', 0x9F, 0x01, 'a', 0x01};
+    parse(chunks.data());
+    const auto more = collect_stats().parse;
+    REQUIRE(more.documents == 2);
+    REQUIRE(more.bytes_chunks == 1);
+    REQUIRE(more.max_depth == 2);
+    REQUIRE(more.family(NbfxRecordFamily::Bytes) == 6);
+    REQUIRE(more.family(NbfxRecordFamily::End) == 1);
+}
+
+TEST_CASE("serialize counts written records", "[nbfx::stats]") {
+    const auto element = parse(document.data());
+    reset_stats();
+
+    std::vector<uint8_t> data(serialized_size(element));
+    serialize(element, data.data());
+    REQUIRE(data == document);
+
+    const auto stats = collect_stats().serialize;
+    REQUIRE(stats.documents == 1);
+    REQUIRE(stats.records[0x40] == 1);
+    REQUIRE(stats.records[0x04] == 1);
+    REQUIRE(stats.records[0x99] == 1);
+    REQUIRE(stats.family(NbfxRecordFamily::Element) == 3);
+    REQUIRE(stats.family(NbfxRecordFamily::Attribute) == 6);
+    REQUIRE(stats.family(NbfxRecordFamily::Text) == 4);
+    REQUIRE(stats.characters == 5);
+    REQUIRE(stats.max_depth == 1);
+
+    NbfxElement root(L"root", {}, {});
+    std::vector<uint8_t> spliced;
+    serialize_spliced(root, document.data(), document.size(), std::back_inserter(spliced));
+    REQUIRE(collect_stats().serialize.family(NbfxRecordFamily::Raw) == document.size());
+}
+
+TEST_CASE("stats of threads are aggregated and kept after they exit", "[nbfx::stats]") {
+    reset_stats();
+
+    std::vector<std::thread> threads;
+    for (auto i = 0; i < 4; ++i) {
+        threads.emplace_back([] {
+            for (auto j = 0; j < 10; ++j) {
+                parse(document.data());
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    parse(document.data());
+
+    const auto stats = collect_stats();
+    REQUIRE(stats.parse.documents == 41);
+    REQUIRE(stats.parse.records[0x40] == 41);
+
+    reset_stats();
+    REQUIRE(collect_stats().parse.documents == 0);
+}
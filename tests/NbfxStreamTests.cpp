@@ -0,0 +1,290 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/stream.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace nbfx;
+
+namespace {
+    std::vector<uint8_t> serialize_to_vector(const NbfxElement &root) {
+        std::vector<uint8_t> data;
+        serialize(root, std::back_inserter(data));
+        return data;
+    }
+
+    /**
+     * Returns at most a few bytes per read to exercise record boundaries
+     */
+    struct TrickleSource {
+        const std::vector<uint8_t> &data;
+        size_t position = 0;
+
+        size_t read(uint8_t *buffer, size_t size) {
+            const auto n = std::min({size, data.size() - position, size_t{3}});
+            std::copy_n(data.data() + position, n, buffer);
+            position += n;
+            return n;
+        }
+    };
+
+    struct PieceSink {
+        std::vector<uint8_t> received;
+        size_t pieces = 0;
+
+        bool on_bytes(const std::vector<NbfxElement> &path, const uint8_t *p, size_t size) {
+            if (path.back().name() != L"Blob") {
+                return false;
+            }
+            received.insert(received.end(), p, p + size);
+            ++pieces;
+            return true;
+        }
+    };
+}
+
+TEST_CASE("NbfxStreamParser parses consecutive documents from istream", "[nbfx::NbfxStreamParser]") {
+    const NbfxElement first(L"first", {NbfxAttribute(L"id", NbfxValue(int32_t{7}))}, {
+            NbfxElement(L"Name", {}, NbfxValue(L"alpha"))
+    });
+    const NbfxElement second(L"second", {}, NbfxValue(L"beta"));
+
+    auto data = serialize_to_vector(first);
+    const auto tail = serialize_to_vector(second);
+    data.insert(data.end(), tail.begin(), tail.end());
+
+    std::istringstream stream(std::string(data.begin(), data.end()));
+    NbfxStreamParser<NbfxIstreamSource> parser(NbfxIstreamSource{stream});
+
+    REQUIRE_FALSE(parser.at_end());
+    const auto a = parser.parse();
+    REQUIRE(a.name() == L"first");
+    REQUIRE(a.attributes()[0].value().integer() == 7);
+    REQUIRE(a.first_child(L"Name")->value().string() == L"alpha");
+
+    const auto b = parser.parse();
+    REQUIRE(b.name() == L"second");
+    REQUIRE(b.value().string() == L"beta");
+    REQUIRE(parser.at_end());
+}
+
+TEST_CASE("NbfxStreamParser grows buffer for records split across reads", "[nbfx::NbfxStreamParser]") {
+    const std::wstring text(200, L'x');
+    const NbfxElement root(L"root", {}, {
+            NbfxElement(L"Text", {}, NbfxValue(text)),
+            NbfxElement(L"Small", {}, NbfxValue(std::vector<uint8_t>{1, 2, 3}))
+    });
+    const auto data = serialize_to_vector(root);
+
+    NbfxStreamParser<TrickleSource> parser(TrickleSource{data}, 16);
+    const auto parsed = parser.parse();
+    REQUIRE(parsed.first_child(L"Text")->value().string() == text);
+    REQUIRE((parsed.first_child(L"Small")->value().bytes() == std::vector<uint8_t>{1, 2, 3}));
+    REQUIRE(parser.at_end());
+}
+
+TEST_CASE("NbfxStreamParser reads large bytes straight into the value", "[nbfx::NbfxStreamParser]") {
+    std::vector<uint8_t> payload(300000);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i * 31);
+    }
+    const NbfxElement root(L"root", {}, {
+            NbfxElement(L"Blob", {}, NbfxValue(payload)),
+            NbfxElement(L"After", {}, NbfxValue(L"tail"))
+    });
+    const auto data = serialize_to_vector(root);
+
+    std::FILE *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    std::fwrite(data.data(), 1, data.size(), file);
+    std::rewind(file);
+
+    const auto parsed = parse_stream(NbfxFileSource{file}, 4096);
+    std::fclose(file);
+
+    REQUIRE(parsed.first_child(L"Blob")->value().bytes() == payload);
+    REQUIRE(parsed.first_child(L"After")->value().string() == L"tail");
+}
+
+TEST_CASE("NbfxStreamParser passes large bytes to the sink in pieces", "[nbfx::NbfxStreamParser]") {
+    std::vector<uint8_t> payload(100000, 0x5A);
+    const NbfxElement root(L"root", {}, {
+            NbfxElement(L"Blob", {}, NbfxValue(payload))
+    });
+    const auto data = serialize_to_vector(root);
+
+    NbfxStreamParser<TrickleSource> parser(TrickleSource{data}, 1024);
+    PieceSink sink;
+    const auto parsed = parser.parse(sink);
+
+    REQUIRE(sink.received == payload);
+    REQUIRE(sink.pieces > 1);
+    REQUIRE(parsed.first_child(L"Blob")->value().type() == NbfxValueType::Null);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST_CASE("NbfxStreamParser reads from file descriptor", "[nbfx::NbfxStreamParser]") {
+    const NbfxElement root(L"root", {}, NbfxValue(L"fd"));
+    const auto data = serialize_to_vector(root);
+
+    std::FILE *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    std::fwrite(data.data(), 1, data.size(), file);
+    std::fflush(file);
+    std::rewind(file);
+
+    const auto parsed = parse_stream(NbfxFdSource{fileno(file)});
+    std::fclose(file);
+    REQUIRE(parsed.value().string() == L"fd");
+}
+#endif
+
+TEST_CASE("NbfxStreamParser throws on truncated stream", "[nbfx::NbfxStreamParser]") {
+    const NbfxElement root(L"root", {}, {
+            NbfxElement(L"Blob", {}, NbfxValue(std::vector<uint8_t>(5000, 1)))
+    });
+    auto data = serialize_to_vector(root);
+    data.resize(data.size() - 100);
+
+    std::istringstream small(std::string(data.begin(), data.begin() + 3));
+    REQUIRE_THROWS_AS(parse_stream(NbfxIstreamSource{small}), std::runtime_error);
+
+    std::istringstream large(std::string(data.begin(), data.end()));
+    REQUIRE_THROWS_AS(parse_stream(NbfxIstreamSource{large}, 1024), std::runtime_error);
+}
+
+TEST_CASE("NbfxIncrementalParser resumes between fed chunks", "[nbfx::NbfxIncrementalParser]") {
+    const NbfxElement first(L"first", {}, {
+            NbfxElement(L"Blob", {}, NbfxValue(std::vector<uint8_t>(1000, 0x11)))
+    });
+    const NbfxElement second(L"second", {}, NbfxValue(L"beta"));
+
+    auto data = serialize_to_vector(first);
+    const auto tail = serialize_to_vector(second);
+    data.insert(data.end(), tail.begin(), tail.end());
+
+    NbfxIncrementalParser parser(64);
+    std::vector<NbfxElement> documents;
+    for (size_t i = 0; i < data.size(); i += 7) {
+        parser.feed(data.data() + i, std::min<size_t>(7, data.size() - i));
+        while (auto element = parser.next()) {
+            documents.emplace_back(std::move(*element));
+        }
+    }
+
+    REQUIRE(parser.idle());
+    REQUIRE(documents.size() == 2);
+    REQUIRE(documents[0].first_child(L"Blob")->value().bytes() == std::vector<uint8_t>(1000, 0x11));
+    REQUIRE(documents[1].value().string() == L"beta");
+}
+
+TEST_CASE("NbfxIncrementalParser limits bytes records it collects", "[nbfx::NbfxIncrementalParser]") {
+    const auto data = serialize_to_vector(NbfxElement(L"doc", {}, NbfxValue(std::vector<uint8_t>(1000, 0x22))));
+
+    NbfxIncrementalParser exact(64, 1000);
+    exact.feed(data.data(), data.size());
+    const auto parsed = exact.next();
+    REQUIRE(parsed.has_value());
+    REQUIRE(parsed->value().bytes_size() == 1000);
+
+    NbfxIncrementalParser limited(64, 999);
+    limited.feed(data.data(), data.size());
+    REQUIRE_THROWS_AS(limited.next(), std::length_error);
+
+    // <doc> with Bytes32Text claiming 2^31 bytes
+    const std::vector<uint8_t> hostile = {0x40, 0x03, 'd', 'o', 'c', 0xA3, 0x00, 0x00, 0x00, 0x80, 1, 2, 3};
+    NbfxIncrementalParser parser(64);
+    parser.feed(hostile.data(), hostile.size());
+    REQUIRE_THROWS_AS(parser.next(), std::length_error);
+}
+
+TEST_CASE("NbfxStreamParser checks records against quotas", "[nbfx::NbfxStreamParser]") {
+    const NbfxElement nested(L"a", {}, {NbfxElement(L"b", {}, {NbfxElement(L"c", {}, NbfxValue(L"deep"))})});
+    auto data = serialize_to_vector(nested);
+    const auto again = data;
+    data.insert(data.end(), again.begin(), again.end());
+
+    auto quotas = NbfxReaderQuotas::max();
+    quotas.max_name_count = 3;
+    NbfxStreamParser<TrickleSource> counted(TrickleSource{data}, 16, quotas);
+    REQUIRE(counted.parse().name() == L"a");
+    REQUIRE(counted.parse().name() == L"a");
+
+    quotas.max_depth = 2;
+    NbfxStreamParser<TrickleSource> shallow(TrickleSource{data}, 16, quotas);
+    REQUIRE_THROWS_AS(shallow.parse(), std::length_error);
+
+    // two bytes records of one value, each larger than the buffer, passed to the sink
+    std::vector<uint8_t> chunks = {0x40, 0x04, 'B', 'l', 'o', 'b', 0xA0, 0x00, 0x02};
+    chunks.insert(chunks.end(), 512, 0x11);
+    chunks.insert(chunks.end(), {0xA1, 0x00, 0x02});
+    chunks.insert(chunks.end(), 512, 0x22);
+
+    quotas = NbfxReaderQuotas::max();
+    quotas.max_bytes_length = 1024;
+    PieceSink sink;
+    NbfxStreamParser<TrickleSource> fits(TrickleSource{chunks}, 64, quotas);
+    REQUIRE_NOTHROW(fits.parse(sink));
+    REQUIRE(sink.received.size() == 1024);
+
+    quotas.max_bytes_length = 1000;
+    NbfxStreamParser<TrickleSource> limited(TrickleSource{chunks}, 64, quotas);
+    REQUIRE_THROWS_AS(limited.parse(sink), std::length_error);
+}
+
+TEST_CASE("NbfxIncrementalParser checks string lengths before buffering the record", "[nbfx::NbfxIncrementalParser]") {
+    // <doc> with Chars32Text claiming 1 GiB
+    const std::vector<uint8_t> hostile = {0x40, 0x03, 'd', 'o', 'c', 0x9C, 0x00, 0x00, 0x00, 0x40, 'a', 'b', 'c'};
+
+    auto quotas = NbfxReaderQuotas::max();
+    quotas.max_string_length = 1024;
+    NbfxIncrementalParser parser(64, quotas);
+    parser.feed(hostile.data(), hostile.size());
+    REQUIRE_THROWS_AS(parser.next(), std::length_error);
+
+    // a name claiming 1 MiB
+    const std::vector<uint8_t> name = {0x40, 0x80, 0x80, 0x40, 'n', 'a', 'm', 'e'};
+    NbfxIncrementalParser named(64, quotas);
+    named.feed(name.data(), name.size());
+    REQUIRE_THROWS_AS(named.next(), std::length_error);
+}
+
+TEST_CASE("NbfxStreamParser collects large text outside of the buffer", "[nbfx::NbfxStreamParser]") {
+    const std::wstring text(100000, L'x');
+    const NbfxElement root(L"root", {}, {
+            NbfxElement(L"Text", {}, NbfxValue(text)),
+            NbfxElement(L"After", {}, NbfxValue(L"tail"))
+    });
+    const auto data = serialize_to_vector(root);
+
+    NbfxStreamParser<TrickleSource> parser(TrickleSource{data}, 1024);
+    const auto parsed = parser.parse();
+    REQUIRE(parsed.first_child(L"Text")->value().string() == text);
+    REQUIRE(parsed.first_child(L"After")->value().string() == L"tail");
+}
+
+TEST_CASE("NbfxIncrementalParser limits length of records", "[nbfx::NbfxIncrementalParser]") {
+    const auto text = serialize_to_vector(NbfxElement(L"doc", {}, NbfxValue(std::wstring(2000, L'x'))));
+    NbfxIncrementalParser long_text(64, NbfxIncrementalParser::default_max_bytes_length, 1000);
+    long_text.feed(text.data(), 8);
+    REQUIRE_THROWS_AS(long_text.next(), std::length_error);
+
+    const auto name = serialize_to_vector(NbfxElement(std::wstring(2000, L'n'), {}, {}));
+    NbfxIncrementalParser long_name(64, NbfxIncrementalParser::default_max_bytes_length, 1000);
+    long_name.feed(name.data(), 8);
+    REQUIRE_THROWS_AS(long_name.next(), std::length_error);
+
+    const auto attribute = serialize_to_vector(
+            NbfxElement(L"doc", {NbfxAttribute(L"a", NbfxValue(std::wstring(2000, L'x')))}, {}));
+    NbfxIncrementalParser long_attribute(64, NbfxIncrementalParser::default_max_bytes_length, 1000);
+    long_attribute.feed(attribute.data(), attribute.size());
+    REQUIRE_THROWS_AS(long_attribute.next(), std::length_error);
+
+    NbfxIncrementalParser fits(64, NbfxIncrementalParser::default_max_bytes_length, 4000);
+    fits.feed(attribute.data(), attribute.size());
+    REQUIRE(fits.next().has_value());
+}
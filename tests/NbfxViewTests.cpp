@@ -0,0 +1,57 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+using namespace nbfx;
+
+TEST_CASE("parse_view points into the input", "[nbfx::parse_view]") {
+    NbfxElement root(QName(L"s", L"root"), {NbfxAttribute(L"id", NbfxValue(7))}, {
+            NbfxElement(L"a", {}, NbfxValue(L"hello")),
+            NbfxElement(L"b", {}, {
+                    NbfxElement(L"c", {}, NbfxValue(static_cast<int64_t>(-3)))
+            })
+    });
+
+    std::vector<uint8_t> data;
+    serialize(root, std::back_inserter(data));
+    const auto view = parse_view(data.cbegin());
+
+    REQUIRE(view.prefix() == "s");
+    REQUIRE(view.name() == "root");
+    REQUIRE(view.attributes().size() == 1);
+    REQUIRE(view.attributes().at(0).name() == "id");
+    REQUIRE(view.attributes().at(0).value().integer() == 7);
+    REQUIRE(view.children().size() == 2);
+
+    const auto a = view.first_child("a");
+    REQUIRE(a != nullptr);
+    const auto chars = a->value().text().chars();
+    REQUIRE(chars == "hello");
+    REQUIRE(reinterpret_cast<const uint8_t *>(chars.data()) > data.data());
+    REQUIRE(reinterpret_cast<const uint8_t *>(chars.data()) < data.data() + data.size());
+
+    const auto c = view.find_descendant("c");
+    REQUIRE(c != nullptr);
+    REQUIRE(c->value().value().integer() == -3);
+    REQUIRE(view.first_child("b")->value().empty());
+}
+
+TEST_CASE("parse_view keeps consecutive bytes records as one value", "[nbfx::parse_view]") {
+    NbfxValue blob{std::vector<uint8_t>{1, 2, 3}};
+    blob.append_bytes({4, 5});
+
+    std::vector<uint8_t> data;
+    serialize(NbfxElement(L"doc", {}, {NbfxElement(L"Blob", {}, blob)}), std::back_inserter(data));
+    const auto view = parse_view(data.data());
+
+    const auto &value = view.first_child("Blob")->value();
+    REQUIRE(value.record_count() == 2);
+
+    size_t total = 0;
+    value.for_each_text([&total](const NbfxTextView &text) { total += text.bytes().size; });
+    REQUIRE(total == 5);
+    REQUIRE((value.value().bytes() == std::vector<uint8_t>{1, 2, 3, 4, 5}));
+}
@@ -0,0 +1,199 @@
+#include "catch.hpp"
+#include "nbfx.hpp"
+#include "nbfx/xml.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    std::vector<uint8_t> to_bytes(const NbfxElement &element) {
+        std::vector<uint8_t> data;
+        serialize(element, std::back_inserter(data), false);
+        return data;
+    }
+}
+
+TEST_CASE("to_xml writes elements, attributes and escaped text", "[nbfx::xml]") {
+    const NbfxElement element(QName(L"s", L"Envelope"), {
+            NbfxAttribute(QName(L"s", L"xmlns"), NbfxValue(L"urn:soap")),
+            NbfxAttribute(L"note", NbfxValue(L"a \"quoted\" <tab>\t&"))
+    }, {
+            NbfxElement(L"Text", {}, NbfxValue(L"1 < 2 && 3 > 2, the quick brown fox")),
+            NbfxElement(L"Empty", {}, {}),
+            NbfxElement(L"Number", {}, NbfxValue(int64_t{-70000})),
+            NbfxElement(L"Flag", {}, NbfxValue(true)),
+            NbfxElement(L"Data", {}, NbfxValue(std::vector<uint8_t>{'M', 'a', 'n', 'y'}))
+    });
+    const auto data = to_bytes(element);
+
+    REQUIRE(to_xml(data.data()) ==
+            "<s:Envelope xmlns:s=\"urn:soap\" note=\"a &quot;quoted&quot; &lt;tab&gt;&#9;&amp;\">"
+            "<Text>1 &lt; 2 &amp;&amp; 3 &gt; 2, the quick brown fox</Text>"
+            "<Empty/>"
+            "<Number>-70000</Number>"
+            "<Flag>true</Flag>"
+            "<Data>TWFueQ==</Data>"
+            "</s:Envelope>");
+}
+
+TEST_CASE("to_xml formats typed text records", "[nbfx::xml]") {
+    using namespace std::chrono;
+    const auto time = system_clock::time_point(seconds(1709210096)) + milliseconds(500);
+    const auto data = to_bytes(NbfxElement(L"t", {}, NbfxValue(time_point_cast<nanoseconds>(time))));
+    REQUIRE(to_xml(data.data()) == "<t>2024-02-29T12:34:56.5</t>");
+
+    // <a>1.5 INF 2^64-1</a> as Double, Float and UInt64 records
+    const std::vector<uint8_t> numbers = {
+            0x40, 0x01, 'a',
+            0x92, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF8, 0x3F,
+            0x90, 0x00, 0x00, 0x80, 0x7F,
+            0xB3, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+    };
+    REQUIRE(to_xml(numbers.data()) == "<a>1.5INF18446744073709551615</a>");
+}
+
+TEST_CASE("to_xml joins consecutive bytes records into one base64 text", "[nbfx::xml]") {
+    const std::vector<uint8_t> data = {
+            0x40, 0x01, 'b',
+            0x9E, 0x01, 'M',
+            0x9E, 0x02, 'a', 'n',
+            0x9F, 0x01, 'y'
+    };
+    REQUIRE(to_xml(data.data()) == "<b>TWFueQ==</b>");
+}
+
+TEST_CASE("to_xml writes dictionary names", "[nbfx::xml]") {
+    // <s:D:2 xmlns:s="D:4"><D:8/></s:D:2>
+    const std::vector<uint8_t> data = {0x56, 0x02, 0x0B, 0x01, 's', 0x04, 0x42, 0x08, 0x01, 0x01};
+    REQUIRE(to_xml(data.data()) == "<s:D:2 xmlns:s=\"D:4\"><D:8/></s:D:2>");
+
+    NbfxXmlOptions options;
+    options.dictionary = [](uint32_t id) -> std::string_view {
+        switch (id) {
+            case 2:
+                return "Envelope";
+            case 4:
+                return "http://www.w3.org/2003/05/soap-envelope";
+            default:
+                return "Header";
+        }
+    };
+    REQUIRE(to_xml(data.data(), options) ==
+            "<s:Envelope xmlns:s=\"http://www.w3.org/2003/05/soap-envelope\"><Header/></s:Envelope>");
+}
+
+TEST_CASE("to_xml writes to a stream and returns the end of the document", "[nbfx::xml]") {
+    NbfxElement element(L"root", {}, {});
+    for (auto i = 0; i < 5000; ++i) {
+        element.children().push_back(NbfxElement(L"item", {}, NbfxValue(L"some text & more")));
+    }
+    auto data = to_bytes(element);
+    const auto size = data.size();
+    data.push_back(0x40);
+
+    std::string text;
+    REQUIRE(to_xml(data.data(), text) == data.data() + size);
+
+    std::ostringstream stream;
+    REQUIRE(to_xml(data.data(), stream) == data.data() + size);
+    REQUIRE(stream.str() == text);
+}
+
+namespace {
+    struct WriteRecorder : std::streambuf {
+        std::string data;
+        std::streamsize largest = 0;
+
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            data.append(s, static_cast<size_t>(n));
+            largest = std::max(largest, n);
+            return n;
+        }
+
+        int overflow(int c) override {
+            if (c != EOF) {
+                data += static_cast<char>(c);
+            }
+            return c;
+        }
+    };
+}
+
+TEST_CASE("to_xml flushes large text and bytes while writing them", "[nbfx::xml]") {
+    NbfxValue chunked{std::vector<uint8_t>(600000, 0xAB)};
+    chunked.append_bytes(std::vector<uint8_t>(600001, 0xCD));
+    const auto data = to_bytes(NbfxElement(L"root", {NbfxAttribute(L"a", NbfxValue(std::wstring(500000, L'&')))}, {
+            NbfxElement(L"blob", {}, chunked),
+            NbfxElement(L"text", {}, NbfxValue(std::wstring(1000000, L'<')))
+    }));
+
+    std::string text;
+    to_xml(data.data(), text);
+
+    WriteRecorder recorder;
+    std::ostream stream(&recorder);
+    to_xml(data.data(), stream);
+    REQUIRE(recorder.data == text);
+    REQUIRE(recorder.largest < 4 * 64 * 1024);
+}
+
+TEST_CASE("from_xml encodes elements and closes them with text records", "[nbfx::xml]") {
+    REQUIRE((from_xml("<a>hi</a>") == std::vector<uint8_t>{0x40, 0x01, 'a', 0x99, 0x02, 'h', 'i'}));
+    REQUIRE((from_xml("<a><b/></a>") == std::vector<uint8_t>{0x40, 0x01, 'a', 0x40, 0x01, 'b', 0x01, 0x01}));
+    REQUIRE((from_xml("<s:a s:x=''/>") == std::vector<uint8_t>{0x70, 0x01, 'a', 0x38, 0x01, 'x', 0xA8, 0x01}));
+}
+
+TEST_CASE("from_xml output parses to the same tree", "[nbfx::xml]") {
+    const auto data = from_xml(
+            "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+            "<!-- message -->\n"
+            "<s:Envelope xmlns:s=\"urn:soap\" xmlns=\"urn:default\">\n"
+            "  <Header id='1' ns1:kind=\"&lt;x&gt;\" xmlns:ns1=\"urn:ns1\"/>\n"
+            "  <Body><!-- note --><Text>caf&#233; &amp; &#x1F600;</Text><Raw><![CDATA[<not markup>]]></Raw></Body>\n"
+            "</s:Envelope>");
+
+    const auto root = parse(data.begin());
+    REQUIRE(root.qname() == QName(L"s", L"Envelope"));
+    REQUIRE(root.attributes().size() == 2);
+    REQUIRE(root.children().size() == 2);
+
+    const auto &header = root.children()[0];
+    REQUIRE(header.attributes().size() == 3);
+    REQUIRE(header.attributes()[1].value().to_string() == L"<x>");
+
+    const auto &body = root.children()[1];
+    REQUIRE(body.children()[0].value().to_string() == L"café & \U0001F600");
+    REQUIRE(body.children()[1].value().to_string() == L"<not markup>");
+}
+
+TEST_CASE("XML survives a round trip through NBFX", "[nbfx::xml]") {
+    const std::string xml =
+            "<s:Envelope xmlns:s=\"urn:soap\" xmlns:long=\"urn:long\">"
+            "<long:Header long:id=\"a&amp;b\"><To>net.tcp://x/y</To></long:Header>"
+            "<s:Body><Empty/><Text>line&#13;\nend &lt;/Text&gt;</Text></s:Body>"
+            "</s:Envelope>";
+    const auto data = from_xml(xml);
+    REQUIRE(to_xml(data.data()) == xml);
+
+    NbfxXmlOptions options;
+    options.keep_whitespace = true;
+    const std::string spaced = "<a> <b> x </b> </a>";
+    REQUIRE(to_xml(from_xml(spaced, options).data()) == spaced);
+    REQUIRE(to_xml(from_xml(spaced).data()) == "<a><b> x </b></a>");
+}
+
+TEST_CASE("from_xml rejects malformed XML", "[nbfx::xml]") {
+    REQUIRE_THROWS_AS(from_xml("<a></b>"), std::invalid_argument);
+    REQUIRE_THROWS_AS(from_xml("<a>"), std::invalid_argument);
+    REQUIRE_THROWS_AS(from_xml("text"), std::invalid_argument);
+    REQUIRE_THROWS_AS(from_xml("<a x=1/>"), std::invalid_argument);
+    REQUIRE_THROWS_AS(from_xml("<a>&unknown;</a>"), std::invalid_argument);
+    REQUIRE_THROWS_AS(from_xml("<!DOCTYPE a><a/>"), std::invalid_argument);
+}
@@ -0,0 +1,674 @@
+/**
+ * Command line tool for inspecting and converting NBFX captures
+ *
+ * Inputs are files of documents stored back to back. They are memory mapped and released behind
+ * the current position, files are processed in parallel and their output is written in order.
+ */
+#include "nbfx.hpp"
+#include "nbfx/corpus.hpp"
+#include "nbfx/file.hpp"
+#include "nbfx/json.hpp"
+#include "nbfx/rewrite.hpp"
+#include "nbfx/text.hpp"
+#include "nbfx/xml.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nbfx;
+
+namespace {
+    constexpr size_t release_interval = 64 << 20;
+    constexpr size_t chunk_size = 64 << 10;
+    // output of a file waiting for its turn is buffered up to this size
+    constexpr size_t pending_limit = 4 << 20;
+
+    const char usage[] =
+            "usage: nbfx <command> [options] files...\n"
+            "\n"
+            "commands:\n"
+            "  dump            print records with offsets, types and values\n"
+            "  to-xml          write each document as a line of XML\n"
+            "  to-json         write each document as a line of JSON\n"
+            "  stats           record type histogram, depth and size by subtree\n"
+            "  extract <path>  write elements matching the path, e.g. Envelope/Body/*\n"
+            "  generate        write a synthetic corpus to the file\n"
+            "\n"
+            "options:\n"
+            "  -j <n>          files processed in parallel, all cores by default\n"
+            "  --depth <n>     deepest subtree reported by stats, 3 by default\n"
+            "  --json          extract writes JSON instead of XML\n"
+            "  --preset <name> generate: soap12 (default), soap12-blobs, soap12-arrays, wide or deep\n"
+            "  --seed <n>      generate: seed of the corpus, 1 by default\n"
+            "  --count <n>     generate: number of messages, 1000 by default\n";
+
+    /**
+     * Writes output of files in order, a file waits for its turn once it has buffered enough
+     */
+    class OrderedOutput {
+    public:
+        void write(size_t index, std::string &buffer, bool last) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_turn != index) {
+                if (!last && buffer.size() < pending_limit) {
+                    return;
+                }
+                m_ready.wait(lock, [&] { return m_turn == index; });
+            }
+            lock.unlock();
+
+            std::fwrite(buffer.data(), 1, buffer.size(), stdout);
+            buffer.clear();
+
+            if (last) {
+                std::fflush(stdout);
+                lock.lock();
+                ++m_turn;
+                m_ready.notify_all();
+            }
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_ready;
+        size_t m_turn = 0;
+    };
+
+    /**
+     * Output of one file, also a stream for the converters
+     */
+    class FileOutput : public std::streambuf {
+    public:
+        FileOutput(OrderedOutput &output, size_t index) : m_output(output), m_index(index), m_stream(this) {}
+
+        std::string &buffer() noexcept {
+            return m_buffer;
+        }
+
+        std::ostream &stream() noexcept {
+            return m_stream;
+        }
+
+        void flush_if_full() {
+            if (m_buffer.size() >= chunk_size) {
+                m_output.write(m_index, m_buffer, false);
+            }
+        }
+
+        void finish() {
+            m_output.write(m_index, m_buffer, true);
+        }
+
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            m_buffer.append(s, static_cast<size_t>(n));
+            flush_if_full();
+            return n;
+        }
+
+        int_type overflow(int_type c) override {
+            if (c != traits_type::eof()) {
+                m_buffer += traits_type::to_char_type(c);
+                flush_if_full();
+            }
+            return traits_type::not_eof(c);
+        }
+
+    private:
+        OrderedOutput &m_output;
+        size_t m_index;
+        std::string m_buffer;
+        std::ostream m_stream;
+    };
+
+    struct Options {
+        std::string command;
+        std::string path;
+        std::vector<std::string> files;
+        unsigned jobs = std::thread::hardware_concurrency();
+        size_t depth = 3;
+        bool json = false;
+        std::string preset = "soap12";
+        uint64_t seed = 1;
+        size_t count = 1000;
+    };
+
+    template<typename F>
+    void for_each_document(const NbfxMappedFile &file, F &&process) {
+        file.advise_sequential();
+        auto p = file.begin();
+        auto released = p;
+        while (p != file.end()) {
+            const auto next = find_document_end(p, file.end());
+            process(p, next);
+            p = next;
+            if (static_cast<size_t>(p - released) >= release_interval) {
+                file.release(released, p);
+                released = p;
+            }
+        }
+    }
+
+    std::string record_name(uint8_t raw) {
+        static const char *const fixed[] = {
+                "0x00", "EndElement", "Comment", "Array", "ShortAttribute", "Attribute",
+                "ShortDictionaryAttribute", "DictionaryAttribute", "ShortXmlnsAttribute", "XmlnsAttribute",
+                "ShortDictionaryXmlnsAttribute", "DictionaryXmlnsAttribute"
+        };
+        static const char *const elements[] = {"ShortElement", "Element", "ShortDictionaryElement", "DictionaryElement"};
+        static const char *const texts[] = {
+                "ZeroText", "OneText", "FalseText", "TrueText", "Int8Text", "Int16Text", "Int32Text", "Int64Text",
+                "FloatText", "DoubleText", "DecimalText", "DateTimeText", "Chars8Text", "Chars16Text", "Chars32Text",
+                "Bytes8Text", "Bytes16Text", "Bytes32Text", "StartListText", "EndListText", "EmptyText",
+                "DictionaryText", "UniqueIdText", "TimeSpanText", "UuidText", "UInt64Text", "BoolText",
+                "UnicodeChars8Text", "UnicodeChars16Text", "UnicodeChars32Text", "QNameDictionaryText"
+        };
+
+        const auto letter = [raw](uint8_t first) { return std::string(1, static_cast<char>('A' + raw - first)); };
+        if (raw <= 0x0B) {
+            return fixed[raw];
+        } else if (raw <= 0x25) {
+            return "PrefixDictionaryAttribute" + letter(0x0C);
+        } else if (raw <= 0x3F) {
+            return "PrefixAttribute" + letter(0x26);
+        } else if (raw <= 0x43) {
+            return elements[raw - 0x40];
+        } else if (raw <= 0x5D) {
+            return "PrefixDictionaryElement" + letter(0x44);
+        } else if (raw <= 0x77) {
+            return "PrefixElement" + letter(0x5E);
+        } else if (raw >= 0x80 && raw <= 0xBD) {
+            return std::string(texts[(raw - 0x80) / 2]) + (raw & 1u ? "WithEndElement" : "");
+        }
+        char unknown[8];
+        std::snprintf(unknown, sizeof(unknown), "0x%02X", raw);
+        return unknown;
+    }
+
+    void append_qname(std::string &out, std::string_view prefix, const NbfxReader<const uint8_t *> &reader) {
+        if (!prefix.empty()) {
+            out.append(prefix);
+            out += ':';
+        }
+        if (reader.is_dictionary_name()) {
+            out += "D:";
+            detail::appendNumber(out, reader.name_id());
+        } else {
+            out.append(reader.name());
+        }
+    }
+
+    void append_value(std::string &out, const NbfxTextView &text) {
+        switch (text.type()) {
+            case NbfxRecordType::Chars8Text:
+            case NbfxRecordType::Chars16Text:
+            case NbfxRecordType::Chars32Text:
+            case NbfxRecordType::EmptyText:
+                out += '"';
+                detail::appendJsonEscaped(out, text.chars());
+                out += '"';
+                break;
+            case NbfxRecordType::UnicodeChars8Text:
+            case NbfxRecordType::UnicodeChars16Text:
+            case NbfxRecordType::UnicodeChars32Text: {
+                std::string utf8;
+                detail::appendUtf16(utf8, text.bytes());
+                out += '"';
+                detail::appendJsonEscaped(out, utf8);
+                out += '"';
+                break;
+            }
+            case NbfxRecordType::Bytes8Text:
+            case NbfxRecordType::Bytes16Text:
+            case NbfxRecordType::Bytes32Text: {
+                const auto bytes = text.bytes();
+                detail::appendNumber(out, bytes.size);
+                out += " bytes";
+                for (size_t i = 0; i < std::min<size_t>(bytes.size, 16); ++i) {
+                    char hex[4];
+                    std::snprintf(hex, sizeof(hex), " %02x", bytes.data[i]);
+                    out += hex;
+                }
+                if (bytes.size > 16) {
+                    out += " ...";
+                }
+                break;
+            }
+            case NbfxRecordType::DictionaryText:
+                out += "D:";
+                detail::appendNumber(out, text.id());
+                break;
+            case NbfxRecordType::ZeroText:
+            case NbfxRecordType::OneText:
+            case NbfxRecordType::Int8Text:
+            case NbfxRecordType::Int16Text:
+            case NbfxRecordType::Int32Text:
+            case NbfxRecordType::Int64Text:
+                detail::appendNumber(out, text.integer());
+                break;
+            case NbfxRecordType::UInt64Text:
+                detail::appendNumber(out, text.uint64());
+                break;
+            case NbfxRecordType::TrueText:
+            case NbfxRecordType::FalseText:
+            case NbfxRecordType::BoolText:
+                out += text.boolean() ? "true" : "false";
+                break;
+            case NbfxRecordType::FloatText:
+                detail::appendNumber(out, text.float_single());
+                break;
+            case NbfxRecordType::DoubleText:
+                detail::appendNumber(out, text.float_double());
+                break;
+            case NbfxRecordType::DateTimeText:
+                detail::appendDateTime(out, text.datetime());
+                break;
+            case NbfxRecordType::StartListText:
+            case NbfxRecordType::EndListText:
+                break;
+            default:
+                out += detail::utf_to_wstring.to_bytes(text.value().to_string());
+                break;
+        }
+    }
+
+    /**
+     * One line per node: offset in the file, record type and the node indented by depth
+     */
+    void dump(const NbfxMappedFile &file, FileOutput &output) {
+        auto &out = output.buffer();
+        std::vector<std::string> names;
+
+        for_each_document(file, [&](const uint8_t *begin, const uint8_t *) {
+            NbfxReader<const uint8_t *> reader(begin);
+            while (reader.read()) {
+                const auto type = reader.node_type();
+                const auto synthesized = type == NbfxNodeType::EndElement && reader.record_begin() == reader.position();
+
+                char offset[24];
+                std::snprintf(offset, sizeof(offset), "%010zx  ", static_cast<size_t>(reader.record_begin() - file.begin()));
+                out += offset;
+
+                auto name = synthesized ? std::string() : record_name(*reader.record_begin());
+                name.resize(std::max<size_t>(name.size() + 1, 34), ' ');
+                out += name;
+
+                const auto depth = type == NbfxNodeType::Element ? reader.depth() - 1 : reader.depth();
+                out.append(2 * depth, ' ');
+
+                switch (type) {
+                    case NbfxNodeType::Element:
+                        names.emplace_back();
+                        append_qname(names.back(), reader.prefix(), reader);
+                        out += '<';
+                        out += names.back();
+                        out += '>';
+                        break;
+                    case NbfxNodeType::Attribute:
+                        out += '@';
+                        if (reader.is_xmlns()) {
+                            out += "xmlns";
+                            if (!reader.prefix().empty()) {
+                                out += ':';
+                                out.append(reader.prefix());
+                            }
+                        } else {
+                            append_qname(out, reader.prefix(), reader);
+                        }
+                        out += " = ";
+                        append_value(out, reader.text());
+                        break;
+                    case NbfxNodeType::Text:
+                        append_value(out, reader.text());
+                        break;
+                    case NbfxNodeType::EndElement:
+                        out += "</";
+                        out += names.back();
+                        out += '>';
+                        names.pop_back();
+                        break;
+                    default:
+                        break;
+                }
+                out += '\n';
+                output.flush_if_full();
+            }
+        });
+    }
+
+    struct Subtree {
+        uint64_t count = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct Stats {
+        uint64_t files = 0;
+        uint64_t documents = 0;
+        uint64_t bytes = 0;
+        uint64_t min_document = UINT64_MAX;
+        uint64_t max_document = 0;
+        size_t max_depth = 0;
+        std::array<Subtree, 256> records{};
+        std::map<std::string, Subtree> subtrees;
+
+        void merge(const Stats &other) {
+            files += other.files;
+            documents += other.documents;
+            bytes += other.bytes;
+            min_document = std::min(min_document, other.min_document);
+            max_document = std::max(max_document, other.max_document);
+            max_depth = std::max(max_depth, other.max_depth);
+            for (size_t i = 0; i < records.size(); ++i) {
+                records[i].count += other.records[i].count;
+                records[i].bytes += other.records[i].bytes;
+            }
+            for (const auto &subtree : other.subtrees) {
+                auto &total = subtrees[subtree.first];
+                total.count += subtree.second.count;
+                total.bytes += subtree.second.bytes;
+            }
+        }
+    };
+
+    /**
+     * Measures records without decoding them, subtrees are keyed by their path of local names
+     */
+    void collect_stats(const NbfxMappedFile &file, size_t max_depth, Stats &stats) {
+        struct Open {
+            size_t path_size;
+            const uint8_t *begin;
+        };
+        std::vector<Open> open;
+        std::string path;
+
+        ++stats.files;
+        for_each_document(file, [&](const uint8_t *begin, const uint8_t *end) {
+            const auto size = static_cast<uint64_t>(end - begin);
+            ++stats.documents;
+            stats.bytes += size;
+            stats.min_document = std::min(stats.min_document, size);
+            stats.max_document = std::max(stats.max_document, size);
+
+            for (auto p = begin; p != end;) {
+                const auto record_size = detail::measureRecord(p, static_cast<size_t>(end - p));
+                const auto raw = *p;
+                const auto type = static_cast<NbfxRecordType>(raw);
+                stats.records[raw].count++;
+                stats.records[raw].bytes += record_size;
+
+                if (IsElement(type)) {
+                    open.push_back(Open{path.size(), p});
+                    stats.max_depth = std::max(stats.max_depth, open.size());
+                    if (open.size() <= max_depth) {
+                        const auto frame = detail::elementFrame(p);
+                        if (!path.empty()) {
+                            path += '/';
+                        }
+                        if (frame.dictionary) {
+                            path += "D:";
+                            detail::appendNumber(path, frame.id);
+                        } else {
+                            path.append(frame.name);
+                        }
+                    }
+                } else if (type == NbfxRecordType::EndElement || (IsTextRecord(type) && (raw & 1u))) {
+                    if (open.size() <= max_depth) {
+                        auto &subtree = stats.subtrees[path];
+                        subtree.count++;
+                        subtree.bytes += static_cast<uint64_t>(p + record_size - open.back().begin);
+                    }
+                    path.resize(open.back().path_size);
+                    open.pop_back();
+                }
+                p += record_size;
+            }
+        });
+    }
+
+    void print_stats(const Stats &stats, size_t max_depth) {
+        std::printf("files         %llu\n", static_cast<unsigned long long>(stats.files));
+        std::printf("documents     %llu\n", static_cast<unsigned long long>(stats.documents));
+        std::printf("bytes         %llu\n", static_cast<unsigned long long>(stats.bytes));
+        if (stats.documents) {
+            std::printf("document size min %llu, avg %llu, max %llu\n",
+                        static_cast<unsigned long long>(stats.min_document),
+                        static_cast<unsigned long long>(stats.bytes / stats.documents),
+                        static_cast<unsigned long long>(stats.max_document));
+        }
+        std::printf("max depth     %zu\n\n", stats.max_depth);
+
+        std::printf("%-36s %14s %16s\n", "record", "count", "bytes");
+        for (size_t i = 0; i < stats.records.size(); ++i) {
+            if (stats.records[i].count) {
+                std::printf("%-36s %14llu %16llu\n", record_name(static_cast<uint8_t>(i)).c_str(),
+                            static_cast<unsigned long long>(stats.records[i].count),
+                            static_cast<unsigned long long>(stats.records[i].bytes));
+            }
+        }
+
+        std::vector<std::pair<std::string, Subtree>> subtrees(stats.subtrees.begin(), stats.subtrees.end());
+        std::sort(subtrees.begin(), subtrees.end(), [](const auto &left, const auto &right) {
+            return left.second.bytes != right.second.bytes ? left.second.bytes > right.second.bytes : left.first < right.first;
+        });
+
+        std::printf("\n%-36s %14s %16s %10s\n", ("subtree (depth <= " + std::to_string(max_depth) + ")").c_str(),
+                    "count", "bytes", "avg");
+        for (const auto &subtree : subtrees) {
+            std::printf("%-36s %14llu %16llu %10llu\n", subtree.first.c_str(),
+                        static_cast<unsigned long long>(subtree.second.count),
+                        static_cast<unsigned long long>(subtree.second.bytes),
+                        static_cast<unsigned long long>(subtree.second.bytes / subtree.second.count));
+        }
+    }
+
+    /**
+     * Writes every element matching the path, subtrees that can't contain a match are skipped
+     */
+    void extract(const NbfxMappedFile &file, const std::vector<detail::NbfxPathSegment> &segments, bool json,
+                 FileOutput &output) {
+        std::vector<detail::NbfxPathFrame> path;
+
+        for_each_document(file, [&](const uint8_t *begin, const uint8_t *end) {
+            for (auto p = begin; p != end;) {
+                const auto raw = *p;
+                const auto type = static_cast<NbfxRecordType>(raw);
+                if (!IsElement(type)) {
+                    if (type == NbfxRecordType::EndElement || (IsTextRecord(type) && (raw & 1u))) {
+                        path.pop_back();
+                    }
+                    p += detail::measureRecord(p, static_cast<size_t>(end - p));
+                    continue;
+                }
+
+                path.push_back(detail::elementFrame(p));
+                const auto depth = path.size();
+                const bool prefix = depth <= segments.size() &&
+                                    std::equal(path.begin(), path.end(), segments.begin(),
+                                               [](const detail::NbfxPathFrame &frame, const detail::NbfxPathSegment &segment) {
+                                                   return detail::matches(segment, frame);
+                                               });
+
+                if (prefix && depth < segments.size()) {
+                    p += detail::measureRecord(p, static_cast<size_t>(end - p));
+                    continue;
+                }
+
+                if (prefix) {
+                    if (json) {
+                        to_json(p, output.stream());
+                    } else {
+                        to_xml(p, output.stream());
+                    }
+                    output.stream().put('\n');
+                }
+                p = find_document_end(p, end);
+                path.pop_back();
+            }
+        });
+    }
+
+    int generate(const Options &options) {
+        if (options.files.size() != 1) {
+            std::fputs(usage, stderr);
+            return 2;
+        }
+        const auto &path = options.files[0];
+        try {
+            NbfxCorpusGenerator generator(corpus_preset(options.preset, options.seed));
+            auto file = std::fopen(path.c_str(), "wb");
+            if (!file) {
+                std::perror(path.c_str());
+                return 1;
+            }
+            std::vector<uint8_t> buffer;
+            bool written = true;
+            for (size_t i = 0; i < options.count && written; ++i) {
+                generator.write(std::back_inserter(buffer));
+                if (buffer.size() >= chunk_size || i + 1 == options.count) {
+                    written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+                    buffer.clear();
+                }
+            }
+            if (std::fclose(file) != 0 || !written) {
+                std::perror(path.c_str());
+                return 1;
+            }
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "nbfx: %s\n", e.what());
+            return 2;
+        }
+        return 0;
+    }
+
+    void convert(const NbfxMappedFile &file, bool json, FileOutput &output) {
+        for_each_document(file, [&](const uint8_t *begin, const uint8_t *) {
+            if (json) {
+                to_json(begin, output.stream());
+            } else {
+                to_xml(begin, output.stream());
+            }
+            output.stream().put('\n');
+        });
+    }
+
+    bool parse_options(int argc, char **argv, Options &options) {
+        if (argc < 2) {
+            return false;
+        }
+        options.command = argv[1];
+
+        int i = 2;
+        if (options.command == "extract") {
+            if (argc < 3) {
+                return false;
+            }
+            options.path = argv[i++];
+        }
+
+        for (; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "-j" && i + 1 < argc) {
+                options.jobs = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+            } else if (arg == "--depth" && i + 1 < argc) {
+                options.depth = std::strtoul(argv[++i], nullptr, 10);
+            } else if (arg == "--json") {
+                options.json = true;
+            } else if (arg == "--preset" && i + 1 < argc) {
+                options.preset = argv[++i];
+            } else if (arg == "--seed" && i + 1 < argc) {
+                options.seed = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--count" && i + 1 < argc) {
+                options.count = std::strtoull(argv[++i], nullptr, 10);
+            } else if (!arg.empty() && arg[0] == '-') {
+                return false;
+            } else {
+                options.files.push_back(arg);
+            }
+        }
+
+        static const char *const commands[] = {"dump", "to-xml", "to-json", "stats", "extract", "generate"};
+        return !options.files.empty() &&
+               std::find(std::begin(commands), std::end(commands), options.command) != std::end(commands);
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::fputs(usage, stderr);
+        return 2;
+    }
+
+    if (options.command == "generate") {
+        return generate(options);
+    }
+
+    std::vector<detail::NbfxPathSegment> segments;
+    if (options.command == "extract") {
+        try {
+            segments = detail::parsePath(options.path);
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "nbfx: %s\n", e.what());
+            return 2;
+        }
+    }
+
+    const auto jobs = static_cast<unsigned>(std::min<size_t>(std::max(1u, options.jobs), options.files.size()));
+    OrderedOutput ordered;
+    std::vector<Stats> stats(jobs);
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+
+    const auto work = [&](unsigned worker) {
+        for (auto index = next++; index < options.files.size(); index = next++) {
+            const auto &path = options.files[index];
+            FileOutput output(ordered, index);
+            try {
+                const NbfxMappedFile file(path);
+                if (options.command == "dump") {
+                    dump(file, output);
+                } else if (options.command == "to-xml" || options.command == "to-json") {
+                    convert(file, options.command == "to-json", output);
+                } else if (options.command == "extract") {
+                    extract(file, segments, options.json, output);
+                } else {
+                    collect_stats(file, options.depth, stats[worker]);
+                }
+            } catch (const std::exception &e) {
+                std::fprintf(stderr, "nbfx: %s: %s\n", path.c_str(), e.what());
+                failed = true;
+            }
+            output.finish();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned worker = 1; worker < jobs; ++worker) {
+        threads.emplace_back(work, worker);
+    }
+    work(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (options.command == "stats") {
+        for (unsigned worker = 1; worker < jobs; ++worker) {
+            stats[0].merge(stats[worker]);
+        }
+        print_stats(stats[0], options.depth);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,347 @@
+/**
+ * Replays a capture of messages through parse, serialize or both on several threads
+ *
+ * Reports throughput and resident memory every second, and latency percentiles at the end.
+ * Messages are length prefixed, by 4 byte little endian integers or .NET framing MultiByteInt31,
+ * or stored back to back without prefix like the corpora written by nbfx generate.
+ * Usage: nbfx_replay [--mode parse|serialize|roundtrip] [--threads N] [--duration S]
+ *                    [--prefix u32|varint|none] capture
+ */
+#include "nbfx.hpp"
+#include "nbfx/documents.hpp"
+#include "nbfx/file.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace nbfx;
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    const char usage[] =
+            "usage: nbfx_replay [options] capture\n"
+            "\n"
+            "options:\n"
+            "  --mode <mode>      parse (default), serialize or roundtrip\n"
+            "  --threads <n>      replaying threads, all cores by default\n"
+            "  --duration <s>     seconds to replay for, 10 by default\n"
+            "  --prefix <format>  u32 (default) for 4 byte little endian lengths, varint for\n"
+            "                     MultiByteInt31 lengths, none for documents stored back to back\n";
+
+    struct Options {
+        std::string mode = "parse";
+        std::string prefix = "u32";
+        std::string path;
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        double duration = 10;
+    };
+
+    /**
+     * Log-linear latency histogram in nanoseconds, like HdrHistogram with 2 significant digits
+     *
+     * Values below 128 have buckets of their own, above that each power of two is split into 64 buckets.
+     */
+    class Histogram {
+    public:
+        void record(uint64_t value) noexcept {
+            ++m_counts[index(value)];
+            ++m_total;
+            m_max = std::max(m_max, value);
+        }
+
+        void merge(const Histogram &other) noexcept {
+            for (size_t i = 0; i < m_counts.size(); ++i) {
+                m_counts[i] += other.m_counts[i];
+            }
+            m_total += other.m_total;
+            m_max = std::max(m_max, other.m_max);
+        }
+
+        /**
+         * Upper bound of the bucket holding the percentile
+         */
+        uint64_t percentile(double percent) const noexcept {
+            if (!m_total) {
+                return 0;
+            }
+            const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(percent / 100 * static_cast<double>(m_total) + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < m_counts.size(); ++i) {
+                seen += m_counts[i];
+                if (seen >= rank) {
+                    return std::min(upper_bound(i), m_max);
+                }
+            }
+            return m_max;
+        }
+
+        uint64_t total() const noexcept {
+            return m_total;
+        }
+
+        uint64_t max() const noexcept {
+            return m_max;
+        }
+
+    private:
+        static constexpr unsigned sub_bits = 6;
+        static constexpr size_t half = size_t{1} << sub_bits;
+
+        static size_t index(uint64_t value) noexcept {
+            if (value < 2 * half) {
+                return static_cast<size_t>(value);
+            }
+            unsigned msb = 63;
+            while (!(value >> msb)) {
+                --msb;
+            }
+            const auto shift = msb - sub_bits;
+            return (shift + 1) * half + static_cast<size_t>(value >> shift) - half;
+        }
+
+        static uint64_t upper_bound(size_t index) noexcept {
+            if (index < 2 * half) {
+                return index;
+            }
+            const auto shift = index / half - 1;
+            return ((index % half + half + 1) << shift) - 1;
+        }
+
+        std::array<uint64_t, (64 - sub_bits + 1) * half> m_counts{};
+        uint64_t m_total = 0;
+        uint64_t m_max = 0;
+    };
+
+    size_t resident_bytes() {
+#ifdef __linux__
+        if (auto file = std::fopen("/proc/self/statm", "r")) {
+            unsigned long size = 0, resident = 0;
+            const auto read = std::fscanf(file, "%lu %lu", &size, &resident);
+            std::fclose(file);
+            if (read == 2) {
+                return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            }
+        }
+#endif
+        return 0;
+    }
+
+    std::vector<NbfxBytesView> split(const NbfxMappedFile &file, const std::string &prefix) {
+        const auto end = file.end();
+        if (prefix == "none") {
+            return split_documents(file.begin(), end);
+        }
+
+        std::vector<NbfxBytesView> messages;
+        for (auto p = file.begin(); p != end;) {
+            size_t size = 0;
+            if (prefix == "u32") {
+                if (end - p < 4) {
+                    throw std::invalid_argument("truncated length prefix");
+                }
+                size = size_t{p[0]} | size_t{p[1]} << 8u | size_t{p[2]} << 16u | size_t{p[3]} << 24u;
+                p += 4;
+            } else {
+                unsigned shift = 0;
+                for (;; shift += 7) {
+                    if (p == end || shift > 28) {
+                        throw std::invalid_argument("invalid length prefix");
+                    }
+                    const auto b = *p++;
+                    size |= size_t{b & 0x7Fu} << shift;
+                    if (!(b & 0x80u)) {
+                        break;
+                    }
+                }
+            }
+
+            if (static_cast<size_t>(end - p) < size) {
+                throw std::invalid_argument("truncated message " + std::to_string(messages.size()));
+            }
+            // parse trusts the data to end where it should, so check it once up front
+            if (!size || find_document_end(p, p + size) != p + size) {
+                throw std::invalid_argument("message " + std::to_string(messages.size()) + " isn't one document");
+            }
+            messages.push_back(NbfxBytesView{p, size});
+            p += size;
+        }
+        return messages;
+    }
+
+    bool parse_options(int argc, char **argv, Options &options) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--mode" && i + 1 < argc) {
+                options.mode = argv[++i];
+            } else if (arg == "--threads" && i + 1 < argc) {
+                options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+            } else if (arg == "--duration" && i + 1 < argc) {
+                options.duration = std::strtod(argv[++i], nullptr);
+            } else if (arg == "--prefix" && i + 1 < argc) {
+                options.prefix = argv[++i];
+            } else if (!arg.empty() && arg[0] == '-') {
+                return false;
+            } else if (options.path.empty()) {
+                options.path = arg;
+            } else {
+                return false;
+            }
+        }
+        return !options.path.empty() && options.threads && options.duration > 0 &&
+               (options.mode == "parse" || options.mode == "serialize" || options.mode == "roundtrip") &&
+               (options.prefix == "u32" || options.prefix == "varint" || options.prefix == "none");
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::fputs(usage, stderr);
+        return 2;
+    }
+
+    std::vector<NbfxBytesView> messages;
+    std::vector<NbfxElement> trees;
+    std::unique_ptr<NbfxMappedFile> file;
+    size_t total_size = 0;
+    try {
+        file = std::make_unique<NbfxMappedFile>(options.path);
+        messages = split(*file, options.prefix);
+        if (messages.empty()) {
+            throw std::invalid_argument("no messages");
+        }
+        if (options.mode == "serialize") {
+            trees.reserve(messages.size());
+            for (const auto &message : messages) {
+                trees.push_back(parse(message.data));
+            }
+        }
+        for (const auto &message : messages) {
+            total_size += message.size;
+        }
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "nbfx_replay: %s: %s\n", options.path.c_str(), e.what());
+        return 1;
+    }
+
+    std::printf("%zu messages, %.1f MB, mode %s, %u threads, RSS %.1f MB\n", messages.size(),
+                static_cast<double>(total_size) / 1e6, options.mode.c_str(), options.threads,
+                static_cast<double>(resident_bytes()) / 1e6);
+
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> operations{0};
+        std::atomic<uint64_t> bytes{0};
+    };
+    std::vector<Counters> counters(options.threads);
+    std::vector<Histogram> histograms(options.threads);
+    std::atomic<bool> stop{false};
+    std::atomic<bool> failed{false};
+    std::atomic<size_t> sink{0};
+
+    const auto work = [&](unsigned worker) {
+        auto &histogram = histograms[worker];
+        auto &counter = counters[worker];
+        std::vector<uint8_t> buffer;
+        size_t children = 0;
+        // threads start at different messages so they don't replay in lockstep
+        auto index = messages.size() * worker / options.threads;
+        try {
+            while (!stop.load(std::memory_order_relaxed)) {
+                const auto &message = messages[index];
+                buffer.clear();
+                const auto start = clock_type::now();
+                if (options.mode == "parse") {
+                    children += parse(message.data).children().size();
+                } else if (options.mode == "serialize") {
+                    serialize(trees[index], std::back_inserter(buffer), false);
+                } else {
+                    serialize(parse(message.data), std::back_inserter(buffer), false);
+                }
+                const auto elapsed = clock_type::now() - start;
+                histogram.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+                counter.operations.store(counter.operations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                counter.bytes.store(counter.bytes.load(std::memory_order_relaxed) + message.size, std::memory_order_relaxed);
+                if (++index == messages.size()) {
+                    index = 0;
+                }
+            }
+        } catch (const std::exception &e) {
+            std::fprintf(stderr, "nbfx_replay: message %zu: %s\n", index, e.what());
+            failed = true;
+            stop = true;
+        }
+        sink += children;
+    };
+
+    const auto begin = clock_type::now();
+    std::vector<std::thread> threads;
+    for (unsigned worker = 0; worker < options.threads; ++worker) {
+        threads.emplace_back(work, worker);
+    }
+
+    const auto deadline = begin + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(options.duration));
+    uint64_t last_operations = 0;
+    uint64_t last_bytes = 0;
+    size_t peak_resident = 0;
+    auto last = begin;
+    while (!stop) {
+        std::this_thread::sleep_until(std::min(last + std::chrono::seconds(1), deadline));
+        const auto now = clock_type::now();
+        uint64_t operations = 0;
+        uint64_t bytes = 0;
+        for (const auto &counter : counters) {
+            operations += counter.operations.load(std::memory_order_relaxed);
+            bytes += counter.bytes.load(std::memory_order_relaxed);
+        }
+        const auto seconds = std::chrono::duration<double>(now - last).count();
+        const auto resident = resident_bytes();
+        peak_resident = std::max(peak_resident, resident);
+        std::printf("%8.1fs %12.0f msg/s %10.1f MB/s   RSS %.1f MB\n", std::chrono::duration<double>(now - begin).count(),
+                    static_cast<double>(operations - last_operations) / seconds,
+                    static_cast<double>(bytes - last_bytes) / seconds / 1e6, static_cast<double>(resident) / 1e6);
+        std::fflush(stdout);
+        last_operations = operations;
+        last_bytes = bytes;
+        last = now;
+        if (now >= deadline) {
+            stop = true;
+        }
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const auto seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+    Histogram histogram;
+    uint64_t bytes = 0;
+    for (unsigned worker = 0; worker < options.threads; ++worker) {
+        histogram.merge(histograms[worker]);
+        bytes += counters[worker].bytes.load();
+    }
+
+    std::printf("\n%llu messages in %.1fs: %.0f msg/s, %.1f MB/s, peak RSS %.1f MB\n",
+                static_cast<unsigned long long>(histogram.total()), seconds,
+                static_cast<double>(histogram.total()) / seconds, static_cast<double>(bytes) / seconds / 1e6,
+                static_cast<double>(peak_resident) / 1e6);
+    std::printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+                static_cast<double>(histogram.percentile(50)) / 1e3, static_cast<double>(histogram.percentile(90)) / 1e3,
+                static_cast<double>(histogram.percentile(99)) / 1e3, static_cast<double>(histogram.percentile(99.9)) / 1e3,
+                static_cast<double>(histogram.max()) / 1e3);
+    return failed ? 1 : 0;
+}